@@ -13,8 +13,10 @@ proc sqlite3mc-handle-default-cipher {} {
       rc4       { set dcv RC4       }
       ascon128  { set dcv ASCON128  }
       aegis     { set dcv AEGIS     }
+      aes256gcm { set dcv AES256GCM }
+      aes256xts { set dcv AES256XTS }
       default {
-        user-error "Invalid --default-cipher value '$dc'. Use one of: aes128cbc, aes256cbc, chacha20, sqlcipher, rc4, ascon128, aegis"
+        user-error "Invalid --default-cipher value '$dc'. Use one of: aes128cbc, aes256cbc, chacha20, sqlcipher, rc4, ascon128, aegis, aes256gcm, aes256xts"
       }
     }
     msg-result $dc
@@ -43,7 +45,7 @@ proc sqlite-custom-flags {} {
      aes-hw-support=1   => {Disable AES hardware support}
      builtin-ciphers=1  => {Disable all builtin ciphers}
      dynamic-ciphers    => {Enable dynamic ciphers}
-     default-cipher:=chacha20 => {Default cipher (aes128cbc, aes256cbc, chacha20, sqlcipher, rc4, ascon128, aegis)}
+     default-cipher:=chacha20 => {Default cipher (aes128cbc, aes256cbc, chacha20, sqlcipher, rc4, ascon128, aegis, aes256gcm, aes256xts)}
 
      cipher-aes128cbc=1 => {Disable cipher AES128CBC}
      cipher-aes256cbc=1 => {Disable cipher AES256CBC}
@@ -52,6 +54,8 @@ proc sqlite-custom-flags {} {
      cipher-rc4=1       => {Disable cipher RC4}
      cipher-ascon128=1  => {Disable cipher ASCON128}
      cipher-aegis=1     => {Disable cipher AEGIS}
+     cipher-aes256gcm=1 => {Disable cipher AES256GCM}
+     cipher-aes256xts=1 => {Disable cipher AES256XTS}
 
      extfunc            => {Enable the EXTFUNC extension}
      regexp             => {Enable the REGEXP extension}
@@ -146,6 +150,8 @@ proc sqlite-custom-handle-flags {} {
     cipher-rc4       -DHAVE_CIPHER_RC4         {}
     cipher-ascon128  -DHAVE_CIPHER_ASCON128    {}
     cipher-aegis     -DHAVE_CIPHER_AEGIS       {}
+    cipher-aes256gcm -DHAVE_CIPHER_AES_256_GCM {}
+    cipher-aes256xts -DHAVE_CIPHER_AES_256_XTS {}
   }] {
     proj-if-opt-truthy $boolFlag {
       if {0 != [eval $ifSetEvalThis]} {
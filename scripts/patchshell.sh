@@ -27,9 +27,13 @@ sed -e '/^      sputf(stdout, "SQLite version/{n;N;d}' "$INPUT" \
   | sed '/End ext\/misc\/series.c/a #endif' \
   | sed '/Begin ext\/misc\/regexp.c/i #ifndef SQLITE_OMIT_SHELL_REGEXP' \
   | sed '/End ext\/misc\/regexp.c/a #endif' \
+  | sed '/Begin ext\/misc\/zipfile.c/i #ifndef SQLITE_OMIT_SHELL_ZIPFILE' \
+  | sed '/End ext\/misc\/zipfile.c/a #endif' \
   | sed '/sqlite3_shathree_init(p->db, 0, 0);/i #ifndef SQLITE_OMIT_SHELL_SHATHREE' \
   | sed '/sqlite3_shathree_init(p->db, 0, 0);/a #endif' \
   | sed '/sqlite3_series_init(p->db, 0, 0);/i #ifndef SQLITE_OMIT_SHELL_SERIES' \
   | sed '/sqlite3_series_init(p->db, 0, 0);/a #endif' \
   | sed '/sqlite3_regexp_init(p->db, 0, 0);/i #ifndef SQLITE_OMIT_SHELL_REGEXP' \
-  | sed '/sqlite3_regexp_init(p->db, 0, 0);/a #endif'
+  | sed '/sqlite3_regexp_init(p->db, 0, 0);/a #endif' \
+  | sed '/sqlite3_zipfile_init(p->db, 0, 0);/i #ifndef SQLITE_OMIT_SHELL_ZIPFILE' \
+  | sed '/sqlite3_zipfile_init(p->db, 0, 0);/a #endif'
@@ -156,6 +156,15 @@ aesHardwareCheck()
   return (cpuInfo[2] & (1 << 25)) != 0 && (cpuInfo[2] & (1 << 19)) != 0;
 }
 
+static int
+aesClmulCheck()
+{
+  unsigned int cpuInfo[4];
+  __cpuid(1, cpuInfo[0], cpuInfo[1], cpuInfo[2], cpuInfo[3]);
+  /* Check PCLMULQDQ */
+  return (cpuInfo[2] & (1 << 1)) != 0;
+}
+
 #else /* !(defined(__clang__) || defined(__GNUC__)) */
 /* Compiler Visual C++ */
 
@@ -169,6 +178,14 @@ aesHardwareCheck()
   return (CPUInfo[2] & (1 << 25)) != 0 && (CPUInfo[2] & (1 << 19)) != 0; /* Check AES and SSE4.1 */
 }
 
+static int
+aesClmulCheck()
+{
+  unsigned int CPUInfo[4];
+  __cpuid((int*) CPUInfo, 1);
+  return (CPUInfo[2] & (1 << 1)) != 0; /* Check PCLMULQDQ */
+}
+
 #endif /* defined(__clang__) || defined(__GNUC__) */
 
 #if defined(__GNUC__)
@@ -450,6 +467,407 @@ aesDecryptCBC(const unsigned char* in,
   }
 }
 
+/*
+** AES CTR encryption/decryption with 32-bit big endian counter (as used by GCM)
+**
+** Four counter blocks are processed in parallel to keep the AES pipeline busy.
+*/
+SQLITE3MC_FUNC_ISA("sse4.2,aes")
+static void
+aesCryptCTR(const unsigned char* in,
+            unsigned char* out,
+            unsigned long length,
+            const unsigned char icb[16],
+            const unsigned char* keyData,
+            int numberOfRounds)
+{
+  __m128i key[_MAX_ROUNDS + 1];
+  const __m128i byteSwap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+  const __m128i one = _mm_set_epi32(0, 0, 0, 1);
+  __m128i counter;
+  __m128i b0, b1, b2, b3;
+  unsigned long i = 0;
+  int j;
+
+  /* Load key data into properly aligned local storage */
+  for (j = 0; j <= numberOfRounds; ++j)
+  {
+    key[j] = _mm_loadu_si128(&((__m128i*) keyData)[j]);
+  }
+
+  /* Keep the counter byte-swapped, so that the 32-bit counter is in the lowest lane */
+  counter = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) icb), byteSwap);
+
+  for (; i + 64 <= length; i += 64)
+  {
+    b0 = _mm_shuffle_epi8(counter, byteSwap);
+    counter = _mm_add_epi32(counter, one);
+    b1 = _mm_shuffle_epi8(counter, byteSwap);
+    counter = _mm_add_epi32(counter, one);
+    b2 = _mm_shuffle_epi8(counter, byteSwap);
+    counter = _mm_add_epi32(counter, one);
+    b3 = _mm_shuffle_epi8(counter, byteSwap);
+    counter = _mm_add_epi32(counter, one);
+
+    b0 = _mm_xor_si128(b0, key[0]);
+    b1 = _mm_xor_si128(b1, key[0]);
+    b2 = _mm_xor_si128(b2, key[0]);
+    b3 = _mm_xor_si128(b3, key[0]);
+    for (j = 1; j < numberOfRounds; j++)
+    {
+      b0 = _mm_aesenc_si128(b0, key[j]);
+      b1 = _mm_aesenc_si128(b1, key[j]);
+      b2 = _mm_aesenc_si128(b2, key[j]);
+      b3 = _mm_aesenc_si128(b3, key[j]);
+    }
+    b0 = _mm_aesenclast_si128(b0, key[j]);
+    b1 = _mm_aesenclast_si128(b1, key[j]);
+    b2 = _mm_aesenclast_si128(b2, key[j]);
+    b3 = _mm_aesenclast_si128(b3, key[j]);
+
+    _mm_storeu_si128((__m128i*) (out + i),      _mm_xor_si128(b0, _mm_loadu_si128((const __m128i*) (in + i))));
+    _mm_storeu_si128((__m128i*) (out + i + 16), _mm_xor_si128(b1, _mm_loadu_si128((const __m128i*) (in + i + 16))));
+    _mm_storeu_si128((__m128i*) (out + i + 32), _mm_xor_si128(b2, _mm_loadu_si128((const __m128i*) (in + i + 32))));
+    _mm_storeu_si128((__m128i*) (out + i + 48), _mm_xor_si128(b3, _mm_loadu_si128((const __m128i*) (in + i + 48))));
+  }
+
+  for (; i < length; i += 16)
+  {
+    b0 = _mm_shuffle_epi8(counter, byteSwap);
+    counter = _mm_add_epi32(counter, one);
+    b0 = _mm_xor_si128(b0, key[0]);
+    for (j = 1; j < numberOfRounds; j++)
+    {
+      b0 = _mm_aesenc_si128(b0, key[j]);
+    }
+    b0 = _mm_aesenclast_si128(b0, key[j]);
+
+    if (i + 16 <= length)
+    {
+      _mm_storeu_si128((__m128i*) (out + i), _mm_xor_si128(b0, _mm_loadu_si128((const __m128i*) (in + i))));
+    }
+    else
+    {
+      /* Incomplete last block */
+      unsigned char keyStream[16];
+      unsigned long k;
+      _mm_storeu_si128((__m128i*) keyStream, b0);
+      for (k = 0; i + k < length; ++k)
+      {
+        out[i + k] = in[i + k] ^ keyStream[k];
+      }
+    }
+  }
+}
+
+/*
+** GHASH based on carry-less multiplication
+**
+** Field elements are kept byte-reflected. Multiplication and reduction follow
+** the Intel white paper "Intel Carry-Less Multiplication Instruction and its
+** Usage for Computing the GCM Mode". Since shifting and reduction are linear,
+** four products are accumulated before a single reduction.
+*/
+SQLITE3MC_FUNC_ISA_INLINE("sse4.2,pclmul")
+static void
+aesClmulMultiply(__m128i a, __m128i b, __m128i* lo, __m128i* hi)
+{
+  __m128i t0 = _mm_clmulepi64_si128(a, b, 0x00);
+  __m128i t1 = _mm_clmulepi64_si128(a, b, 0x10);
+  __m128i t2 = _mm_clmulepi64_si128(a, b, 0x01);
+  __m128i t3 = _mm_clmulepi64_si128(a, b, 0x11);
+  t1 = _mm_xor_si128(t1, t2);
+  *lo = _mm_xor_si128(t0, _mm_slli_si128(t1, 8));
+  *hi = _mm_xor_si128(t3, _mm_srli_si128(t1, 8));
+}
+
+SQLITE3MC_FUNC_ISA_INLINE("sse4.2,pclmul")
+static __m128i
+aesClmulReduce(__m128i lo, __m128i hi)
+{
+  __m128i t2, t4, t5, t7, t8, t9;
+
+  /* Shift the 256-bit product left by one bit */
+  t7 = _mm_srli_epi32(lo, 31);
+  t8 = _mm_srli_epi32(hi, 31);
+  lo = _mm_slli_epi32(lo, 1);
+  hi = _mm_slli_epi32(hi, 1);
+  t9 = _mm_srli_si128(t7, 12);
+  t8 = _mm_slli_si128(t8, 4);
+  t7 = _mm_slli_si128(t7, 4);
+  lo = _mm_or_si128(lo, t7);
+  hi = _mm_or_si128(hi, t8);
+  hi = _mm_or_si128(hi, t9);
+
+  /* Reduce modulo x^128 + x^7 + x^2 + x + 1 */
+  t7 = _mm_slli_epi32(lo, 31);
+  t8 = _mm_slli_epi32(lo, 30);
+  t9 = _mm_slli_epi32(lo, 25);
+  t7 = _mm_xor_si128(t7, t8);
+  t7 = _mm_xor_si128(t7, t9);
+  t8 = _mm_srli_si128(t7, 4);
+  t7 = _mm_slli_si128(t7, 12);
+  lo = _mm_xor_si128(lo, t7);
+
+  t2 = _mm_srli_epi32(lo, 1);
+  t4 = _mm_srli_epi32(lo, 2);
+  t5 = _mm_srli_epi32(lo, 7);
+  t2 = _mm_xor_si128(t2, t4);
+  t2 = _mm_xor_si128(t2, t5);
+  t2 = _mm_xor_si128(t2, t8);
+  lo = _mm_xor_si128(lo, t2);
+  return _mm_xor_si128(hi, lo);
+}
+
+/*
+** Precompute the powers H, H^2, H^3, H^4 of the hash key
+*/
+SQLITE3MC_FUNC_ISA("sse4.2,pclmul")
+static void
+aesGhashInitCLMUL(const unsigned char hashKey[16], unsigned char hashKeyPowers[64])
+{
+  const __m128i byteSwap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+  __m128i h1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) hashKey), byteSwap);
+  __m128i h2, h3, h4, lo, hi;
+
+  aesClmulMultiply(h1, h1, &lo, &hi);
+  h2 = aesClmulReduce(lo, hi);
+  aesClmulMultiply(h2, h1, &lo, &hi);
+  h3 = aesClmulReduce(lo, hi);
+  aesClmulMultiply(h3, h1, &lo, &hi);
+  h4 = aesClmulReduce(lo, hi);
+
+  _mm_storeu_si128(&((__m128i*) hashKeyPowers)[0], h1);
+  _mm_storeu_si128(&((__m128i*) hashKeyPowers)[1], h2);
+  _mm_storeu_si128(&((__m128i*) hashKeyPowers)[2], h3);
+  _mm_storeu_si128(&((__m128i*) hashKeyPowers)[3], h4);
+}
+
+/*
+** Absorb data into the GHASH state, an incomplete last block is padded with zeros
+*/
+SQLITE3MC_FUNC_ISA("sse4.2,pclmul")
+static void
+aesGhashCLMUL(unsigned char state[16],
+              const unsigned char hashKeyPowers[64],
+              const unsigned char* data,
+              unsigned long length)
+{
+  const __m128i byteSwap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+  __m128i h1 = _mm_loadu_si128(&((const __m128i*) hashKeyPowers)[0]);
+  __m128i h2 = _mm_loadu_si128(&((const __m128i*) hashKeyPowers)[1]);
+  __m128i h3 = _mm_loadu_si128(&((const __m128i*) hashKeyPowers)[2]);
+  __m128i h4 = _mm_loadu_si128(&((const __m128i*) hashKeyPowers)[3]);
+  __m128i x = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) state), byteSwap);
+  __m128i lo, hi, tlo, thi;
+  unsigned long i = 0;
+
+  for (; i + 64 <= length; i += 64)
+  {
+    __m128i c0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (data + i)), byteSwap);
+    __m128i c1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (data + i + 16)), byteSwap);
+    __m128i c2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (data + i + 32)), byteSwap);
+    __m128i c3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (data + i + 48)), byteSwap);
+
+    aesClmulMultiply(_mm_xor_si128(x, c0), h4, &lo, &hi);
+    aesClmulMultiply(c1, h3, &tlo, &thi);
+    lo = _mm_xor_si128(lo, tlo);
+    hi = _mm_xor_si128(hi, thi);
+    aesClmulMultiply(c2, h2, &tlo, &thi);
+    lo = _mm_xor_si128(lo, tlo);
+    hi = _mm_xor_si128(hi, thi);
+    aesClmulMultiply(c3, h1, &tlo, &thi);
+    lo = _mm_xor_si128(lo, tlo);
+    hi = _mm_xor_si128(hi, thi);
+    x = aesClmulReduce(lo, hi);
+  }
+
+  for (; i < length; i += 16)
+  {
+    __m128i c0;
+    if (i + 16 <= length)
+    {
+      c0 = _mm_loadu_si128((const __m128i*) (data + i));
+    }
+    else
+    {
+      unsigned char block[16];
+      memset(block, 0, 16);
+      memcpy(block, data + i, length - i);
+      c0 = _mm_loadu_si128((const __m128i*) block);
+    }
+    c0 = _mm_shuffle_epi8(c0, byteSwap);
+    aesClmulMultiply(_mm_xor_si128(x, c0), h1, &lo, &hi);
+    x = aesClmulReduce(lo, hi);
+  }
+
+  _mm_storeu_si128((__m128i*) state, _mm_shuffle_epi8(x, byteSwap));
+}
+
+/*
+** AES XTS encryption/decryption (IEEE P1619) with ciphertext stealing
+**
+** The tweak is encrypted with the tweak key, the data key schedule is either
+** an encryption or a decryption schedule. Four blocks are processed in parallel.
+*/
+
+SQLITE3MC_FUNC_ISA_INLINE("sse4.2,aes")
+static __m128i
+aesXtsNextTweak(__m128i tweak)
+{
+  /* Multiply by alpha in GF(2^128), carries are propagated between the 64-bit halves */
+  __m128i carry = _mm_shuffle_epi32(_mm_srai_epi32(tweak, 31), _MM_SHUFFLE(1, 1, 3, 3));
+  carry = _mm_and_si128(carry, _mm_set_epi32(0, 1, 0, 0x87));
+  return _mm_xor_si128(_mm_slli_epi64(tweak, 1), carry);
+}
+
+SQLITE3MC_FUNC_ISA_INLINE("sse4.2,aes")
+static __m128i
+aesXtsEncryptBlock(__m128i data, const __m128i* key, int numberOfRounds)
+{
+  int j;
+  data = _mm_xor_si128(data, key[0]);
+  for (j = 1; j < numberOfRounds; ++j)
+  {
+    data = _mm_aesenc_si128(data, key[j]);
+  }
+  return _mm_aesenclast_si128(data, key[numberOfRounds]);
+}
+
+SQLITE3MC_FUNC_ISA_INLINE("sse4.2,aes")
+static __m128i
+aesXtsDecryptBlock(__m128i data, const __m128i* key, int numberOfRounds)
+{
+  int j;
+  data = _mm_xor_si128(data, key[numberOfRounds]);
+  for (j = 1; j < numberOfRounds; ++j)
+  {
+    data = _mm_aesdec_si128(data, key[numberOfRounds - j]);
+  }
+  return _mm_aesdeclast_si128(data, key[0]);
+}
+
+SQLITE3MC_FUNC_ISA("sse4.2,aes")
+static void
+aesCryptXTS(const unsigned char* in,
+            unsigned char* out,
+            unsigned long length,
+            const unsigned char tweak[16],
+            const unsigned char* keyData,
+            const unsigned char* tweakKeyData,
+            int numberOfRounds,
+            int encrypt)
+{
+  __m128i key[_MAX_ROUNDS + 1];
+  __m128i t0, t1, t2, t3;
+  __m128i d0, d1, d2, d3;
+  unsigned long i = 0;
+  int j;
+  unsigned long numBlocks = length / 16;
+  unsigned long lenFrag = (length % 16);
+  /* With ciphertext stealing the last complete block is processed together with the fragment */
+  unsigned long numFull = (lenFrag > 0) ? numBlocks - 1 : numBlocks;
+
+  /* Encrypt the tweak */
+  for (j = 0; j <= numberOfRounds; ++j)
+  {
+    key[j] = _mm_loadu_si128(&((const __m128i*) tweakKeyData)[j]);
+  }
+  t0 = aesXtsEncryptBlock(_mm_loadu_si128((const __m128i*) tweak), key, numberOfRounds);
+
+  /* Load key data into properly aligned local storage */
+  for (j = 0; j <= numberOfRounds; ++j)
+  {
+    key[j] = _mm_loadu_si128(&((const __m128i*) keyData)[j]);
+  }
+
+  for (; i + 4 <= numFull; i += 4)
+  {
+    t1 = aesXtsNextTweak(t0);
+    t2 = aesXtsNextTweak(t1);
+    t3 = aesXtsNextTweak(t2);
+    d0 = _mm_xor_si128(_mm_loadu_si128(&((const __m128i*) in)[i + 0]), t0);
+    d1 = _mm_xor_si128(_mm_loadu_si128(&((const __m128i*) in)[i + 1]), t1);
+    d2 = _mm_xor_si128(_mm_loadu_si128(&((const __m128i*) in)[i + 2]), t2);
+    d3 = _mm_xor_si128(_mm_loadu_si128(&((const __m128i*) in)[i + 3]), t3);
+    if (encrypt)
+    {
+      d0 = _mm_xor_si128(d0, key[0]);
+      d1 = _mm_xor_si128(d1, key[0]);
+      d2 = _mm_xor_si128(d2, key[0]);
+      d3 = _mm_xor_si128(d3, key[0]);
+      for (j = 1; j < numberOfRounds; ++j)
+      {
+        d0 = _mm_aesenc_si128(d0, key[j]);
+        d1 = _mm_aesenc_si128(d1, key[j]);
+        d2 = _mm_aesenc_si128(d2, key[j]);
+        d3 = _mm_aesenc_si128(d3, key[j]);
+      }
+      d0 = _mm_aesenclast_si128(d0, key[numberOfRounds]);
+      d1 = _mm_aesenclast_si128(d1, key[numberOfRounds]);
+      d2 = _mm_aesenclast_si128(d2, key[numberOfRounds]);
+      d3 = _mm_aesenclast_si128(d3, key[numberOfRounds]);
+    }
+    else
+    {
+      d0 = _mm_xor_si128(d0, key[numberOfRounds]);
+      d1 = _mm_xor_si128(d1, key[numberOfRounds]);
+      d2 = _mm_xor_si128(d2, key[numberOfRounds]);
+      d3 = _mm_xor_si128(d3, key[numberOfRounds]);
+      for (j = 1; j < numberOfRounds; ++j)
+      {
+        d0 = _mm_aesdec_si128(d0, key[numberOfRounds - j]);
+        d1 = _mm_aesdec_si128(d1, key[numberOfRounds - j]);
+        d2 = _mm_aesdec_si128(d2, key[numberOfRounds - j]);
+        d3 = _mm_aesdec_si128(d3, key[numberOfRounds - j]);
+      }
+      d0 = _mm_aesdeclast_si128(d0, key[0]);
+      d1 = _mm_aesdeclast_si128(d1, key[0]);
+      d2 = _mm_aesdeclast_si128(d2, key[0]);
+      d3 = _mm_aesdeclast_si128(d3, key[0]);
+    }
+    _mm_storeu_si128(&((__m128i*) out)[i + 0], _mm_xor_si128(d0, t0));
+    _mm_storeu_si128(&((__m128i*) out)[i + 1], _mm_xor_si128(d1, t1));
+    _mm_storeu_si128(&((__m128i*) out)[i + 2], _mm_xor_si128(d2, t2));
+    _mm_storeu_si128(&((__m128i*) out)[i + 3], _mm_xor_si128(d3, t3));
+    t0 = aesXtsNextTweak(t3);
+  }
+
+  for (; i < numFull; ++i)
+  {
+    d0 = _mm_xor_si128(_mm_loadu_si128(&((const __m128i*) in)[i]), t0);
+    d0 = (encrypt) ? aesXtsEncryptBlock(d0, key, numberOfRounds) : aesXtsDecryptBlock(d0, key, numberOfRounds);
+    _mm_storeu_si128(&((__m128i*) out)[i], _mm_xor_si128(d0, t0));
+    t0 = aesXtsNextTweak(t0);
+  }
+
+  /* Use Cipher Text Stealing (CTS) for incomplete last block */
+  if (lenFrag > 0)
+  {
+    UINT8 lastblock[16];
+    UINT8 partialblock[16];
+    /* Decryption uses the tweaks of the last two blocks in reverse order */
+    t1 = aesXtsNextTweak(t0);
+    if (!encrypt)
+    {
+      t2 = t0;
+      t0 = t1;
+      t1 = t2;
+    }
+    d0 = _mm_xor_si128(_mm_loadu_si128(&((const __m128i*) in)[numFull]), t0);
+    d0 = (encrypt) ? aesXtsEncryptBlock(d0, key, numberOfRounds) : aesXtsDecryptBlock(d0, key, numberOfRounds);
+    _mm_storeu_si128((__m128i*) lastblock, _mm_xor_si128(d0, t0));
+
+    /* Steal the tail of the processed block to complete the fragment */
+    memcpy(partialblock, lastblock, 16);
+    memcpy(partialblock, &in[16 * numBlocks], lenFrag);
+    d0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*) partialblock), t1);
+    d0 = (encrypt) ? aesXtsEncryptBlock(d0, key, numberOfRounds) : aesXtsDecryptBlock(d0, key, numberOfRounds);
+    _mm_storeu_si128(&((__m128i*) out)[numFull], _mm_xor_si128(d0, t1));
+    memcpy(&out[16 * numBlocks], lastblock, lenFrag);
+  }
+}
+
 #elif HAS_AES_HARDWARE == AES_HARDWARE_NEON
 /* --- Implementation for AES-NEON --- */
 
@@ -513,6 +931,13 @@ aesHardwareCheck()
   return aesHardwareAvailableOnPlatform();
 }
 
+static int
+aesClmulCheck()
+{
+  /* GHASH based on carry-less multiplication is implemented for AES-NI only */
+  return 0;
+}
+
 /*
 ** Set up expanded key
 */
@@ -809,6 +1234,12 @@ aesHardwareCheck()
   return 0;
 }
 
+static int
+aesClmulCheck()
+{
+  return 0;
+}
+
 #endif
 
 #if defined(__GNUC__)
@@ -831,3 +1262,20 @@ aesHardwareAvailable()
   }
   return hwAvailable;
 }
+
+/*
+** Check whether GCM can be computed in hardware,
+** that is, whether AES-NI and PCLMULQDQ are both available.
+*/
+static int
+aesGcmHardwareAvailable()
+{
+  static int initialized = 0;
+  static int hwAvailable = 0;
+  if (!initialized)
+  {
+    hwAvailable = aesHardwareAvailable() && aesClmulCheck();
+    initialized = 1;
+  }
+  return hwAvailable;
+}
@@ -39,12 +39,12 @@ ASCON_API
 forceinline void ascon_initaead(ascon_state_t* s, const ascon_key_t* key,
                                 const uint8_t* npub) {
 #if CRYPTO_KEYBYTES == 16
-  if (ASCON_AEAD_RATE == 8) s->x[0] = ASCON_128_IV;
-  if (ASCON_AEAD_RATE == 16) s->x[0] = ASCON_128A_IV;
+  if (ASCON_AEAD_RATE == 8) s->x[0] = ASCON_CONST(ASCON_128_IV);
+  if (ASCON_AEAD_RATE == 16) s->x[0] = ASCON_CONST(ASCON_128A_IV);
   s->x[1] = key->x[0];
   s->x[2] = key->x[1];
 #else /* CRYPTO_KEYBYTES == 20 */
-  s->x[0] = key->x[0] ^ ASCON_80PQ_IV;
+  s->x[0] = key->x[0] ^ ASCON_CONST(ASCON_80PQ_IV);
   s->x[1] = key->x[1];
   s->x[2] = key->x[2];
 #endif
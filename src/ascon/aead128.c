@@ -0,0 +1,216 @@
+/*
+** Name:        aead128.c
+** Purpose:     Stream encryption/decryption with Ascon-AEAD128 (NIST SP 800-232)
+** Based on:    Public domain Ascon reference implementation
+**              and optimized variants for 32- and 64-bit
+**              (see https://github.com/ascon/ascon-c)
+** Remarks:     API functions adapted for use in SQLite3 Multiple Ciphers
+**              Ascon-AEAD128 absorbs 128 bits per permutation call and
+**              uses little endian byte order
+** Modified by: Ulrich Telle
+** Copyright:   (c) 2026 Ulrich Telle
+** License:     MIT
+*/
+
+#include "api.h"
+#include "ascon.h"
+#include "crypto_aead.h"
+#include "permutations.h"
+#include "printstate.h"
+
+#if !ASCON_INLINE_MODE
+#undef forceinline
+#define forceinline
+#endif
+
+#define ASCON_AEAD128_RATE 16
+#define ASCON_AEAD128_PB_ROUNDS 8
+
+typedef struct {
+  uint64_t x[2];
+} ascon_aead128_key_t;
+
+ASCON_API
+forceinline void ascon_aead128_loadkey(ascon_aead128_key_t* key, const uint8_t* k) {
+  key->x[0] = ASCON_LOADBYTES_LE(k, 8);
+  key->x[1] = ASCON_LOADBYTES_LE(k + 8, 8);
+}
+
+ASCON_API
+forceinline void ascon_aead128_init(ascon_state_t* s, const ascon_aead128_key_t* key,
+                                    const uint8_t* npub) {
+  s->x[0] = ASCON_CONST(ASCON_AEAD128_IV);
+  s->x[1] = key->x[0];
+  s->x[2] = key->x[1];
+  s->x[3] = ASCON_LOADBYTES_LE(npub, 8);
+  s->x[4] = ASCON_LOADBYTES_LE(npub + 8, 8);
+  ascon_printstate("init 1st key xor", s);
+  ASCON_P(s, 12);
+  s->x[3] ^= key->x[0];
+  s->x[4] ^= key->x[1];
+  ascon_printstate("init 2nd key xor", s);
+}
+
+ASCON_API
+forceinline void ascon_aead128_adata(ascon_state_t* s, const uint8_t* ad,
+                                     uint64_t adlen) {
+  if (adlen) {
+    /* full associated data blocks */
+    while (adlen >= ASCON_AEAD128_RATE) {
+      s->x[0] ^= ASCON_LOADBYTES_LE(ad, 8);
+      s->x[1] ^= ASCON_LOADBYTES_LE(ad + 8, 8);
+      ascon_printstate("absorb adata", s);
+      ASCON_P(s, ASCON_AEAD128_PB_ROUNDS);
+      ad += ASCON_AEAD128_RATE;
+      adlen -= ASCON_AEAD128_RATE;
+    }
+    /* final associated data block */
+    uint64_t* px = &s->x[0];
+    if (adlen >= 8) {
+      s->x[0] ^= ASCON_LOADBYTES_LE(ad, 8);
+      px = &s->x[1];
+      ad += 8;
+      adlen -= 8;
+    }
+    *px ^= ASCON_PAD_LE((int) adlen);
+    if (adlen) *px ^= ASCON_LOADBYTES_LE(ad, (int) adlen);
+    ascon_printstate("pad adata", s);
+    ASCON_P(s, ASCON_AEAD128_PB_ROUNDS);
+  }
+  /* domain separation */
+  s->x[4] ^= ASCON_DSEP_LE();
+  ascon_printstate("domain separation", s);
+}
+
+ASCON_API
+forceinline void ascon_aead128_encrypt_data(ascon_state_t* s, uint8_t* c,
+                                            const uint8_t* m, uint64_t mlen) {
+  /* full plaintext blocks */
+  while (mlen >= ASCON_AEAD128_RATE) {
+    s->x[0] ^= ASCON_LOADBYTES_LE(m, 8);
+    s->x[1] ^= ASCON_LOADBYTES_LE(m + 8, 8);
+    ASCON_STOREBYTES_LE(c, s->x[0], 8);
+    ASCON_STOREBYTES_LE(c + 8, s->x[1], 8);
+    ascon_printstate("absorb plaintext", s);
+    ASCON_P(s, ASCON_AEAD128_PB_ROUNDS);
+    m += ASCON_AEAD128_RATE;
+    c += ASCON_AEAD128_RATE;
+    mlen -= ASCON_AEAD128_RATE;
+  }
+  /* final plaintext block */
+  uint64_t* px = &s->x[0];
+  if (mlen >= 8) {
+    s->x[0] ^= ASCON_LOADBYTES_LE(m, 8);
+    ASCON_STOREBYTES_LE(c, s->x[0], 8);
+    px = &s->x[1];
+    m += 8;
+    c += 8;
+    mlen -= 8;
+  }
+  *px ^= ASCON_PAD_LE((int) mlen);
+  if (mlen) {
+    *px ^= ASCON_LOADBYTES_LE(m, (int) mlen);
+    ASCON_STOREBYTES_LE(c, *px, (int) mlen);
+  }
+  ascon_printstate("pad plaintext", s);
+}
+
+ASCON_API
+forceinline void ascon_aead128_decrypt_data(ascon_state_t* s, uint8_t* m,
+                                            const uint8_t* c, uint64_t clen) {
+  /* full ciphertext blocks */
+  while (clen >= ASCON_AEAD128_RATE) {
+    uint64_t c0 = ASCON_LOADBYTES_LE(c, 8);
+    uint64_t c1 = ASCON_LOADBYTES_LE(c + 8, 8);
+    ASCON_STOREBYTES_LE(m, s->x[0] ^ c0, 8);
+    ASCON_STOREBYTES_LE(m + 8, s->x[1] ^ c1, 8);
+    s->x[0] = c0;
+    s->x[1] = c1;
+    ascon_printstate("insert ciphertext", s);
+    ASCON_P(s, ASCON_AEAD128_PB_ROUNDS);
+    m += ASCON_AEAD128_RATE;
+    c += ASCON_AEAD128_RATE;
+    clen -= ASCON_AEAD128_RATE;
+  }
+  /* final ciphertext block */
+  uint64_t* px = &s->x[0];
+  if (clen >= 8) {
+    uint64_t cx = ASCON_LOADBYTES_LE(c, 8);
+    ASCON_STOREBYTES_LE(m, s->x[0] ^ cx, 8);
+    s->x[0] = cx;
+    px = &s->x[1];
+    m += 8;
+    c += 8;
+    clen -= 8;
+  }
+  *px ^= ASCON_PAD_LE((int) clen);
+  if (clen) {
+    uint64_t cx = ASCON_LOADBYTES_LE(c, (int) clen);
+    *px ^= cx;
+    ASCON_STOREBYTES_LE(m, *px, (int) clen);
+    *px = ASCON_CLEAR_LE(*px, (int) clen);
+    *px ^= cx;
+  }
+  ascon_printstate("pad ciphertext", s);
+}
+
+ASCON_API
+forceinline void ascon_aead128_final(ascon_state_t* s, const ascon_aead128_key_t* key) {
+  s->x[2] ^= key->x[0];
+  s->x[3] ^= key->x[1];
+  ascon_printstate("final 1st key xor", s);
+  ASCON_P(s, 12);
+  s->x[3] ^= key->x[0];
+  s->x[4] ^= key->x[1];
+  ascon_printstate("final 2nd key xor", s);
+}
+
+SQLITE_PRIVATE
+int ascon_aead128_encrypt(uint8_t* ctext,
+                          uint8_t tag[ASCON_AEAD_TAG_LEN],
+                          const uint8_t* mtext, uint64_t mlen,
+                          const uint8_t* ad, uint64_t adlen,
+                          const uint8_t nonce[ASCON_AEAD_NONCE_LEN],
+                          const uint8_t k[ASCON_AEAD_KEY_LEN])
+{
+  ascon_state_t s;
+  /* perform ascon computation */
+  ascon_aead128_key_t key;
+  ascon_aead128_loadkey(&key, k);
+  ascon_aead128_init(&s, &key, nonce);
+  ascon_aead128_adata(&s, ad, adlen);
+  ascon_aead128_encrypt_data(&s, ctext, mtext, mlen);
+  ascon_aead128_final(&s, &key);
+  /* set tag */
+  ASCON_STOREBYTES_LE(tag, s.x[3], 8);
+  ASCON_STOREBYTES_LE(tag + 8, s.x[4], 8);
+  sqlite3mcSecureZeroMemory(&s, sizeof(ascon_state_t));
+  sqlite3mcSecureZeroMemory(&key, sizeof(ascon_aead128_key_t));
+  return 0;
+}
+
+SQLITE_PRIVATE
+int ascon_aead128_decrypt(uint8_t* mtext,
+                          const uint8_t* ctext, uint64_t clen,
+                          const uint8_t* ad, uint64_t adlen,
+                          const uint8_t tag[ASCON_AEAD_TAG_LEN],
+                          const uint8_t nonce[ASCON_AEAD_NONCE_LEN],
+                          const uint8_t k[ASCON_AEAD_KEY_LEN])
+{
+  int rc = 0;
+  ascon_state_t s;
+  /* perform ascon computation */
+  ascon_aead128_key_t key;
+  ascon_aead128_loadkey(&key, k);
+  ascon_aead128_init(&s, &key, nonce);
+  ascon_aead128_adata(&s, ad, adlen);
+  ascon_aead128_decrypt_data(&s, mtext, ctext, clen);
+  ascon_aead128_final(&s, &key);
+  /* verify tag (should be constant time, check compiler output) */
+  s.x[3] ^= ASCON_LOADBYTES_LE(tag, 8);
+  s.x[4] ^= ASCON_LOADBYTES_LE(tag + 8, 8);
+  rc = ASCON_NOTZERO(s.x[3], s.x[4]);
+  sqlite3mcSecureZeroMemory(&s, sizeof(ascon_state_t));
+  sqlite3mcSecureZeroMemory(&key, sizeof(ascon_aead128_key_t));
+  return rc;
+}
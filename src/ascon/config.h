@@ -16,4 +16,13 @@
 #define ASCON_UNROLL_LOOPS 1
 #endif
 
+/* bit-interleaved state words (32-bit rotations only), default on 32-bit platforms */
+#ifndef ASCON_BIT_INTERLEAVED
+#if defined(__LP64__) || defined(_WIN64)
+#define ASCON_BIT_INTERLEAVED 0
+#else
+#define ASCON_BIT_INTERLEAVED 1
+#endif
+#endif
+
 #endif /* CONFIG_H_ */
@@ -33,6 +33,9 @@
 #define ASCON_128A_IV 0x80800c0800000000ull
 #define ASCON_80PQ_IV 0xa0400c0600000000ull
 
+/* Ascon-AEAD128 as standardized in NIST SP 800-232 */
+#define ASCON_AEAD128_IV 0x00001000808c0001ull
+
 #define ASCON_HASH_IV 0x00400c0000000100ull
 #define ASCON_HASHA_IV 0x00400c0400000100ull
 #define ASCON_XOF_IV 0x00400c0000000000ull
@@ -57,4 +57,28 @@ int ascon_aead_decrypt(uint8_t* mtext, const uint8_t* ctext, uint64_t clen,
                        const uint8_t nonce[ASCON_AEAD_NONCE_LEN],
                        const uint8_t k[ASCON_AEAD_KEY_LEN]);
 
+/*
+** Encryption using Ascon-AEAD128 (NIST SP 800-232).
+**
+** Parameters as for ascon_aead_encrypt.
+*/
+SQLITE_PRIVATE
+int ascon_aead128_encrypt(uint8_t* ctext, uint8_t tag[ASCON_AEAD_TAG_LEN],
+                          const uint8_t* mtext, uint64_t mlen,
+                          const uint8_t* ad, uint64_t adlen,
+                          const uint8_t nonce[ASCON_AEAD_NONCE_LEN],
+                          const uint8_t k[ASCON_AEAD_KEY_LEN]);
+
+/*
+** Decryption using Ascon-AEAD128 (NIST SP 800-232).
+**
+** Parameters as for ascon_aead_decrypt.
+*/
+SQLITE_PRIVATE
+int ascon_aead128_decrypt(uint8_t* mtext, const uint8_t* ctext, uint64_t clen,
+                          const uint8_t* ad, uint64_t adlen,
+                          const uint8_t tag[ASCON_AEAD_TAG_LEN],
+                          const uint8_t nonce[ASCON_AEAD_NONCE_LEN],
+                          const uint8_t k[ASCON_AEAD_KEY_LEN]);
+
 #endif
@@ -29,13 +29,13 @@ forceinline void ascon_inithash(ascon_state_t* s) {
   /* initialize */
 #ifdef ASCON_PRINT_STATE
 #if ASCON_HASH_BYTES == 32 && ASCON_HASH_ROUNDS == 12
-  s->x[0] = ASCON_HASH_IV;
+  s->x[0] = ASCON_CONST(ASCON_HASH_IV);
 #elif ASCON_HASH_BYTES == 32 && ASCON_HASH_ROUNDS == 8
-  s->x[0] = ASCON_HASHA_IV;
+  s->x[0] = ASCON_CONST(ASCON_HASHA_IV);
 #elif ASCON_HASH_BYTES == 0 && ASCON_HASH_ROUNDS == 12
-  s->x[0] = ASCON_XOF_IV;
+  s->x[0] = ASCON_CONST(ASCON_XOF_IV);
 #elif ASCON_HASH_BYTES == 0 && ASCON_HASH_ROUNDS == 8
-  s->x[0] = ASCON_XOFA_IV;
+  s->x[0] = ASCON_CONST(ASCON_XOFA_IV);
 #endif
   for (i = 1; i < 5; ++i) s->x[i] = 0;
   ascon_printstate("initial value", s);
@@ -54,7 +54,7 @@ forceinline void ascon_inithash(ascon_state_t* s) {
   const uint64_t iv[5] = {ASCON_XOFA_IV0, ASCON_XOFA_IV1, ASCON_XOFA_IV2,
                           ASCON_XOFA_IV3, ASCON_XOFA_IV4};
 #endif
-  for (i = 0; i < 5; ++i) s->x[i] = (iv[i]);
+  for (i = 0; i < 5; ++i) s->x[i] = ASCON_CONST(iv[i]);
   ascon_printstate("initialization", s);
 }
 
@@ -39,7 +39,7 @@ void ascon_pbkdf2_init(ascon_state_t* state, const char* functionName,
     ascon_hash(initial, (const uint8_t*) functionName, fnLength);
   }
 
-  state->x[0] = ASCON_HASH_IV;
+  state->x[0] = ASCON_CONST(ASCON_HASH_IV);
   state->x[1] = ASCON_LOAD(initial, 8);
   state->x[2] = ASCON_LOAD(initial + 8, 8);
   state->x[3] = ASCON_LOAD(initial + 16, 8);
@@ -51,7 +51,7 @@ void ascon_pbkdf2_init(ascon_state_t* state, const char* functionName,
     ascon_absorb(state, custom, customlen);
     ASCON_P(state, 12);
     /* domain separation */
-    state->x[4] ^= 1;
+    state->x[4] ^= ASCON_DSEP();
   }
 }
 
@@ -3,17 +3,15 @@
 #if !ASCON_INLINE_PERM && ASCON_UNROLL_LOOPS
 
 ASCON_API
-void P12(ascon_state_t* s) { P12ROUNDS(s); }
+void ASCON_P12(ascon_state_t* s) { ASCON_P12ROUNDS(s); }
 
 #endif
 
-#if ((defined(ASCON_AEAD_RATE) && ASCON_AEAD_RATE == 16) ||    \
-     (defined(ASCON_HASH_ROUNDS) && ASCON_HASH_ROUNDS == 8) || \
-     (defined(ASCON_PRF_ROUNDS) && ASCON_PRF_ROUNDS == 8)) &&  \
-    !ASCON_INLINE_PERM && ASCON_UNROLL_LOOPS
+/* Ascon-AEAD128 (SP 800-232) always uses 8 rounds */
+#if !ASCON_INLINE_PERM && ASCON_UNROLL_LOOPS
 
 ASCON_API
-void P8(ascon_state_t* s) { P8ROUNDS(s); }
+void ASCON_P8(ascon_state_t* s) { ASCON_P8ROUNDS(s); }
 
 #endif
 
@@ -21,13 +19,13 @@ void P8(ascon_state_t* s) { P8ROUNDS(s); }
     !ASCON_INLINE_PERM && ASCON_UNROLL_LOOPS
 
 ASCON_API
-void P6(ascon_state_t* s) { P6ROUNDS(s); }
+void ASCON_P6(ascon_state_t* s) { ASCON_P6ROUNDS(s); }
 
 #endif
 
 #if !ASCON_INLINE_PERM && !ASCON_UNROLL_LOOPS
 
 ASCON_API
-void P(ascon_state_t* s, int nr) { PROUNDS(s, nr); }
+void ASCON_P(ascon_state_t* s, int nr) { ASCON_PROUNDS(s, nr); }
 
 #endif
@@ -15,7 +15,10 @@
 
 #include "forceinline.h"
 
-#if defined(__LP64__) || defined(_WIN64)
+#if ASCON_BIT_INTERLEAVED
+/* Bit-interleaved words, rotations are mapped to 32-bit rotations by ASCON_ROR */
+#include "round64.h"
+#elif defined(__LP64__) || defined(_WIN64)
 /* 64-bit machine, Windows or Linux or OS X */
 #include "round64.h"
 #else
@@ -11,7 +11,7 @@ ASCON_API
 forceinline void ASCON_ROUND(ascon_state_t* s, uint8_t C) {
   uint64_t xtemp;
   /* round constant */
-  s->x[2] ^= C;
+  s->x[2] ^= ASCON_ROUNDCONST(C);
   /* s-box layer */
   s->x[0] ^= s->x[4];
   s->x[4] ^= s->x[3];
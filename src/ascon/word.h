@@ -6,6 +6,7 @@
 
 #include "api.h"
 #include "bendian.h"
+#include "config.h"
 #include "forceinline.h"
 
 typedef union {
@@ -14,14 +15,98 @@ typedef union {
   uint8_t b[8];
 } word_t;
 
+#if ASCON_BIT_INTERLEAVED
+
+/*
+** Bit-interleaved representation: the even bits of a 64-bit word are kept
+** in the lower 32 bits, the odd bits in the upper 32 bits. Then each 64-bit
+** rotation becomes two 32-bit rotations, which is much faster on 32-bit CPUs.
+*/
+
+ASCON_API
+forceinline uint64_t ASCON_TOBI(uint64_t x) {
+  uint64_t e = x & 0x5555555555555555ull;
+  uint64_t o = (x >> 1) & 0x5555555555555555ull;
+  e = (e | (e >> 1)) & 0x3333333333333333ull;
+  o = (o | (o >> 1)) & 0x3333333333333333ull;
+  e = (e | (e >> 2)) & 0x0f0f0f0f0f0f0f0full;
+  o = (o | (o >> 2)) & 0x0f0f0f0f0f0f0f0full;
+  e = (e | (e >> 4)) & 0x00ff00ff00ff00ffull;
+  o = (o | (o >> 4)) & 0x00ff00ff00ff00ffull;
+  e = (e | (e >> 8)) & 0x0000ffff0000ffffull;
+  o = (o | (o >> 8)) & 0x0000ffff0000ffffull;
+  e = (e | (e >> 16)) & 0x00000000ffffffffull;
+  o = (o | (o >> 16)) & 0x00000000ffffffffull;
+  return e | (o << 32);
+}
+
+ASCON_API
+forceinline uint64_t ASCON_FROMBI(uint64_t x) {
+  uint64_t e = x & 0x00000000ffffffffull;
+  uint64_t o = x >> 32;
+  e = (e | (e << 16)) & 0x0000ffff0000ffffull;
+  o = (o | (o << 16)) & 0x0000ffff0000ffffull;
+  e = (e | (e << 8)) & 0x00ff00ff00ff00ffull;
+  o = (o | (o << 8)) & 0x00ff00ff00ff00ffull;
+  e = (e | (e << 4)) & 0x0f0f0f0f0f0f0f0full;
+  o = (o | (o << 4)) & 0x0f0f0f0f0f0f0f0full;
+  e = (e | (e << 2)) & 0x3333333333333333ull;
+  o = (o | (o << 2)) & 0x3333333333333333ull;
+  e = (e | (e << 1)) & 0x5555555555555555ull;
+  o = (o | (o << 1)) & 0x5555555555555555ull;
+  return e | (o << 1);
+}
+
+ASCON_API
+forceinline uint32_t ASCON_ROR32(uint32_t x, int n) { return x >> n | x << (-n & 31); }
+
+ASCON_API
+forceinline uint64_t ASCON_ROR(uint64_t x, int n) {
+  uint32_t e = (uint32_t) x;
+  uint32_t o = (uint32_t) (x >> 32);
+  uint32_t re, ro;
+  if (n & 1) {
+    re = ASCON_ROR32(o, (n - 1) / 2);
+    ro = ASCON_ROR32(e, (n + 1) / 2);
+  } else {
+    re = ASCON_ROR32(e, n / 2);
+    ro = ASCON_ROR32(o, n / 2);
+  }
+  return (uint64_t) re | ((uint64_t) ro << 32);
+}
+
+/* Round constants have 8 bits only */
+ASCON_API
+forceinline uint64_t ASCON_ROUNDCONST(uint8_t c) {
+  uint32_t e = (c & 1) | ((c >> 1) & 2) | ((c >> 2) & 4) | ((c >> 3) & 8);
+  uint32_t o = ((c >> 1) & 1) | ((c >> 2) & 2) | ((c >> 3) & 4) | ((c >> 4) & 8);
+  return (uint64_t) e | ((uint64_t) o << 32);
+}
+
+#define ASCON_CONST(x) ASCON_TOBI(x)
+#define ASCON_U64TOWORD(x) ASCON_TOBI(ASCON_U64BIG(x))
+#define ASCON_WORDTOU64(x) ASCON_U64BIG(ASCON_FROMBI(x))
+#define ASCON_LETOWORD(x) ASCON_TOBI(ASCON_U64LITTLE(x))
+#define ASCON_WORDTOLE(x) ASCON_U64LITTLE(ASCON_FROMBI(x))
+
+#else
+
+ASCON_API
+forceinline uint64_t ASCON_ROR(uint64_t x, int n) { return x >> n | x << (-n & 63); }
+
+#define ASCON_ROUNDCONST(c) ((uint64_t) (c))
+
+#define ASCON_CONST(x) (x)
 #define ASCON_U64TOWORD(x) ASCON_U64BIG(x)
 #define ASCON_WORDTOU64(x) ASCON_U64BIG(x)
+#define ASCON_LETOWORD(x) ASCON_U64LITTLE(x)
+#define ASCON_WORDTOLE(x) ASCON_U64LITTLE(x)
+
+#endif
+
 #define ASCON_LOAD(b, n) ASCON_LOADBYTES(b, n)
 #define ASCON_STORE(b, w, n) ASCON_STOREBYTES(b, w, n)
 
-ASCON_API
-forceinline uint64_t ASCON_ROR(uint64_t x, int n) { return x >> n | x << (-n & 63); }
-
 ASCON_API
 forceinline uint64_t ASCON_KEYROT(uint64_t lo2hi, uint64_t hi2lo) {
   return lo2hi << 32 | hi2lo >> 32;
@@ -37,10 +122,10 @@ forceinline int ASCON_NOTZERO(uint64_t a, uint64_t b) {
 }
 
 ASCON_API
-forceinline uint64_t ASCON_PAD(int i) { return 0x80ull << (56 - 8 * i); }
+forceinline uint64_t ASCON_PAD(int i) { return ASCON_CONST(0x80ull << (56 - 8 * i)); }
 
 ASCON_API
-forceinline uint64_t ASCON_DSEP() { return 0x01; }
+forceinline uint64_t ASCON_DSEP() { return ASCON_CONST(0x01ull); }
 
 ASCON_API
 forceinline uint64_t ASCON_PRFS_MLEN(uint64_t len) { return len << 51; }
@@ -48,14 +133,14 @@ forceinline uint64_t ASCON_PRFS_MLEN(uint64_t len) { return len << 51; }
 ASCON_API
 forceinline uint64_t ASCON_CLEAR(uint64_t w, int n) {
   /* undefined for n == 0 */
-  uint64_t mask = ~0ull >> (8 * n);
+  uint64_t mask = ASCON_CONST(~0ull >> (8 * n));
   return w & mask;
 }
 
 ASCON_API
 forceinline uint64_t ASCON_MASK(int n) {
   /* undefined for n == 0 */
-  return ~0ull >> (64 - 8 * n);
+  return ASCON_CONST(~0ull >> (64 - 8 * n));
 }
 
 ASCON_API
@@ -71,4 +156,32 @@ forceinline void ASCON_STOREBYTES(uint8_t* bytes, uint64_t w, int n) {
   memcpy(bytes, &x, n);
 }
 
+/* Little endian variants, as specified for Ascon in NIST SP 800-232 */
+
+ASCON_API
+forceinline uint64_t ASCON_PAD_LE(int i) { return ASCON_CONST(0x01ull << (8 * i)); }
+
+ASCON_API
+forceinline uint64_t ASCON_DSEP_LE() { return ASCON_CONST(0x8000000000000000ull); }
+
+ASCON_API
+forceinline uint64_t ASCON_CLEAR_LE(uint64_t w, int n) {
+  /* undefined for n == 0 */
+  uint64_t mask = ASCON_CONST(~0ull << (8 * n));
+  return w & mask;
+}
+
+ASCON_API
+forceinline uint64_t ASCON_LOADBYTES_LE(const uint8_t* bytes, int n) {
+  uint64_t x = 0;
+  memcpy(&x, bytes, n);
+  return ASCON_LETOWORD(x);
+}
+
+ASCON_API
+forceinline void ASCON_STOREBYTES_LE(uint8_t* bytes, uint64_t w, int n) {
+  uint64_t x = ASCON_WORDTOLE(w);
+  memcpy(bytes, &x, n);
+}
+
 #endif /* WORD_H_ */
@@ -48,8 +48,11 @@
 
 /*
  * ChaCha20 stream cipher
+ *
+ * The number of rounds is configurable to support the reduced-round
+ * variants ChaCha12 and ChaCha8 (rounds must be even).
  */
-static void chacha20_block(uint32_t x[16])
+static void chacha20_block(uint32_t x[16], int rounds)
 {
   int i;
   /* Macro renamed from QR to CC20QR to avoid name clashes. */
@@ -58,7 +61,7 @@ static void chacha20_block(uint32_t x[16])
   x[c] += x[d]; x[b] ^= x[c]; x[b] = ROL32(x[b], 12); \
   x[a] += x[b]; x[d] ^= x[a]; x[d] = ROL32(x[d],  8); \
   x[c] += x[d]; x[b] ^= x[c]; x[b] = ROL32(x[b],  7);
-  for (i = 0; i < 10; i++)
+  for (i = 0; i < rounds; i += 2)
   {
     /* Column round */
     CC20QR(x, 0, 4, 8, 12)
@@ -75,8 +78,8 @@ static void chacha20_block(uint32_t x[16])
 }
 
 SQLITE_PRIVATE
-void chacha20_xor(void* buffer, size_t n, const uint8_t key[32],
-                  const uint8_t nonce[12], uint32_t counter)
+void chacha_xor(void* buffer, size_t n, const uint8_t key[32],
+                const uint8_t nonce[12], uint32_t counter, int rounds)
 {
   size_t i;
   union {
@@ -111,7 +114,7 @@ void chacha20_xor(void* buffer, size_t n, const uint8_t key[32],
     {
       block.words[i] = state[i];
     }
-    chacha20_block(block.words);
+    chacha20_block(block.words, rounds);
     for (i = 0; i < 16; ++i)
     {
       block.words[i] += state[i];
@@ -127,7 +130,7 @@ void chacha20_xor(void* buffer, size_t n, const uint8_t key[32],
   {
     block.words[i] = state[i];
   }
-  chacha20_block(state);
+  chacha20_block(state, rounds);
   for (i = 0; i < 16; ++i)
   {
     state[i] += block.words[i];
@@ -139,6 +142,13 @@ void chacha20_xor(void* buffer, size_t n, const uint8_t key[32],
   }
 }
 
+SQLITE_PRIVATE
+void chacha20_xor(void* buffer, size_t n, const uint8_t key[32],
+                  const uint8_t nonce[12], uint32_t counter)
+{
+  chacha_xor(buffer, n, key, nonce, counter, 20);
+}
+
 /*
  * Poly1305 authentication tags
  */
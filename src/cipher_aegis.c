@@ -162,7 +162,7 @@ typedef struct _aegisCipher
 static void*
 AllocateAegisCipher(sqlite3* db)
 {
-  AegisCipher* aegisCipher = (AegisCipher*) sqlite3_malloc(sizeof(AegisCipher));
+  AegisCipher* aegisCipher = (AegisCipher*) sqlite3mcSecureAlloc(sizeof(AegisCipher));
   if (aegisCipher != NULL)
   {
     memset(aegisCipher, 0, sizeof(AegisCipher));
@@ -197,7 +197,7 @@ FreeAegisCipher(void* cipher)
 {
   AegisCipher* aegisCipher = (AegisCipher*) cipher;
   sqlite3mcSecureZeroMemory(aegisCipher, sizeof(AegisCipher));
-  sqlite3_free(aegisCipher);
+  sqlite3mcSecureFree(aegisCipher);
 }
 
 static void
@@ -248,6 +248,251 @@ GetSaltAegisCipher(void* cipher)
   return aegisCipher->m_salt;
 }
 
+/*
+** Process-wide scheduler for Argon2 key derivations
+**
+** Each Argon2 key derivation requires mcost kB of memory (19 MB by default).
+** To avoid memory spikes when many databases are opened at once, the number
+** of concurrent derivations can be limited (parameter "argon2_concurrency",
+** 0 = unlimited). Memory blocks can be retained after a derivation for reuse
+** by subsequent derivations (parameter "argon2_pool_size", maximum number of
+** idle blocks, 0 = no pooling), which avoids allocating and page faulting
+** large blocks again and again. Argon2 wipes its memory before releasing it,
+** so pooled blocks do not contain any key material.
+**
+** SQLite does not provide condition variables; like the default busy
+** handler, a derivation waiting for a free slot polls in 1 ms intervals.
+*/
+
+#define ARGON2_CONCURRENCY_MAX  1024
+#define ARGON2_POOL_SIZE_MAX    64
+
+typedef struct McArgon2Block McArgon2Block;
+struct McArgon2Block
+{
+  McArgon2Block* pNext;      /* Next idle block */
+  size_t         nCapacity;  /* Usable size of the block */
+};
+
+/* Keep the memory passed to Argon2 aligned to a cache line */
+#define ARGON2_BLOCK_HEADER 64
+
+static struct
+{
+  int            nConcurrency;  /* Maximum number of concurrent derivations */
+  int            nPoolSize;     /* Maximum number of idle blocks */
+  int            nActive;       /* Number of running derivations */
+  int            nIdle;         /* Number of idle blocks */
+  McArgon2Block* pIdle;         /* List of idle blocks */
+  sqlite3_mutex* mutex;         /* Mutex to protect the scheduler */
+} mcArgon2Scheduler = { 0, 0, 0, 0, NULL, NULL };
+
+/*
+** The scheduler is protected by its own mutex,
+** allocated on initialization of SQLite3 Multiple Ciphers
+*/
+static sqlite3_mutex* mcArgon2Mutex()
+{
+  return mcArgon2Scheduler.mutex;
+}
+
+/*
+** Allocate the mutex of the scheduler
+*/
+SQLITE_PRIVATE int
+sqlite3mcInitArgon2Scheduler()
+{
+  if (mcArgon2Scheduler.mutex == NULL)
+  {
+    mcArgon2Scheduler.mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_FAST);
+    if (mcArgon2Scheduler.mutex == NULL)
+    {
+      return SQLITE_NOMEM;
+    }
+  }
+  return SQLITE_OK;
+}
+
+/*
+** Release the idle blocks and the mutex of the scheduler
+*/
+SQLITE_PRIVATE void
+sqlite3mcTermArgon2Scheduler()
+{
+  McArgon2Block* pBlock = mcArgon2Scheduler.pIdle;
+  while (pBlock != NULL)
+  {
+    McArgon2Block* pNext = pBlock->pNext;
+    free(pBlock);
+    pBlock = pNext;
+  }
+  mcArgon2Scheduler.pIdle = NULL;
+  mcArgon2Scheduler.nIdle = 0;
+  sqlite3_mutex_free(mcArgon2Scheduler.mutex);
+  mcArgon2Scheduler.mutex = NULL;
+}
+
+static int
+mcArgon2Allocate(uint8_t** memory, size_t bytesToAllocate)
+{
+  sqlite3_mutex* mutex = mcArgon2Mutex();
+  McArgon2Block** ppBest = NULL;
+  McArgon2Block** ppBlock;
+  McArgon2Block* pBlock = NULL;
+
+  /* Take the smallest idle block large enough */
+  sqlite3_mutex_enter(mutex);
+  for (ppBlock = &mcArgon2Scheduler.pIdle; *ppBlock != NULL; ppBlock = &(*ppBlock)->pNext)
+  {
+    if ((*ppBlock)->nCapacity >= bytesToAllocate &&
+        (ppBest == NULL || (*ppBlock)->nCapacity < (*ppBest)->nCapacity))
+    {
+      ppBest = ppBlock;
+    }
+  }
+  if (ppBest != NULL)
+  {
+    pBlock = *ppBest;
+    *ppBest = pBlock->pNext;
+    --mcArgon2Scheduler.nIdle;
+  }
+  sqlite3_mutex_leave(mutex);
+
+  if (pBlock == NULL)
+  {
+    /* Blocks may outlive sqlite3_shutdown, use the system allocator like Argon2 */
+    pBlock = (McArgon2Block*) malloc(ARGON2_BLOCK_HEADER + bytesToAllocate);
+    if (pBlock == NULL)
+    {
+      *memory = NULL;
+      return ARGON2_MEMORY_ALLOCATION_ERROR;
+    }
+    pBlock->nCapacity = bytesToAllocate;
+  }
+  pBlock->pNext = NULL;
+  *memory = (uint8_t*) pBlock + ARGON2_BLOCK_HEADER;
+  return ARGON2_OK;
+}
+
+static void
+mcArgon2Free(uint8_t* memory, size_t bytesToFree)
+{
+  sqlite3_mutex* mutex = mcArgon2Mutex();
+  McArgon2Block* pBlock = (McArgon2Block*) (memory - ARGON2_BLOCK_HEADER);
+  sqlite3_mutex_enter(mutex);
+  if (mcArgon2Scheduler.nIdle < mcArgon2Scheduler.nPoolSize)
+  {
+    pBlock->pNext = mcArgon2Scheduler.pIdle;
+    mcArgon2Scheduler.pIdle = pBlock;
+    ++mcArgon2Scheduler.nIdle;
+    pBlock = NULL;
+  }
+  sqlite3_mutex_leave(mutex);
+  free(pBlock);
+}
+
+/*
+** Set or query the scheduler limits ("argon2_concurrency", "argon2_pool_size")
+** A negative value only queries the current value.
+** Returns the current value, or -1 for an unknown or invalid parameter.
+*/
+SQLITE_PRIVATE int
+sqlite3mcArgon2Config(const char* paramName, int newValue)
+{
+  sqlite3_mutex* mutex = mcArgon2Mutex();
+  McArgon2Block* pTrim = NULL;
+  int value = -1;
+
+  sqlite3_mutex_enter(mutex);
+  if (sqlite3_stricmp(paramName, "argon2_concurrency") == 0)
+  {
+    if (newValue >= 0 && newValue <= ARGON2_CONCURRENCY_MAX)
+    {
+      mcArgon2Scheduler.nConcurrency = newValue;
+    }
+    value = (newValue <= ARGON2_CONCURRENCY_MAX) ? mcArgon2Scheduler.nConcurrency : -1;
+  }
+  else if (sqlite3_stricmp(paramName, "argon2_pool_size") == 0)
+  {
+    if (newValue >= 0 && newValue <= ARGON2_POOL_SIZE_MAX)
+    {
+      mcArgon2Scheduler.nPoolSize = newValue;
+      /* Release idle blocks exceeding the new pool size */
+      while (mcArgon2Scheduler.nIdle > newValue)
+      {
+        McArgon2Block* pBlock = mcArgon2Scheduler.pIdle;
+        mcArgon2Scheduler.pIdle = pBlock->pNext;
+        --mcArgon2Scheduler.nIdle;
+        pBlock->pNext = pTrim;
+        pTrim = pBlock;
+      }
+    }
+    value = (newValue <= ARGON2_POOL_SIZE_MAX) ? mcArgon2Scheduler.nPoolSize : -1;
+  }
+  sqlite3_mutex_leave(mutex);
+
+  while (pTrim != NULL)
+  {
+    McArgon2Block* pNext = pTrim->pNext;
+    free(pTrim);
+    pTrim = pNext;
+  }
+  return value;
+}
+
+/*
+** Derive a key with Argon2id under control of the scheduler
+*/
+SQLITE_PRIVATE int
+sqlite3mcArgon2idHashRaw(uint32_t tCost, uint32_t mCost, uint32_t parallelism,
+                         const void* pwd, size_t pwdLength,
+                         const void* salt, size_t saltLength,
+                         void* hash, size_t hashLength)
+{
+  sqlite3_mutex* mutex = mcArgon2Mutex();
+  argon2_context context;
+  int rc;
+
+  memset(&context, 0, sizeof(argon2_context));
+  context.out = (uint8_t*) hash;
+  context.outlen = (uint32_t) hashLength;
+  context.pwd = (uint8_t*) pwd;
+  context.pwdlen = (uint32_t) pwdLength;
+  context.salt = (uint8_t*) salt;
+  context.saltlen = (uint32_t) saltLength;
+  context.t_cost = tCost;
+  context.m_cost = mCost;
+  context.lanes = parallelism;
+  context.threads = parallelism;
+  context.version = ARGON2_VERSION_NUMBER;
+  context.allocate_cbk = mcArgon2Allocate;
+  context.free_cbk = mcArgon2Free;
+  context.flags = ARGON2_DEFAULT_FLAGS;
+
+  /* Wait for a free slot */
+  for (;;)
+  {
+    int acquired;
+    sqlite3_mutex_enter(mutex);
+    acquired = mcArgon2Scheduler.nConcurrency == 0 ||
+               mcArgon2Scheduler.nActive < mcArgon2Scheduler.nConcurrency;
+    if (acquired)
+    {
+      ++mcArgon2Scheduler.nActive;
+    }
+    sqlite3_mutex_leave(mutex);
+    if (acquired) break;
+    sqlite3_sleep(1);
+  }
+
+  rc = argon2_ctx(&context, Argon2_id);
+
+  sqlite3_mutex_enter(mutex);
+  --mcArgon2Scheduler.nActive;
+  sqlite3_mutex_leave(mutex);
+  return rc;
+}
+
 static void
 GenerateKeyAegisCipher(void* cipher, char* userPassword, int passwordLength, int rekey, unsigned char* cipherSalt)
 {
@@ -277,12 +522,12 @@ GenerateKeyAegisCipher(void* cipher, char* userPassword, int passwordLength, int
                                       aegisCipher->m_key, aegisCipher->m_salt);
   if (!bypass)
   {
-    int rc = argon2id_hash_raw((uint32_t) aegisCipher->m_argon2Tcost,
-                               (uint32_t) aegisCipher->m_argon2Mcost,
-                               (uint32_t) aegisCipher->m_argon2Pcost,
-                               userPassword, passwordLength,
-                               aegisCipher->m_salt, SALTLENGTH_AEGIS,
-                               aegisCipher->m_key, aegisCipher->m_keyLength);
+    int rc = sqlite3mcArgon2idHashRaw((uint32_t) aegisCipher->m_argon2Tcost,
+                                      (uint32_t) aegisCipher->m_argon2Mcost,
+                                      (uint32_t) aegisCipher->m_argon2Pcost,
+                                      userPassword, passwordLength,
+                                      aegisCipher->m_salt, SALTLENGTH_AEGIS,
+                                      aegisCipher->m_key, aegisCipher->m_keyLength);
   }
   SQLITE3MC_DEBUG_LOG("generate: codec=%p pFile=%p\n", aegisCipher, fd);
   SQLITE3MC_DEBUG_HEX("generate  key:", aegisCipher->m_key, aegisCipher->m_keyLength);
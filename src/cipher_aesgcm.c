@@ -0,0 +1,582 @@
+/*
+** Name:        cipher_aesgcm.c
+** Purpose:     Implementation of cipher AES-256-GCM
+** Author:      Ulrich Telle
+** Created:     2026-10-19
+** Copyright:   (c) 2026 Ulrich Telle
+** License:     MIT
+*/
+
+#include "cipher_common.h"
+
+/* --- AES 256-bit GCM cipher --- */
+#if HAVE_CIPHER_AES_256_GCM
+
+#define CIPHER_NAME_AES256GCM "aes256gcm"
+
+/*
+** Configuration parameters for "aes256gcm"
+**
+** - kdf_iter : number of iterations for key derivation (PBKDF2-HMAC-SHA256)
+** - plaintext_header_size : size of unencrypted database header
+**
+** Each page gets a fresh random 96-bit nonce. The page number and the
+** unencrypted part of the database header are authenticated as additional data.
+** To stay within the safety margin of random GCM nonces, a database key should
+** not be used for more than 2^32 page writes.
+*/
+
+#define AES256GCM_KDF_ITER_DEFAULT 256000
+
+SQLITE_PRIVATE CipherParams mcAes256GcmParams[] =
+{
+  { "kdf_iter",              AES256GCM_KDF_ITER_DEFAULT, AES256GCM_KDF_ITER_DEFAULT, 1, 0x7fffffff },
+  { "plaintext_header_size", 0,                          0,                          0, 100 /* restrict to db header size */ },
+  CIPHER_PARAMS_SENTINEL
+};
+
+#define KEYLENGTH_AES256GCM       32
+#define SALTLENGTH_AES256GCM      16
+#define PAGE_NONCE_LEN_AES256GCM  12
+#define PAGE_TAG_LEN_AES256GCM    16
+#define PAGE_RESERVED_AES256GCM   (PAGE_NONCE_LEN_AES256GCM + PAGE_TAG_LEN_AES256GCM)
+
+/*
+** AES-256-GCM primitives
+**
+** AES-NI and PCLMULQDQ are used if available at runtime, otherwise the
+** portable Rijndael implementation and a table driven GHASH are used.
+*/
+
+typedef struct _AesGcmContext
+{
+  int      m_hwAvailable;
+  Rijndael m_aes;
+  uint64_t m_hashTableLow[16];
+  uint64_t m_hashTableHigh[16];
+#if HAS_AES_HARDWARE == AES_HARDWARE_NI
+  unsigned char m_hwKey[(_MAX_ROUNDS + 1) * 16];
+  unsigned char m_hwHashKeys[64];
+#endif
+} AesGcmContext;
+
+/* Reduction constants for GHASH processing 4 bits at a time */
+static const uint64_t mcAesGcmLast4[16] =
+{
+  0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+  0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0
+};
+
+static uint64_t
+AesGcmLoad64BE(const unsigned char* p)
+{
+  return ((uint64_t) p[0] << 56) | ((uint64_t) p[1] << 48) | ((uint64_t) p[2] << 40) | ((uint64_t) p[3] << 32) |
+         ((uint64_t) p[4] << 24) | ((uint64_t) p[5] << 16) | ((uint64_t) p[6] <<  8) | ((uint64_t) p[7]);
+}
+
+static void
+AesGcmInitHashTable(AesGcmContext* ctx, const unsigned char hashKey[16])
+{
+  uint64_t vh = AesGcmLoad64BE(hashKey);
+  uint64_t vl = AesGcmLoad64BE(hashKey + 8);
+  int i, j;
+
+  ctx->m_hashTableLow[8] = vl;
+  ctx->m_hashTableHigh[8] = vh;
+  ctx->m_hashTableLow[0] = 0;
+  ctx->m_hashTableHigh[0] = 0;
+  for (i = 4; i > 0; i >>= 1)
+  {
+    uint64_t t = (vl & 1) ? 0xe100000000000000ULL : 0;
+    vl = (vh << 63) | (vl >> 1);
+    vh = (vh >> 1) ^ t;
+    ctx->m_hashTableLow[i] = vl;
+    ctx->m_hashTableHigh[i] = vh;
+  }
+  for (i = 2; i <= 8; i *= 2)
+  {
+    vh = ctx->m_hashTableHigh[i];
+    vl = ctx->m_hashTableLow[i];
+    for (j = 1; j < i; ++j)
+    {
+      ctx->m_hashTableHigh[i + j] = vh ^ ctx->m_hashTableHigh[j];
+      ctx->m_hashTableLow[i + j] = vl ^ ctx->m_hashTableLow[j];
+    }
+  }
+}
+
+static void
+AesGcmMultiplyH(const AesGcmContext* ctx, unsigned char x[16])
+{
+  int i;
+  unsigned char lo = x[15] & 0x0f;
+  unsigned char hi;
+  uint64_t zh = ctx->m_hashTableHigh[lo];
+  uint64_t zl = ctx->m_hashTableLow[lo];
+  uint64_t rem;
+
+  for (i = 15; i >= 0; --i)
+  {
+    lo = x[i] & 0x0f;
+    hi = (x[i] >> 4) & 0x0f;
+    if (i != 15)
+    {
+      rem = zl & 0x0f;
+      zl = (zh << 60) | (zl >> 4);
+      zh = (zh >> 4) ^ (mcAesGcmLast4[rem] << 48);
+      zh ^= ctx->m_hashTableHigh[lo];
+      zl ^= ctx->m_hashTableLow[lo];
+    }
+    rem = zl & 0x0f;
+    zl = (zh << 60) | (zl >> 4);
+    zh = (zh >> 4) ^ (mcAesGcmLast4[rem] << 48);
+    zh ^= ctx->m_hashTableHigh[hi];
+    zl ^= ctx->m_hashTableLow[hi];
+  }
+  STORE64_BE(x, zh);
+  STORE64_BE(x + 8, zl);
+}
+
+static void
+AesGcmGhash(const AesGcmContext* ctx, unsigned char state[16], const unsigned char* data, unsigned long length)
+{
+#if HAS_AES_HARDWARE == AES_HARDWARE_NI
+  if (ctx->m_hwAvailable)
+  {
+    aesGhashCLMUL(state, ctx->m_hwHashKeys, data, length);
+    return;
+  }
+#endif
+  {
+    unsigned long i;
+    unsigned long k;
+    for (i = 0; i < length; i += 16)
+    {
+      unsigned long n = (length - i < 16) ? length - i : 16;
+      for (k = 0; k < n; ++k)
+      {
+        state[k] ^= data[i + k];
+      }
+      AesGcmMultiplyH(ctx, state);
+    }
+  }
+}
+
+static void
+AesGcmCtr(AesGcmContext* ctx, const unsigned char icb[16], const unsigned char* in, unsigned char* out, unsigned long length)
+{
+#if HAS_AES_HARDWARE == AES_HARDWARE_NI
+  if (ctx->m_hwAvailable)
+  {
+    aesCryptCTR(in, out, length, icb, ctx->m_hwKey, 14);
+    return;
+  }
+#endif
+  {
+    unsigned char counter[16];
+    unsigned char keyStream[16];
+    unsigned long i;
+    unsigned long k;
+    uint32_t c = ((uint32_t) icb[12] << 24) | ((uint32_t) icb[13] << 16) | ((uint32_t) icb[14] << 8) | icb[15];
+    memcpy(counter, icb, 12);
+    for (i = 0; i < length; i += 16)
+    {
+      unsigned long n = (length - i < 16) ? length - i : 16;
+      STORE32_BE(counter + 12, c);
+      RijndaelEncrypt(&ctx->m_aes, counter, keyStream);
+      for (k = 0; k < n; ++k)
+      {
+        out[i + k] = in[i + k] ^ keyStream[k];
+      }
+      ++c;
+    }
+    sqlite3mcSecureZeroMemory(keyStream, sizeof(keyStream));
+  }
+}
+
+static void
+AesGcmInit(AesGcmContext* ctx, const unsigned char key[KEYLENGTH_AES256GCM])
+{
+  unsigned char hashKey[16];
+  unsigned char zero[16];
+  memset(zero, 0, 16);
+  memset(ctx, 0, sizeof(AesGcmContext));
+
+#if HAS_AES_HARDWARE == AES_HARDWARE_NI
+  ctx->m_hwAvailable = aesGcmHardwareAvailable();
+  if (ctx->m_hwAvailable)
+  {
+    aesGenKeyEncrypt(key, 256, ctx->m_hwKey);
+    /* The hash key is the encryption of the zero block, i.e. key stream for counter 0 */
+    aesCryptCTR(zero, hashKey, 16, zero, ctx->m_hwKey, 14);
+    aesGhashInitCLMUL(hashKey, ctx->m_hwHashKeys);
+  }
+  else
+#endif
+  {
+    /* Set up the software key schedule, regardless of AES hardware support */
+    UINT8 keyMatrix[_MAX_KEY_COLUMNS][4];
+    int i;
+    for (i = 0; i < KEYLENGTH_AES256GCM; ++i)
+    {
+      keyMatrix[i >> 2][i & 3] = key[i];
+    }
+    ctx->m_aes.m_mode = RIJNDAEL_Direction_Mode_ECB;
+    ctx->m_aes.m_direction = RIJNDAEL_Direction_Encrypt;
+    ctx->m_aes.m_uRounds = 14;
+    RijndaelKeySched(&ctx->m_aes, keyMatrix);
+    ctx->m_aes.m_state = RIJNDAEL_State_Valid;
+    sqlite3mcSecureZeroMemory(keyMatrix, sizeof(keyMatrix));
+    RijndaelEncrypt(&ctx->m_aes, zero, hashKey);
+    AesGcmInitHashTable(ctx, hashKey);
+  }
+  sqlite3mcSecureZeroMemory(hashKey, sizeof(hashKey));
+}
+
+static void
+AesGcmTag(AesGcmContext* ctx, const unsigned char j0[16],
+          const unsigned char* aad, unsigned long aadLen,
+          const unsigned char* ciphertext, unsigned long length,
+          unsigned char tag[16])
+{
+  unsigned char state[16];
+  unsigned char lengths[16];
+  memset(state, 0, 16);
+  AesGcmGhash(ctx, state, aad, aadLen);
+  AesGcmGhash(ctx, state, ciphertext, length);
+  STORE64_BE(lengths, (uint64_t) aadLen * 8);
+  STORE64_BE(lengths + 8, (uint64_t) length * 8);
+  AesGcmGhash(ctx, state, lengths, 16);
+  AesGcmCtr(ctx, j0, state, tag, 16);
+}
+
+/*
+** Encrypt in place and compute the tag, nonce must have 12 bytes
+*/
+static void
+AesGcmEncrypt(AesGcmContext* ctx, const unsigned char nonce[PAGE_NONCE_LEN_AES256GCM],
+              const unsigned char* aad, unsigned long aadLen,
+              unsigned char* data, unsigned long length,
+              unsigned char tag[PAGE_TAG_LEN_AES256GCM])
+{
+  unsigned char j0[16];
+  unsigned char icb[16];
+  memcpy(j0, nonce, PAGE_NONCE_LEN_AES256GCM);
+  STORE32_BE(j0 + 12, 1);
+  memcpy(icb, nonce, PAGE_NONCE_LEN_AES256GCM);
+  STORE32_BE(icb + 12, 2);
+  AesGcmCtr(ctx, icb, data, data, length);
+  if (tag != NULL)
+  {
+    AesGcmTag(ctx, j0, aad, aadLen, data, length, tag);
+  }
+}
+
+/*
+** Verify the tag (if given) and decrypt in place, nonce must have 12 bytes
+** Returns 0 on success, -1 if the tag does not match
+*/
+static int
+AesGcmDecrypt(AesGcmContext* ctx, const unsigned char nonce[PAGE_NONCE_LEN_AES256GCM],
+              const unsigned char* aad, unsigned long aadLen,
+              unsigned char* data, unsigned long length,
+              const unsigned char tag[PAGE_TAG_LEN_AES256GCM])
+{
+  int rc = 0;
+  unsigned char j0[16];
+  unsigned char icb[16];
+  memcpy(j0, nonce, PAGE_NONCE_LEN_AES256GCM);
+  STORE32_BE(j0 + 12, 1);
+  memcpy(icb, nonce, PAGE_NONCE_LEN_AES256GCM);
+  STORE32_BE(icb + 12, 2);
+  if (tag != NULL)
+  {
+    unsigned char expected[PAGE_TAG_LEN_AES256GCM];
+    unsigned char diff = 0;
+    int j;
+    AesGcmTag(ctx, j0, aad, aadLen, data, length, expected);
+    for (j = 0; j < PAGE_TAG_LEN_AES256GCM; ++j)
+    {
+      diff |= expected[j] ^ tag[j];
+    }
+    rc = (diff == 0) ? 0 : -1;
+  }
+  AesGcmCtr(ctx, icb, data, data, length);
+  return rc;
+}
+
+/*
+** Cipher "aes256gcm"
+*/
+
+typedef struct _aes256GcmCipher
+{
+  int           m_kdfIter;
+  int           m_plaintextHeaderSize;
+  int           m_keyLength;
+  uint8_t       m_key[KEYLENGTH_AES256GCM];
+  uint8_t       m_salt[SALTLENGTH_AES256GCM];
+  AesGcmContext m_gcm;
+} Aes256GcmCipher;
+
+static void*
+AllocateAes256GcmCipher(sqlite3* db)
+{
+  Aes256GcmCipher* gcmCipher = (Aes256GcmCipher*) sqlite3mcSecureAlloc(sizeof(Aes256GcmCipher));
+  if (gcmCipher != NULL)
+  {
+    memset(gcmCipher, 0, sizeof(Aes256GcmCipher));
+    gcmCipher->m_keyLength = KEYLENGTH_AES256GCM;
+  }
+  if (gcmCipher != NULL)
+  {
+    CipherParams* cipherParams = sqlite3mcGetCipherParams(db, CIPHER_NAME_AES256GCM);
+    gcmCipher->m_kdfIter = sqlite3mcGetCipherParameter(cipherParams, "kdf_iter");
+    gcmCipher->m_plaintextHeaderSize = sqlite3mcGetCipherParameter(cipherParams, "plaintext_header_size");
+  }
+  return gcmCipher;
+}
+
+static void
+FreeAes256GcmCipher(void* cipher)
+{
+  Aes256GcmCipher* gcmCipher = (Aes256GcmCipher*) cipher;
+  sqlite3mcSecureZeroMemory(gcmCipher, sizeof(Aes256GcmCipher));
+  sqlite3mcSecureFree(gcmCipher);
+}
+
+static void
+CloneAes256GcmCipher(void* cipherTo, void* cipherFrom)
+{
+  Aes256GcmCipher* gcmCipherTo = (Aes256GcmCipher*) cipherTo;
+  Aes256GcmCipher* gcmCipherFrom = (Aes256GcmCipher*) cipherFrom;
+  gcmCipherTo->m_kdfIter = gcmCipherFrom->m_kdfIter;
+  gcmCipherTo->m_plaintextHeaderSize = gcmCipherFrom->m_plaintextHeaderSize;
+  gcmCipherTo->m_keyLength = gcmCipherFrom->m_keyLength;
+  memcpy(gcmCipherTo->m_key, gcmCipherFrom->m_key, KEYLENGTH_AES256GCM);
+  memcpy(gcmCipherTo->m_salt, gcmCipherFrom->m_salt, SALTLENGTH_AES256GCM);
+  memcpy(&gcmCipherTo->m_gcm, &gcmCipherFrom->m_gcm, sizeof(AesGcmContext));
+}
+
+static int
+GetLegacyAes256GcmCipher(void* cipher)
+{
+  return 0;
+}
+
+static int
+GetPageSizeAes256GcmCipher(void* cipher)
+{
+  return 0;
+}
+
+static int
+GetReservedAes256GcmCipher(void* cipher)
+{
+  return PAGE_RESERVED_AES256GCM;
+}
+
+static unsigned char*
+GetSaltAes256GcmCipher(void* cipher)
+{
+  Aes256GcmCipher* gcmCipher = (Aes256GcmCipher*) cipher;
+  return gcmCipher->m_salt;
+}
+
+static void
+GenerateKeyAes256GcmCipher(void* cipher, char* userPassword, int passwordLength, int rekey, unsigned char* cipherSalt)
+{
+  Aes256GcmCipher* gcmCipher = (Aes256GcmCipher*) cipher;
+
+  int keyOnly = 1;
+  if (rekey == 2)
+  {
+    /* (rekey == 2) means database is in WAL mode, thus don't change the cipher salt */
+    rekey = (cipherSalt != NULL) ? 0 : 1;
+  }
+  if (rekey || cipherSalt == NULL)
+  {
+    chacha20_rng(gcmCipher->m_salt, SALTLENGTH_AES256GCM);
+    keyOnly = 0;
+  }
+  else
+  {
+    memcpy(gcmCipher->m_salt, cipherSalt, SALTLENGTH_AES256GCM);
+    if (gcmCipher->m_plaintextHeaderSize > 0)
+      keyOnly = 0;
+  }
+
+  /* Bypass key derivation, if raw key (and optionally salt) are given */
+  int bypass = sqlite3mcExtractRawKey(userPassword, passwordLength,
+                                      keyOnly, KEYLENGTH_AES256GCM, SALTLENGTH_AES256GCM,
+                                      gcmCipher->m_key, gcmCipher->m_salt);
+  if (!bypass)
+  {
+    fastpbkdf2_hmac_sha256((unsigned char*) userPassword, passwordLength,
+                           gcmCipher->m_salt, SALTLENGTH_AES256GCM,
+                           gcmCipher->m_kdfIter,
+                           gcmCipher->m_key, KEYLENGTH_AES256GCM);
+  }
+
+  /* Expand the key once, page operations only use the expanded key */
+  AesGcmInit(&gcmCipher->m_gcm, gcmCipher->m_key);
+
+  SQLITE3MC_DEBUG_LOG("generate: codec=%p pFile=%p\n", gcmCipher, fd);
+  SQLITE3MC_DEBUG_HEX("generate  key:", gcmCipher->m_key, KEYLENGTH_AES256GCM);
+  SQLITE3MC_DEBUG_HEX("generate salt:", gcmCipher->m_salt, SALTLENGTH_AES256GCM);
+}
+
+/*
+** Additional authenticated data: page number (4 bytes, little endian),
+** followed by the unencrypted part of page 1 (salt or plaintext header)
+*/
+static int
+Aes256GcmBuildAad(unsigned char* aad, int page, const unsigned char* data, int offset)
+{
+  STORE32_LE(aad, page);
+  if (offset > 0)
+  {
+    memcpy(aad + 4, data, offset);
+  }
+  return 4 + offset;
+}
+
+static int
+EncryptPageAes256GcmCipher(void* cipher, int page, unsigned char* data, int len, int reserved)
+{
+  Aes256GcmCipher* gcmCipher = (Aes256GcmCipher*) cipher;
+  int rc = SQLITE_OK;
+  int nReserved = (reserved == 0) ? 0 : GetReservedAes256GcmCipher(cipher);
+  int n = len - nReserved;
+  int usePlaintextHeader = 0;
+  int offset = 0;
+
+  /* Check whether a plaintext header should be used */
+  if (page == 1)
+  {
+    int plaintextHeaderSize = gcmCipher->m_plaintextHeaderSize;
+    if (plaintextHeaderSize > 0)
+    {
+      usePlaintextHeader = 1;
+      offset = (plaintextHeaderSize > CIPHER_PAGE1_OFFSET) ? plaintextHeaderSize : CIPHER_PAGE1_OFFSET;
+    }
+    else
+    {
+      offset = CIPHER_PAGE1_OFFSET;
+    }
+  }
+
+  /* Check whether number of required reserved bytes and actually reserved bytes match */
+  if (nReserved > reserved)
+  {
+    return SQLITE_CORRUPT;
+  }
+
+  if (page == 1 && usePlaintextHeader == 0)
+  {
+    memcpy(data, gcmCipher->m_salt, SALTLENGTH_AES256GCM);
+  }
+
+  if (nReserved > 0)
+  {
+    /* Encrypt and authenticate */
+    unsigned char aad[4 + PLAINTEXT_HEADER_MAX];
+    int aadLen = Aes256GcmBuildAad(aad, page, data, offset);
+    chacha20_rng(data + n, PAGE_NONCE_LEN_AES256GCM);
+    AesGcmEncrypt(&gcmCipher->m_gcm, data + n, aad, aadLen,
+                  data + offset, n - offset, data + n + PAGE_NONCE_LEN_AES256GCM);
+  }
+  else
+  {
+    /* Encrypt only */
+    unsigned char nonce[16];
+    sqlite3mcGenerateInitialVector(page, nonce);
+    AesGcmEncrypt(&gcmCipher->m_gcm, nonce, NULL, 0, data + offset, n - offset, NULL);
+  }
+
+  return rc;
+}
+
+static int
+DecryptPageAes256GcmCipher(void* cipher, int page, unsigned char* data, int len, int reserved, int hmacCheck)
+{
+  Aes256GcmCipher* gcmCipher = (Aes256GcmCipher*) cipher;
+  int rc = SQLITE_OK;
+  int nReserved = (reserved == 0) ? 0 : GetReservedAes256GcmCipher(cipher);
+  int n = len - nReserved;
+  int usePlaintextHeader = 0;
+  int offset = 0;
+
+  /* Check whether a plaintext header should be used */
+  if (page == 1)
+  {
+    int plaintextHeaderSize = gcmCipher->m_plaintextHeaderSize;
+    if (plaintextHeaderSize > 0)
+    {
+      usePlaintextHeader = 1;
+      offset = (plaintextHeaderSize > CIPHER_PAGE1_OFFSET) ? plaintextHeaderSize : CIPHER_PAGE1_OFFSET;
+    }
+    else
+    {
+      offset = CIPHER_PAGE1_OFFSET;
+    }
+  }
+
+  /* Check whether number of required reserved bytes and actually reserved bytes match */
+  if (nReserved > reserved)
+  {
+    return (page == 1) ? SQLITE_NOTADB : SQLITE_CORRUPT;
+  }
+
+  if (nReserved > 0)
+  {
+    /* Decrypt and verify MAC */
+    unsigned char aad[4 + PLAINTEXT_HEADER_MAX];
+    int aadLen = Aes256GcmBuildAad(aad, page, data, offset);
+    int tagOk = AesGcmDecrypt(&gcmCipher->m_gcm, data + n, aad, aadLen,
+                              data + offset, n - offset,
+                              (hmacCheck != 0) ? data + n + PAGE_NONCE_LEN_AES256GCM : NULL);
+    if (tagOk != 0)
+    {
+      SQLITE3MC_DEBUG_LOG("decrypt: codec=%p page=%d\n", gcmCipher, page);
+      SQLITE3MC_DEBUG_HEX("decrypt data+00:", data, 16);
+      SQLITE3MC_DEBUG_HEX("decrypt data+24:", data + 24, 16);
+      SQLITE3MC_DEBUG_HEX("decrypt data+n:", data + n, PAGE_RESERVED_AES256GCM);
+      /* Bad MAC */
+      rc = (page == 1) ? SQLITE_NOTADB : SQLITE_CORRUPT;
+    }
+    if (page == 1 && usePlaintextHeader == 0 && rc == SQLITE_OK)
+    {
+      memcpy(data, SQLITE_FILE_HEADER, 16);
+    }
+  }
+  else
+  {
+    /* Decrypt only */
+    unsigned char nonce[16];
+    sqlite3mcGenerateInitialVector(page, nonce);
+    AesGcmDecrypt(&gcmCipher->m_gcm, nonce, NULL, 0, data + offset, n - offset, NULL);
+    if (page == 1 && usePlaintextHeader == 0)
+    {
+      memcpy(data, SQLITE_FILE_HEADER, 16);
+    }
+  }
+
+  return rc;
+}
+
+SQLITE_PRIVATE const CipherDescriptor mcAes256GcmDescriptor =
+{
+  CIPHER_NAME_AES256GCM,
+  AllocateAes256GcmCipher,
+  FreeAes256GcmCipher,
+  CloneAes256GcmCipher,
+  GetLegacyAes256GcmCipher,
+  GetPageSizeAes256GcmCipher,
+  GetReservedAes256GcmCipher,
+  GetSaltAes256GcmCipher,
+  GenerateKeyAes256GcmCipher,
+  EncryptPageAes256GcmCipher,
+  DecryptPageAes256GcmCipher
+};
+#endif
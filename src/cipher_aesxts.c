@@ -0,0 +1,371 @@
+/*
+** Name:        cipher_aesxts.c
+** Purpose:     Implementation of cipher AES-256-XTS
+** Author:      Ulrich Telle
+** Created:     2026-10-19
+** Copyright:   (c) 2026 Ulrich Telle
+** License:     MIT
+*/
+
+#include "cipher_common.h"
+
+/* --- AES 256-bit XTS cipher --- */
+#if HAVE_CIPHER_AES_256_XTS
+
+#define CIPHER_NAME_AES256XTS "aes256xts"
+
+/*
+** Configuration parameters for "aes256xts"
+**
+** - kdf_iter : number of iterations for key derivation (PBKDF2-HMAC-SHA256)
+** - plaintext_header_size : size of unencrypted database header
+**
+** XTS is length preserving, no bytes per page are reserved. The page number
+** is used as the tweak. Like all unauthenticated modes, XTS does not detect
+** modification of the ciphertext.
+*/
+
+#define AES256XTS_KDF_ITER_DEFAULT 256000
+
+SQLITE_PRIVATE CipherParams mcAes256XtsParams[] =
+{
+  { "kdf_iter",              AES256XTS_KDF_ITER_DEFAULT, AES256XTS_KDF_ITER_DEFAULT, 1, 0x7fffffff },
+  { "plaintext_header_size", 0,                          0,                          0, 100 /* restrict to db header size */ },
+  CIPHER_PARAMS_SENTINEL
+};
+
+/* Data key and tweak key, 256 bits each */
+#define KEYLENGTH_AES256XTS   64
+#define SALTLENGTH_AES256XTS  16
+
+typedef struct _aes256XtsCipher
+{
+  int      m_kdfIter;
+  int      m_plaintextHeaderSize;
+  int      m_keyLength;
+  int      m_hwAvailable;
+  uint8_t  m_key[KEYLENGTH_AES256XTS];
+  uint8_t  m_salt[SALTLENGTH_AES256XTS];
+  Rijndael m_aesEncrypt;
+  Rijndael m_aesDecrypt;
+  Rijndael m_aesTweak;
+#if HAS_AES_HARDWARE == AES_HARDWARE_NI
+  unsigned char m_hwKeyEncrypt[(_MAX_ROUNDS + 1) * 16];
+  unsigned char m_hwKeyDecrypt[(_MAX_ROUNDS + 1) * 16];
+  unsigned char m_hwKeyTweak[(_MAX_ROUNDS + 1) * 16];
+#endif
+} Aes256XtsCipher;
+
+static void
+AesXtsSoftwareKeySched(Rijndael* aes, const unsigned char* key, int decrypt)
+{
+  UINT8 keyMatrix[_MAX_KEY_COLUMNS][4];
+  int i;
+  for (i = 0; i < 32; ++i)
+  {
+    keyMatrix[i >> 2][i & 3] = key[i];
+  }
+  aes->m_mode = RIJNDAEL_Direction_Mode_ECB;
+  aes->m_direction = (decrypt) ? RIJNDAEL_Direction_Decrypt : RIJNDAEL_Direction_Encrypt;
+  aes->m_uRounds = 14;
+  RijndaelKeySched(aes, keyMatrix);
+  if (decrypt) RijndaelKeyEncToDec(aes);
+  aes->m_state = RIJNDAEL_State_Valid;
+  sqlite3mcSecureZeroMemory(keyMatrix, sizeof(keyMatrix));
+}
+
+static void
+AesXtsInit(Aes256XtsCipher* xtsCipher)
+{
+  const unsigned char* dataKey = xtsCipher->m_key;
+  const unsigned char* tweakKey = xtsCipher->m_key + 32;
+  xtsCipher->m_hwAvailable = 0;
+#if HAS_AES_HARDWARE == AES_HARDWARE_NI
+  if (aesHardwareAvailable())
+  {
+    aesGenKeyEncrypt(dataKey, 256, xtsCipher->m_hwKeyEncrypt);
+    aesGenKeyDecrypt(dataKey, 256, xtsCipher->m_hwKeyDecrypt);
+    aesGenKeyEncrypt(tweakKey, 256, xtsCipher->m_hwKeyTweak);
+    xtsCipher->m_hwAvailable = 1;
+    return;
+  }
+#endif
+  AesXtsSoftwareKeySched(&xtsCipher->m_aesEncrypt, dataKey, 0);
+  AesXtsSoftwareKeySched(&xtsCipher->m_aesDecrypt, dataKey, 1);
+  AesXtsSoftwareKeySched(&xtsCipher->m_aesTweak, tweakKey, 0);
+}
+
+static void
+AesXtsSoftwareNextTweak(unsigned char tweak[16])
+{
+  /* Multiply by alpha in GF(2^128), little endian byte order */
+  int j;
+  unsigned char carry = 0;
+  for (j = 0; j < 16; ++j)
+  {
+    unsigned char next = tweak[j] >> 7;
+    tweak[j] = (unsigned char) ((tweak[j] << 1) | carry);
+    carry = next;
+  }
+  if (carry)
+  {
+    tweak[0] ^= 0x87;
+  }
+}
+
+static void
+AesXtsSoftwareBlock(Rijndael* aes, int encrypt, const unsigned char* in, unsigned char* out, const unsigned char tweak[16])
+{
+  unsigned char block[16];
+  int j;
+  for (j = 0; j < 16; ++j)
+  {
+    block[j] = in[j] ^ tweak[j];
+  }
+  if (encrypt)
+    RijndaelEncrypt(aes, block, block);
+  else
+    RijndaelDecrypt(aes, block, block);
+  for (j = 0; j < 16; ++j)
+  {
+    out[j] = block[j] ^ tweak[j];
+  }
+}
+
+/*
+** Encrypt or decrypt a data unit in place, length must be at least 16 bytes
+*/
+static void
+AesXtsCrypt(Aes256XtsCipher* xtsCipher, int encrypt, int page, unsigned char* data, unsigned long length)
+{
+  unsigned char tweak[16];
+
+  /* The tweak is the data unit number as 128-bit little endian value */
+  memset(tweak, 0, 16);
+  STORE32_LE(tweak, page);
+
+#if HAS_AES_HARDWARE == AES_HARDWARE_NI
+  if (xtsCipher->m_hwAvailable)
+  {
+    aesCryptXTS(data, data, length, tweak,
+                (encrypt) ? xtsCipher->m_hwKeyEncrypt : xtsCipher->m_hwKeyDecrypt,
+                xtsCipher->m_hwKeyTweak, 14, encrypt);
+    return;
+  }
+#endif
+  {
+    Rijndael* aes = (encrypt) ? &xtsCipher->m_aesEncrypt : &xtsCipher->m_aesDecrypt;
+    unsigned long numBlocks = length / 16;
+    unsigned long lenFrag = length % 16;
+    unsigned long numFull = (lenFrag > 0) ? numBlocks - 1 : numBlocks;
+    unsigned long i;
+
+    RijndaelEncrypt(&xtsCipher->m_aesTweak, tweak, tweak);
+    for (i = 0; i < numFull; ++i)
+    {
+      AesXtsSoftwareBlock(aes, encrypt, data + 16 * i, data + 16 * i, tweak);
+      AesXtsSoftwareNextTweak(tweak);
+    }
+
+    /* Use Cipher Text Stealing (CTS) for incomplete last block */
+    if (lenFrag > 0)
+    {
+      unsigned char lastTweak[16];
+      unsigned char lastblock[16];
+      unsigned char partialblock[16];
+      unsigned char* tweakFirst = tweak;
+      unsigned char* tweakSecond = lastTweak;
+      memcpy(lastTweak, tweak, 16);
+      AesXtsSoftwareNextTweak(lastTweak);
+      if (!encrypt)
+      {
+        /* Decryption uses the tweaks of the last two blocks in reverse order */
+        tweakFirst = lastTweak;
+        tweakSecond = tweak;
+      }
+      AesXtsSoftwareBlock(aes, encrypt, data + 16 * numFull, lastblock, tweakFirst);
+      memcpy(partialblock, lastblock, 16);
+      memcpy(partialblock, data + 16 * numBlocks, lenFrag);
+      AesXtsSoftwareBlock(aes, encrypt, partialblock, data + 16 * numFull, tweakSecond);
+      memcpy(data + 16 * numBlocks, lastblock, lenFrag);
+      sqlite3mcSecureZeroMemory(lastblock, sizeof(lastblock));
+      sqlite3mcSecureZeroMemory(partialblock, sizeof(partialblock));
+    }
+  }
+}
+
+static void*
+AllocateAes256XtsCipher(sqlite3* db)
+{
+  Aes256XtsCipher* xtsCipher = (Aes256XtsCipher*) sqlite3mcSecureAlloc(sizeof(Aes256XtsCipher));
+  if (xtsCipher != NULL)
+  {
+    memset(xtsCipher, 0, sizeof(Aes256XtsCipher));
+    xtsCipher->m_keyLength = KEYLENGTH_AES256XTS;
+  }
+  if (xtsCipher != NULL)
+  {
+    CipherParams* cipherParams = sqlite3mcGetCipherParams(db, CIPHER_NAME_AES256XTS);
+    xtsCipher->m_kdfIter = sqlite3mcGetCipherParameter(cipherParams, "kdf_iter");
+    xtsCipher->m_plaintextHeaderSize = sqlite3mcGetCipherParameter(cipherParams, "plaintext_header_size");
+  }
+  return xtsCipher;
+}
+
+static void
+FreeAes256XtsCipher(void* cipher)
+{
+  Aes256XtsCipher* xtsCipher = (Aes256XtsCipher*) cipher;
+  sqlite3mcSecureZeroMemory(xtsCipher, sizeof(Aes256XtsCipher));
+  sqlite3mcSecureFree(xtsCipher);
+}
+
+static void
+CloneAes256XtsCipher(void* cipherTo, void* cipherFrom)
+{
+  Aes256XtsCipher* xtsCipherTo = (Aes256XtsCipher*) cipherTo;
+  Aes256XtsCipher* xtsCipherFrom = (Aes256XtsCipher*) cipherFrom;
+  memcpy(xtsCipherTo, xtsCipherFrom, sizeof(Aes256XtsCipher));
+}
+
+static int
+GetLegacyAes256XtsCipher(void* cipher)
+{
+  return 0;
+}
+
+static int
+GetPageSizeAes256XtsCipher(void* cipher)
+{
+  return 0;
+}
+
+static int
+GetReservedAes256XtsCipher(void* cipher)
+{
+  return 0;
+}
+
+static unsigned char*
+GetSaltAes256XtsCipher(void* cipher)
+{
+  Aes256XtsCipher* xtsCipher = (Aes256XtsCipher*) cipher;
+  return xtsCipher->m_salt;
+}
+
+static void
+GenerateKeyAes256XtsCipher(void* cipher, char* userPassword, int passwordLength, int rekey, unsigned char* cipherSalt)
+{
+  Aes256XtsCipher* xtsCipher = (Aes256XtsCipher*) cipher;
+
+  int keyOnly = 1;
+  if (rekey == 2)
+  {
+    /* (rekey == 2) means database is in WAL mode, thus don't change the cipher salt */
+    rekey = (cipherSalt != NULL) ? 0 : 1;
+  }
+  if (rekey || cipherSalt == NULL)
+  {
+    chacha20_rng(xtsCipher->m_salt, SALTLENGTH_AES256XTS);
+    keyOnly = 0;
+  }
+  else
+  {
+    memcpy(xtsCipher->m_salt, cipherSalt, SALTLENGTH_AES256XTS);
+    if (xtsCipher->m_plaintextHeaderSize > 0)
+      keyOnly = 0;
+  }
+
+  /* Bypass key derivation, if raw key (and optionally salt) are given */
+  int bypass = sqlite3mcExtractRawKey(userPassword, passwordLength,
+                                      keyOnly, KEYLENGTH_AES256XTS, SALTLENGTH_AES256XTS,
+                                      xtsCipher->m_key, xtsCipher->m_salt);
+  if (!bypass)
+  {
+    fastpbkdf2_hmac_sha256((unsigned char*) userPassword, passwordLength,
+                           xtsCipher->m_salt, SALTLENGTH_AES256XTS,
+                           xtsCipher->m_kdfIter,
+                           xtsCipher->m_key, KEYLENGTH_AES256XTS);
+  }
+
+  /* Expand data key and tweak key once, page operations only use the expanded keys */
+  AesXtsInit(xtsCipher);
+
+  SQLITE3MC_DEBUG_LOG("generate: codec=%p pFile=%p\n", xtsCipher, fd);
+  SQLITE3MC_DEBUG_HEX("generate  key:", xtsCipher->m_key, KEYLENGTH_AES256XTS);
+  SQLITE3MC_DEBUG_HEX("generate salt:", xtsCipher->m_salt, SALTLENGTH_AES256XTS);
+}
+
+static int
+EncryptPageAes256XtsCipher(void* cipher, int page, unsigned char* data, int len, int reserved)
+{
+  Aes256XtsCipher* xtsCipher = (Aes256XtsCipher*) cipher;
+  int rc = SQLITE_OK;
+  int offset = 0;
+
+  if (page == 1)
+  {
+    int plaintextHeaderSize = xtsCipher->m_plaintextHeaderSize;
+    if (plaintextHeaderSize > 0)
+    {
+      offset = (plaintextHeaderSize > CIPHER_PAGE1_OFFSET) ? plaintextHeaderSize : CIPHER_PAGE1_OFFSET;
+    }
+    else
+    {
+      offset = CIPHER_PAGE1_OFFSET;
+      memcpy(data, xtsCipher->m_salt, SALTLENGTH_AES256XTS);
+    }
+  }
+
+  /* The whole page is encrypted, including a possibly reserved area */
+  AesXtsCrypt(xtsCipher, 1, page, data + offset, len - offset);
+
+  return rc;
+}
+
+static int
+DecryptPageAes256XtsCipher(void* cipher, int page, unsigned char* data, int len, int reserved, int hmacCheck)
+{
+  Aes256XtsCipher* xtsCipher = (Aes256XtsCipher*) cipher;
+  int rc = SQLITE_OK;
+  int usePlaintextHeader = 0;
+  int offset = 0;
+
+  if (page == 1)
+  {
+    int plaintextHeaderSize = xtsCipher->m_plaintextHeaderSize;
+    if (plaintextHeaderSize > 0)
+    {
+      usePlaintextHeader = 1;
+      offset = (plaintextHeaderSize > CIPHER_PAGE1_OFFSET) ? plaintextHeaderSize : CIPHER_PAGE1_OFFSET;
+    }
+    else
+    {
+      offset = CIPHER_PAGE1_OFFSET;
+    }
+  }
+
+  AesXtsCrypt(xtsCipher, 0, page, data + offset, len - offset);
+  if (page == 1 && usePlaintextHeader == 0)
+  {
+    memcpy(data, SQLITE_FILE_HEADER, 16);
+  }
+
+  return rc;
+}
+
+SQLITE_PRIVATE const CipherDescriptor mcAes256XtsDescriptor =
+{
+  CIPHER_NAME_AES256XTS,
+  AllocateAes256XtsCipher,
+  FreeAes256XtsCipher,
+  CloneAes256XtsCipher,
+  GetLegacyAes256XtsCipher,
+  GetPageSizeAes256XtsCipher,
+  GetReservedAes256XtsCipher,
+  GetSaltAes256XtsCipher,
+  GenerateKeyAes256XtsCipher,
+  EncryptPageAes256XtsCipher,
+  DecryptPageAes256XtsCipher
+};
+#endif
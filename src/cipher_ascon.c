@@ -18,17 +18,26 @@
 ** Configuration parameters for "ascon128a"
 **
 ** - kdf_iter : number of iterations for key derivation
+** - algorithm : AEAD algorithm used for page encryption
+**               possible values: 1 = Ascon-128 v1.2 (default)
+**                                2 = Ascon-AEAD128 (NIST SP 800-232, 128-bit rate)
+**               (not stored in the database, has to be given on opening the database)
 */
 
 #define ASCON128_KDF_ITER_DEFAULT 64007
 
+#define ASCON128_ALGORITHM_ASCON128 1
+#define ASCON128_ALGORITHM_AEAD128  2
+
 /* Make ASCON code static unless told otherwise */
 #ifndef ASCON_API
 #define ASCON_API static
 #endif
 
 #include "ascon/prolog.h"
+#include "ascon/permutations.c"
 #include "ascon/aead.c"
+#include "ascon/aead128.c"
 #include "ascon/hash.c"
 #include "ascon/pbkdf2.c"
 
@@ -36,6 +45,7 @@ SQLITE_PRIVATE CipherParams mcAscon128Params[] =
 {
   { "kdf_iter",              ASCON128_KDF_ITER_DEFAULT, ASCON128_KDF_ITER_DEFAULT, 1, 0x7fffffff },
   { "plaintext_header_size", 0,                         0,                         0, 100 /* restrict to db header size */ },
+  { "algorithm",             ASCON128_ALGORITHM_ASCON128, ASCON128_ALGORITHM_ASCON128, ASCON128_ALGORITHM_ASCON128, ASCON128_ALGORITHM_AEAD128 },
   CIPHER_PARAMS_SENTINEL
 };
 
@@ -49,6 +59,7 @@ typedef struct _ascon128Cipher
 {
   int     m_kdfIter;
   int     m_plaintextHeaderSize;
+  int     m_algorithm;
   int     m_keyLength;
   uint8_t m_key[KEYLENGTH_ASCON128];
   uint8_t m_salt[SALTLENGTH_ASCON128];
@@ -57,7 +68,7 @@ typedef struct _ascon128Cipher
 static void*
 AllocateAscon128Cipher(sqlite3* db)
 {
-  Ascon128Cipher* ascon128Cipher = (Ascon128Cipher*) sqlite3_malloc(sizeof(Ascon128Cipher));
+  Ascon128Cipher* ascon128Cipher = (Ascon128Cipher*) sqlite3mcSecureAlloc(sizeof(Ascon128Cipher));
   if (ascon128Cipher != NULL)
   {
     memset(ascon128Cipher, 0, sizeof(Ascon128Cipher));
@@ -70,6 +81,7 @@ AllocateAscon128Cipher(sqlite3* db)
     CipherParams* cipherParams = sqlite3mcGetCipherParams(db, CIPHER_NAME_ASCON128);
     ascon128Cipher->m_kdfIter = sqlite3mcGetCipherParameter(cipherParams, "kdf_iter");
     ascon128Cipher->m_plaintextHeaderSize = sqlite3mcGetCipherParameter(cipherParams, "plaintext_header_size");
+    ascon128Cipher->m_algorithm = sqlite3mcGetCipherParameter(cipherParams, "algorithm");
   }
   return ascon128Cipher;
 }
@@ -79,7 +91,7 @@ FreeAscon128Cipher(void* cipher)
 {
   Ascon128Cipher* ascon128Cipher = (Ascon128Cipher*) cipher;
   sqlite3mcSecureZeroMemory(ascon128Cipher, sizeof(Ascon128Cipher));
-  sqlite3_free(ascon128Cipher);
+  sqlite3mcSecureFree(ascon128Cipher);
 }
 
 static void
@@ -89,6 +101,7 @@ CloneAscon128Cipher(void* cipherTo, void* cipherFrom)
   Ascon128Cipher* ascon128CipherFrom = (Ascon128Cipher*) cipherFrom;
   ascon128CipherTo->m_kdfIter = ascon128CipherFrom->m_kdfIter;
   ascon128CipherTo->m_plaintextHeaderSize = ascon128CipherFrom->m_plaintextHeaderSize;
+  ascon128CipherTo->m_algorithm = ascon128CipherFrom->m_algorithm;
   ascon128CipherTo->m_keyLength = ascon128CipherFrom->m_keyLength;
   memcpy(ascon128CipherTo->m_key, ascon128CipherFrom->m_key, KEYLENGTH_ASCON128);
   memcpy(ascon128CipherTo->m_salt, ascon128CipherFrom->m_salt, SALTLENGTH_ASCON128);
@@ -175,6 +188,28 @@ AsconGenOtk(uint8_t* out, const uint8_t* key, const uint8_t* nonce, int page)
   return 0;
 }
 
+static int
+AsconAeadEncrypt(int algorithm, uint8_t* ctext, uint8_t* tag,
+                 const uint8_t* mtext, uint64_t mlen,
+                 const uint8_t* ad, uint64_t adlen,
+                 const uint8_t* nonce, const uint8_t* key)
+{
+  return (algorithm == ASCON128_ALGORITHM_AEAD128)
+    ? ascon_aead128_encrypt(ctext, tag, mtext, mlen, ad, adlen, nonce, key)
+    : ascon_aead_encrypt(ctext, tag, mtext, mlen, ad, adlen, nonce, key);
+}
+
+static int
+AsconAeadDecrypt(int algorithm, uint8_t* mtext,
+                 const uint8_t* ctext, uint64_t clen,
+                 const uint8_t* ad, uint64_t adlen,
+                 const uint8_t* tag, const uint8_t* nonce, const uint8_t* key)
+{
+  return (algorithm == ASCON128_ALGORITHM_AEAD128)
+    ? ascon_aead128_decrypt(mtext, ctext, clen, ad, adlen, tag, nonce, key)
+    : ascon_aead_decrypt(mtext, ctext, clen, ad, adlen, tag, nonce, key);
+}
+
 static int
 EncryptPageAscon128Cipher(void* cipher, int page, unsigned char* data, int len, int reserved)
 {
@@ -218,9 +253,9 @@ EncryptPageAscon128Cipher(void* cipher, int page, unsigned char* data, int len,
     chacha20_rng(data + n + PAGE_TAG_LEN_ASCON128, PAGE_NONCE_LEN_ASCON128);
     AsconGenOtk(otk, ascon128Cipher->m_key, data + n + PAGE_TAG_LEN_ASCON128, page);
 
-    ascon_aead_encrypt(data + offset, data + n, data + offset, mlen - offset,
-                       NULL /* ad */, 0 /* adlen*/,
-                       data + n + PAGE_TAG_LEN_ASCON128, otk);
+    AsconAeadEncrypt(ascon128Cipher->m_algorithm, data + offset, data + n, data + offset, mlen - offset,
+                     NULL /* ad */, 0 /* adlen*/,
+                     data + n + PAGE_TAG_LEN_ASCON128, otk);
     if (page == 1 && usePlaintextHeader == 0)
     {
       memcpy(data, ascon128Cipher->m_salt, SALTLENGTH_ASCON128);
@@ -237,9 +272,9 @@ EncryptPageAscon128Cipher(void* cipher, int page, unsigned char* data, int len,
     AsconGenOtk(otk, ascon128Cipher->m_key, nonce, page);
 
     /* Encrypt */
-    ascon_aead_encrypt(data + offset, dummyTag, data + offset, mlen - offset,
-                       NULL /* ad */, 0 /* adlen*/,
-                       nonce, otk);
+    AsconAeadEncrypt(ascon128Cipher->m_algorithm, data + offset, dummyTag, data + offset, mlen - offset,
+                     NULL /* ad */, 0 /* adlen*/,
+                     nonce, otk);
       if (page == 1 && usePlaintextHeader == 0)
     {
       memcpy(data, ascon128Cipher->m_salt, SALTLENGTH_ASCON128);
@@ -295,9 +330,9 @@ DecryptPageAscon128Cipher(void* cipher, int page, unsigned char* data, int len,
     AsconGenOtk(otk, ascon128Cipher->m_key, data + n + PAGE_TAG_LEN_ASCON128, page);
 
     /* Determine MAC and decrypt */
-    tagOk = ascon_aead_decrypt(data + offset, data + offset, clen - offset,
-                               NULL /* ad */, 0 /* adlen */,
-                               data + n, data + n + PAGE_TAG_LEN_ASCON128, otk);
+    tagOk = AsconAeadDecrypt(ascon128Cipher->m_algorithm, data + offset, data + offset, clen - offset,
+                             NULL /* ad */, 0 /* adlen */,
+                             data + n, data + n + PAGE_TAG_LEN_ASCON128, otk);
     if (hmacCheck != 0)
     {
       /* Verify the MAC */
@@ -331,9 +366,9 @@ DecryptPageAscon128Cipher(void* cipher, int page, unsigned char* data, int len,
     AsconGenOtk(otk, ascon128Cipher->m_key, nonce, page);
 
     /* Decrypt */
-    tagOk = ascon_aead_decrypt(data + offset, data + offset, clen - offset,
-                               NULL /* ad */, 0 /* adlen */,
-                               dummyTag, nonce, otk);
+    tagOk = AsconAeadDecrypt(ascon128Cipher->m_algorithm, data + offset, data + offset, clen - offset,
+                             NULL /* ad */, 0 /* adlen */,
+                             dummyTag, nonce, otk);
     if (page == 1 && usePlaintextHeader == 0)
     {
       memcpy(data, SQLITE_FILE_HEADER, 16);
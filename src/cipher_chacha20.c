@@ -21,6 +21,9 @@
 **                 (page 1 encrypted, kdf_iter = 12345)
 **                 possible values:  1 = yes, 0 = no
 ** - kdf_iter : number of iterations for key derivation
+** - rounds : number of ChaCha rounds used for page encryption
+**            possible values: 20 (default), 12, 8
+**            (not stored in the database, has to be given on opening the database)
 */
 
 #ifdef SQLITE3MC_USE_SQLEET_LEGACY
@@ -32,6 +35,7 @@
 #define CHACHA20_KDF_ITER_DEFAULT 64007
 #define SQLEET_KDF_ITER           12345
 #define CHACHA20_LEGACY_PAGE_SIZE 4096
+#define CHACHA20_ROUNDS_DEFAULT   20
 
 SQLITE_PRIVATE CipherParams mcChaCha20Params[] =
 {
@@ -39,6 +43,7 @@ SQLITE_PRIVATE CipherParams mcChaCha20Params[] =
   { "legacy_page_size",      CHACHA20_LEGACY_PAGE_SIZE, CHACHA20_LEGACY_PAGE_SIZE, 0, SQLITE_MAX_PAGE_SIZE },
   { "kdf_iter",              CHACHA20_KDF_ITER_DEFAULT, CHACHA20_KDF_ITER_DEFAULT, 1, 0x7fffffff },
   { "plaintext_header_size", 0,                         0,                         0, 100 /* restrict to db header size */ },
+  { "rounds",                CHACHA20_ROUNDS_DEFAULT,   CHACHA20_ROUNDS_DEFAULT,   8, 20 },
   CIPHER_PARAMS_SENTINEL
 };
 
@@ -55,6 +60,7 @@ typedef struct _chacha20Cipher
   int     m_legacyPageSize;
   int     m_kdfIter;
   int     m_plaintextHeaderSize;
+  int     m_rounds;
   int     m_keyLength;
   uint8_t m_key[KEYLENGTH_CHACHA20];
   uint8_t m_salt[SALTLENGTH_CHACHA20];
@@ -63,7 +69,7 @@ typedef struct _chacha20Cipher
 static void*
 AllocateChaCha20Cipher(sqlite3* db)
 {
-  ChaCha20Cipher* chacha20Cipher = (ChaCha20Cipher*) sqlite3_malloc(sizeof(ChaCha20Cipher));
+  ChaCha20Cipher* chacha20Cipher = (ChaCha20Cipher*) sqlite3mcSecureAlloc(sizeof(ChaCha20Cipher));
   if (chacha20Cipher != NULL)
   {
     memset(chacha20Cipher, 0, sizeof(ChaCha20Cipher));
@@ -82,6 +88,12 @@ AllocateChaCha20Cipher(sqlite3* db)
       chacha20Cipher->m_kdfIter = SQLEET_KDF_ITER;
     }
     chacha20Cipher->m_plaintextHeaderSize = sqlite3mcGetCipherParameter(cipherParams, "plaintext_header_size");
+    chacha20Cipher->m_rounds = sqlite3mcGetCipherParameter(cipherParams, "rounds");
+    /* Other values are rejected on configuration; sqleet always uses ChaCha20 */
+    if (chacha20Cipher->m_legacy != 0 || (chacha20Cipher->m_rounds != 12 && chacha20Cipher->m_rounds != 8))
+    {
+      chacha20Cipher->m_rounds = CHACHA20_ROUNDS_DEFAULT;
+    }
   }
   return chacha20Cipher;
 }
@@ -91,7 +103,7 @@ FreeChaCha20Cipher(void* cipher)
 {
   ChaCha20Cipher* chacha20Cipher = (ChaCha20Cipher*) cipher;
   sqlite3mcSecureZeroMemory(chacha20Cipher, sizeof(ChaCha20Cipher));
-  sqlite3_free(chacha20Cipher);
+  sqlite3mcSecureFree(chacha20Cipher);
 }
 
 static void
@@ -103,6 +115,7 @@ CloneChaCha20Cipher(void* cipherTo, void* cipherFrom)
   chacha20CipherTo->m_legacyPageSize = chacha20CipherFrom->m_legacyPageSize;
   chacha20CipherTo->m_kdfIter = chacha20CipherFrom->m_kdfIter;
   chacha20CipherTo->m_plaintextHeaderSize = chacha20CipherFrom->m_plaintextHeaderSize;
+  chacha20CipherTo->m_rounds = chacha20CipherFrom->m_rounds;
   chacha20CipherTo->m_keyLength = chacha20CipherFrom->m_keyLength;
   memcpy(chacha20CipherTo->m_key, chacha20CipherFrom->m_key, KEYLENGTH_CHACHA20);
   memcpy(chacha20CipherTo->m_salt, chacha20CipherFrom->m_salt, SALTLENGTH_CHACHA20);
@@ -226,9 +239,9 @@ EncryptPageChaCha20Cipher(void* cipher, int page, unsigned char* data, int len,
     memset(otk, 0, OTK_LEN_CHACHA20);
     chacha20_rng(data + n, PAGE_NONCE_LEN_CHACHA20);
     counter = LOAD32_LE(data + n + PAGE_NONCE_LEN_CHACHA20 - 4) ^ page;
-    chacha20_xor(otk, OTK_LEN_CHACHA20, chacha20Cipher->m_key, data + n, counter);
+    chacha_xor(otk, OTK_LEN_CHACHA20, chacha20Cipher->m_key, data + n, counter, chacha20Cipher->m_rounds);
 
-    chacha20_xor(data + offset, n - offset, otk + 32, data + n, counter + 1);
+    chacha_xor(data + offset, n - offset, otk + 32, data + n, counter + 1, chacha20Cipher->m_rounds);
     if (page == 1 && usePlaintextHeader == 0)
     {
       memcpy(data, chacha20Cipher->m_salt, SALTLENGTH_CHACHA20);
@@ -242,10 +255,10 @@ EncryptPageChaCha20Cipher(void* cipher, int page, unsigned char* data, int len,
     memset(otk, 0, OTK_LEN_CHACHA20);
     sqlite3mcGenerateInitialVector(page, nonce);
     counter = LOAD32_LE(&nonce[PAGE_NONCE_LEN_CHACHA20 - 4]) ^ page;
-    chacha20_xor(otk, OTK_LEN_CHACHA20, chacha20Cipher->m_key, nonce, counter);
+    chacha_xor(otk, OTK_LEN_CHACHA20, chacha20Cipher->m_key, nonce, counter, chacha20Cipher->m_rounds);
 
     /* Encrypt */
-    chacha20_xor(data + offset, n - offset, otk + 32, nonce, counter + 1);
+    chacha_xor(data + offset, n - offset, otk + 32, nonce, counter + 1, chacha20Cipher->m_rounds);
     if (page == 1 && usePlaintextHeader == 0)
     {
       memcpy(data, chacha20Cipher->m_salt, SALTLENGTH_CHACHA20);
@@ -315,12 +328,12 @@ DecryptPageChaCha20Cipher(void* cipher, int page, unsigned char* data, int len,
     /* Decrypt and verify MAC */
     memset(otk, 0, OTK_LEN_CHACHA20);
     counter = LOAD32_LE(data + n + PAGE_NONCE_LEN_CHACHA20 - 4) ^ page;
-    chacha20_xor(otk, OTK_LEN_CHACHA20, chacha20Cipher->m_key, data + n, counter);
+    chacha_xor(otk, OTK_LEN_CHACHA20, chacha20Cipher->m_key, data + n, counter, chacha20Cipher->m_rounds);
 
     /* Determine MAC and decrypt */
     allzero = chacha20_ismemset(data, 0, n);
     poly1305(data, n + PAGE_NONCE_LEN_CHACHA20, otk, tag);
-    chacha20_xor(data + offset, n - offset, otk + 32, data + n, counter + 1);
+    chacha_xor(data + offset, n - offset, otk + 32, data + n, counter + 1, chacha20Cipher->m_rounds);
 
     if (hmacCheck != 0)
     {
@@ -351,10 +364,10 @@ DecryptPageChaCha20Cipher(void* cipher, int page, unsigned char* data, int len,
     memset(otk, 0, OTK_LEN_CHACHA20);
     sqlite3mcGenerateInitialVector(page, nonce);
     counter = LOAD32_LE(&nonce[PAGE_NONCE_LEN_CHACHA20 - 4]) ^ page;
-    chacha20_xor(otk, OTK_LEN_CHACHA20, chacha20Cipher->m_key, nonce, counter);
+    chacha_xor(otk, OTK_LEN_CHACHA20, chacha20Cipher->m_key, nonce, counter, chacha20Cipher->m_rounds);
 
     /* Decrypt */
-    chacha20_xor(data + offset, n - offset, otk + 32, nonce, counter + 1);
+    chacha_xor(data + offset, n - offset, otk + 32, nonce, counter + 1, chacha20Cipher->m_rounds);
     if (page == 1 && usePlaintextHeader == 0)
     {
       memcpy(data, SQLITE_FILE_HEADER, 16);
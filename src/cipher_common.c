@@ -206,7 +206,8 @@ sqlite3mcCodecInit(Codec* codec)
     codec->m_bt = NULL;
 #endif
     codec->m_btShared = NULL;
-    memset(codec->m_page, 0, sizeof(codec->m_page));
+    codec->m_page = NULL;
+    codec->m_pageBufferSize = 0;
     codec->m_pageSize = 0;
     codec->m_reserved = 0;
     codec->m_lastError = SQLITE_OK;
@@ -233,6 +234,7 @@ sqlite3mcCodecTerm(Codec* codec)
     globalCodecDescriptorTable[codec->m_writeCipherType - 1].m_freeCipher(codec->m_writeCipher);
     codec->m_writeCipher = NULL;
   }
+  sqlite3mcSecureFree(codec->m_page);
   memset(codec, 0, sizeof(Codec));
 }
 
@@ -243,10 +245,12 @@ sqlite3mcClearKeySalt(Codec* codec)
   memset(codec->m_keySalt, 0, sizeof(codec->m_keySalt));
 }
 
+/*
+** Allocate the read cipher of a codec, the key is derived separately
+*/
 SQLITE_PRIVATE int
-sqlite3mcCodecSetup(Codec* codec, int cipherType, char* userPassword, int passwordLength)
+sqlite3mcCodecSetupCipher(Codec* codec, int cipherType)
 {
-  int rc = SQLITE_OK;
   CipherParams* globalParams = sqlite3mcGetCipherParams(codec->m_db, CIPHER_NAME_GLOBAL);
   if (cipherType <= CODEC_TYPE_UNKNOWN)
   {
@@ -259,19 +263,10 @@ sqlite3mcCodecSetup(Codec* codec, int cipherType, char* userPassword, int passwo
   codec->m_hasWriteCipher = 1;
   codec->m_readCipherType = cipherType;
   codec->m_readCipher = globalCodecDescriptorTable[codec->m_readCipherType-1].m_allocateCipher(codec->m_db);
-  if (codec->m_readCipher != NULL)
-  {
-    unsigned char* keySalt = (codec->m_hasKeySalt != 0) ? codec->m_keySalt : NULL;
-    sqlite3mcGenerateReadKey(codec, userPassword, passwordLength, keySalt);
-    rc = sqlite3mcCopyCipher(codec, 1);
-  }
-  else
-  {
-    rc = SQLITE_NOMEM;
-  }
-  return rc;
+  return (codec->m_readCipher != NULL) ? SQLITE_OK : SQLITE_NOMEM;
 }
 
+
 SQLITE_PRIVATE int
 sqlite3mcSetupWriteCipher(Codec* codec, int cipherType, char* userPassword, int passwordLength, int usesWal)
 {
@@ -402,9 +397,32 @@ sqlite3mcGetWriteReserved(Codec* codec)
   return codec->m_writeReserved;
 }
 
+/*
+** Get the page buffer of the codec, sized for the current page size
+** The buffer is allocated on first use, because it is only required for
+** writing pages and reading partial pages. The page size of the database
+** may change without notice to the codec (PRAGMA page_size, VACUUM),
+** therefore the size is checked on each call.
+** Returns NULL, if the buffer could not be allocated.
+*/
 SQLITE_PRIVATE unsigned char*
 sqlite3mcGetPageBuffer(Codec* codec)
 {
+  int pageSize = sqlite3mcGetPageSize(codec);
+  if (codec->m_page == NULL || codec->m_pageBufferSize != pageSize)
+  {
+    unsigned char* page = (unsigned char*) sqlite3mcSecureAlloc(pageSize + 24);
+    if (page != NULL)
+    {
+      sqlite3mcSecureFree(codec->m_page);
+      codec->m_page = page;
+      codec->m_pageBufferSize = pageSize;
+    }
+    else if (codec->m_page == NULL || codec->m_pageBufferSize < pageSize)
+    {
+      return NULL;
+    }
+  }
   return &codec->m_page[4];
 }
 
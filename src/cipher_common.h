@@ -87,7 +87,8 @@ typedef struct _Codec
   Btree*        m_bt; /* Pointer to B-tree used by DB */
 #endif
   BtShared*     m_btShared; /* Pointer to shared B-tree used by DB */
-  unsigned char m_page[SQLITE_MAX_PAGE_SIZE + 24];
+  unsigned char* m_page; /* Page buffer, allocated on demand */
+  int           m_pageBufferSize; /* Page size the page buffer is allocated for */
   int           m_pageSize;
   int           m_reserved;
   int           m_lastError;
@@ -110,7 +111,7 @@ SQLITE_PRIVATE void sqlite3mcCodecTerm(Codec* codec);
 
 SQLITE_PRIVATE void sqlite3mcClearKeySalt(Codec* codec);
 
-SQLITE_PRIVATE int sqlite3mcCodecSetup(Codec* codec, int cipherType, char* userPassword, int passwordLength);
+SQLITE_PRIVATE int sqlite3mcCodecSetupCipher(Codec* codec, int cipherType);
 
 SQLITE_PRIVATE int sqlite3mcSetupWriteCipher(Codec* codec, int cipherType, char* userPassword, int passwordLength, int usesWal);
 
@@ -209,6 +210,14 @@ SQLITE_PRIVATE void sqlite3mcCodecGetKey(sqlite3* db, int nDb, void** zKey, int*
 
 SQLITE_PRIVATE void sqlite3mcSecureZeroMemory(void* v, size_t n);
 
+SQLITE_PRIVATE void* sqlite3mcSecureAlloc(int nByte);
+
+SQLITE_PRIVATE void sqlite3mcSecureFree(void* pPrior);
+
+SQLITE_PRIVATE int sqlite3mcInitSecureMemory();
+
+SQLITE_PRIVATE void sqlite3mcTermSecureMemory();
+
 /* Debugging */
 
 #if 0
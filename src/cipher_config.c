@@ -47,6 +47,14 @@ sqlite3mc_config(sqlite3* db, const char* paramName, int newValue)
   if (sqlite3_initialize()) return value;
 #endif
 
+#if HAVE_CIPHER_AEGIS
+  /* Process-wide limits of Argon2 key derivations, independent of db */
+  if (paramName != NULL && sqlite3_strnicmp(paramName, "argon2_", 7) == 0)
+  {
+    return sqlite3mcArgon2Config(paramName, newValue);
+  }
+#endif
+
   if (paramName == NULL || (db == NULL && newValue >= 0))
   {
     return value;
@@ -235,6 +243,11 @@ int checkParameterValue(const char* paramName, int value, const char* cipherName
       ok = value % 16 == 0;
     }
   }
+  if (ok && sqlite3_stricmp(paramName, "rounds") == 0)
+  {
+    /* Only ChaCha20, ChaCha12, and ChaCha8 are supported */
+    ok = value == 20 || value == 12 || value == 8;
+  }
   return ok;
 }
 
@@ -354,6 +367,12 @@ sqlite3mc_config_cipher(sqlite3* db, const char* cipherName, const char* paramNa
           param->m_value = newValue;
           value = newValue;
         }
+        else if (newValue >= param->m_minValue && newValue <= param->m_maxValue)
+        {
+          sqlite3_log(SQLITE_WARNING,
+                      "sqlite3mc_config_cipher: Value %d for parameter '%s' of cipher '%s' not supported",
+                      newValue, paramName, cipherName);
+        }
         else if (newValue != -1)
         {
           sqlite3_log(SQLITE_WARNING,
@@ -717,7 +736,8 @@ sqlite3mcConfigParams(sqlite3_context* context, int argc, sqlite3_value** argv)
         {
           /* Change cipher parameter value */
           int value = sqlite3_value_int(argv[2]);
-          if (value >= param2->m_minValue && value <= param2->m_maxValue)
+          if (value >= param2->m_minValue && value <= param2->m_maxValue &&
+              checkParameterValue(nameParam2, value, nameParam1))
           {
             if (hasDefaultPrefix)
             {
@@ -884,6 +904,215 @@ sqlite3mcConfigureFromUri(sqlite3* db, const char* zDbName, int configDefault)
   return rc;
 }
 
+/*
+** Calibration of key derivation functions
+**
+** The key derivation function of a cipher scheme is run with an increasing
+** work factor, until a run takes long enough for a reliable measurement.
+** The work factor meeting the target latency is extrapolated linearly from
+** the last run. The work factor is the parameter "kdf_iter" (number of
+** PBKDF2 iterations) for all cipher schemes except "aegis", for which it
+** is the parameter "tcost" (number of Argon2 passes, "mcost" and "pcost"
+** remain unchanged).
+*/
+
+#define MC_KDF_NONE          0
+#define MC_KDF_PBKDF2_SHA1   1
+#define MC_KDF_PBKDF2_SHA256 2
+#define MC_KDF_PBKDF2_SHA512 3
+#define MC_KDF_ASCON_PBKDF2  4
+#define MC_KDF_ARGON2ID      5
+
+/*
+** Determine the key derivation function of a cipher scheme
+** Returns the name of the work factor parameter, or NULL if the cipher
+** scheme has no configurable key derivation function.
+*/
+static const char*
+mcKdfLookup(const char* cipherName, CipherParams* cipherParams, int* kdfType, int* mcost, int* pcost)
+{
+  *kdfType = MC_KDF_NONE;
+  *mcost = *pcost = 0;
+#if HAVE_CIPHER_CHACHA20
+  if (sqlite3_stricmp(cipherName, CIPHER_NAME_CHACHA20) == 0)
+  {
+    *kdfType = MC_KDF_PBKDF2_SHA256;
+  }
+#endif
+#if HAVE_CIPHER_AES_256_GCM
+  if (sqlite3_stricmp(cipherName, CIPHER_NAME_AES256GCM) == 0)
+  {
+    *kdfType = MC_KDF_PBKDF2_SHA256;
+  }
+#endif
+#if HAVE_CIPHER_AES_256_XTS
+  if (sqlite3_stricmp(cipherName, CIPHER_NAME_AES256XTS) == 0)
+  {
+    *kdfType = MC_KDF_PBKDF2_SHA256;
+  }
+#endif
+#if HAVE_CIPHER_SQLCIPHER
+  if (sqlite3_stricmp(cipherName, CIPHER_NAME_SQLCIPHER) == 0)
+  {
+    switch (sqlite3mcGetCipherParameter(cipherParams, "kdf_algorithm"))
+    {
+      case SQLCIPHER_ALGORITHM_SHA1:   *kdfType = MC_KDF_PBKDF2_SHA1;   break;
+      case SQLCIPHER_ALGORITHM_SHA256: *kdfType = MC_KDF_PBKDF2_SHA256; break;
+      default:                         *kdfType = MC_KDF_PBKDF2_SHA512; break;
+    }
+  }
+#endif
+#if HAVE_CIPHER_ASCON128
+  if (sqlite3_stricmp(cipherName, CIPHER_NAME_ASCON128) == 0)
+  {
+    *kdfType = MC_KDF_ASCON_PBKDF2;
+  }
+#endif
+#if HAVE_CIPHER_AEGIS
+  if (sqlite3_stricmp(cipherName, CIPHER_NAME_AEGIS) == 0)
+  {
+    *kdfType = MC_KDF_ARGON2ID;
+    *mcost = sqlite3mcGetCipherParameter(cipherParams, "mcost");
+    *pcost = sqlite3mcGetCipherParameter(cipherParams, "pcost");
+    return "tcost";
+  }
+#endif
+  return (*kdfType != MC_KDF_NONE) ? "kdf_iter" : NULL;
+}
+
+static void
+mcKdfRun(int kdfType, int workFactor, int mcost, int pcost)
+{
+  static const unsigned char password[] = "sqlite3mc-kdf-calibration";
+  static const unsigned char salt[16] = { 0 };
+  unsigned char key[64];
+  switch (kdfType)
+  {
+    case MC_KDF_PBKDF2_SHA1:
+      fastpbkdf2_hmac_sha1(password, sizeof(password) - 1, salt, sizeof(salt), workFactor, key, 32);
+      break;
+    case MC_KDF_PBKDF2_SHA256:
+      fastpbkdf2_hmac_sha256(password, sizeof(password) - 1, salt, sizeof(salt), workFactor, key, 32);
+      break;
+    case MC_KDF_PBKDF2_SHA512:
+      fastpbkdf2_hmac_sha512(password, sizeof(password) - 1, salt, sizeof(salt), workFactor, key, 32);
+      break;
+#if HAVE_CIPHER_ASCON128
+    case MC_KDF_ASCON_PBKDF2:
+      ascon_pbkdf2(key, 32, password, sizeof(password) - 1, salt, sizeof(salt), workFactor);
+      break;
+#endif
+#if HAVE_CIPHER_AEGIS
+    case MC_KDF_ARGON2ID:
+      /* Run under control of the scheduler, like the actual key derivation */
+      sqlite3mcArgon2idHashRaw((uint32_t) workFactor, (uint32_t) mcost, (uint32_t) pcost,
+                               password, sizeof(password) - 1, salt, sizeof(salt), key, 32);
+      break;
+#endif
+    default:
+      break;
+  }
+  sqlite3mcSecureZeroMemory(key, sizeof(key));
+}
+
+static sqlite3_int64
+mcKdfClock()
+{
+  sqlite3_vfs* pVfs = sqlite3_vfs_find(NULL);
+  sqlite3_int64 now = 0;
+  if (pVfs != NULL)
+  {
+    sqlite3OsCurrentTimeInt64(pVfs, &now);
+  }
+  return now;
+}
+
+SQLITE_API int
+sqlite3mc_calibrate_kdf(sqlite3* db, const char* cipherName, int targetMs)
+{
+  CipherParams* cipherParams;
+  CipherParams* param;
+  const char* workParam = NULL;
+  int kdfType, mcost, pcost;
+  int minValue = 1;
+  int maxValue = 0x7fffffff;
+  int workFactor;
+  sqlite3_int64 threshold;
+  sqlite3_int64 elapsed;
+  sqlite3_int64 value;
+
+#ifndef SQLITE_OMIT_AUTOINIT
+  if (sqlite3_initialize()) return -1;
+#endif
+  if (cipherName == NULL || targetMs <= 0 || sqlite3mc_cipher_index(cipherName) <= 0)
+  {
+    return -1;
+  }
+
+  /* Take a snapshot of the relevant cipher parameters */
+  if (db != NULL)
+  {
+    sqlite3_mutex_enter(db->mutex);
+  }
+  else
+  {
+    sqlite3_mutex_enter(sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_MAIN));
+  }
+  cipherParams = sqlite3mcGetCipherParams(db, cipherName);
+  workParam = mcKdfLookup(cipherName, cipherParams, &kdfType, &mcost, &pcost);
+  if (workParam != NULL)
+  {
+    for (param = cipherParams; param->m_name[0] != 0; ++param)
+    {
+      if (sqlite3_stricmp(workParam, param->m_name) == 0)
+      {
+        minValue = param->m_minValue;
+        maxValue = param->m_maxValue;
+        break;
+      }
+    }
+  }
+  if (db != NULL)
+  {
+    sqlite3_mutex_leave(db->mutex);
+  }
+  else
+  {
+    sqlite3_mutex_leave(sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_MAIN));
+  }
+  if (workParam == NULL)
+  {
+    return -1;
+  }
+
+  /* Measure runs of at least 20 ms (clock granularity), at most 250 ms */
+  threshold = targetMs / 4;
+  if (threshold < 20) threshold = 20;
+  if (threshold > 250) threshold = 250;
+
+  workFactor = (kdfType == MC_KDF_ARGON2ID) ? 1 : 1000;
+  for (;;)
+  {
+    sqlite3_int64 start = mcKdfClock();
+    mcKdfRun(kdfType, workFactor, mcost, pcost);
+    elapsed = mcKdfClock() - start;
+    if (elapsed >= threshold || workFactor > maxValue / 2)
+    {
+      break;
+    }
+    workFactor *= 2;
+  }
+  if (elapsed < 1)
+  {
+    elapsed = 1;
+  }
+
+  value = (sqlite3_int64) workFactor * targetMs / elapsed;
+  if (value < minValue) value = minValue;
+  if (value > maxValue) value = maxValue;
+  return (int) value;
+}
+
 #ifdef SQLITE3MC_WXSQLITE3_COMPATIBLE
 SQLITE_API int
 wxsqlite3_config(sqlite3* db, const char* paramName, int newValue)
@@ -984,6 +1213,37 @@ sqlite3mcFileControlPragma(sqlite3* db, const char* zDbName, int op, void* pArg)
       ((char**)pArg)[0] = sqlite3_mprintf("%d", value);
       rc = SQLITE_OK;
     }
+    else if (sqlite3StrICmp(pragmaName, "cipher_calibrate") == 0)
+    {
+      int targetMs = (pragmaValue != NULL) ? sqlite3Atoi(pragmaValue) : 0;
+      int cipher = sqlite3mc_config(db, "cipher", -1);
+      const char* cipherName = (cipher > 0) ? globalCodecDescriptorTable[cipher - 1].m_name : "";
+      if (targetMs > 0)
+      {
+        int value = sqlite3mc_calibrate_kdf(db, cipherName, targetMs);
+        if (value > 0)
+        {
+          /* Apply the calibrated work factor to the current cipher scheme */
+          int kdfType, mcost, pcost;
+          const char* workParam = mcKdfLookup(cipherName, sqlite3mcGetCipherParams(db, cipherName), &kdfType, &mcost, &pcost);
+          char* param = sqlite3_mprintf("%s%s", (configDefault) ? "default:" : "", workParam);
+          value = sqlite3mc_config_cipher(db, cipherName, param, value);
+          sqlite3_free(param);
+          ((char**)pArg)[0] = sqlite3_mprintf("%d", value);
+          rc = SQLITE_OK;
+        }
+        else
+        {
+          ((char**)pArg)[0] = sqlite3_mprintf("Key derivation of cipher '%s' can't be calibrated.", cipherName);
+          rc = SQLITE_ERROR;
+        }
+      }
+      else
+      {
+        ((char**)pArg)[0] = sqlite3_mprintf("Target latency in milliseconds expected.");
+        rc = SQLITE_ERROR;
+      }
+    }
     else if (sqlite3StrICmp(pragmaName, "cipher_salt") == 0)
     {
       Codec* codec = sqlite3mcGetCodec(db, (zDbName) ? zDbName : "main");
@@ -1071,10 +1331,10 @@ sqlite3mcFileControlPragma(sqlite3* db, const char* zDbName, int op, void* pArg)
       int nValue = sqlite3Strlen30(pragmaValue);
       if (((nValue & 1) == 0) && (sqlite3mcIsHexKey((const unsigned char*) pragmaValue, nValue) != 0))
       {
-        unsigned char* zHexKey = sqlite3_malloc(nValue/2);
+        unsigned char* zHexKey = sqlite3mcSecureAlloc(nValue/2);
         sqlite3mcConvertHex2Bin((const unsigned char*) pragmaValue, nValue, zHexKey);
         rc = sqlite3_key_v2(db, zDbName, zHexKey, nValue/2);
-        sqlite3_free(zHexKey);
+        sqlite3mcSecureFree(zHexKey);
         if (rc == SQLITE_OK)
         {
           ((char**)pArg)[0] = sqlite3_mprintf("ok");
@@ -1121,10 +1381,10 @@ sqlite3mcFileControlPragma(sqlite3* db, const char* zDbName, int op, void* pArg)
       int nValue = sqlite3Strlen30(pragmaValue);
       if (((nValue & 1) == 0) && (sqlite3mcIsHexKey((const unsigned char*) pragmaValue, nValue) != 0))
       {
-        unsigned char* zHexKey = sqlite3_malloc(nValue/2);
+        unsigned char* zHexKey = sqlite3mcSecureAlloc(nValue/2);
         sqlite3mcConvertHex2Bin((const unsigned char*) pragmaValue, nValue, zHexKey);
         rc = sqlite3_rekey_v2(db, zDbName, zHexKey, nValue/2);
-        sqlite3_free(zHexKey);
+        sqlite3mcSecureFree(zHexKey);
         if (rc == SQLITE_OK)
         {
           ((char**)pArg)[0] = sqlite3_mprintf("ok");
@@ -1236,7 +1496,13 @@ sqlite3mcFileControlPragma(sqlite3* db, const char* zDbName, int op, void* pArg)
         if (cipherParams[j].m_name[0] != 0)
         {
           char* param = (configDefault) ? sqlite3_mprintf("default:%s", pragmaName) : pragmaName;
-          if (isIntValue)
+          if (isIntValue && intValue >= cipherParams[j].m_minValue && intValue <= cipherParams[j].m_maxValue &&
+              !checkParameterValue(pragmaName, intValue, cipherName))
+          {
+            ((char**) pArg)[0] = sqlite3_mprintf("Value %d for parameter '%s' not supported.", intValue, pragmaName);
+            rc = SQLITE_ERROR;
+          }
+          else if (isIntValue)
           {
             int value = sqlite3mc_config_cipher(db, cipherName, param, intValue);
 #if HAVE_CIPHER_AEGIS
@@ -1282,14 +1548,14 @@ sqlite3mcCodecQueryParameters(sqlite3* db, const char* zDb, const char* zUri)
     u8 iByte;
     int i;
     int nKey = sqlite3Strlen30(zKey);
-    char* zDecoded = sqlite3_malloc(nKey);
+    char* zDecoded = sqlite3mcSecureAlloc(nKey);
     for (i = 0, iByte = 0; i < nKey && sqlite3Isxdigit(zKey[i]); i++)
     {
       iByte = (iByte << 4) + sqlite3HexToInt(zKey[i]);
       if ((i & 1) != 0) zDecoded[i/2] = iByte;
     }
     sqlite3_key_v2(db, zDb, zDecoded, i/2);
-    sqlite3_free(zDecoded);
+    sqlite3mcSecureFree(zDecoded);
   }
   else if ((zKey = sqlite3_uri_parameter(zUri, "key")) != 0)
   {
@@ -46,7 +46,7 @@ typedef struct _RC4Cipher
 static void*
 AllocateRC4Cipher(sqlite3* db)
 {
-  RC4Cipher* rc4Cipher = (RC4Cipher*) sqlite3_malloc(sizeof(RC4Cipher));
+  RC4Cipher* rc4Cipher = (RC4Cipher*) sqlite3mcSecureAlloc(sizeof(RC4Cipher));
   if (rc4Cipher != NULL)
   {
     rc4Cipher->m_keyLength = KEYLENGTH_RC4;
@@ -66,7 +66,7 @@ FreeRC4Cipher(void* cipher)
 {
   RC4Cipher* localCipher = (RC4Cipher*) cipher;
   sqlite3mcSecureZeroMemory(localCipher, sizeof(RC4Cipher));
-  sqlite3_free(localCipher);
+  sqlite3mcSecureFree(localCipher);
 }
 
 static void
@@ -109,10 +109,10 @@ typedef struct _sqlCipherCipher
 static void*
 AllocateSQLCipherCipher(sqlite3* db)
 {
-  SQLCipherCipher* sqlCipherCipher = (SQLCipherCipher*) sqlite3_malloc(sizeof(SQLCipherCipher));
+  SQLCipherCipher* sqlCipherCipher = (SQLCipherCipher*) sqlite3mcSecureAlloc(sizeof(SQLCipherCipher));
   if (sqlCipherCipher != NULL)
   {
-    sqlCipherCipher->m_aes = (Rijndael*)sqlite3_malloc(sizeof(Rijndael));
+    sqlCipherCipher->m_aes = (Rijndael*)sqlite3mcSecureAlloc(sizeof(Rijndael));
     if (sqlCipherCipher->m_aes != NULL)
     {
       sqlCipherCipher->m_keyLength = KEYLENGTH_SQLCIPHER;
@@ -123,7 +123,7 @@ AllocateSQLCipherCipher(sqlite3* db)
     }
     else
     {
-      sqlite3_free(sqlCipherCipher);
+      sqlite3mcSecureFree(sqlCipherCipher);
       sqlCipherCipher = NULL;
     }
   }
@@ -157,9 +157,9 @@ FreeSQLCipherCipher(void* cipher)
 {
   SQLCipherCipher* sqlCipherCipher = (SQLCipherCipher*) cipher;
   sqlite3mcSecureZeroMemory(sqlCipherCipher->m_aes, sizeof(Rijndael));
-  sqlite3_free(sqlCipherCipher->m_aes);
+  sqlite3mcSecureFree(sqlCipherCipher->m_aes);
   sqlite3mcSecureZeroMemory(sqlCipherCipher, sizeof(SQLCipherCipher));
-  sqlite3_free(sqlCipherCipher);
+  sqlite3mcSecureFree(sqlCipherCipher);
 }
 
 static void
@@ -46,10 +46,10 @@ typedef struct _AES128Cipher
 static void*
 AllocateAES128Cipher(sqlite3* db)
 {
-  AES128Cipher* aesCipher = (AES128Cipher*) sqlite3_malloc(sizeof(AES128Cipher));
+  AES128Cipher* aesCipher = (AES128Cipher*) sqlite3mcSecureAlloc(sizeof(AES128Cipher));
   if (aesCipher != NULL)
   {
-    aesCipher->m_aes = (Rijndael*) sqlite3_malloc(sizeof(Rijndael));
+    aesCipher->m_aes = (Rijndael*) sqlite3mcSecureAlloc(sizeof(Rijndael));
     if (aesCipher->m_aes != NULL)
     {
       aesCipher->m_keyLength = KEYLENGTH_AES128;
@@ -58,7 +58,7 @@ AllocateAES128Cipher(sqlite3* db)
     }
     else
     {
-      sqlite3_free(aesCipher);
+      sqlite3mcSecureFree(aesCipher);
       aesCipher = NULL;
     }
   }
@@ -76,9 +76,9 @@ FreeAES128Cipher(void* cipher)
 {
   AES128Cipher* localCipher = (AES128Cipher*) cipher;
   sqlite3mcSecureZeroMemory(localCipher->m_aes, sizeof(Rijndael));
-  sqlite3_free(localCipher->m_aes);
+  sqlite3mcSecureFree(localCipher->m_aes);
   sqlite3mcSecureZeroMemory(localCipher, sizeof(AES128Cipher));
-  sqlite3_free(localCipher);
+  sqlite3mcSecureFree(localCipher);
 }
 
 static void
@@ -50,10 +50,10 @@ typedef struct _AES256Cipher
 static void*
 AllocateAES256Cipher(sqlite3* db)
 {
-  AES256Cipher* aesCipher = (AES256Cipher*) sqlite3_malloc(sizeof(AES256Cipher));
+  AES256Cipher* aesCipher = (AES256Cipher*) sqlite3mcSecureAlloc(sizeof(AES256Cipher));
   if (aesCipher != NULL)
   {
-    aesCipher->m_aes = (Rijndael*) sqlite3_malloc(sizeof(Rijndael));
+    aesCipher->m_aes = (Rijndael*) sqlite3mcSecureAlloc(sizeof(Rijndael));
     if (aesCipher->m_aes != NULL)
     {
       aesCipher->m_keyLength = KEYLENGTH_AES256;
@@ -62,7 +62,7 @@ AllocateAES256Cipher(sqlite3* db)
     }
     else
     {
-      sqlite3_free(aesCipher);
+      sqlite3mcSecureFree(aesCipher);
       aesCipher = NULL;
     }
   }
@@ -81,9 +81,9 @@ FreeAES256Cipher(void* cipher)
 {
   AES256Cipher* aesCipher = (AES256Cipher*) cipher;
   sqlite3mcSecureZeroMemory(aesCipher->m_aes, sizeof(Rijndael));
-  sqlite3_free(aesCipher->m_aes);
+  sqlite3mcSecureFree(aesCipher->m_aes);
   sqlite3mcSecureZeroMemory(aesCipher, sizeof(AES256Cipher));
-  sqlite3_free(aesCipher);
+  sqlite3mcSecureFree(aesCipher);
 }
 
 static void
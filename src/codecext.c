@@ -67,7 +67,7 @@ sqlite3mcCodecFree(void *pCodecArg)
   if (pCodecArg)
   {
     sqlite3mcCodecTerm(pCodecArg);
-    sqlite3_free(pCodecArg);
+    sqlite3mcSecureFree(pCodecArg);
     pCodecArg = NULL;
   }
 }
@@ -102,6 +102,7 @@ mcReportCodecError(BtShared* pBt, int error)
 
 /*
 // Encrypt/Decrypt functionality, called by pager.c
+// Returns NULL, if no page buffer for encryption could be allocated
 */
 SQLITE_PRIVATE void*
 sqlite3mcCodec(void* pCodecArg, void* data, Pgno nPageNum, int nMode)
@@ -142,6 +143,12 @@ sqlite3mcCodec(void* pCodecArg, void* data, Pgno nPageNum, int nMode)
       if (sqlite3mcHasWriteCipher(codec))
       {
         unsigned char* pageBuffer = sqlite3mcGetPageBuffer(codec);
+        if (pageBuffer == NULL)
+        {
+          rc = SQLITE_NOMEM;
+          data = NULL;
+          break;
+        }
         memcpy(pageBuffer, data, pageSize);
         data = pageBuffer;
         rc = sqlite3mcEncrypt(codec, nPageNum, (unsigned char*) data, pageSize, 1);
@@ -161,6 +168,12 @@ sqlite3mcCodec(void* pCodecArg, void* data, Pgno nPageNum, int nMode)
       if (sqlite3mcHasReadCipher(codec))
       {
         unsigned char* pageBuffer = sqlite3mcGetPageBuffer(codec);
+        if (pageBuffer == NULL)
+        {
+          rc = SQLITE_NOMEM;
+          data = NULL;
+          break;
+        }
         memcpy(pageBuffer, data, pageSize);
         data = pageBuffer;
         rc = sqlite3mcEncrypt(codec, nPageNum, (unsigned char*) data, pageSize, 0);
@@ -181,6 +194,9 @@ sqlite3mcSetCodec(sqlite3* db, const char* zDbName, const char* zFileName, Codec
 SQLITE_PRIVATE int
 sqlite3mcIsEncryptionSupported(sqlite3* db, const char* zDbName);
 
+SQLITE_PRIVATE void
+sqlite3mcSetKeyPending(sqlite3* db, const char* zDbName, int pending);
+
 static int
 mcAdjustBtree(Btree* pBt, int nPageSize, int nReserved, int isLegacy)
 {
@@ -206,13 +222,79 @@ mcAdjustBtree(Btree* pBt, int nPageSize, int nReserved, int isLegacy)
   return rc;
 }
 
+/*
+** Prepare the codec for a key: determine the key salt and allocate the
+** read cipher. The key itself is derived by the caller.
+** Must be called with the connection mutex held.
+*/
+static int
+mcCodecAttachBegin(sqlite3* db, int nDb, const char* dbFileName, Codec* codec)
+{
+  int rc = SQLITE_OK;
+  if (dbFileName != NULL)
+  {
+    /* Check whether key salt is provided via pragma or via URI */
+    const unsigned char* cipherSalt = (const unsigned char*) sqlite3_get_clientdata(db, "sqlite3mc_cipher_salt");
+    if (cipherSalt == NULL)
+    {
+      cipherSalt = (const unsigned char*) sqlite3_uri_parameter(dbFileName, "cipher_salt");
+    }
+    if ((cipherSalt != NULL) && (strlen((const char*)cipherSalt) >= 2 * KEYSALT_LENGTH) && sqlite3mcIsHexKey(cipherSalt, 2 * KEYSALT_LENGTH))
+    {
+      codec->m_hasKeySalt = 1;
+      sqlite3mcConvertHex2Bin(cipherSalt, 2 * KEYSALT_LENGTH, codec->m_keySalt);
+    }
+  }
+
+  /* Configure cipher from URI in case of attached database */
+  if (nDb > 0)
+  {
+    rc = sqlite3mcConfigureFromUri(db, dbFileName, 0);
+  }
+  if (rc == SQLITE_OK)
+  {
+    sqlite3mcSetBtree(codec, db->aDb[nDb].pBt);
+    rc = sqlite3mcCodecSetupCipher(codec, sqlite3mcGetCipherType(db));
+  }
+  return rc;
+}
+
+/*
+** Complete the codec after the key was derived and attach it to the
+** database; a codec that could not be set up is freed.
+** Must be called with the connection mutex held.
+*/
+static int
+mcCodecAttachEnd(sqlite3* db, int nDb, const char* dbFileName, Codec* codec, int rc)
+{
+  sqlite3mcClearKeySalt(codec);
+  if (rc == SQLITE_OK)
+  {
+    rc = sqlite3mcCopyCipher(codec, 1);
+  }
+  if (rc == SQLITE_OK)
+  {
+    int pageSize = sqlite3mcGetPageSizeWriteCipher(codec);
+    int reserved = sqlite3mcGetReservedWriteCipher(codec);
+    mcAdjustBtree(db->aDb[nDb].pBt, pageSize, reserved, sqlite3mcGetLegacyWriteCipher(codec));
+    sqlite3mcCodecSizeChange(codec, pageSize, reserved);
+    sqlite3mcSetCodec(db, db->aDb[nDb].zDbSName, dbFileName, codec);
+  }
+  else
+  {
+    /* Setting up codec failed, do not attach incomplete codec */
+    sqlite3mcCodecFree(codec);
+  }
+  return rc;
+}
+
 static int
 sqlite3mcCodecAttach(sqlite3* db, int nDb, const char* zPath, const void* zKey, int nKey)
 {
   /* Attach a key to a database. */
   const char* zDbName = db->aDb[nDb].zDbSName;
   const char* dbFileName = sqlite3_db_filename(db, zDbName);
-  Codec* codec = (Codec*) sqlite3_malloc(sizeof(Codec));
+  Codec* codec = (Codec*) sqlite3mcSecureAlloc(sizeof(Codec));
   int rc = (codec != NULL) ? sqlite3mcCodecInit(codec) : SQLITE_NOMEM;
   if (rc != SQLITE_OK)
   {
@@ -269,46 +351,14 @@ sqlite3mcCodecAttach(sqlite3* db, int nDb, const char* zPath, const void* zKey,
   }
   else
   {
-    if (dbFileName != NULL)
-    {
-      /* Check whether key salt is provided via pragma or via URI */
-      const unsigned char* cipherSalt = (const unsigned char*) sqlite3_get_clientdata(db, "sqlite3mc_cipher_salt");
-      if (cipherSalt == NULL)
-      {
-        cipherSalt = (const unsigned char*) sqlite3_uri_parameter(dbFileName, "cipher_salt");
-      }
-      if ((cipherSalt != NULL) && (strlen((const char*)cipherSalt) >= 2 * KEYSALT_LENGTH) && sqlite3mcIsHexKey(cipherSalt, 2 * KEYSALT_LENGTH))
-      {
-        codec->m_hasKeySalt = 1;
-        sqlite3mcConvertHex2Bin(cipherSalt, 2 * KEYSALT_LENGTH, codec->m_keySalt);
-      }
-    }
-
-    /* Configure cipher from URI in case of attached database */
-    if (nDb > 0)
-    {
-      rc = sqlite3mcConfigureFromUri(db, dbFileName, 0);
-    }
+    /* Key specified, setup encryption key for database */
+    rc = mcCodecAttachBegin(db, nDb, dbFileName, codec);
     if (rc == SQLITE_OK)
     {
-      /* Key specified, setup encryption key for database */
-      sqlite3mcSetBtree(codec, db->aDb[nDb].pBt);
-      rc = sqlite3mcCodecSetup(codec, sqlite3mcGetCipherType(db), (char*) zKey, nKey);
-      sqlite3mcClearKeySalt(codec);
-    }
-    if (rc == SQLITE_OK)
-    {
-      int pageSize = sqlite3mcGetPageSizeWriteCipher(codec);
-      int reserved = sqlite3mcGetReservedWriteCipher(codec);
-      mcAdjustBtree(db->aDb[nDb].pBt, pageSize, reserved, sqlite3mcGetLegacyWriteCipher(codec));
-      sqlite3mcCodecSizeChange(codec, pageSize, reserved);
-      sqlite3mcSetCodec(db, zDbName, dbFileName, codec);
-    }
-    else
-    {
-      /* Setting up codec failed, do not attach incomplete codec */
-      sqlite3mcCodecFree(codec);
+      unsigned char* keySalt = (codec->m_hasKeySalt != 0) ? codec->m_keySalt : NULL;
+      sqlite3mcGenerateReadKey(codec, (char*) zKey, nKey, keySalt);
     }
+    rc = mcCodecAttachEnd(db, nDb, dbFileName, codec, rc);
   }
 
   sqlite3_mutex_leave(db->mutex);
@@ -332,6 +382,9 @@ sqlite3mcCodecGetKey(sqlite3* db, int nDb, void** zKey, int* nKey)
   *nKey = keylen;
 }
 
+static int
+mcKeyAsyncPending(sqlite3* db);
+
 SQLITE_API int
 sqlite3_key(sqlite3 *db, const void *zKey, int nKey)
 {
@@ -348,6 +401,12 @@ sqlite3_key_v2(sqlite3* db, const char* zDbName, const void* zKey, int nKey)
     sqlite3ErrorWithMsg(db, rc, "Setting key failed. Encryption is not supported by the VFS.");
     return rc;
   }
+  if (db != NULL && mcKeyAsyncPending(db))
+  {
+    rc = SQLITE_BUSY;
+    sqlite3ErrorWithMsg(db, rc, "Setting key failed. Asynchronous key setup in progress.");
+    return rc;
+  }
   if (zKey != NULL && nKey < 0)
   {
     /* Key is zero-terminated string */
@@ -411,6 +470,12 @@ sqlite3_rekey_v2(sqlite3* db, const char* zDbName, const void* zKey, int nKey)
     sqlite3ErrorWithMsg(db, rc, "Rekeying failed. Encryption is not supported by the VFS.");
     return rc;
   }
+  if (mcKeyAsyncPending(db))
+  {
+    rc = SQLITE_BUSY;
+    sqlite3ErrorWithMsg(db, rc, "Rekeying failed. Asynchronous key setup in progress.");
+    return rc;
+  }
   if (zKey != NULL && nKey < 0)
   {
     /* Key is zero-terminated string */
@@ -459,7 +524,7 @@ sqlite3_rekey_v2(sqlite3* db, const char* zDbName, const void* zKey, int nKey)
     if (codec == NULL)
     {
       codecAllocated = 1;
-      codec = (Codec*) sqlite3_malloc(sizeof(Codec));
+      codec = (Codec*) sqlite3mcSecureAlloc(sizeof(Codec));
       rc = (codec != NULL) ? sqlite3mcCodecInit(codec) : SQLITE_NOMEM;
     }
     if (rc == SQLITE_OK)
@@ -652,3 +717,323 @@ sqlite3_rekey(sqlite3 *db, const void *zKey, int nKey)
 {
   return sqlite3_rekey_v2(db, "main", zKey, nKey);
 }
+
+/*
+** Asynchronous key setup
+**
+** The codec is prepared and the database file is marked as pending while
+** sqlite3mc_key_async holds the connection mutex. The key derivation is
+** then performed by a worker thread without holding the mutex; the mutex is
+** taken again only to attach the codec. Until then, locking the database
+** file fails with SQLITE_BUSY, and setting a key fails with SQLITE_BUSY.
+*/
+
+/* Worker threads must run immediately, not deferred until joined */
+#if SQLITE_MAX_WORKER_THREADS>0 && SQLITE_THREADSAFE>0 && \
+    ((SQLITE_OS_UNIX && defined(SQLITE_MUTEX_PTHREADS)) || (SQLITE_OS_WIN && !SQLITE_OS_WINRT))
+#define MC_KEY_ASYNC_THREADS 1
+#else
+#define MC_KEY_ASYNC_THREADS 0
+#endif
+
+static const char* mcKeyAsyncName = "sqlite3mc_key_async";
+
+typedef struct McKeyAsyncTask
+{
+  sqlite3* db;                       /* Database connection */
+  char* zDbName;                     /* Schema name */
+  void* zKey;                        /* Copy of the key (secure memory) */
+  int nKey;                          /* Length of the key */
+  Codec* codec;                      /* Codec prepared for the key */
+  sqlite3mc_key_callback xCallback;  /* Completion callback */
+  void* pArg;                        /* User argument of the callback */
+  int inProgress;                    /* Worker not yet completed */
+  int cancelled;                     /* Connection is being closed */
+#if MC_KEY_ASYNC_THREADS
+  SQLiteThread* pThread;             /* Worker thread */
+#endif
+} McKeyAsyncTask;
+
+static void
+mcKeyAsyncRelease(McKeyAsyncTask* task)
+{
+  if (task->codec != NULL)
+  {
+    sqlite3mcCodecFree(task->codec);
+  }
+  sqlite3mcSecureFree(task->zKey);
+  sqlite3_free(task->zDbName);
+  task->codec = NULL;
+  task->zKey = NULL;
+  task->zDbName = NULL;
+}
+
+static void
+mcKeyAsyncJoin(McKeyAsyncTask* task)
+{
+#if MC_KEY_ASYNC_THREADS
+  if (task->pThread != NULL)
+  {
+    void* pOut;
+    sqlite3ThreadJoin(task->pThread, &pOut);
+    task->pThread = NULL;
+  }
+#endif
+}
+
+static void
+mcKeyAsyncFree(void* pArg)
+{
+  McKeyAsyncTask* task = (McKeyAsyncTask*) pArg;
+  /*
+  ** The connection mutex is held, the worker must not wait for it. Joining
+  ** is safe, since the callback of the worker does not use the connection.
+  */
+  AtomicStore(&task->cancelled, 1);
+  mcKeyAsyncJoin(task);
+  mcKeyAsyncRelease(task);
+  sqlite3_free(task);
+}
+
+/*
+** Check whether an asynchronous key setup is in progress for a connection
+*/
+static int
+mcKeyAsyncPending(sqlite3* db)
+{
+  McKeyAsyncTask* task = (McKeyAsyncTask*) sqlite3_get_clientdata(db, mcKeyAsyncName);
+  return task != NULL && AtomicLoad(&task->inProgress);
+}
+
+/*
+** Acquire the connection mutex, unless the connection is being closed
+*/
+static int
+mcKeyAsyncEnter(McKeyAsyncTask* task)
+{
+  while (sqlite3_mutex_try(task->db->mutex) != SQLITE_OK)
+  {
+    if (AtomicLoad(&task->cancelled))
+    {
+      return 0;
+    }
+    sqlite3_sleep(1);
+  }
+  if (AtomicLoad(&task->cancelled))
+  {
+    sqlite3_mutex_leave(task->db->mutex);
+    return 0;
+  }
+  return 1;
+}
+
+static void*
+mcKeyAsyncWorker(void* pArg)
+{
+  McKeyAsyncTask* task = (McKeyAsyncTask*) pArg;
+  sqlite3* db = task->db;
+  Codec* codec = task->codec;
+  unsigned char* keySalt = (codec->m_hasKeySalt != 0) ? codec->m_keySalt : NULL;
+  sqlite3mc_key_callback xCallback = task->xCallback;
+  void* pCallbackArg = task->pArg;
+  char* zErrMsg = NULL;
+  int rc;
+
+  /* Derive the key without holding the connection mutex */
+  globalCodecDescriptorTable[codec->m_readCipherType-1].m_generateKey(codec->m_readCipher, (char*) task->zKey, task->nKey, 0, keySalt);
+  sqlite3mcSecureFree(task->zKey);
+  task->zKey = NULL;
+
+  if (mcKeyAsyncEnter(task))
+  {
+    /* Attach the codec, unless the database was detached meanwhile */
+    int nDb = sqlite3FindDbName(db, task->zDbName);
+    task->codec = NULL;
+    if (nDb >= 0 && db->aDb[nDb].pBt != NULL && db->aDb[nDb].pBt->pBt == sqlite3mcGetBtShared(codec))
+    {
+      rc = mcCodecAttachEnd(db, nDb, sqlite3_db_filename(db, task->zDbName), codec, SQLITE_OK);
+      sqlite3mcSetKeyPending(db, task->zDbName, 0);
+    }
+    else
+    {
+      sqlite3mcCodecFree(codec);
+      rc = SQLITE_ERROR;
+      sqlite3ErrorWithMsg(db, rc, "Setting key failed. Database '%s' not found.", task->zDbName);
+    }
+    /* Capture the error message, before another thread may overwrite it */
+    if (rc != SQLITE_OK && xCallback != NULL)
+    {
+      zErrMsg = sqlite3_mprintf("%s", sqlite3_errmsg(db));
+    }
+    sqlite3_mutex_leave(db->mutex);
+  }
+  else
+  {
+    rc = SQLITE_ABORT;
+    if (xCallback != NULL)
+    {
+      zErrMsg = sqlite3_mprintf("Setting key aborted. Connection closed.");
+    }
+  }
+  mcKeyAsyncRelease(task);
+  AtomicStore(&task->inProgress, 0);
+
+  if (xCallback != NULL)
+  {
+    xCallback(pCallbackArg, rc, zErrMsg);
+  }
+  sqlite3_free(zErrMsg);
+  return NULL;
+}
+
+SQLITE_API int
+sqlite3mc_key_async(sqlite3* db, const char* zDbName, const void* zKey, int nKey,
+                    sqlite3mc_key_callback xCallback, void* pArg)
+{
+  int rc = SQLITE_OK;
+  int dbIndex;
+  const char* dbFileName;
+  char* zErrMsg;
+  McKeyAsyncTask* task;
+
+#ifdef SQLITE_ENABLE_API_ARMOR
+  if (!sqlite3SafetyCheckOk(db))
+  {
+    return SQLITE_MISUSE_BKPT;
+  }
+#endif
+  if (zKey == NULL || nKey < -1)
+  {
+    return SQLITE_MISUSE;
+  }
+  if (nKey < 0)
+  {
+    /* Key is zero-terminated string */
+    nKey = sqlite3Strlen30((const char*) zKey);
+  }
+
+  sqlite3_mutex_enter(db->mutex);
+  if (mcKeyAsyncPending(db))
+  {
+    /* Previous request not yet completed */
+    sqlite3ErrorWithMsg(db, SQLITE_BUSY, "Asynchronous key setup in progress.");
+    sqlite3_mutex_leave(db->mutex);
+    return SQLITE_BUSY;
+  }
+  if (nKey == 0)
+  {
+    /* Removing the key requires no key derivation */
+    rc = sqlite3_key_v2(db, zDbName, zKey, nKey);
+    zErrMsg = (rc != SQLITE_OK && xCallback != NULL) ? sqlite3_mprintf("%s", sqlite3_errmsg(db)) : NULL;
+    sqlite3_mutex_leave(db->mutex);
+    if (xCallback != NULL)
+    {
+      xCallback(pArg, rc, zErrMsg);
+    }
+    sqlite3_free(zErrMsg);
+    return SQLITE_OK;
+  }
+
+  if (zDbName == NULL)
+  {
+    zDbName = "main";
+  }
+  dbIndex = sqlite3FindDbName(db, zDbName);
+  dbFileName = sqlite3_db_filename(db, zDbName);
+  if (dbIndex < 0)
+  {
+    rc = SQLITE_ERROR;
+    sqlite3ErrorWithMsg(db, rc, "Setting key failed. Database '%s' not found.", zDbName);
+  }
+  else if (!sqlite3mcIsEncryptionSupported(db, zDbName))
+  {
+    rc = SQLITE_ERROR;
+    sqlite3ErrorWithMsg(db, rc, "Setting key failed. Encryption is not supported by the VFS.");
+  }
+  else if (dbFileName == NULL || dbFileName[0] == 0)
+  {
+    rc = SQLITE_ERROR;
+    sqlite3ErrorWithMsg(db, rc, "Setting key not supported for in-memory or temporary databases.");
+  }
+  if (rc != SQLITE_OK)
+  {
+    sqlite3_mutex_leave(db->mutex);
+    return rc;
+  }
+
+  task = (McKeyAsyncTask*) sqlite3_get_clientdata(db, mcKeyAsyncName);
+  if (task != NULL)
+  {
+    /*
+    ** The worker of a previous request has already left the connection,
+    ** it may still be running its callback, which does not use the connection
+    */
+    mcKeyAsyncJoin(task);
+  }
+  else
+  {
+    task = (McKeyAsyncTask*) sqlite3MallocZero(sizeof(McKeyAsyncTask));
+    if (task == NULL || sqlite3_set_clientdata(db, mcKeyAsyncName, task, mcKeyAsyncFree) != SQLITE_OK)
+    {
+      sqlite3_free(task);
+      sqlite3_mutex_leave(db->mutex);
+      return SQLITE_NOMEM;
+    }
+  }
+
+  task->db = db;
+  task->zDbName = sqlite3_mprintf("%s", zDbName);
+  task->zKey = sqlite3mcSecureAlloc(nKey);
+  task->codec = (Codec*) sqlite3mcSecureAlloc(sizeof(Codec));
+  rc = (task->zDbName != NULL && task->zKey != NULL && task->codec != NULL) ? sqlite3mcCodecInit(task->codec) : SQLITE_NOMEM;
+  if (rc == SQLITE_OK)
+  {
+    /* Prepare the codec and read the key salt, while holding the mutex */
+    sqlite3mcSetDb(task->codec, db);
+    rc = mcCodecAttachBegin(db, dbIndex, dbFileName, task->codec);
+    if (rc == SQLITE_OK && !task->codec->m_hasKeySalt &&
+        mcReadDatabaseHeader(task->codec, task->codec->m_keySalt) != NULL)
+    {
+      task->codec->m_hasKeySalt = 1;
+    }
+  }
+  else if (task->codec != NULL)
+  {
+    sqlite3mcSecureFree(task->codec);
+    task->codec = NULL;
+  }
+  if (rc != SQLITE_OK)
+  {
+    mcKeyAsyncRelease(task);
+    sqlite3_mutex_leave(db->mutex);
+    return rc;
+  }
+  memcpy(task->zKey, zKey, nKey);
+  task->nKey = nKey;
+  task->xCallback = xCallback;
+  task->pArg = pArg;
+  task->cancelled = 0;
+  task->inProgress = 1;
+  sqlite3mcSetKeyPending(db, task->zDbName, 1);
+  sqlite3_mutex_leave(db->mutex);
+
+#if MC_KEY_ASYNC_THREADS
+  if (db->mutex != NULL)
+  {
+    rc = sqlite3ThreadCreate(&task->pThread, mcKeyAsyncWorker, task);
+    if (rc != SQLITE_OK)
+    {
+      sqlite3_mutex_enter(db->mutex);
+      sqlite3mcSetKeyPending(db, task->zDbName, 0);
+      mcKeyAsyncRelease(task);
+      task->inProgress = 0;
+      sqlite3_mutex_leave(db->mutex);
+    }
+    return rc;
+  }
+#endif
+
+  /* No threads or no connection mutex: set the key synchronously */
+  mcKeyAsyncWorker(task);
+  return SQLITE_OK;
+}
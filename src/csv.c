@@ -38,6 +38,13 @@
 **
 ** Some extra debugging features (used for testing virtual tables) are available
 ** if this module is compiled with -DSQLITE_TEST.
+**
+** Input files are memory-mapped where possible (unless compiled with
+** -DSQLITE_CSV_OMIT_MMAP), and the field scanner looks for the next separator,
+** quote or newline with SSE2/AVX2 instructions if available.  Unquoted fields
+** of a memory-mapped file or of data= text are handed to the cursor without
+** copying them.  Note that a memory-mapped file must not be truncated while a
+** statement reads it.
 */
 #include "sqlite3ext.h"
 SQLITE_EXTENSION_INIT1
@@ -47,9 +54,58 @@ SQLITE_EXTENSION_INIT1
 #include <stdarg.h>
 #include <ctype.h>
 #include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#if !defined(SQLITE_CSV_OMIT_MMAP)
+#  if defined(_WIN32) || defined(WIN32)
+#    include <windows.h>
+#    define CSV_USE_MMAP 1
+#  elif defined(__unix__) || defined(__unix) || defined(__APPLE__)
+#    include <sys/mman.h>
+#    include <fcntl.h>
+#    include <unistd.h>
+#    define CSV_USE_MMAP 1
+#  endif
+#endif
+#ifndef CSV_USE_MMAP
+#  define CSV_USE_MMAP 0
+#endif
+
+#if defined(__AVX2__)
+#  include <immintrin.h>
+#  if defined(_MSC_VER)
+#    include <intrin.h>
+#  endif
+#  define CSV_USE_AVX2 1
+#  define CSV_USE_SSE2 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP>=2)
+#  include <emmintrin.h>
+#  if defined(_MSC_VER)
+#    include <intrin.h>
+#  endif
+#  define CSV_USE_AVX2 0
+#  define CSV_USE_SSE2 1
+#else
+#  define CSV_USE_AVX2 0
+#  define CSV_USE_SSE2 0
+#endif
 
 #ifndef SQLITE_OMIT_VIRTUALTABLE
 
+#if CSV_USE_SSE2
+/* Index of the lowest set bit of a non-zero SIMD compare mask */
+static unsigned int csv_ctz(unsigned int m){
+#if defined(_MSC_VER)
+  unsigned long k;
+  _BitScanForward(&k, m);
+  return (unsigned int)k;
+#else
+  return (unsigned int)__builtin_ctz(m);
+#endif
+}
+#endif
+
 /*
 ** A macro to hint to the compiler that a function should not be
 ** inlined.
@@ -86,6 +142,9 @@ struct CsvReader {
   size_t iIn;            /* Next unread character in the input buffer */
   size_t nIn;            /* Number of characters in the input buffer */
   char *zIn;             /* The input buffer */
+  size_t iEol;           /* Next newline at or after iIn, if known */
+  void *pMap;            /* Memory mapping of the input file, or NULL */
+  int bNoCopy;           /* Unquoted fields may be returned as input slices */
   char zErr[CSV_MXERR];  /* Error message */
 };
 
@@ -99,6 +158,9 @@ static void csv_reader_init(CsvReader *p){
   p->bNotFirst = 0;
   p->nIn = 0;
   p->zIn = 0;
+  p->iEol = 0;
+  p->pMap = 0;
+  p->bNoCopy = 0;
   p->zErr[0] = 0;
 }
 
@@ -108,6 +170,15 @@ static void csv_reader_reset(CsvReader *p){
     fclose(p->in);
     sqlite3_free(p->zIn);
   }
+#if CSV_USE_MMAP
+  if( p->pMap ){
+#if defined(_WIN32) || defined(WIN32)
+    UnmapViewOfFile(p->pMap);
+#else
+    munmap(p->pMap, p->nIn);
+#endif
+  }
+#endif
   sqlite3_free(p->z);
   csv_reader_init(p);
 }
@@ -120,6 +191,58 @@ static void csv_errmsg(CsvReader *p, const char *zFormat, ...){
   va_end(ap);
 }
 
+#if CSV_USE_MMAP
+/* Memory-map the whole file zFilename into p->zIn.  Return 0 on success,
+** or non-zero if the file can't be mapped, in which case the caller falls
+** back to reading the file with fread().  Empty files are never mapped.
+*/
+static int csv_reader_map(CsvReader *p, const char *zFilename){
+#if defined(_WIN32) || defined(WIN32)
+  HANDLE hFile, hMap;
+  LARGE_INTEGER sz;
+  void *pMap = 0;
+  hFile = CreateFileA(zFilename, GENERIC_READ, FILE_SHARE_READ|FILE_SHARE_WRITE,
+                      NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if( hFile==INVALID_HANDLE_VALUE ) return 1;
+  if( GetFileSizeEx(hFile, &sz) && sz.QuadPart>0
+   && (sqlite3_uint64)sz.QuadPart<=(sqlite3_uint64)(((size_t)-1)>>1)
+  ){
+    hMap = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if( hMap!=NULL ){
+      pMap = MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
+      CloseHandle(hMap);
+    }
+  }
+  CloseHandle(hFile);
+  if( pMap==0 ) return 1;
+  p->pMap = pMap;
+  p->zIn = (char*)pMap;
+  p->nIn = (size_t)sz.QuadPart;
+#else
+  struct stat st;
+  void *pMap;
+  int fd = open(zFilename, O_RDONLY);
+  if( fd<0 ) return 1;
+  if( fstat(fd, &st)!=0 || !S_ISREG(st.st_mode) || st.st_size<=0
+   || (sqlite3_uint64)st.st_size>(sqlite3_uint64)(((size_t)-1)>>1)
+  ){
+    close(fd);
+    return 1;
+  }
+  pMap = mmap(0, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if( pMap==MAP_FAILED ) return 1;
+#if defined(MADV_SEQUENTIAL)
+  madvise(pMap, (size_t)st.st_size, MADV_SEQUENTIAL);
+#endif
+  p->pMap = pMap;
+  p->zIn = (char*)pMap;
+  p->nIn = (size_t)st.st_size;
+#endif
+  return 0;
+}
+#endif /* CSV_USE_MMAP */
+
 /* Open the file associated with a CsvReader
 ** Return the number of errors.
 */
@@ -129,6 +252,9 @@ static int csv_reader_open(
   const char *zData           /*  ... or use this data */
 ){
   if( zFilename ){
+#if CSV_USE_MMAP
+    if( csv_reader_map(p, zFilename)==0 ) return 0;
+#endif
     p->zIn = sqlite3_malloc64( CSV_INBUFSZ );
     if( p->zIn==0 ){
       csv_errmsg(p, "out of memory");
@@ -149,6 +275,28 @@ static int csv_reader_open(
   return 0;
 }
 
+/* Return the offset of the next unread character of the input */
+static i64 csv_reader_tell(CsvReader *p){
+  if( p->in==0 ) return (i64)p->iIn;
+  return (i64)ftell(p->in) - (i64)p->nIn + (i64)p->iIn;
+}
+
+/* Position the reader at offset iOff of the input, which is the start
+** of line nLine. */
+static void csv_reader_seek(CsvReader *p, i64 iOff, i64 nLine){
+  if( p->in==0 ){
+    assert( iOff>=0 && (size_t)iOff<=p->nIn );
+    p->iIn = (size_t)iOff;
+    p->iEol = 0;
+  }else{
+    fseek(p->in, (long)iOff, SEEK_SET);
+    p->iIn = 0;
+    p->nIn = 0;
+  }
+  p->nLine = nLine;
+  p->bNotFirst = iOff>0;
+}
+
 /* The input buffer has overflowed.  Refill the input buffer, then
 ** return the next character
 */
@@ -199,12 +347,82 @@ static int csv_append(CsvReader *p, char c){
   return 0;
 }
 
+/* Append n characters of z[] to the CsvReader.z[] array.
+** Return 0 on success and non-zero if there is an OOM error */
+static int csv_append_n(CsvReader *p, const char *z, size_t n){
+  if( n==0 ) return 0;
+  if( p->n+(i64)n>=p->nAlloc ){
+    char *zNew;
+    i64 nNew = p->nAlloc*2 + 100;
+    if( nNew<p->n+(i64)n+1 ) nNew = p->n+(i64)n+1;
+    zNew = sqlite3_realloc64(p->z, nNew);
+    if( zNew==0 ){
+      csv_errmsg(p, "out of memory");
+      return 1;
+    }
+    p->z = zNew;
+    p->nAlloc = nNew;
+  }
+  memcpy(p->z+p->n, z, n);
+  p->n += n;
+  return 0;
+}
+
+/* Return the offset of the first character c or newline in the in-memory
+** input p->zIn[], starting at offset i.  Return p->nIn if there is none.
+*/
+static size_t csv_scan(CsvReader *p, size_t i, char c){
+  const char *z = p->zIn;
+  size_t n = p->nIn;
+#if CSV_USE_SSE2
+  unsigned int m;
+#if CSV_USE_AVX2
+  const __m256i vc32 = _mm256_set1_epi8(c);
+  const __m256i vnl32 = _mm256_set1_epi8('\n');
+#endif
+  const __m128i vc = _mm_set1_epi8(c);
+  const __m128i vnl = _mm_set1_epi8('\n');
+#if CSV_USE_AVX2
+  while( i+32<=n ){
+    __m256i v = _mm256_loadu_si256((const __m256i*)(z+i));
+    m = (unsigned int)_mm256_movemask_epi8(
+          _mm256_or_si256(_mm256_cmpeq_epi8(v, vc32), _mm256_cmpeq_epi8(v, vnl32)));
+    if( m ) return i + csv_ctz(m);
+    i += 32;
+  }
+#endif
+  while( i+16<=n ){
+    __m128i v = _mm_loadu_si128((const __m128i*)(z+i));
+    m = (unsigned int)_mm_movemask_epi8(
+          _mm_or_si128(_mm_cmpeq_epi8(v, vc), _mm_cmpeq_epi8(v, vnl)));
+    if( m ) return i + csv_ctz(m);
+    i += 16;
+  }
+  while( i<n && z[i]!=c && z[i]!='\n' ) i++;
+  return i;
+#else
+  /* Without SIMD, search for c with memchr() up to the next newline.  The
+  ** position of that newline is remembered, so that a line is searched for
+  ** newlines only once. */
+  const char *zHit;
+  if( p->iEol<i || (p->iEol<n && z[p->iEol]!='\n') ){
+    zHit = memchr(z+i, '\n', n-i);
+    p->iEol = zHit ? (size_t)(zHit-z) : n;
+  }
+  zHit = memchr(z+i, c, p->iEol-i);
+  return zHit ? (size_t)(zHit-z) : p->iEol;
+#endif
+}
+
 /* Read a single field of CSV text.  Compatible with rfc4180 and extended
 ** with the option of having a separator other than ",".
 **
 **   +  Input comes from p->in.
 **   +  Store results in p->z of length p->n.  Space to hold p->z comes
-**      from sqlite3_malloc64().
+**      from sqlite3_malloc64().  If p->bNoCopy is set and the input is
+**      held in memory, an unquoted field is not copied; a pointer to the
+**      field text in p->zIn is returned instead, which is not zero
+**      terminated.
 **   +  Keep track of the line number in p->nLine.
 **   +  Store the character that terminates the field in p->cTerm.  Store
 **      EOF on end-of-file.
@@ -225,6 +443,17 @@ static char *csv_read_one_field(CsvReader *p){
     i64 startLine = p->nLine;
     pc = ppc = 0;
     while( 1 ){
+      if( p->in==0 && pc!='"' && p->iIn<p->nIn ){
+        /* Copy a run of characters, which are neither quote nor newline,
+        ** in one go.  None of them needs special treatment here. */
+        size_t iEnd = csv_scan(p, p->iIn, '"');
+        if( iEnd>p->iIn ){
+          if( csv_append_n(p, p->zIn+p->iIn, iEnd-p->iIn) ) return 0;
+          ppc = (iEnd-p->iIn>1) ? ((unsigned char*)p->zIn)[iEnd-2] : pc;
+          pc = ((unsigned char*)p->zIn)[iEnd-1];
+          p->iIn = iEnd;
+        }
+      }
       c = csv_getc(p);
       if( c<='"' || pc=='"' ){
         if( c=='\n' ) p->nLine++;
@@ -274,6 +503,34 @@ static char *csv_read_one_field(CsvReader *p){
         }
       }
     }
+    if( p->in==0 && p->n==0 ){
+      /* The input is held in memory: locate the end of the field at once */
+      size_t iStart = p->iIn - 1;
+      size_t iEnd = csv_scan(p, iStart, ',');
+      size_t n = iEnd - iStart;
+      int bCr = 0;
+      if( iEnd<p->nIn ){
+        c = ((unsigned char*)p->zIn)[iEnd];
+        p->iIn = iEnd + 1;
+      }else{
+        c = EOF;
+        p->iIn = iEnd;
+      }
+      if( c=='\n' ){
+        p->nLine++;
+        bCr = n>0 && p->zIn[iEnd-1]=='\r';
+      }
+      p->cTerm = (char)c;
+      p->bNotFirst = 1;
+      if( p->bNoCopy ){
+        p->n = (i64)(n - bCr);
+        return p->zIn + iStart;
+      }
+      if( csv_append_n(p, p->zIn+iStart, n) ) return 0;
+      p->n -= bCr;
+      if( p->z ) p->z[p->n] = 0;
+      return p->z;
+    }
     while( c>',' || (c!=EOF && c!=',' && c!='\n') ){
       if( csv_append(p, (char)c) ) return 0;
       c = csv_getc(p);
@@ -308,6 +565,18 @@ static int csvtabEof(sqlite3_vtab_cursor*);
 static int csvtabColumn(sqlite3_vtab_cursor*,sqlite3_context*,int);
 static int csvtabRowid(sqlite3_vtab_cursor*,sqlite3_int64*);
 
+/* Largest rowid */
+#define LARGEST_INT64_CSV  (0xffffffff|(((sqlite3_int64)0x7fffffff)<<32))
+
+/* Number of rows per entry of the sparse rowid index */
+#define CSV_ROWIDX_STEP 64
+
+/* An entry of the sparse rowid index: the position where a row starts */
+typedef struct CsvRowMark {
+  i64 iOff;                       /* Offset of the row in the input */
+  i64 nLine;                      /* Line number at that offset */
+} CsvRowMark;
+
 /* An instance of the CSV virtual table */
 typedef struct CsvTable {
   sqlite3_vtab base;              /* Base class.  Must be first */
@@ -316,8 +585,24 @@ typedef struct CsvTable {
   long iStart;                    /* Offset to start of data in zFilename */
   int nCol;                       /* Number of columns in the CSV file */
   unsigned int tstFlags;          /* Bit values used for testing */
+  CsvRowMark *aMark;              /* Start of rows 1, 1+STEP, 1+2*STEP, ... */
+  int nMark;                      /* Number of entries in aMark[] */
+  int nMarkAlloc;                 /* Space allocated for aMark[] */
+  i64 nRow;                       /* Number of rows, or -1 if not yet known */
+  i64 szFile;                     /* Size of zFilename when indexed */
+  i64 tmFile;                     /* Modification time of zFilename */
 } CsvTable;
 
+/* Values of idxNum: which rowid constraints are passed to xFilter, in the
+** order of the arguments */
+#define CSV_IDX_EQ      0x0001    /* rowid = ? */
+#define CSV_IDX_GT      0x0002    /* rowid > ? */
+#define CSV_IDX_GE      0x0004    /* rowid >= ? */
+#define CSV_IDX_LT      0x0008    /* rowid < ? */
+#define CSV_IDX_LE      0x0010    /* rowid <= ? */
+#define CSV_IDX_LIMIT   0x0020    /* LIMIT ? */
+#define CSV_IDX_OFFSET  0x0040    /* OFFSET ? */
+
 /* Allowed values for tstFlags */
 #define CSVTEST_FIDX  0x0001      /* Pretend that constrained search cost less*/
 
@@ -326,8 +611,11 @@ typedef struct CsvCursor {
   sqlite3_vtab_cursor base;       /* Base class.  Must be first */
   CsvReader rdr;                  /* The CsvReader object */
   char **azVal;                   /* Value of the current row */
+  const char **azText;            /* Text of each entry (azVal[] or input) */
   i64 *aLen;                      /* Length of each entry */
+  i64 *anText;                    /* Number of bytes in each azText[] */
   sqlite3_int64 iRowid;           /* The current rowid.  Negative for EOF */
+  sqlite3_int64 iMaxRowid;        /* Stop after this rowid */
 } CsvCursor;
 
 /* Transfer error message text from a reader into a CsvTable */
@@ -343,6 +631,7 @@ static int csvtabDisconnect(sqlite3_vtab *pVtab){
   CsvTable *p = (CsvTable*)pVtab;
   sqlite3_free(p->zFilename);
   sqlite3_free(p->zData);
+  sqlite3_free(p->aMark);
   sqlite3_free(p);
   return SQLITE_OK;
 }
@@ -568,6 +857,7 @@ static int csvtabConnect(
   *ppVtab = (sqlite3_vtab*)pNew;
   if( pNew==0 ) goto csvtab_connect_oom;
   memset(pNew, 0, sizeof(*pNew));
+  pNew->nRow = -1;
   if( CSV_SCHEMA==0 ){
     sqlite3_str *pStr = sqlite3_str_new(0);
     char *zSep = "";
@@ -622,7 +912,7 @@ static int csvtabConnect(
 #endif
   if( bHeader!=1 ){
     pNew->iStart = 0;
-  }else if( pNew->zData ){
+  }else if( sRdr.in==0 ){
     pNew->iStart = (int)sRdr.iIn;
   }else{
     pNew->iStart = (int)(ftell(sRdr.in) - sRdr.nIn + sRdr.iIn);
@@ -674,6 +964,7 @@ static void csvtabCursorRowReset(CsvCursor *pCur){
   for(i=0; i<pTab->nCol; i++){
     sqlite3_free(pCur->azVal[i]);
     pCur->azVal[i] = 0;
+    pCur->azText[i] = 0;
     pCur->aLen[i] = 0;
   }
 }
@@ -692,6 +983,44 @@ static int csvtabCreate(
  return csvtabConnect(db, pAux, argc, argv, ppVtab, pzErr);
 }
 
+/*
+** Discard the sparse rowid index of a CsvTable, if the file changed since
+** the index was built.
+*/
+static void csvtabCheckIndex(CsvTable *pTab){
+  struct stat st;
+  if( pTab->zFilename==0 ) return;
+  if( stat(pTab->zFilename, &st)!=0 ){
+    st.st_size = 0;
+    st.st_mtime = 0;
+  }
+  if( (i64)st.st_size!=pTab->szFile || (i64)st.st_mtime!=pTab->tmFile ){
+    pTab->nMark = 0;
+    pTab->nRow = -1;
+    pTab->szFile = (i64)st.st_size;
+    pTab->tmFile = (i64)st.st_mtime;
+  }
+}
+
+/*
+** Record the position of the row following the pCur->iRowid rows read so
+** far in the sparse rowid index.  The index is optional, so an OOM error
+** just leaves it incomplete.
+*/
+static void csvtabMarkRow(CsvCursor *pCur){
+  CsvTable *pTab = (CsvTable*)pCur->base.pVtab;
+  if( pTab->nMark>=pTab->nMarkAlloc ){
+    int nNew = pTab->nMarkAlloc*2 + 64;
+    CsvRowMark *aNew = sqlite3_realloc64(pTab->aMark, nNew*sizeof(CsvRowMark));
+    if( aNew==0 ) return;
+    pTab->aMark = aNew;
+    pTab->nMarkAlloc = nNew;
+  }
+  pTab->aMark[pTab->nMark].iOff = csv_reader_tell(&pCur->rdr);
+  pTab->aMark[pTab->nMark].nLine = pCur->rdr.nLine;
+  pTab->nMark++;
+}
+
 /*
 ** Destructor for a CsvCursor.
 */
@@ -710,17 +1039,21 @@ static int csvtabOpen(sqlite3_vtab *p, sqlite3_vtab_cursor **ppCursor){
   CsvTable *pTab = (CsvTable*)p;
   CsvCursor *pCur;
   size_t nByte;
-  nByte = sizeof(*pCur) + (sizeof(char*)+sizeof(i64))*pTab->nCol;
+  nByte = sizeof(*pCur) + (sizeof(char*)+sizeof(i64))*2*pTab->nCol;
   pCur = sqlite3_malloc64( nByte );
   if( pCur==0 ) return SQLITE_NOMEM;
   memset(pCur, 0, nByte);
   pCur->azVal = (char**)&pCur[1];
-  pCur->aLen = (i64*)&pCur->azVal[pTab->nCol];
+  pCur->azText = (const char**)&pCur->azVal[pTab->nCol];
+  pCur->aLen = (i64*)&pCur->azText[pTab->nCol];
+  pCur->anText = &pCur->aLen[pTab->nCol];
   *ppCursor = &pCur->base;
   if( csv_reader_open(&pCur->rdr, pTab->zFilename, pTab->zData) ){
     csv_xfer_error(pTab, &pCur->rdr);
     return SQLITE_ERROR;
   }
+  pCur->rdr.bNoCopy = 1;
+  csvtabCheckIndex(pTab);
   return SQLITE_OK;
 }
 
@@ -733,39 +1066,56 @@ static int csvtabNext(sqlite3_vtab_cursor *cur){
   CsvCursor *pCur = (CsvCursor*)cur;
   CsvTable *pTab = (CsvTable*)cur->pVtab;
   int i = 0;
+  int rc = SQLITE_OK;
   char *z;
+  if( pCur->iRowid==(i64)pTab->nMark*CSV_ROWIDX_STEP && pTab->nRow<0 ){
+    csvtabMarkRow(pCur);
+  }
   do{
     z = csv_read_one_field(&pCur->rdr);
     if( z==0 ){
       break;
     }
     if( i<pTab->nCol ){
+      if( z!=pCur->rdr.z ){
+        /* A slice of the in-memory input, valid until the cursor closes */
+        pCur->azText[i] = z;
+        pCur->anText[i] = pCur->rdr.n;
+        i++;
+        continue;
+      }
       if( pCur->aLen[i] < pCur->rdr.n+1 ){
         char *zNew = sqlite3_realloc64(pCur->azVal[i], pCur->rdr.n+1);
         if( zNew==0 ){
           csv_errmsg(&pCur->rdr, "out of memory");
           csv_xfer_error(pTab, &pCur->rdr);
+          rc = SQLITE_NOMEM;
           break;
         }
         pCur->azVal[i] = zNew;
         pCur->aLen[i] = pCur->rdr.n+1;
       }
       memcpy(pCur->azVal[i], z, pCur->rdr.n+1);
+      pCur->azText[i] = pCur->azVal[i];
+      pCur->anText[i] = pCur->rdr.n;
       i++;
     }
   }while( pCur->rdr.cTerm==',' );
   if( z==0 && i==0 ){
+    if( pCur->rdr.zErr[0]==0 ) pTab->nRow = pCur->iRowid;
     pCur->iRowid = -1;
   }else{
     pCur->iRowid++;
     while( i<pTab->nCol ){
       sqlite3_free(pCur->azVal[i]);
       pCur->azVal[i] = 0;
+      pCur->azText[i] = 0;
       pCur->aLen[i] = 0;
       i++;
     }
+    if( pCur->iRowid>pCur->iMaxRowid ) pCur->iRowid = -1;
   }
-  return SQLITE_OK;
+  return rc;
 }
 
 /*
@@ -779,8 +1129,9 @@ static int csvtabColumn(
 ){
   CsvCursor *pCur = (CsvCursor*)cur;
   CsvTable *pTab = (CsvTable*)cur->pVtab;
-  if( i>=0 && i<pTab->nCol && pCur->azVal[i]!=0 ){
-    sqlite3_result_text(ctx, pCur->azVal[i], -1, SQLITE_TRANSIENT);
+  if( i>=0 && i<pTab->nCol && pCur->azText[i]!=0 ){
+    sqlite3_result_text64(ctx, pCur->azText[i], (sqlite3_uint64)pCur->anText[i],
+                          SQLITE_TRANSIENT, SQLITE_UTF8);
   }
   return SQLITE_OK;
 }
@@ -804,8 +1155,65 @@ static int csvtabEof(sqlite3_vtab_cursor *cur){
 }
 
 /*
-** Only a full table scan is supported.  So xFilter simply rewinds to
-** the beginning.
+** Narrow the rowid range [*piFirst, *piLast] by the constraint "rowid OP pVal".
+** Values that are not numeric leave the range as it is; the constraints
+** are not omitted, so SQLite checks them again anyway.
+*/
+static void csv_rowid_constraint(
+  sqlite3_value *pVal,
+  int op,
+  sqlite3_int64 *piFirst,
+  sqlite3_int64 *piLast
+){
+  sqlite3_int64 v;
+  int eType = sqlite3_value_numeric_type(pVal);
+  if( eType==SQLITE_FLOAT ){
+    double r = sqlite3_value_double(pVal);
+    if( r<-9.0e18 ) r = -9.0e18;
+    if( r>9.0e18 ) r = 9.0e18;
+    v = (sqlite3_int64)r;
+    if( (double)v!=r ){
+      /* Not integral: round towards the values satisfying the constraint */
+      if( op==SQLITE_INDEX_CONSTRAINT_EQ ){
+        *piFirst = 1;
+        *piLast = 0;
+        return;
+      }
+      if( r>0.0 && (op==SQLITE_INDEX_CONSTRAINT_GE
+                    || op==SQLITE_INDEX_CONSTRAINT_LT) ) v++;
+      if( r<0.0 && (op==SQLITE_INDEX_CONSTRAINT_GT
+                    || op==SQLITE_INDEX_CONSTRAINT_LE) ) v--;
+    }
+  }else if( eType==SQLITE_INTEGER ){
+    v = sqlite3_value_int64(pVal);
+  }else{
+    return;
+  }
+  switch( op ){
+    case SQLITE_INDEX_CONSTRAINT_EQ:
+      if( v>*piFirst ) *piFirst = v;
+      if( v<*piLast ) *piLast = v;
+      break;
+    case SQLITE_INDEX_CONSTRAINT_GT:
+      if( v>=*piFirst ) *piFirst = (v<LARGEST_INT64_CSV) ? v+1 : v;
+      if( v==LARGEST_INT64_CSV ) *piLast = 0;
+      break;
+    case SQLITE_INDEX_CONSTRAINT_GE:
+      if( v>*piFirst ) *piFirst = v;
+      break;
+    case SQLITE_INDEX_CONSTRAINT_LT:
+      if( v<=*piLast ) *piLast = (v>0) ? v-1 : 0;
+      break;
+    case SQLITE_INDEX_CONSTRAINT_LE:
+      if( v<*piLast ) *piLast = v;
+      break;
+  }
+}
+
+/*
+** Start a scan of the rows with rowids in the range given by the
+** constraints of idxNum.  The scan starts at the closest preceding entry
+** of the sparse rowid index, which is extended as rows are read.
 */
 static int csvtabFilter(
   sqlite3_vtab_cursor *pVtabCursor,
@@ -814,39 +1222,111 @@ static int csvtabFilter(
 ){
   CsvCursor *pCur = (CsvCursor*)pVtabCursor;
   CsvTable *pTab = (CsvTable*)pVtabCursor->pVtab;
-  pCur->iRowid = 0;
+  sqlite3_int64 iFirst = 1;
+  sqlite3_int64 iLast = LARGEST_INT64_CSV;
+  sqlite3_int64 nLimit = -1;
+  int iArg = 0;
+  int iMark;
+  int rc;
 
   /* Ensure the field buffer is always allocated. Otherwise, if the
   ** first field is zero bytes in size, this may be mistaken for an OOM
   ** error in csvtabNext(). */
   if( csv_append(&pCur->rdr, 0) ) return SQLITE_NOMEM;
 
+  if( idxNum & CSV_IDX_EQ ){
+    csv_rowid_constraint(argv[iArg++], SQLITE_INDEX_CONSTRAINT_EQ, &iFirst, &iLast);
+  }
+  if( idxNum & CSV_IDX_GT ){
+    csv_rowid_constraint(argv[iArg++], SQLITE_INDEX_CONSTRAINT_GT, &iFirst, &iLast);
+  }
+  if( idxNum & CSV_IDX_GE ){
+    csv_rowid_constraint(argv[iArg++], SQLITE_INDEX_CONSTRAINT_GE, &iFirst, &iLast);
+  }
+  if( idxNum & CSV_IDX_LT ){
+    csv_rowid_constraint(argv[iArg++], SQLITE_INDEX_CONSTRAINT_LT, &iFirst, &iLast);
+  }
+  if( idxNum & CSV_IDX_LE ){
+    csv_rowid_constraint(argv[iArg++], SQLITE_INDEX_CONSTRAINT_LE, &iFirst, &iLast);
+  }
+  if( idxNum & CSV_IDX_LIMIT ){
+    nLimit = sqlite3_value_int64(argv[iArg++]);
+  }
+  if( idxNum & CSV_IDX_OFFSET ){
+    /* OFFSET is only consumed if there are no other constraints */
+    sqlite3_int64 nOffset = sqlite3_value_int64(argv[iArg++]);
+    if( nOffset>0 ){
+      iFirst = (nOffset<LARGEST_INT64_CSV) ? nOffset+1 : LARGEST_INT64_CSV;
+    }
+  }
+  if( nLimit>=0 && nLimit<=LARGEST_INT64_CSV-iFirst ){
+    iLast = iFirst + nLimit - 1;
+  }
+  assert( iArg==argc );
+
+  if( iFirst<1 ) iFirst = 1;
+  pCur->iMaxRowid = iLast;
+  if( iFirst>iLast || (pTab->nRow>=0 && iFirst>pTab->nRow) ){
+    pCur->iRowid = -1;
+    return SQLITE_OK;
+  }
+
   if( pCur->rdr.in==0 ){
-    assert( pCur->rdr.zIn==pTab->zData );
+    assert( pCur->rdr.zIn==pTab->zData || pCur->rdr.pMap!=0 );
     assert( pTab->iStart>=0 );
     assert( (size_t)pTab->iStart<=pCur->rdr.nIn );
-    pCur->rdr.iIn = pTab->iStart;
+  }
+  iMark = pTab->nMark - 1;
+  if( (iFirst-1)/CSV_ROWIDX_STEP<iMark ){
+    iMark = (int)((iFirst-1)/CSV_ROWIDX_STEP);
+  }
+  if( iMark>=0 ){
+    csv_reader_seek(&pCur->rdr, pTab->aMark[iMark].iOff,
+                    pTab->aMark[iMark].nLine);
+    pCur->iRowid = (sqlite3_int64)iMark*CSV_ROWIDX_STEP;
   }else{
-    fseek(pCur->rdr.in, pTab->iStart, SEEK_SET);
-    pCur->rdr.iIn = 0;
-    pCur->rdr.nIn = 0;
+    csv_reader_seek(&pCur->rdr, pTab->iStart, 0);
+    pCur->iRowid = 0;
   }
-  return csvtabNext(pVtabCursor);
+  do{
+    rc = csvtabNext(pVtabCursor);
+  }while( rc==SQLITE_OK && pCur->iRowid>0 && pCur->iRowid<iFirst );
+  return rc;
 }
 
 /*
-** Only a forward full table scan is supported.  xBestIndex is mostly
-** a no-op.  If CSVTEST_FIDX is set, then the presence of equality
-** constraints lowers the estimated cost, which is fiction, but is useful
-** for testing certain kinds of virtual table behavior.
+** Constraints on the rowid are passed to xFilter, which uses the sparse
+** rowid index to start the scan close to the first requested row.  OFFSET
+** (and LIMIT) are consumed as well if there are no other constraints and
+** no ORDER BY other than rowid ascending.
+** Rows are always returned in rowid order.  If CSVTEST_FIDX is set, then
+** the presence of equality constraints lowers the estimated cost, which is
+** fiction, but is useful for testing certain kinds of virtual table
+** behavior.
 */
 static int csvtabBestIndex(
   sqlite3_vtab *tab,
   sqlite3_index_info *pIdxInfo
 ){
+  CsvTable *pTab = (CsvTable*)tab;
+  int iEq = -1, iLower = -1, iUpper = -1, iLimit = -1, iOffset = -1;
+  int nOther = 0;
+  int idxNum = 0;
+  int nArg = 0;
+  int bInOrder = pIdxInfo->nOrderBy==0;
+  int i;
+
   pIdxInfo->estimatedCost = 1000000;
+  if( pTab->nRow>=0 ) pIdxInfo->estimatedRows = pTab->nRow;
+  if( pIdxInfo->nOrderBy==1
+   && pIdxInfo->aOrderBy[0].iColumn<0
+   && pIdxInfo->aOrderBy[0].desc==0
+  ){
+    pIdxInfo->orderByConsumed = 1;
+    bInOrder = 1;
+  }
 #ifdef SQLITE_TEST
-  if( (((CsvTable*)tab)->tstFlags & CSVTEST_FIDX)!=0 ){
+  if( (pTab->tstFlags & CSVTEST_FIDX)!=0 ){
     /* The usual (and sensible) case is to always do a full table scan.
     ** The code in this branch only runs when testflags=1.  This code
     ** generates an artifical and unrealistic plan which is useful
@@ -858,7 +1338,6 @@ static int csvtabBestIndex(
     ** as omittable, however, so the query planner should still generate a
     ** plan that gives a correct answer, even if they plan is not optimal.
     */
-    int i;
     int nConst = 0;
     for(i=0; i<pIdxInfo->nConstraint; i++){
       unsigned char op;
@@ -873,12 +1352,71 @@ static int csvtabBestIndex(
         nConst++;
       }
     }
+    return SQLITE_OK;
   }
 #endif
+  for(i=0; i<pIdxInfo->nConstraint; i++){
+    const struct sqlite3_index_constraint *pCons = &pIdxInfo->aConstraint[i];
+    if( pCons->op==SQLITE_INDEX_CONSTRAINT_LIMIT ){
+      if( pCons->usable ) iLimit = i;
+      continue;
+    }
+    if( pCons->op==SQLITE_INDEX_CONSTRAINT_OFFSET ){
+      if( pCons->usable ) iOffset = i;
+      continue;
+    }
+    nOther++;
+    if( pCons->usable==0 || pCons->iColumn>=0 ) continue;
+    switch( pCons->op ){
+      case SQLITE_INDEX_CONSTRAINT_EQ:
+        if( iEq<0 ) iEq = i;
+        break;
+      case SQLITE_INDEX_CONSTRAINT_GT:
+      case SQLITE_INDEX_CONSTRAINT_GE:
+        if( iLower<0 ) iLower = i;
+        break;
+      case SQLITE_INDEX_CONSTRAINT_LT:
+      case SQLITE_INDEX_CONSTRAINT_LE:
+        if( iUpper<0 ) iUpper = i;
+        break;
+    }
+  }
+  if( iEq>=0 ){
+    idxNum = CSV_IDX_EQ;
+    pIdxInfo->aConstraintUsage[iEq].argvIndex = ++nArg;
+    pIdxInfo->estimatedCost = CSV_ROWIDX_STEP;
+    pIdxInfo->estimatedRows = 1;
+    pIdxInfo->idxFlags |= SQLITE_INDEX_SCAN_UNIQUE;
+  }else if( iLower>=0 || iUpper>=0 ){
+    if( iLower>=0 ){
+      idxNum |= (pIdxInfo->aConstraint[iLower].op==SQLITE_INDEX_CONSTRAINT_GT)
+                  ? CSV_IDX_GT : CSV_IDX_GE;
+      pIdxInfo->aConstraintUsage[iLower].argvIndex = ++nArg;
+      pIdxInfo->estimatedCost /= 2;
+    }
+    if( iUpper>=0 ){
+      idxNum |= (pIdxInfo->aConstraint[iUpper].op==SQLITE_INDEX_CONSTRAINT_LT)
+                  ? CSV_IDX_LT : CSV_IDX_LE;
+      pIdxInfo->aConstraintUsage[iUpper].argvIndex = ++nArg;
+      pIdxInfo->estimatedCost /= 2;
+    }
+    if( pTab->nRow>=0 ) pIdxInfo->estimatedRows = pTab->nRow/4 + 1;
+  }else if( nOther==0 && iOffset>=0 && bInOrder ){
+    /* LIMIT and OFFSET count rows in the order of the result, which is
+    ** the rowid order only if there is no ORDER BY or if it was consumed */
+    if( iLimit>=0 ){
+      idxNum |= CSV_IDX_LIMIT;
+      pIdxInfo->aConstraintUsage[iLimit].argvIndex = ++nArg;
+    }
+    idxNum |= CSV_IDX_OFFSET;
+    pIdxInfo->aConstraintUsage[iOffset].argvIndex = ++nArg;
+    pIdxInfo->aConstraintUsage[iOffset].omit = 1;
+    pIdxInfo->estimatedCost /= 2;
+  }
+  pIdxInfo->idxNum = idxNum;
   return SQLITE_OK;
 }
 
-
 static sqlite3_module CsvModule = {
   0,                       /* iVersion */
   csvtabCreate,            /* xCreate */
@@ -144,79 +144,16 @@ SQLITE_EXTENSION_INIT1
 #include <stdlib.h>
 #include <assert.h>
 
-#ifndef _MAP_H_
-#define _MAP_H_
-
-#if 0
-#if !defined(SQLITE_OS_WIN) || !defined(_MSC_VER)
-#include <stdint.h>
-#else
-typedef signed char int8_t;
-typedef unsigned char uint8_t;
-typedef signed int int16_t;
-typedef unsigned int uint16_t;
-typedef signed long int int32_t;
-typedef unsigned long int uint32_t;
-typedef signed __int64 int64_t;
-typedef unsigned __int64 uint64_t;
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP>=2)
+#include <emmintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
 #endif
+#define EXTFUNC_USE_SSE2 1
+#else
+#define EXTFUNC_USE_SSE2 0
 #endif
 
-/*
-** Simple binary tree implementation to use in median, mode and quartile calculations
-** Tree is not necessarily balanced. That would require something like red&black trees of AVL
-*/
-
-typedef int(*cmp_func)(const void *, const void *);
-typedef void(*map_iterator)(void*, i64, void*);
-
-typedef struct node{
-  struct node *l;
-  struct node *r;
-  void* data;
-  i64   count;
-} node;
-
-typedef struct map{
-  node *base;
-  cmp_func cmp;
-  short free;
-} map;
-
-/*
-** creates a map given a comparison function
-*/
-static map map_make(cmp_func cmp);
-
-/*
-** inserts the element e into map m
-*/
-static void map_insert(map *m, void *e);
-
-/*
-** executes function iter over all elements in the map, in key increasing order
-*/
-static void map_iterate(map *m, map_iterator iter, void* p);
-
-/*
-** frees all memory used by a map
-*/
-static void map_destroy(map *m);
-
-/*
-** compares 2 integers
-** to use with map_make
-*/
-static int int_cmp(const void *a, const void *b);
-
-/*
-** compares 2 doubles
-** to use with map_make
-*/
-static int double_cmp(const void *a, const void *b);
-
-#endif /* _MAP_H_ */
-
 static char *sqlite3StrDup( const char *z ) {
     char *res = sqlite3_malloc( (int) (strlen(z)+1) );
     return strcpy( res, z );
@@ -1017,52 +954,119 @@ static void strfilterFunc(sqlite3_context *context, int argc, sqlite3_value **ar
   }
 }
 
+#if EXTFUNC_USE_SSE2
+/*
+** Index of the lowest set bit of a non-zero SIMD compare mask
+*/
+static unsigned int extfunc_ctz(unsigned int m){
+#if defined(_MSC_VER)
+  unsigned long k;
+  _BitScanForward(&k, m);
+  return (unsigned int)k;
+#else
+  return (unsigned int)__builtin_ctz(m);
+#endif
+}
+#endif
+
+/*
+** Returns a pointer to the first occurence of the n2 bytes z2 (n2>0) in
+** the n1 bytes z1, or NULL if there is none.
+** Candidate positions are found by comparing the first and the last byte
+** of z2 for 16 positions at once (SSE2), or by memchr() for the first byte,
+** and only then the remaining bytes are compared.
+** This is an auxiliary function.
+*/
+static const char *_memfind(const char *z1, size_t n1, const char *z2, size_t n2){
+  const char *zLast;   /* last position where a match could start */
+
+  if( n2>n1 ){
+    return 0;
+  }
+  zLast = z1 + (n1-n2);
+
+#if EXTFUNC_USE_SSE2
+  if( n2>1 ){
+    const __m128i vFirst = _mm_set1_epi8(z2[0]);
+    const __m128i vLast = _mm_set1_epi8(z2[n2-1]);
+    while( zLast-z1>=15 ){
+      __m128i a = _mm_loadu_si128((const __m128i*)z1);
+      __m128i b = _mm_loadu_si128((const __m128i*)(z1+n2-1));
+      unsigned int m = (unsigned int)_mm_movemask_epi8(
+          _mm_and_si128(_mm_cmpeq_epi8(a, vFirst), _mm_cmpeq_epi8(b, vLast)));
+      while( m ){
+        unsigned int k = extfunc_ctz(m);
+        if( memcmp(z1+k+1, z2+1, n2-2)==0 ){
+          return z1+k;
+        }
+        m &= m-1;
+      }
+      z1 += 16;
+    }
+  }
+#endif
+
+  while( z1<=zLast ){
+    z1 = (const char*)memchr(z1, z2[0], (size_t)(zLast-z1)+1);
+    if( z1==0 ){
+      return 0;
+    }
+    if( memcmp(z1+1, z2+1, n2-1)==0 ){
+      return z1;
+    }
+    z1++;
+  }
+  return 0;
+}
+
 /*
 ** Given a string z1, retutns the (0 based) index of it's first occurence
 ** in z2 after the first s characters.
 ** Returns -1 when there isn't a match.
 ** updates p to point to the character where the match occured.
+** The search works on the UTF-8 bytes; only matches starting at a character
+** boundary count, and the byte offset is converted to a character index
+** at the end.
 ** This is an auxiliary function.
 */
 static int _substr(const char* z1, const char* z2, int s, const char** p){
   int c = 0;
-  int rVal=-1;
-  const char* zt1;
-  const char* zt2;
-  int c1,c2;
+  const char* zStart;
+  const char* zEnd;
+  const char* zt;
+  size_t n1;
 
   if( '\0'==*z1 ){
     return -1;
   }
 
-  while( (sqliteCharVal((unsigned char *)z2) != 0) && (c++)<s){
+  while( *z2!=0 && (c++)<s ){
     sqliteNextChar(z2);
   }
 
-  c = 0;
-  while( (sqliteCharVal((unsigned char *)z2)) != 0 ){
-    zt1 = z1;
-    zt2 = z2;
-
-    do{
-      c1 = sqliteCharVal((unsigned char *)zt1);
-      c2 = sqliteCharVal((unsigned char *)zt2);
-      sqliteNextChar(zt1);
-      sqliteNextChar(zt2);
-    }while( c1 == c2 && c1 != 0 && c2 != 0 );
-
-    if( c1 == 0 ){
-      rVal = c;
-      break;
+  n1 = strlen(z1);
+  zStart = z2;
+  zEnd = z2 + strlen(z2);
+  zt = _memfind(zStart, zEnd-zStart, z1, n1);
+  while( zt && zt>zStart && (0xc0&*zt)==0x80 ){
+    zt = _memfind(zt+1, zEnd-(zt+1), z1, n1);
+  }
+  if( zt==0 ){
+    if(p){
+      *p=zEnd;
     }
+    return -1;
+  }
 
-    sqliteNextChar(z2);
-    ++c;
+  /* count the characters preceding the match */
+  c = 0;
+  for(z2=zStart+1; z2<=zt; z2++){
+    if( (0xc0&*z2)!=0x80 ) ++c;
   }
   if(p){
-    *p=z2;
+    *p=zt;
   }
-  return rVal >=0 ? rVal+s : rVal;
+  return c+s;
 }
 
 /*
@@ -1394,47 +1398,134 @@ static void reverseFunc(sqlite3_context *context, int argc, sqlite3_value **argv
   sqlite3_free(rz);
 }
 
+/*
+** A double-double number, the unevaluated sum hi+lo with |lo| at most
+** half an ulp of hi, which gives about 106 bits of precision.
+*/
+typedef struct DoubleDouble DoubleDouble;
+struct DoubleDouble {
+  double hi;
+  double lo;
+};
+
 /*
 ** An instance of the following structure holds the context of a
 ** stdev() or variance() aggregate computation.
 ** implementaion of http://en.wikipedia.org/wiki/Algorithms_for_calculating_variance#Algorithm_II
 ** less prone to rounding errors
+** The mean and the sum of squared differences are kept as double-double
+** numbers, so that removing values from a window frame (in particular
+** large outliers) does not leave the rounding errors of the removed
+** values behind.
 */
 typedef struct StdevCtx StdevCtx;
 struct StdevCtx {
-  double rM;
-  double rS;
+  DoubleDouble rM;
+  DoubleDouble rS;
   i64 cnt;          /* number of elements */
 };
 
+/*
+** A value collected by a mode(), median() or quartile aggregate computation.
+** Which member is valid depends on ModeCtx.is_double.
+*/
+typedef union ModeValue ModeValue;
+union ModeValue {
+  i64 i;
+  double d;
+};
+
 /*
 ** An instance of the following structure holds the context of a
 ** mode() or median() aggregate computation.
-** Depends on structures defined in map.c (see map & map)
+** median() and the quartiles collect the values in a contiguous array and
+** pick the requested order statistics by selection when finalized.
+** mode() counts the occurrences of each distinct value in an open
+** addressing hash table, where a[] holds the keys and aCount[] the counts
+** (0 marking an empty slot).
 ** These aggregate functions only work for integers and floats although
 ** they could be made to work for strings. This is usually considered meaningless.
 ** Only usuall order (for median), no use of collation functions (would this even make sense?)
 */
 typedef struct ModeCtx ModeCtx;
 struct ModeCtx {
-  i64 riM;            /* integer value found so far */
-  double rdM;         /* double value found so far */
   i64 cnt;            /* number of elements so far */
-  double pcnt;        /* number of elements smaller than a percentile */
-  i64 mcnt;           /* maximum number of occurrences (for mode) */
-  i64 mn;             /* number of occurrences (for mode and percentiles) */
-  i64 is_double;      /* whether the computation is being done for doubles (>0) or integers (=0) */
-  map* m;             /* map structure used for the computation */
-  int done;           /* whether the answer has been found */
+  i64 nDistinct;      /* number of distinct values (for mode) */
+  i64 nAlloc;         /* number of allocated entries in a[] */
+  int is_double;      /* whether the computation is being done for doubles (>0) or integers (=0) */
+  ModeValue *a;       /* values (for percentiles) or hash slots (for mode) */
+  i64 *aCount;        /* occurrences of the value in each hash slot (for mode) */
 };
 
+#define MODE_LT(bDouble, X, Y) ((bDouble) ? (X).d<(Y).d : (X).i<(Y).i)
+#define MODE_EQ(bDouble, X, Y) ((bDouble) ? (X).d==(Y).d : (X).i==(Y).i)
+
+/*
+** Error-free transformations of a sum and a product of two doubles
+** (Knuth's TwoSum and Dekker's TwoProduct)
+*/
+static DoubleDouble ddTwoSum(double a, double b){
+  DoubleDouble r;
+  double t;
+  r.hi = a + b;
+  t = r.hi - a;
+  r.lo = (a - (r.hi - t)) + (b - t);
+  return r;
+}
+
+static DoubleDouble ddNormalize(double hi, double lo){
+  DoubleDouble r;
+  r.hi = hi + lo;
+  r.lo = lo - (r.hi - hi);
+  return r;
+}
+
+static DoubleDouble ddTwoProduct(double a, double b){
+  const double split = 134217729.0;   /* 2^27+1 */
+  DoubleDouble r;
+  double t, aHi, aLo, bHi, bLo;
+  t = split*a;
+  aHi = t - (t - a);
+  aLo = a - aHi;
+  t = split*b;
+  bHi = t - (t - b);
+  bLo = b - bHi;
+  r.hi = a*b;
+  r.lo = ((aHi*bHi - r.hi) + aHi*bLo + aLo*bHi) + aLo*bLo;
+  return r;
+}
+
+/*
+** Double-double arithmetic: a+b, x-a, a*b and a/n
+*/
+static DoubleDouble ddAdd(DoubleDouble a, DoubleDouble b){
+  DoubleDouble r = ddTwoSum(a.hi, b.hi);
+  return ddNormalize(r.hi, r.lo + (a.lo + b.lo));
+}
+
+static DoubleDouble ddSubFrom(double x, DoubleDouble a){
+  DoubleDouble r = ddTwoSum(x, -a.hi);
+  return ddNormalize(r.hi, r.lo - a.lo);
+}
+
+static DoubleDouble ddMul(DoubleDouble a, DoubleDouble b){
+  DoubleDouble r = ddTwoProduct(a.hi, b.hi);
+  return ddNormalize(r.hi, r.lo + (a.hi*b.lo + a.lo*b.hi));
+}
+
+static DoubleDouble ddDiv(DoubleDouble a, double n){
+  double q = a.hi/n;
+  DoubleDouble r = ddTwoProduct(q, n);
+  return ddNormalize(q, (((a.hi - r.hi) - r.lo) + a.lo)/n);
+}
+
 /*
 ** called for each value received during a calculation of stdev or variance
 */
 static void varianceStep(sqlite3_context *context, int argc, sqlite3_value **argv){
   StdevCtx *p;
 
-  double delta;
+  DoubleDouble delta;
   double x;
 
   assert( argc==1 );
@@ -1443,21 +1534,129 @@ static void varianceStep(sqlite3_context *context, int argc, sqlite3_value **arg
   if( SQLITE_NULL != sqlite3_value_numeric_type(argv[0]) ){
     p->cnt++;
     x = sqlite3_value_double(argv[0]);
-    delta = (x-p->rM);
-    p->rM += delta/p->cnt;
-    p->rS += delta*(x-p->rM);
+    delta = ddSubFrom(x, p->rM);
+    p->rM = ddAdd(p->rM, ddDiv(delta, (double)p->cnt));
+    p->rS = ddAdd(p->rS, ddMul(delta, ddSubFrom(x, p->rM)));
+  }
+}
+
+/*
+** called for each value leaving the frame when stdev or variance is used
+** as a window function; reverses the update of varianceStep
+*/
+static void varianceInverse(sqlite3_context *context, int argc, sqlite3_value **argv){
+  StdevCtx *p;
+
+  DoubleDouble delta;
+  double x;
+
+  assert( argc==1 );
+  p = sqlite3_aggregate_context(context, sizeof(*p));
+  /* only consider non-null values */
+  if( p && SQLITE_NULL != sqlite3_value_numeric_type(argv[0]) ){
+    p->cnt--;
+    if( p->cnt<=0 ){
+      /* start over exactly, discarding accumulated rounding errors */
+      memset(p, 0, sizeof(*p));
+    }else{
+      x = sqlite3_value_double(argv[0]);
+      delta = ddSubFrom(x, p->rM);
+      delta.hi = -delta.hi;
+      delta.lo = -delta.lo;
+      p->rM = ddAdd(p->rM, ddDiv(delta, (double)p->cnt));
+      p->rS = ddAdd(p->rS, ddMul(delta, ddSubFrom(x, p->rM)));
+    }
+  }
+}
+
+/*
+** Converts the non-null value pArg of numeric type 'type' for the
+** aggregate p. The type of the first value determines whether the
+** computation is done for integers or for doubles.
+*/
+static ModeValue modeValue(ModeCtx *p, int type, sqlite3_value *pArg){
+  ModeValue x;
+  if( p->cnt==0 ){
+    p->is_double = (type!=SQLITE_INTEGER);
+  }
+  if( 0==p->is_double ){
+    x.i = sqlite3_value_int64(pArg);
+  }else{
+    x.d = sqlite3_value_double(pArg);
   }
+  return x;
 }
 
 /*
-** called for each value received during a calculation of mode of median
+** Hash function for the mode() hash table.
+** 0.0 and -0.0 compare equal, so they have to hash alike.
+*/
+static sqlite3_uint64 modeHash(ModeValue x, int bDouble){
+  sqlite3_uint64 h;
+  if( bDouble && x.d==0.0 ){
+    h = 0;
+  }else{
+    h = (sqlite3_uint64)x.i;
+  }
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+/*
+** Returns the slot of value x in the mode() hash table, or the empty
+** slot where it has to be inserted.
+*/
+static i64 modeFind(ModeCtx *p, ModeValue x){
+  i64 mask = p->nAlloc-1;
+  i64 i = (i64)(modeHash(x, p->is_double) & (sqlite3_uint64)mask);
+  while( p->aCount[i]!=0 && !MODE_EQ(p->is_double, p->a[i], x) ){
+    i = (i+1) & mask;
+  }
+  return i;
+}
+
+/*
+** Doubles the size of the mode() hash table.
+** Returns SQLITE_NOMEM if the memory could not be allocated.
+*/
+static int modeGrow(ModeCtx *p){
+  ModeValue *aOld = p->a;
+  i64 *aOldCount = p->aCount;
+  i64 nOld = p->nAlloc;
+  i64 nNew = nOld ? nOld*2 : 64;
+  i64 i;
+  sqlite3_uint64 nByte = nNew*(sizeof(ModeValue)+sizeof(i64));
+
+  p->a = (ModeValue*)sqlite3_malloc64(nByte);
+  if( p->a==0 ){
+    p->a = aOld;
+    return SQLITE_NOMEM;
+  }
+  memset(p->a, 0, (size_t)nByte);
+  p->aCount = (i64*)&p->a[nNew];
+  p->nAlloc = nNew;
+  for(i=0; i<nOld; i++){
+    if( aOldCount[i]!=0 ){
+      i64 j = modeFind(p, aOld[i]);
+      p->a[j] = aOld[i];
+      p->aCount[j] = aOldCount[i];
+    }
+  }
+  sqlite3_free(aOld);
+  return SQLITE_OK;
+}
+
+/*
+** called for each value received during a calculation of mode
 */
 static void modeStep(sqlite3_context *context, int argc, sqlite3_value **argv){
   ModeCtx *p;
-  i64 xi=0;
-  double xd=0.0;
-  i64 *iptr;
-  double *dptr;
+  ModeValue x;
+  i64 i;
   int type;
 
   assert( argc==1 );
@@ -1467,145 +1666,201 @@ static void modeStep(sqlite3_context *context, int argc, sqlite3_value **argv){
     return;
 
   p = sqlite3_aggregate_context(context, sizeof(*p));
-
-  if( 0==(p->m) ){
-    p->m = calloc(1, sizeof(map));
-    if( type==SQLITE_INTEGER ){
-      /* map will be used for integers */
-      *(p->m) = map_make(int_cmp);
-      p->is_double = 0;
-    }else{
-      p->is_double = 1;
-      /* map will be used for doubles */
-      *(p->m) = map_make(double_cmp);
-    }
+  if( p==0 ){
+    sqlite3_result_error_nomem(context);
+    return;
   }
 
-  ++(p->cnt);
-
-  if( 0==p->is_double ){
-    xi = sqlite3_value_int64(argv[0]);
-    iptr = (i64*)calloc(1,sizeof(i64));
-    *iptr = xi;
-    map_insert(p->m, iptr);
-  }else{
-    xd = sqlite3_value_double(argv[0]);
-    dptr = (double*)calloc(1,sizeof(double));
-    *dptr = xd;
-    map_insert(p->m, dptr);
+  x = modeValue(p, type, argv[0]);
+  /* keep the load factor of the hash table at most 1/2 */
+  if( p->nDistinct*2>=p->nAlloc && modeGrow(p)!=SQLITE_OK ){
+    sqlite3_result_error_nomem(context);
+    return;
   }
+  i = modeFind(p, x);
+  if( p->aCount[i]==0 ){
+    p->a[i] = x;
+    ++p->nDistinct;
+  }
+  ++p->aCount[i];
+  ++p->cnt;
 }
 
 /*
-**  Auxiliary function that iterates all elements in a map and finds the mode
-**  (most frequent value)
+** called for each value received during a calculation of median or quartiles
 */
-static void modeIterate(void* e, i64 c, void* pp){
-  i64 ei;
-  double ed;
-  ModeCtx *p = (ModeCtx*)pp;
+static void medianStep(sqlite3_context *context, int argc, sqlite3_value **argv){
+  ModeCtx *p;
+  ModeValue x;
+  int type;
 
-  if( 0==p->is_double ){
-    ei = *(int*)(e);
-
-    if( p->mcnt==c ){
-      ++p->mn;
-    }else if( p->mcnt<c ){
-      p->riM = ei;
-      p->mcnt = c;
-      p->mn=1;
-    }
-  }else{
-    ed = *(double*)(e);
-
-    if( p->mcnt==c ){
-      ++p->mn;
-    }else if(p->mcnt<c){
-      p->rdM = ed;
-      p->mcnt = c;
-      p->mn=1;
+  assert( argc==1 );
+  type = sqlite3_value_numeric_type(argv[0]);
+
+  if( type == SQLITE_NULL)
+    return;
+
+  p = sqlite3_aggregate_context(context, sizeof(*p));
+  if( p==0 ){
+    sqlite3_result_error_nomem(context);
+    return;
+  }
+
+  x = modeValue(p, type, argv[0]);
+  if( p->cnt>=p->nAlloc ){
+    i64 nNew = p->nAlloc ? p->nAlloc*2 : 64;
+    ModeValue *aNew;
+    aNew = (ModeValue*)sqlite3_realloc64(p->a, nNew*sizeof(ModeValue));
+    if( aNew==0 ){
+      sqlite3_result_error_nomem(context);
+      return;
     }
+    p->a = aNew;
+    p->nAlloc = nNew;
   }
+  p->a[p->cnt++] = x;
 }
 
 /*
-**  Auxiliary function that iterates all elements in a map and finds the median
-**  (the value such that the number of elements smaller is equal the the number of
-**  elements larger)
+** Comparison functions for qsort(), used by modeSelect()
 */
-static void medianIterate(void* e, i64 c, void* pp){
-  i64 ei;
-  double ed;
-  double iL;
-  double iR;
-  int il;
-  int ir;
-  ModeCtx *p = (ModeCtx*)pp;
+static int modeCmpInt(const void *a, const void *b){
+  i64 aa = ((const ModeValue*)a)->i;
+  i64 bb = ((const ModeValue*)b)->i;
+  return (aa>bb) - (aa<bb);
+}
 
-  if(p->done>0)
-    return;
+static int modeCmpDouble(const void *a, const void *b){
+  double aa = ((const ModeValue*)a)->d;
+  double bb = ((const ModeValue*)b)->d;
+  return (aa>bb) - (aa<bb);
+}
 
-  iL = p->pcnt;
-  iR = p->cnt - p->pcnt;
-  il = p->mcnt + c;
-  ir = p->cnt - p->mcnt;
-
-  if( il >= iL ){
-    if( ir >= iR ){
-    ++p->mn;
-      if( 0==p->is_double ){
-        ei = *(int*)(e);
-        p->riM += ei;
-      }else{
-        ed = *(double*)(e);
-        p->rdM += ed;
+/*
+** Rearranges a[0..n-1] such that a[k] holds the value it would hold if
+** the array were sorted, with no larger value before and no smaller value
+** after it.
+** Quickselect with a median-of-three pivot; if the partitioning does not
+** converge within 2*log2(n) rounds, the remaining range is sorted instead,
+** which bounds the worst case to O(n log n).
+*/
+static void modeSelect(ModeValue *a, i64 n, i64 k, int bDouble){
+  i64 lo = 0;
+  i64 hi = n-1;
+  i64 m;
+  int nDepth = 0;
+
+  for(m=n; m>0; m>>=1) nDepth += 2;
+  while( lo<hi ){
+    ModeValue pivot, t;
+    i64 i = lo;
+    i64 j = hi;
+
+    if( nDepth--<=0 ){
+      qsort(&a[lo], (size_t)(hi-lo+1), sizeof(ModeValue),
+            bDouble ? modeCmpDouble : modeCmpInt);
+      return;
+    }
+    m = lo + (hi-lo)/2;
+    if( MODE_LT(bDouble, a[m], a[lo]) ){ t = a[m]; a[m] = a[lo]; a[lo] = t; }
+    if( MODE_LT(bDouble, a[hi], a[m]) ){
+      t = a[hi]; a[hi] = a[m]; a[m] = t;
+      if( MODE_LT(bDouble, a[m], a[lo]) ){ t = a[m]; a[m] = a[lo]; a[lo] = t; }
+    }
+    pivot = a[m];
+    while( i<=j ){
+      while( MODE_LT(bDouble, a[i], pivot) ) i++;
+      while( MODE_LT(bDouble, pivot, a[j]) ) j--;
+      if( i<=j ){
+        t = a[i]; a[i] = a[j]; a[j] = t;
+        i++;
+        j--;
       }
+    }
+    /* a[lo..j] <= pivot, a[j+1..i-1] == pivot, a[i..hi] >= pivot */
+    if( k<=j ){
+      hi = j;
+    }else if( k>=i ){
+      lo = i;
     }else{
-      p->done=1;
+      return;
     }
   }
-  p->mcnt+=c;
 }
 
 /*
-** Returns the mode value
+** Returns the mode value (most frequent value), if it is unique
 */
 static void modeFinalize(sqlite3_context *context){
   ModeCtx *p;
   p = sqlite3_aggregate_context(context, 0);
-  if( p && p->m ){
-    map_iterate(p->m, modeIterate, p);
-    map_destroy(p->m);
-    free(p->m);
+  if( p && p->a ){
+    ModeValue xMode;
+    i64 mcnt = 0;       /* maximum number of occurrences */
+    i64 mn = 0;         /* number of values with mcnt occurrences */
+    i64 i;
+
+    xMode.i = 0;
+    for(i=0; i<p->nAlloc; i++){
+      if( p->aCount[i]>mcnt ){
+        xMode = p->a[i];
+        mcnt = p->aCount[i];
+        mn = 1;
+      }else if( p->aCount[i]==mcnt ){
+        ++mn;
+      }
+    }
+    sqlite3_free(p->a);
+    p->a = 0;
 
-    if( 1==p->mn ){
+    if( 1==mn ){
       if( 0==p->is_double )
-        sqlite3_result_int64(context, p->riM);
+        sqlite3_result_int64(context, xMode.i);
       else
-        sqlite3_result_double(context, p->rdM);
+        sqlite3_result_double(context, xMode.d);
     }
   }
 }
 
 /*
 ** auxiliary function for percentiles
+** Returns the value such that num/den of the elements are smaller and the
+** rest is larger. If the elements split exactly between two order
+** statistics, the average of both is returned.
 */
-static void _medianFinalize(sqlite3_context *context){
+static void _medianFinalize(sqlite3_context *context, int num, int den){
   ModeCtx *p;
   p = (ModeCtx*) sqlite3_aggregate_context(context, 0);
-  if( p && p->m ){
-    p->done=0;
-    map_iterate(p->m, medianIterate, p);
-    map_destroy(p->m);
-    free(p->m);
-
-    if( 0==p->is_double )
-      if( 1==p->mn )
-        sqlite3_result_int64(context, p->riM);
+  if( p && p->a ){
+    int bDouble = p->is_double;
+    i64 t = p->cnt*num;
+    i64 lo = t/den;
+    i64 hi = lo;
+    i64 i;
+    ModeValue x, y;
+
+    if( t%den==0 ) lo = hi-1;
+    modeSelect(p->a, p->cnt, lo, bDouble);
+    x = y = p->a[lo];
+    if( hi>lo ){
+      /* after the selection the next order statistic is the minimum of the rest */
+      y = p->a[hi];
+      for(i=hi+1; i<p->cnt; i++){
+        if( MODE_LT(bDouble, p->a[i], y) ) y = p->a[i];
+      }
+    }
+    sqlite3_free(p->a);
+    p->a = 0;
+
+    if( 0==bDouble )
+      if( x.i==y.i )
+        sqlite3_result_int64(context, x.i);
       else
-        sqlite3_result_double(context, p->riM*1.0/p->mn);
+        sqlite3_result_double(context, ((double)x.i+(double)y.i)/2);
+    else if( x.d==y.d )
+      sqlite3_result_double(context, x.d);
     else
-      sqlite3_result_double(context, p->rdM/p->mn);
+      sqlite3_result_double(context, (x.d+y.d)/2);
   }
 }
 
@@ -1613,36 +1868,21 @@ static void _medianFinalize(sqlite3_context *context){
 ** Returns the median value
 */
 static void medianFinalize(sqlite3_context *context){
-  ModeCtx *p;
-  p = (ModeCtx*) sqlite3_aggregate_context(context, 0);
-  if( p!=0 ){
-    p->pcnt = (p->cnt)/2.0;
-    _medianFinalize(context);
-  }
+  _medianFinalize(context, 1, 2);
 }
 
 /*
 ** Returns the lower_quartile value
 */
 static void lower_quartileFinalize(sqlite3_context *context){
-  ModeCtx *p;
-  p = (ModeCtx*) sqlite3_aggregate_context(context, 0);
-  if( p!=0 ){
-    p->pcnt = (p->cnt)/4.0;
-    _medianFinalize(context);
-  }
+  _medianFinalize(context, 1, 4);
 }
 
 /*
 ** Returns the upper_quartile value
 */
 static void upper_quartileFinalize(sqlite3_context *context){
-  ModeCtx *p;
-  p = (ModeCtx*) sqlite3_aggregate_context(context, 0);
-  if( p!=0 ){
-    p->pcnt = (p->cnt)*3/4.0;
-    _medianFinalize(context);
-  }
+  _medianFinalize(context, 3, 4);
 }
 
 /*
@@ -1651,8 +1891,8 @@ static void upper_quartileFinalize(sqlite3_context *context){
 static void stdevFinalize(sqlite3_context *context){
   StdevCtx *p;
   p = sqlite3_aggregate_context(context, 0);
-  if( p && p->cnt>1 ){
-    sqlite3_result_double(context, sqrt(p->rS/(p->cnt-1)));
+  if( p && p->cnt>1 && p->rS.hi>0.0 ){
+    sqlite3_result_double(context, sqrt((p->rS.hi+p->rS.lo)/(p->cnt-1)));
   }else{
     sqlite3_result_double(context, 0.0);
   }
@@ -1664,8 +1904,8 @@ static void stdevFinalize(sqlite3_context *context){
 static void varianceFinalize(sqlite3_context *context){
   StdevCtx *p;
   p = sqlite3_aggregate_context(context, 0);
-  if( p && p->cnt>1 ){
-    sqlite3_result_double(context, p->rS/(p->cnt-1));
+  if( p && p->cnt>1 && p->rS.hi>0.0 ){
+    sqlite3_result_double(context, (p->rS.hi+p->rS.lo)/(p->cnt-1));
   }else{
     sqlite3_result_double(context, 0.0);
   }
@@ -1844,13 +2084,14 @@ int RegisterExtensionFunctions(sqlite3 *db){
     u8 needCollSeq;
     void (*xStep)(sqlite3_context*,int,sqlite3_value**);
     void (*xFinalize)(sqlite3_context*);
+    void (*xInverse)(sqlite3_context*,int,sqlite3_value**);  /* window functions only */
   } aAggs[] = {
-    { "stdev",            1, 0, 0, varianceStep, stdevFinalize  },
-    { "variance",         1, 0, 0, varianceStep, varianceFinalize  },
-    { "mode",             1, 0, 0, modeStep,     modeFinalize  },
-    { "median",           1, 0, 0, modeStep,     medianFinalize  },
-    { "lower_quartile",   1, 0, 0, modeStep,     lower_quartileFinalize  },
-    { "upper_quartile",   1, 0, 0, modeStep,     upper_quartileFinalize  },
+    { "stdev",            1, 0, 0, varianceStep, stdevFinalize,          varianceInverse },
+    { "variance",         1, 0, 0, varianceStep, varianceFinalize,       varianceInverse },
+    { "mode",             1, 0, 0, modeStep,     modeFinalize,           0 },
+    { "median",           1, 0, 0, medianStep,   medianFinalize,         0 },
+    { "lower_quartile",   1, 0, 0, medianStep,   lower_quartileFinalize, 0 },
+    { "upper_quartile",   1, 0, 0, medianStep,   upper_quartileFinalize, 0 },
   };
   int i;
 
@@ -1883,8 +2124,11 @@ int RegisterExtensionFunctions(sqlite3 *db){
     }
     /* sqlite3CreateFunc */
     /* LMH no error checking */
-    sqlite3_create_function(db, aAggs[i].zName, aAggs[i].nArg, SQLITE_UTF8,
-        pArg, 0, aAggs[i].xStep, aAggs[i].xFinalize);
+    /* The finalizers of window functions don't release the context,
+    ** so they double as xValue */
+    sqlite3_create_window_function(db, aAggs[i].zName, aAggs[i].nArg,
+        SQLITE_UTF8, pArg, aAggs[i].xStep, aAggs[i].xFinalize,
+        aAggs[i].xInverse ? aAggs[i].xFinalize : 0, aAggs[i].xInverse, 0);
 #if 0
     if( aAggs[i].needCollSeq ){
       struct FuncDefAgg *pFunc = sqlite3FindFunction( db, aAggs[i].zName,
@@ -1906,112 +2150,3 @@ int sqlite3_extension_init(
   return 0;
 }
 #endif /* COMPILE_SQLITE_EXTENSIONS_AS_LOADABLE_MODULE */
-
-map map_make(cmp_func cmp){
-  map r;
-  r.cmp=cmp;
-  r.base = 0;
-
-  return r;
-}
-
-static
-void* xcalloc(size_t nmemb, size_t size, char* s){
-  void* ret = calloc(nmemb, size);
-  return ret;
-}
-
-static
-void xfree(void* p){
-  free(p);
-}
-
-static
-void node_insert(node** n, cmp_func cmp, void *e){
-  int c;
-  node* nn;
-  if(*n==0){
-    nn = (node*)xcalloc(1,sizeof(node), "for node");
-    nn->data = e;
-    nn->count = 1;
-    *n=nn;
-  }else{
-    c=cmp((*n)->data,e);
-    if(0==c){
-      ++((*n)->count);
-      xfree(e);
-    }else if(c>0){
-      /* put it right here */
-      node_insert(&((*n)->l), cmp, e);
-    }else{
-      node_insert(&((*n)->r), cmp, e);
-    }
-  }
-}
-
-void map_insert(map *m, void *e){
-  node_insert(&(m->base), m->cmp, e);
-}
-
-static
-void node_iterate(node *n, map_iterator iter, void* p){
-  if(n){
-    if(n->l)
-      node_iterate(n->l, iter, p);
-    iter(n->data, n->count, p);
-    if(n->r)
-      node_iterate(n->r, iter, p);
-  }
-}
-
-void map_iterate(map *m, map_iterator iter, void* p){
-  node_iterate(m->base, iter, p);
-}
-
-static
-void node_destroy(node *n){
-  if(0!=n){
-    xfree(n->data);
-    if(n->l)
-      node_destroy(n->l);
-    if(n->r)
-      node_destroy(n->r);
-
-    xfree(n);
-  }
-}
-
-void map_destroy(map *m){
-  node_destroy(m->base);
-}
-
-int int_cmp(const void *a, const void *b){
-  i64 aa = *(i64 *)(a);
-  i64 bb = *(i64 *)(b);
-  /* printf("cmp %d <=> %d\n",aa,bb); */
-  if(aa==bb)
-    return 0;
-  else if(aa<bb)
-    return -1;
-  else
-    return 1;
-}
-
-int double_cmp(const void *a, const void *b){
-  double aa = *(double *)(a);
-  double bb = *(double *)(b);
-  /* printf("cmp %d <=> %d\n",aa,bb); */
-  if(aa==bb)
-    return 0;
-  else if(aa<bb)
-    return -1;
-  else
-    return 1;
-}
-
-#if 0
-void print_elem(void *e, i64 c, void* p){
-  int ee = *(int*)(e);
-  printf("%d => %lld\n", ee,c);
-}
-#endif
@@ -36,128 +36,445 @@ SQLITE_PRIVATE void sqlite3mcSecureZeroMemory(void* v, size_t n)
 
 #if SQLITE3MC_SECURE_MEMORY
 
-/* Flag indicating whether securing memory allocations is initialized */
-static volatile int mcSecureMemoryInitialized = 0;
 /* Flag indicating whether memory allocations will be secured */
 static volatile int mcSecureMemoryFlag = 0;
 
-/* Map of default memory allocation methods */
-static volatile sqlite3_mem_methods mcDefaultMemoryMethods;
+/*
+** Secure arena
+**
+** Only memory holding key material (cipher objects, codecs including their
+** page buffer, passphrases, and VLE keys) is allocated via
+** sqlite3mcSecureAlloc. While memory security is enabled, these allocations
+** are served from an arena of chunks obtained directly from the operating
+** system. Each chunk is enclosed by inaccessible guard pages, is excluded
+** from core dumps where supported, and is locked into physical memory for
+** memory security level "lock". Blocks are scrubbed when they are freed,
+** so that the general SQLite allocator is not affected at all.
+**
+** One chunk, which became completely unused, is kept (scrubbed and still
+** locked) for subsequent allocations, so that opening and closing a single
+** connection repeatedly does not map, lock, unlock and unmap a chunk each
+** time. It is released on shutdown of SQLite3 Multiple Ciphers.
+*/
+
+#if defined(_WIN32)
+#define MC_SECURE_ARENA 1
+#elif defined(__unix__) || defined(__unix) || (defined(__APPLE__) && defined(__MACH__))
+#include <sys/mman.h>
+#include <unistd.h>
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#define MC_SECURE_ARENA 1
+#else
+#define MC_SECURE_ARENA 0
+#endif
+
+/* Minimal size of an arena chunk, excluding guard pages */
+#ifndef SQLITE3MC_SECURE_CHUNK_SIZE
+#define SQLITE3MC_SECURE_CHUNK_SIZE (128*1024)
+#endif
+
+typedef struct McSecureChunk McSecureChunk;
+typedef struct McSecureBlock McSecureBlock;
+
+/*
+** Header of a secure memory block
+** Blocks allocated from the heap (arena not available or memory security
+** disabled) do not belong to a chunk.
+*/
+struct McSecureBlock
+{
+  McSecureChunk* pChunk;  /* Chunk containing the block, or NULL */
+  size_t         nSize;   /* Size of the block including the header */
+  McSecureBlock* pNext;   /* Next free block of the chunk (free blocks only) */
+};
+
+/*
+** Header of an arena chunk
+** The header is located at the start of the accessible region of the
+** mapping, followed by the blocks of the chunk.
+*/
+struct McSecureChunk
+{
+  McSecureChunk* pNext;     /* Next chunk of the arena */
+  size_t         nRegion;   /* Size of the accessible region */
+  McSecureBlock* pFree;     /* Free blocks, ordered by address */
+  int            isLocked;  /* Flag whether the region is locked in memory */
+};
+
+#define MC_SECURE_ALIGN     16
+#define MC_SECURE_ROUND(n)  (((n) + (MC_SECURE_ALIGN-1)) & ~((size_t) (MC_SECURE_ALIGN-1)))
+#define MC_SECURE_HEADER    MC_SECURE_ROUND(sizeof(McSecureBlock))
+#define MC_SECURE_CHUNKHDR  MC_SECURE_ROUND(sizeof(McSecureChunk))
+
+#if MC_SECURE_ARENA
+
+static struct
+{
+  McSecureChunk* pChunks;    /* List of chunks */
+  McSecureChunk* pEmpty;     /* Unused chunk kept in the list, or NULL */
+  size_t         nPageSize;  /* Page size of the operating system */
+  sqlite3_mutex* mutex;      /* Mutex to protect the arena */
+} mcSecureArena = { NULL, NULL, 0, NULL };
 
 /*
-** Return the size of an allocation
+** The arena is protected by its own mutex,
+** allocated on initialization of SQLite3 Multiple Ciphers
 */
-static int mcMemorySize(void* pBuf)
+static sqlite3_mutex* mcSecureArenaMutex()
 {
-  return mcDefaultMemoryMethods.xSize(pBuf);
+  return mcSecureArena.mutex;
+}
+
+static size_t mcSecurePageSize()
+{
+  if (mcSecureArena.nPageSize == 0)
+  {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    mcSecureArena.nPageSize = info.dwPageSize;
+#else
+    long nPageSize = sysconf(_SC_PAGESIZE);
+    mcSecureArena.nPageSize = (nPageSize > 0) ? (size_t) nPageSize : 4096;
+#endif
+  }
+  return mcSecureArena.nPageSize;
 }
 
 /*
-** Memory allocation function
+** Lock the accessible region of a chunk into physical memory
+** Locking is best effort, it fails if the process limit is exceeded.
 */
-static void* mcMemoryAlloc(int nByte)
+static void mcSecureChunkLock(McSecureChunk* pChunk)
 {
-  return mcDefaultMemoryMethods.xMalloc(nByte);
+  if (!pChunk->isLocked)
+  {
+#ifdef _WIN32
+    pChunk->isLocked = VirtualLock(pChunk, pChunk->nRegion) != 0;
+#else
+    pChunk->isLocked = mlock(pChunk, pChunk->nRegion) == 0;
+#endif
+  }
+}
+
+/*
+** Create a chunk holding at least a block of nSize bytes
+*/
+static McSecureChunk* mcSecureChunkCreate(size_t nSize)
+{
+  size_t nPage = mcSecurePageSize();
+  size_t nRegion = MC_SECURE_CHUNKHDR + nSize;
+  size_t nMap;
+  unsigned char* pMap;
+  McSecureChunk* pChunk;
+  McSecureBlock* pBlock;
+
+  if (nRegion < SQLITE3MC_SECURE_CHUNK_SIZE)
+  {
+    nRegion = SQLITE3MC_SECURE_CHUNK_SIZE;
+  }
+  nRegion = (nRegion + nPage - 1) & ~(nPage - 1);
+  nMap = nRegion + 2 * nPage;
+
+#ifdef _WIN32
+  pMap = (unsigned char*) VirtualAlloc(NULL, nMap, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+  if (pMap == NULL)
+  {
+    return NULL;
+  }
+  else
+  {
+    DWORD oldProtect;
+    VirtualProtect(pMap, nPage, PAGE_NOACCESS, &oldProtect);
+    VirtualProtect(pMap + nPage + nRegion, nPage, PAGE_NOACCESS, &oldProtect);
+  }
+#else
+  pMap = (unsigned char*) mmap(NULL, nMap, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (pMap == (unsigned char*) MAP_FAILED)
+  {
+    return NULL;
+  }
+  if (mprotect(pMap + nPage, nRegion, PROT_READ | PROT_WRITE) != 0)
+  {
+    munmap(pMap, nMap);
+    return NULL;
+  }
+#ifdef MADV_DONTDUMP
+  madvise(pMap + nPage, nRegion, MADV_DONTDUMP);
+#endif
+#endif
+
+  /* Fresh mappings are zero filled */
+  pChunk = (McSecureChunk*) (pMap + nPage);
+  pChunk->nRegion = nRegion;
+  pChunk->isLocked = 0;
+  pBlock = (McSecureBlock*) ((unsigned char*) pChunk + MC_SECURE_CHUNKHDR);
+  pBlock->pChunk = pChunk;
+  pBlock->nSize = nRegion - MC_SECURE_CHUNKHDR;
+  pBlock->pNext = NULL;
+  pChunk->pFree = pBlock;
+  if (mcSecureMemoryFlag == SECURE_MEMORY_LOCK)
+  {
+    mcSecureChunkLock(pChunk);
+  }
+  pChunk->pNext = mcSecureArena.pChunks;
+  mcSecureArena.pChunks = pChunk;
+  return pChunk;
 }
 
 /*
-** Free a prior allocation
+** Unlink a chunk from the arena and return it to the operating system
 */
-static void mcMemoryFree(void* pPrior)
+static void mcSecureChunkDestroy(McSecureChunk* pChunk)
 {
-  if (mcSecureMemoryFlag)
+  size_t nPage = mcSecurePageSize();
+  unsigned char* pMap = (unsigned char*) pChunk - nPage;
+  McSecureChunk** ppChunk = &mcSecureArena.pChunks;
+
+  while (*ppChunk != pChunk)
+  {
+    ppChunk = &(*ppChunk)->pNext;
+  }
+  *ppChunk = pChunk->pNext;
+
+#ifdef _WIN32
+  if (pChunk->isLocked)
+  {
+    VirtualUnlock(pChunk, pChunk->nRegion);
+  }
+  VirtualFree(pMap, 0, MEM_RELEASE);
+#else
+  if (pChunk->isLocked)
   {
-    int nSize = mcMemorySize(pPrior);
-    sqlite3mcSecureZeroMemory(pPrior, nSize);
+    munlock(pChunk, pChunk->nRegion);
   }
-  mcDefaultMemoryMethods.xFree(pPrior);
+  munmap(pMap, pChunk->nRegion + 2 * nPage);
+#endif
 }
 
 /*
-** Resize an allocation
+** Allocate a block of nSize bytes (including header) from a chunk (first fit)
 */
-static void* mcMemoryRealloc(void* pPrior, int nByte)
+static McSecureBlock* mcSecureChunkAlloc(McSecureChunk* pChunk, size_t nSize)
 {
-  void* pNew = NULL;
-  if (mcSecureMemoryFlag)
+  McSecureBlock** ppBlock = &pChunk->pFree;
+  McSecureBlock* pBlock;
+  while ((pBlock = *ppBlock) != NULL)
   {
-    int nPriorSize = mcMemorySize(pPrior);
-    if (nByte == 0)
+    if (pBlock->nSize >= nSize)
     {
-      /* New size = 0, just free prior memory */
-      mcMemoryFree(pPrior);
-      return NULL;
+      if (pBlock->nSize - nSize >= MC_SECURE_HEADER + MC_SECURE_ALIGN)
+      {
+        /* Split block, the remainder stays in the free list */
+        McSecureBlock* pRest = (McSecureBlock*) ((unsigned char*) pBlock + nSize);
+        pRest->pChunk = pChunk;
+        pRest->nSize = pBlock->nSize - nSize;
+        pRest->pNext = pBlock->pNext;
+        pBlock->nSize = nSize;
+        *ppBlock = pRest;
+      }
+      else
+      {
+        *ppBlock = pBlock->pNext;
+      }
+      pBlock->pNext = NULL;
+      return pBlock;
     }
-    else if (!pPrior)
+    ppBlock = &pBlock->pNext;
+  }
+  return NULL;
+}
+
+/*
+** Return a block to the free list of its chunk, merging adjacent free blocks
+** Returns true, if the chunk is completely unused afterwards.
+*/
+static int mcSecureChunkFree(McSecureChunk* pChunk, McSecureBlock* pBlock)
+{
+  McSecureBlock* pPrev = NULL;
+  McSecureBlock* pNext = pChunk->pFree;
+
+  while (pNext != NULL && pNext < pBlock)
+  {
+    pPrev = pNext;
+    pNext = pNext->pNext;
+  }
+  if (pNext != NULL && (unsigned char*) pBlock + pBlock->nSize == (unsigned char*) pNext)
+  {
+    pBlock->nSize += pNext->nSize;
+    pBlock->pNext = pNext->pNext;
+    memset(pNext, 0, sizeof(McSecureBlock));
+  }
+  else
+  {
+    pBlock->pNext = pNext;
+  }
+  if (pPrev != NULL && (unsigned char*) pPrev + pPrev->nSize == (unsigned char*) pBlock)
+  {
+    pPrev->nSize += pBlock->nSize;
+    pPrev->pNext = pBlock->pNext;
+    memset(pBlock, 0, sizeof(McSecureBlock));
+    pBlock = pPrev;
+  }
+  else if (pPrev != NULL)
+  {
+    pPrev->pNext = pBlock;
+  }
+  else
+  {
+    pChunk->pFree = pBlock;
+  }
+  return pBlock->nSize == pChunk->nRegion - MC_SECURE_CHUNKHDR;
+}
+
+#endif /* MC_SECURE_ARENA */
+
+/*
+** Allocate memory for key material
+*/
+SQLITE_PRIVATE void* sqlite3mcSecureAlloc(int nByte)
+{
+  McSecureBlock* pBlock = NULL;
+  size_t nSize;
+  if (nByte <= 0)
+  {
+    return NULL;
+  }
+  nSize = MC_SECURE_HEADER + MC_SECURE_ROUND((size_t) nByte);
+#if MC_SECURE_ARENA
+  if (mcSecureMemoryFlag != SECURE_MEMORY_NONE)
+  {
+    sqlite3_mutex* mutex = mcSecureArenaMutex();
+    McSecureChunk* pChunk;
+    sqlite3_mutex_enter(mutex);
+    for (pChunk = mcSecureArena.pChunks; pChunk != NULL; pChunk = pChunk->pNext)
+    {
+      if ((pBlock = mcSecureChunkAlloc(pChunk, nSize)) != NULL)
+      {
+        break;
+      }
+    }
+    if (pBlock == NULL && (pChunk = mcSecureChunkCreate(nSize)) != NULL)
     {
-      /* Prior size = 0, just allocate new memory */
-      return mcMemoryAlloc(nByte);
+      pBlock = mcSecureChunkAlloc(pChunk, nSize);
     }
-    else if(nByte <= nPriorSize)
+    if (pBlock != NULL && pChunk == mcSecureArena.pEmpty)
     {
-      /* New size less or equal prior size, do nothing - we do not shrink allocations */
-      return pPrior;
+      /* The kept chunk is in use again */
+      mcSecureArena.pEmpty = NULL;
     }
-    else
+    sqlite3_mutex_leave(mutex);
+    if (pBlock != NULL)
     {
-      /* New size greater than prior size, reallocate memory */
-      pNew = mcMemoryAlloc(nByte);
-      if (pNew)
-      {
-        memcpy(pNew, pPrior, nPriorSize);
-        mcMemoryFree(pPrior);
-      }
-      return pNew;
+      return (unsigned char*) pBlock + MC_SECURE_HEADER;
     }
+    /* The operating system refused a new chunk, fall back to the heap */
   }
-  else
+#endif
+  pBlock = (McSecureBlock*) sqlite3_malloc64(nSize);
+  if (pBlock == NULL)
   {
-    return mcDefaultMemoryMethods.xRealloc(pPrior, nByte);
+    return NULL;
   }
+  pBlock->pChunk = NULL;
+  pBlock->nSize = nSize;
+  pBlock->pNext = NULL;
+  return (unsigned char*) pBlock + MC_SECURE_HEADER;
 }
 
 /*
-** Round up request size to allocation size
+** Scrub and free memory allocated with sqlite3mcSecureAlloc
 */
-static int mcMemoryRoundup(int nByte)
+SQLITE_PRIVATE void sqlite3mcSecureFree(void* pPrior)
 {
-  return mcDefaultMemoryMethods.xRoundup(nByte);
+  McSecureBlock* pBlock;
+  if (pPrior == NULL)
+  {
+    return;
+  }
+  pBlock = (McSecureBlock*) ((unsigned char*) pPrior - MC_SECURE_HEADER);
+  sqlite3mcSecureZeroMemory(pPrior, pBlock->nSize - MC_SECURE_HEADER);
+#if MC_SECURE_ARENA
+  if (pBlock->pChunk != NULL)
+  {
+    sqlite3_mutex* mutex = mcSecureArenaMutex();
+    McSecureChunk* pChunk = pBlock->pChunk;
+    sqlite3_mutex_enter(mutex);
+    if (mcSecureChunkFree(pChunk, pBlock))
+    {
+      /* Keep one unused chunk, release any further one */
+      if (mcSecureArena.pEmpty == NULL)
+      {
+        mcSecureArena.pEmpty = pChunk;
+      }
+      else
+      {
+        mcSecureChunkDestroy(pChunk);
+      }
+    }
+    sqlite3_mutex_leave(mutex);
+    return;
+  }
+#endif
+  sqlite3_free(pBlock);
 }
 
 /*
-** Initialize the memory allocator
+** Allocate the mutex of the secure arena
 */
-static int mcMemoryInit(void* pAppData)
+SQLITE_PRIVATE int sqlite3mcInitSecureMemory()
 {
-  return mcDefaultMemoryMethods.xInit(pAppData);
+#if MC_SECURE_ARENA
+  if (mcSecureArena.mutex == NULL)
+  {
+    mcSecureArena.mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_FAST);
+    if (mcSecureArena.mutex == NULL)
+    {
+      return SQLITE_NOMEM;
+    }
+  }
+#endif
+  return SQLITE_OK;
 }
 
 /*
-** Deinitialize the memory allocator
+** Release the unused chunk kept by the arena and free the mutex
 */
-static void mcMemoryShutdown(void* pAppData)
+SQLITE_PRIVATE void sqlite3mcTermSecureMemory()
 {
-  mcDefaultMemoryMethods.xShutdown(pAppData);
+#if MC_SECURE_ARENA
+  if (mcSecureArena.pEmpty != NULL)
+  {
+    mcSecureChunkDestroy(mcSecureArena.pEmpty);
+    mcSecureArena.pEmpty = NULL;
+  }
+  sqlite3_mutex_free(mcSecureArena.mutex);
+  mcSecureArena.mutex = NULL;
+#endif
 }
 
-static sqlite3_mem_methods mcSecureMemoryMethods =
-{
-  mcMemoryAlloc,
-  mcMemoryFree,
-  mcMemoryRealloc,
-  mcMemorySize,
-  mcMemoryRoundup,
-  mcMemoryInit,
-  mcMemoryShutdown,
-  0
-};
-
 SQLITE_PRIVATE void sqlite3mcSetMemorySecurity(int value)
 {
   /* memory security can be changed only, if locking is not enabled */
   if (mcSecureMemoryFlag < 2)
   {
     mcSecureMemoryFlag = (value >= 0 && value <= 2) ? value : 0;
+#if MC_SECURE_ARENA
+    if (mcSecureMemoryFlag == SECURE_MEMORY_LOCK)
+    {
+      /* Lock the chunks allocated so far */
+      sqlite3_mutex* mutex = mcSecureArenaMutex();
+      McSecureChunk* pChunk;
+      sqlite3_mutex_enter(mutex);
+      for (pChunk = mcSecureArena.pChunks; pChunk != NULL; pChunk = pChunk->pNext)
+      {
+        mcSecureChunkLock(pChunk);
+      }
+      sqlite3_mutex_leave(mutex);
+    }
+#endif
   }
 }
 
@@ -166,23 +483,44 @@ SQLITE_PRIVATE int sqlite3mcGetMemorySecurity()
   return mcSecureMemoryFlag;
 }
 
-#endif /* SQLITE3MC_SECURE_MEMORY */
+#else /* !SQLITE3MC_SECURE_MEMORY */
 
-SQLITE_PRIVATE void sqlite3mcInitMemoryMethods()
+/*
+** Allocate memory for key material
+*/
+SQLITE_PRIVATE void* sqlite3mcSecureAlloc(int nByte)
 {
-#if SQLITE3MC_SECURE_MEMORY
-  if (!mcSecureMemoryInitialized)
+  return sqlite3_malloc(nByte);
+}
+
+/*
+** Scrub and free memory allocated with sqlite3mcSecureAlloc
+*/
+SQLITE_PRIVATE void sqlite3mcSecureFree(void* pPrior)
+{
+  if (pPrior != NULL)
   {
-    if (sqlite3_config(SQLITE_CONFIG_GETMALLOC, &mcDefaultMemoryMethods) != SQLITE_OK ||
-      sqlite3_config(SQLITE_CONFIG_MALLOC, &mcSecureMemoryMethods) != SQLITE_OK)
-    {
-      mcSecureMemoryFlag = mcSecureMemoryInitialized = 0;
-    }
-    else
-    {
-      mcSecureMemoryInitialized = 1;
-    }
+    sqlite3mcSecureZeroMemory(pPrior, (size_t) sqlite3_msize(pPrior));
+    sqlite3_free(pPrior);
   }
-#endif /* SQLITE3MC_SECURE_MEMORY */
 }
 
+SQLITE_PRIVATE int sqlite3mcInitSecureMemory()
+{
+  return SQLITE_OK;
+}
+
+SQLITE_PRIVATE void sqlite3mcTermSecureMemory()
+{
+}
+
+#endif /* SQLITE3MC_SECURE_MEMORY */
+
+/*
+** Called from the patched SQLite on initialization of its memory allocator
+** Memory security no longer wraps the SQLite allocator, because scrubbing
+** is restricted to the secure arena.
+*/
+SQLITE_PRIVATE void sqlite3mcInitMemoryMethods()
+{
+}
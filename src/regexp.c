@@ -57,12 +57,35 @@
 ** this expansion.
 **
 ** To help prevent DoS attacks, the maximum size of the NFA is restricted.
+**
+** Before the NFA is run, the input is searched for a literal string that
+** every match has to contain, if the regular expression has one.  Inputs
+** without it are rejected right away.  For ASCII input, the transitions of
+** the NFA are cached as states of a DFA which is built lazily while
+** matching.  The DFA is kept with the compiled regular expression and grows
+** up to SQLITE_REGEXP_DFA_BUDGET bytes; beyond that the NFA takes over.
+** Compile with SQLITE_REGEXP_DFA_BUDGET=0 to disable the DFA.
 */
 #include <string.h>
 #include <stdlib.h>
 #include "sqlite3ext.h"
 SQLITE_EXTENSION_INIT1
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP>=2)
+#include <emmintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#define RE_USE_SSE2 1
+#else
+#define RE_USE_SSE2 0
+#endif
+
+/* Maximum memory used by the DFA of a compiled regular expression */
+#ifndef SQLITE_REGEXP_DFA_BUDGET
+# define SQLITE_REGEXP_DFA_BUDGET 262144
+#endif
+
 /*
 ** The following #defines change the names of some functions implemented in
 ** this file to prevent name collisions with C-library functions of the
@@ -120,6 +143,37 @@ struct ReInput {
   int mx;                  /* EOF when i>=mx */
 };
 
+/* Special values of ReDfaState.aNext[] */
+#define RE_DFA_UNKNOWN   (-1)  /* Transition not computed yet */
+#define RE_DFA_ACCEPT    (-2)  /* The transition reaches RE_OP_ACCEPT */
+#define RE_DFA_FULL      (-3)  /* Target state not added, budget exhausted */
+
+/* A state of the DFA is the set of active NFA states after an input
+** character, together with the property of that character which matters
+** for the next transition, whether it is a word character.
+*/
+typedef struct ReDfaState ReDfaState;
+struct ReDfaState {
+  int aNext[128];             /* Next state for ASCII characters */
+  unsigned iHash;             /* Hash of aSet[] and bWord */
+  unsigned nSet;              /* Number of NFA states in aSet[] */
+  unsigned char bWord;        /* Previous character was a word character */
+  unsigned char bAccept;      /* True if accepting at the end of input */
+  ReStateNumber aSet[1];      /* Sorted NFA states.  Allocated as needed */
+};
+
+/* The lazily built DFA of a compiled regular expression
+*/
+typedef struct ReDfa ReDfa;
+struct ReDfa {
+  ReDfaState **apState;       /* All states */
+  int nState;                 /* Number of states in apState[] */
+  int nStateAlloc;            /* Slots allocated for apState[] */
+  int *aHash;                 /* Hash table of states.  Index+1 or 0 */
+  int nHash;                  /* Number of slots in aHash[], a power of 2 */
+  sqlite3_int64 nByte;        /* Memory used by the DFA */
+};
+
 /* A compiled NFA (or an NFA that is in the process of being compiled) is
 ** an instance of the following object.
 */
@@ -132,6 +186,11 @@ struct ReCompiled {
   unsigned (*xNextChar)(ReInput*);  /* Next character function */
   unsigned char zInit[12];    /* Initial text to match */
   int nInit;                  /* Number of bytes in zInit */
+  unsigned char zLit[24];     /* Literal text contained in every match */
+  int nLit;                   /* Number of bytes in zLit */
+  int bBoundary;              /* True if there is an RE_OP_BOUNDARY */
+  unsigned nMatch;            /* Number of calls to re_match() */
+  ReDfa *pDfa;                /* DFA built while matching, or NULL */
   unsigned nState;            /* Number of entries in aOp[] and aArg[] */
   unsigned nAlloc;            /* Slots allocated for aOp[] and aArg[] */
   unsigned mxAlloc;           /* Complexity limit */
@@ -196,6 +255,294 @@ static int re_space_char(int c){
   return c==' ' || c=='\t' || c=='\n' || c=='\r' || c=='\v' || c=='\f';
 }
 
+#if RE_USE_SSE2
+/* Index of the lowest set bit of a non-zero SIMD compare mask */
+static unsigned re_ctz(unsigned m){
+#if defined(_MSC_VER)
+  unsigned long k;
+  _BitScanForward(&k, m);
+  return (unsigned)k;
+#else
+  return (unsigned)__builtin_ctz(m);
+#endif
+}
+#endif
+
+/* Return the offset of the first occurrence of the n bytes zLit[] (n>0)
+** in the nIn bytes zIn[], or -1 if there is none.  Candidate positions
+** are located by the first and the last byte of zLit[], 16 positions at
+** a time with SSE2 or by memchr() otherwise.
+*/
+static int re_find(
+  const unsigned char *zIn, int nIn,
+  const unsigned char *zLit, int n
+){
+  int i = 0;
+  int iLast = nIn - n;      /* Last offset where a match could start */
+#if RE_USE_SSE2
+  if( n>1 ){
+    const __m128i vFirst = _mm_set1_epi8((char)zLit[0]);
+    const __m128i vLast = _mm_set1_epi8((char)zLit[n-1]);
+    while( i+15<=iLast ){
+      __m128i a = _mm_loadu_si128((const __m128i*)(zIn+i));
+      __m128i b = _mm_loadu_si128((const __m128i*)(zIn+i+n-1));
+      unsigned m = (unsigned)_mm_movemask_epi8(
+          _mm_and_si128(_mm_cmpeq_epi8(a, vFirst), _mm_cmpeq_epi8(b, vLast)));
+      while( m ){
+        unsigned k = re_ctz(m);
+        if( memcmp(zIn+i+k+1, zLit+1, n-2)==0 ) return i+(int)k;
+        m &= m-1;
+      }
+      i += 16;
+    }
+  }
+#endif
+  while( i<=iLast ){
+    const unsigned char *z = memchr(zIn+i, zLit[0], iLast-i+1);
+    if( z==0 ) return -1;
+    i = (int)(z - zIn);
+    if( memcmp(z+1, zLit+1, n-1)==0 ) return i;
+    i++;
+  }
+  return -1;
+}
+
+/* Advance the NFA by the input character c, which follows cPrev.  The
+** states in pThis are active before c.  States reached without consuming
+** input are added to pThis, and the states active after c to pNext.
+** Return true if RE_OP_ACCEPT is reached.
+*/
+static int re_step(
+  ReCompiled *pRe,
+  ReStateSet *pThis,
+  ReStateSet *pNext,
+  int c,
+  int cPrev
+){
+  unsigned int i;
+  for(i=0; i<pThis->nState; i++){
+    int x = pThis->aState[i];
+    switch( pRe->aOp[x] ){
+      case RE_OP_MATCH: {
+        if( pRe->aArg[x]==c ) re_add_state(pNext, x+1);
+        break;
+      }
+      case RE_OP_ATSTART: {
+        if( cPrev==RE_START ) re_add_state(pThis, x+1);
+        break;
+      }
+      case RE_OP_ANY: {
+        if( c!=0 ) re_add_state(pNext, x+1);
+        break;
+      }
+      case RE_OP_WORD: {
+        if( re_word_char(c) ) re_add_state(pNext, x+1);
+        break;
+      }
+      case RE_OP_NOTWORD: {
+        if( !re_word_char(c) && c!=0 ) re_add_state(pNext, x+1);
+        break;
+      }
+      case RE_OP_DIGIT: {
+        if( re_digit_char(c) ) re_add_state(pNext, x+1);
+        break;
+      }
+      case RE_OP_NOTDIGIT: {
+        if( !re_digit_char(c) && c!=0 ) re_add_state(pNext, x+1);
+        break;
+      }
+      case RE_OP_SPACE: {
+        if( re_space_char(c) ) re_add_state(pNext, x+1);
+        break;
+      }
+      case RE_OP_NOTSPACE: {
+        if( !re_space_char(c) && c!=0 ) re_add_state(pNext, x+1);
+        break;
+      }
+      case RE_OP_BOUNDARY: {
+        if( re_word_char(c)!=re_word_char(cPrev) ) re_add_state(pThis, x+1);
+        break;
+      }
+      case RE_OP_ANYSTAR: {
+        re_add_state(pNext, x);
+        re_add_state(pThis, x+1);
+        break;
+      }
+      case RE_OP_FORK: {
+        re_add_state(pThis, x+pRe->aArg[x]);
+        re_add_state(pThis, x+1);
+        break;
+      }
+      case RE_OP_GOTO: {
+        re_add_state(pThis, x+pRe->aArg[x]);
+        break;
+      }
+      case RE_OP_ACCEPT: {
+        return 1;
+      }
+      case RE_OP_CC_EXC: {
+        if( c==0 ) break;
+        /* fall-through */ goto re_op_cc_inc;
+      }
+      case RE_OP_CC_INC: re_op_cc_inc: {
+        int j = 1;
+        int n = pRe->aArg[x];
+        int hit = 0;
+        for(j=1; j>0 && j<n; j++){
+          if( pRe->aOp[x+j]==RE_OP_CC_VALUE ){
+            if( pRe->aArg[x+j]==c ){
+              hit = 1;
+              j = -1;
+            }
+          }else{
+            if( pRe->aArg[x+j]<=c && pRe->aArg[x+j+1]>=c ){
+              hit = 1;
+              j = -1;
+            }else{
+              j++;
+            }
+          }
+        }
+        if( pRe->aOp[x]==RE_OP_CC_EXC ) hit = !hit;
+        if( hit ) re_add_state(pNext, x+n);
+        break;
+      }
+    }
+  }
+  return 0;
+}
+
+/* Return true if the NFA accepts when the input ends with the states
+** in pSet active.
+*/
+static int re_accepting(ReCompiled *pRe, ReStateSet *pSet){
+  unsigned int i;
+  for(i=0; i<pSet->nState; i++){
+    int x = pSet->aState[i];
+    while( pRe->aOp[x]==RE_OP_GOTO ) x += pRe->aArg[x];
+    if( pRe->aOp[x]==RE_OP_ACCEPT ) return 1;
+  }
+  return 0;
+}
+
+#if SQLITE_REGEXP_DFA_BUDGET>0
+/* Free the DFA of a compiled regular expression */
+static void re_dfa_free(ReDfa *pDfa){
+  if( pDfa ){
+    int i;
+    for(i=0; i<pDfa->nState; i++) sqlite3_free(pDfa->apState[i]);
+    sqlite3_free(pDfa->apState);
+    sqlite3_free(pDfa->aHash);
+    sqlite3_free(pDfa);
+  }
+}
+
+/* Comparison function for sorting NFA states */
+static int re_state_cmp(const void *a, const void *b){
+  return (int)*(const ReStateNumber*)a - (int)*(const ReStateNumber*)b;
+}
+
+/* Return the DFA state for the NFA states in pSet after the input
+** character c, adding it to the DFA if necessary.  pSet is sorted as a
+** side effect.  Return RE_DFA_FULL if the state is new and doesn't fit
+** into the budget of the DFA or if out of memory.
+*/
+static int re_dfa_state(ReCompiled *pRe, ReStateSet *pSet, int c){
+  ReDfa *pDfa = pRe->pDfa;
+  ReDfaState *pState;
+  unsigned char bWord = pRe->bBoundary && re_word_char(c);
+  unsigned h = 2166136261u ^ bWord;
+  unsigned i;
+  sqlite3_int64 nByte;
+  int iSlot;
+
+  qsort(pSet->aState, pSet->nState, sizeof(ReStateNumber), re_state_cmp);
+  for(i=0; i<pSet->nState; i++) h = (h ^ pSet->aState[i])*16777619u;
+  if( pDfa->nHash>0 ){
+    iSlot = (int)(h & (pDfa->nHash-1));
+    while( pDfa->aHash[iSlot] ){
+      pState = pDfa->apState[pDfa->aHash[iSlot]-1];
+      if( pState->iHash==h && pState->bWord==bWord
+       && pState->nSet==pSet->nState
+       && memcmp(pState->aSet, pSet->aState,
+                 pSet->nState*sizeof(ReStateNumber))==0
+      ){
+        return pDfa->aHash[iSlot]-1;
+      }
+      iSlot = (iSlot+1) & (pDfa->nHash-1);
+    }
+  }
+
+  /* Add a new state */
+  nByte = sizeof(ReDfaState) + pSet->nState*sizeof(ReStateNumber);
+  if( pDfa->nByte+nByte>SQLITE_REGEXP_DFA_BUDGET ) return RE_DFA_FULL;
+  if( pDfa->nState>=pDfa->nStateAlloc ){
+    int nNew = pDfa->nStateAlloc ? pDfa->nStateAlloc*2 : 16;
+    ReDfaState **apNew;
+    apNew = sqlite3_realloc64(pDfa->apState, nNew*sizeof(ReDfaState*));
+    if( apNew==0 ) return RE_DFA_FULL;
+    pDfa->apState = apNew;
+    pDfa->nStateAlloc = nNew;
+  }
+  if( pDfa->nState*2>=pDfa->nHash ){
+    int nNew = pDfa->nHash ? pDfa->nHash*2 : 32;
+    int *aNew = sqlite3_malloc64(nNew*sizeof(int));
+    int j;
+    if( aNew==0 ) return RE_DFA_FULL;
+    memset(aNew, 0, nNew*sizeof(int));
+    for(j=0; j<pDfa->nState; j++){
+      iSlot = (int)(pDfa->apState[j]->iHash & (nNew-1));
+      while( aNew[iSlot] ) iSlot = (iSlot+1) & (nNew-1);
+      aNew[iSlot] = j+1;
+    }
+    sqlite3_free(pDfa->aHash);
+    pDfa->aHash = aNew;
+    pDfa->nHash = nNew;
+  }
+  pState = sqlite3_malloc64(nByte);
+  if( pState==0 ) return RE_DFA_FULL;
+  for(i=0; i<128; i++) pState->aNext[i] = RE_DFA_UNKNOWN;
+  pState->iHash = h;
+  pState->nSet = pSet->nState;
+  pState->bWord = bWord;
+  pState->bAccept = (unsigned char)re_accepting(pRe, pSet);
+  memcpy(pState->aSet, pSet->aState, pSet->nState*sizeof(ReStateNumber));
+  pDfa->nByte += nByte;
+  iSlot = (int)(h & (pDfa->nHash-1));
+  while( pDfa->aHash[iSlot] ) iSlot = (iSlot+1) & (pDfa->nHash-1);
+  pDfa->aHash[iSlot] = pDfa->nState+1;
+  pDfa->apState[pDfa->nState] = pState;
+  return pDfa->nState++;
+}
+
+/* Compute the transition of DFA state iState on the input character c
+** by running the NFA.  pThis and pNext are used as work space; pNext
+** holds the NFA states after c on return.  Return the next DFA state,
+** RE_DFA_ACCEPT, or RE_DFA_FULL if the next state could not be added.
+** Transitions on ASCII characters are remembered.
+*/
+static int re_dfa_step(
+  ReCompiled *pRe,
+  int iState,
+  int c,
+  ReStateSet *pThis,
+  ReStateSet *pNext
+){
+  ReDfaState *pState = pRe->pDfa->apState[iState];
+  int iNext;
+  pThis->nState = pState->nSet;
+  memcpy(pThis->aState, pState->aSet, pState->nSet*sizeof(ReStateNumber));
+  pNext->nState = 0;
+  if( re_step(pRe, pThis, pNext, c, pState->bWord ? 'a' : ' ') ){
+    iNext = RE_DFA_ACCEPT;
+  }else{
+    iNext = re_dfa_state(pRe, pNext, c);
+  }
+  if( c<128 && iNext!=RE_DFA_FULL ) pState->aNext[c] = iNext;
+  return iNext;
+}
+#endif /* SQLITE_REGEXP_DFA_BUDGET>0 */
+
 /* Run a compiled regular expression on the zero-terminated input
 ** string zIn[].  Return true on a match and false if there is no match.
 */
@@ -203,11 +550,13 @@ static int re_match(ReCompiled *pRe, const unsigned char *zIn, int nIn){
   ReStateSet aStateSet[2], *pThis, *pNext;
   ReStateNumber aSpace[100];
   ReStateNumber *pToFree;
-  unsigned int i = 0;
   unsigned int iSwap = 0;
   int c = RE_START;
   int cPrev = 0;
   int rc = 0;
+#if SQLITE_REGEXP_DFA_BUDGET>0
+  int bDfa = 0;
+#endif
   ReInput in;
 
   in.z = zIn;
@@ -216,17 +565,30 @@ static int re_match(ReCompiled *pRe, const unsigned char *zIn, int nIn){
 
   /* Look for the initial prefix match, if there is one. */
   if( pRe->nInit ){
-    unsigned char x = pRe->zInit[0];
-    while( in.i+pRe->nInit<=in.mx 
-     && (zIn[in.i]!=x ||
-         strncmp((const char*)zIn+in.i, (const char*)pRe->zInit, pRe->nInit)!=0)
-    ){
-      in.i++;
-    }
-    if( in.i+pRe->nInit>in.mx ) return 0;
+    int iInit = re_find(zIn, in.mx, pRe->zInit, pRe->nInit);
+    if( iInit<0 ) return 0;
+    in.i = iInit;
     c = RE_START-1;
   }
 
+  /* Reject the input if it lacks a literal required by every match */
+  if( pRe->nLit && re_find(zIn+in.i, in.mx-in.i, pRe->zLit, pRe->nLit)<0 ){
+    return 0;
+  }
+
+#if SQLITE_REGEXP_DFA_BUDGET>0
+  /* Building the DFA pays off if the compiled regular expression is
+  ** reused, or for longer input */
+  if( pRe->nMatch<2 ) pRe->nMatch++;
+  if( pRe->nMatch>1 || in.mx-in.i>=256 ){
+    if( pRe->pDfa==0 ){
+      pRe->pDfa = sqlite3_malloc64(sizeof(ReDfa));
+      if( pRe->pDfa ) memset(pRe->pDfa, 0, sizeof(ReDfa));
+    }
+    bDfa = pRe->pDfa!=0;
+  }
+#endif
+
   if( pRe->nState<=(sizeof(aSpace)/(sizeof(aSpace[0])*2)) ){
     pToFree = 0;
     aStateSet[0].aState = aSpace;
@@ -246,102 +608,49 @@ static int re_match(ReCompiled *pRe, const unsigned char *zIn, int nIn){
     pNext = &aStateSet[iSwap];
     iSwap = 1 - iSwap;
     pNext->nState = 0;
-    for(i=0; i<pThis->nState; i++){
-      int x = pThis->aState[i];
-      switch( pRe->aOp[x] ){
-        case RE_OP_MATCH: {
-          if( pRe->aArg[x]==c ) re_add_state(pNext, x+1);
-          break;
-        }
-        case RE_OP_ATSTART: {
-          if( cPrev==RE_START ) re_add_state(pThis, x+1);
-          break;
-        }
-        case RE_OP_ANY: {
-          if( c!=0 ) re_add_state(pNext, x+1);
-          break;
-        }
-        case RE_OP_WORD: {
-          if( re_word_char(c) ) re_add_state(pNext, x+1);
-          break;
-        }
-        case RE_OP_NOTWORD: {
-          if( !re_word_char(c) && c!=0 ) re_add_state(pNext, x+1);
-          break;
-        }
-        case RE_OP_DIGIT: {
-          if( re_digit_char(c) ) re_add_state(pNext, x+1);
-          break;
-        }
-        case RE_OP_NOTDIGIT: {
-          if( !re_digit_char(c) && c!=0 ) re_add_state(pNext, x+1);
-          break;
-        }
-        case RE_OP_SPACE: {
-          if( re_space_char(c) ) re_add_state(pNext, x+1);
-          break;
-        }
-        case RE_OP_NOTSPACE: {
-          if( !re_space_char(c) && c!=0 ) re_add_state(pNext, x+1);
-          break;
-        }
-        case RE_OP_BOUNDARY: {
-          if( re_word_char(c)!=re_word_char(cPrev) ) re_add_state(pThis, x+1);
-          break;
-        }
-        case RE_OP_ANYSTAR: {
-          re_add_state(pNext, x);
-          re_add_state(pThis, x+1);
-          break;
+    if( re_step(pRe, pThis, pNext, c, cPrev) ){
+      rc = 1;
+      goto re_match_end;
+    }
+#if SQLITE_REGEXP_DFA_BUDGET>0
+    /* After the first character, continue with the DFA as long as its
+    ** states fit into the budget */
+    if( bDfa && c!=RE_EOF && pNext->nState>0 ){
+      int noCase = pRe->xNextChar==re_next_char_nocase;
+      int iState = re_dfa_state(pRe, pNext, c);
+      bDfa = 0;
+      while( iState>=0 ){
+        ReDfaState *pState = pRe->pDfa->apState[iState];
+        int iNext;
+        if( c==RE_EOF || pState->nSet==0 ){
+          rc = pState->bAccept;
+          goto re_match_end;
         }
-        case RE_OP_FORK: {
-          re_add_state(pThis, x+pRe->aArg[x]);
-          re_add_state(pThis, x+1);
-          break;
+        if( in.i<in.mx && in.z[in.i]<0x80 ){
+          c = in.z[in.i++];
+          if( noCase && c>='A' && c<='Z' ) c += 'a' - 'A';
+        }else{
+          c = pRe->xNextChar(&in);
         }
-        case RE_OP_GOTO: {
-          re_add_state(pThis, x+pRe->aArg[x]);
-          break;
+        iNext = c<128 ? pState->aNext[c] : RE_DFA_UNKNOWN;
+        if( iNext==RE_DFA_UNKNOWN ){
+          iNext = re_dfa_step(pRe, iState, c, &aStateSet[0], &aStateSet[1]);
         }
-        case RE_OP_ACCEPT: {
+        if( iNext==RE_DFA_ACCEPT ){
           rc = 1;
           goto re_match_end;
         }
-        case RE_OP_CC_EXC: {
-          if( c==0 ) break;
-          /* fall-through */ goto re_op_cc_inc;
-        }
-        case RE_OP_CC_INC: re_op_cc_inc: {
-          int j = 1;
-          int n = pRe->aArg[x];
-          int hit = 0;
-          for(j=1; j>0 && j<n; j++){
-            if( pRe->aOp[x+j]==RE_OP_CC_VALUE ){
-              if( pRe->aArg[x+j]==c ){
-                hit = 1;
-                j = -1;
-              }
-            }else{
-              if( pRe->aArg[x+j]<=c && pRe->aArg[x+j+1]>=c ){
-                hit = 1;
-                j = -1;
-              }else{
-                j++;
-              }
-            }
-          }
-          if( pRe->aOp[x]==RE_OP_CC_EXC ) hit = !hit;
-          if( hit ) re_add_state(pNext, x+n);
-          break;
+        if( iNext==RE_DFA_FULL ){
+          /* Continue with the NFA from the states after c */
+          pNext = &aStateSet[1];
+          iSwap = 0;
         }
+        iState = iNext;
       }
     }
+#endif
   }
-  for(i=0; i<pNext->nState; i++){
-    int x = pNext->aState[i];
-    while( pRe->aOp[x]==RE_OP_GOTO ) x += pRe->aArg[x];
-    if( pRe->aOp[x]==RE_OP_ACCEPT ){ rc = 1; break; }
-  }
+  rc = re_accepting(pRe, pNext);
 re_match_end:
   sqlite3_free(pToFree);
   return rc;
@@ -644,6 +953,9 @@ static const char *re_subcompile_string(ReCompiled *p){
 */
 static void re_free(ReCompiled *pRe){
   if( pRe ){
+#if SQLITE_REGEXP_DFA_BUDGET>0
+    re_dfa_free(pRe->pDfa);
+#endif
     sqlite3_free(pRe->aOp);
     sqlite3_free(pRe->aArg);
     sqlite3_free(pRe);
@@ -659,6 +971,91 @@ static void re_free_voidptr(void *p){
   re_free((ReCompiled*)p);
 }
 
+/* Find the longest run of RE_OP_MATCH opcodes that every match has to
+** pass through, and enter its UTF-8 text into zLit[].  An opcode is
+** passed by every match if no jump leads over it, since all jumps but
+** the loops of "*" and "+" are forward and the RE_OP_ACCEPT is last.
+** The run stops at characters that also match invalid UTF-8 (U+FFFD) or
+** the end of input.  Return non-zero if out of memory.
+*/
+static int re_literal(ReCompiled *pRe){
+  int *aCover;          /* Number of jumps leading over each opcode */
+  int nCover = 0;
+  int iBest = -1;
+  int nBest = 0;
+  int i, j;
+
+  aCover = sqlite3_malloc64( sizeof(int)*(pRe->nState+1) );
+  if( aCover==0 ) return 1;
+  memset(aCover, 0, sizeof(int)*(pRe->nState+1));
+  for(i=0; i<(int)pRe->nState; i++){
+    int iTo = i;
+    switch( pRe->aOp[i] ){
+      case RE_OP_FORK:
+      case RE_OP_GOTO:
+      case RE_OP_CC_INC:
+      case RE_OP_CC_EXC:
+        iTo = i + pRe->aArg[i];
+        break;
+    }
+    if( iTo>i+1 ){
+      aCover[i+1]++;
+      aCover[iTo]--;
+    }
+  }
+  for(i=0; i<(int)pRe->nState; i++){
+    nCover += aCover[i];
+    if( pRe->aOp[i]==RE_OP_CC_INC || pRe->aOp[i]==RE_OP_CC_EXC ){
+      /* skip the values of the character class */
+      for(j=i+1; j<i+pRe->aArg[i]; j++) nCover += aCover[j];
+      i = j-1;
+      continue;
+    }
+    if( nCover==0 && pRe->aOp[i]==RE_OP_MATCH ){
+      int n = 0;
+      for(j=i; pRe->aOp[j]==RE_OP_MATCH; j++){
+        unsigned x = pRe->aArg[j];
+        if( x==RE_EOF || x==0xfffd || x>0x10ffff ) break;
+        n += x<=0x7f ? 1 : x<=0x7ff ? 2 : x<=0xffff ? 3 : 4;
+      }
+      /* The literal at the start of an unanchored pattern is searched
+      ** as zInit[] already */
+      if( n>nBest && (i!=1 || n>pRe->nInit) ){
+        iBest = i;
+        nBest = n;
+      }
+    }
+  }
+  sqlite3_free(aCover);
+
+  if( iBest<0 ) return 0;
+  for(j=0, i=iBest; i<(int)pRe->nState && pRe->aOp[i]==RE_OP_MATCH; i++){
+    unsigned x = pRe->aArg[i];
+    if( x==RE_EOF || x==0xfffd || x>0x10ffff ) break;
+    if( x<=0x7f ){
+      if( j+1>(int)sizeof(pRe->zLit) ) break;
+      pRe->zLit[j++] = (unsigned char)x;
+    }else if( x<=0x7ff ){
+      if( j+2>(int)sizeof(pRe->zLit) ) break;
+      pRe->zLit[j++] = (unsigned char)(0xc0 | (x>>6));
+      pRe->zLit[j++] = 0x80 | (x&0x3f);
+    }else if( x<=0xffff ){
+      if( j+3>(int)sizeof(pRe->zLit) ) break;
+      pRe->zLit[j++] = (unsigned char)(0xe0 | (x>>12));
+      pRe->zLit[j++] = 0x80 | ((x>>6)&0x3f);
+      pRe->zLit[j++] = 0x80 | (x&0x3f);
+    }else{
+      if( j+4>(int)sizeof(pRe->zLit) ) break;
+      pRe->zLit[j++] = (unsigned char)(0xf0 | (x>>18));
+      pRe->zLit[j++] = 0x80 | ((x>>12)&0x3f);
+      pRe->zLit[j++] = 0x80 | ((x>>6)&0x3f);
+      pRe->zLit[j++] = 0x80 | (x&0x3f);
+    }
+  }
+  pRe->nLit = j;
+  return 0;
+}
+
 /*
 ** Compile a textual regular expression in zIn[] into a compiled regular
 ** expression suitable for us by re_match() and return a pointer to the
@@ -736,6 +1133,17 @@ static const char *re_compile(
     if( j>0 && pRe->zInit[j-1]==0 ) j--;
     pRe->nInit = j;
   }
+
+  /* Another optimization: a literal that every match contains lets
+  ** re_match() reject inputs without running the NFA. */
+  if( !noCase && pRe->zErr==0 && re_literal(pRe) ){
+    re_free(pRe);
+    *ppRe = 0;
+    return "out of memory";
+  }
+  for(i=0; i<(int)pRe->nState; i++){
+    if( pRe->aOp[i]==RE_OP_BOUNDARY ) pRe->bBoundary = 1;
+  }
   return pRe->zErr;
 }
 
@@ -873,6 +1281,13 @@ static void re_bytecode_func(
     }
     sqlite3_str_appendf(pStr, "\n");
   }
+  if( pRe->nLit>0 ){
+    sqlite3_str_appendf(pStr, "LITERAL  ");
+    for(i=0; i<pRe->nLit; i++){
+      sqlite3_str_appendf(pStr, "%02x", pRe->zLit[i]);
+    }
+    sqlite3_str_appendf(pStr, "\n");
+  }
   for(i=0; (unsigned)i<pRe->nState; i++){
     sqlite3_str_appendf(pStr, "%-8s %4d\n",
          ReOpName[(unsigned char)pRe->aOp[i]], pRe->aArg[i]);
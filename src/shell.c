@@ -12176,6 +12176,7 @@ int sqlite3_appendvfs_init(
 /************************* End ext/misc/appendvfs.c ********************/
 #endif
 #ifdef SQLITE_HAVE_ZLIB
+#ifndef SQLITE_OMIT_SHELL_ZIPFILE
 /************************* Begin ext/misc/zipfile.c ******************/
 /*
 ** 2017-12-26
@@ -14479,6 +14480,7 @@ int sqlite3_zipfile_init(
 }
 
 /************************* End ext/misc/zipfile.c ********************/
+#endif
 /************************* Begin ext/misc/sqlar.c ******************/
 /*
 ** 2017-12-17
@@ -28131,7 +28133,9 @@ static void open_db(ShellState *p, int openFlags){
 #endif
 #ifdef SQLITE_HAVE_ZLIB
     if( !p->bSafeModePersist ){
+#ifndef SQLITE_OMIT_SHELL_ZIPFILE
       sqlite3_zipfile_init(p->db, 0, 0);
+#endif
       sqlite3_sqlar_init(p->db, 0, 0);
     }
 #endif
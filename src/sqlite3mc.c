@@ -171,11 +171,10 @@ sqlite3mcVersion(sqlite3_context* context, int argc, sqlite3_value** argv)
 SQLITE_PRIVATE void sqlite3mcSetMemorySecurity(int value);
 SQLITE_PRIVATE int sqlite3mcGetMemorySecurity();
 
-/* Memory locking is currently not supported */
-#ifdef SQLITE3MC_ENABLE_MEMLOCK
-#undef SQLITE3MC_ENABLE_MEMLOCK
+/* Memory locking applies to the secure arena for key material */
+#ifndef SQLITE3MC_ENABLE_MEMLOCK
+#define SQLITE3MC_ENABLE_MEMLOCK 1
 #endif
-#define SQLITE3MC_ENABLE_MEMLOCK 0
 
 #endif
 
@@ -186,10 +185,11 @@ SQLITE_PRIVATE int sqlite3mcGetMemorySecurity();
 #include "sha1.c"
 #include "sha2.c"
 
-#if HAVE_CIPHER_CHACHA20 || HAVE_CIPHER_SQLCIPHER || HAVE_CIPHER_ASCON128 || HAVE_CIPHER_AEGIS
+#if HAVE_CIPHER_CHACHA20 || HAVE_CIPHER_SQLCIPHER || HAVE_CIPHER_ASCON128 || HAVE_CIPHER_AEGIS || HAVE_CIPHER_AES_256_GCM || HAVE_CIPHER_AES_256_XTS
 #include "fastpbkdf2.c"
 
 /* Prototypes for several crypto functions to make pedantic compilers happy */
+SQLITE_PRIVATE void chacha_xor(void* data, size_t n, const uint8_t key[32], const uint8_t nonce[12], uint32_t counter, int rounds);
 SQLITE_PRIVATE void chacha20_xor(void* data, size_t n, const uint8_t key[32], const uint8_t nonce[12], uint32_t counter);
 SQLITE_PRIVATE void poly1305(const uint8_t* msg, size_t n, const uint8_t key[32], uint8_t tag[16]);
 SQLITE_PRIVATE int poly1305_tagcmp(const uint8_t tag1[16], const uint8_t tag2[16]);
@@ -207,7 +207,7 @@ mcRegisterCodecExtensions(sqlite3* db, char** pzErrMsg, const sqlite3_api_routin
 /*
 ** Codec implementation
 */
-#if HAVE_CIPHER_AES_128_CBC || HAVE_CIPHER_AES_256_CBC || HAVE_CIPHER_SQLCIPHER
+#if HAVE_CIPHER_AES_128_CBC || HAVE_CIPHER_AES_256_CBC || HAVE_CIPHER_SQLCIPHER || HAVE_CIPHER_AES_256_GCM || HAVE_CIPHER_AES_256_XTS
 #include "rijndael.c"
 #endif
 
@@ -231,6 +231,8 @@ mcRegisterCodecExtensions(sqlite3* db, char** pzErrMsg, const sqlite3_api_routin
 #include "cipher_sds_rc4.c"
 #include "cipher_ascon.c"
 #include "cipher_aegis.c"
+#include "cipher_aesgcm.c"
+#include "cipher_aesxts.c"
 #include "cipher_common.c"
 #include "cipher_config.c"
 
@@ -672,6 +674,10 @@ SQLITE_PRIVATE int
 sqlite3mc_initialize(const char* arg)
 {
   int rc = sqlite3mcInitCipherTables();
+  if (rc == SQLITE_OK)
+  {
+    rc = sqlite3mcInitSecureMemory();
+  }
 #if HAVE_CIPHER_AES_128_CBC
   if (rc == SQLITE_OK)
   {
@@ -714,6 +720,22 @@ sqlite3mc_initialize(const char* arg)
     aegis_init();
     rc = sqlite3mcRegisterCipher(&mcAegisDescriptor, mcAegisParams, (CODEC_TYPE_AEGIS == CODEC_TYPE));
   }
+  if (rc == SQLITE_OK)
+  {
+    rc = sqlite3mcInitArgon2Scheduler();
+  }
+#endif
+#if HAVE_CIPHER_AES_256_GCM
+  if (rc == SQLITE_OK)
+  {
+    rc = sqlite3mcRegisterCipher(&mcAes256GcmDescriptor, mcAes256GcmParams, (CODEC_TYPE_AES256GCM == CODEC_TYPE));
+  }
+#endif
+#if HAVE_CIPHER_AES_256_XTS
+  if (rc == SQLITE_OK)
+  {
+    rc = sqlite3mcRegisterCipher(&mcAes256XtsDescriptor, mcAes256XtsParams, (CODEC_TYPE_AES256XTS == CODEC_TYPE));
+  }
 #endif
 
   /*
@@ -825,6 +847,10 @@ sqlite3mc_shutdown(void)
 {
   sqlite3mc_vfs_shutdown();
   sqlite3mcTermCipherTables();
+#if HAVE_CIPHER_AEGIS
+  sqlite3mcTermArgon2Scheduler();
+#endif
+  sqlite3mcTermSecureMemory();
 }
 
 /*
@@ -929,6 +955,15 @@ static const sqlite3mc_api_routines sqlite3mcApis =
   sqlite3mc_vfs_create,
   sqlite3mc_vfs_destroy,
   sqlite3mc_vfs_shutdown,
+
+  sqlite3mc_wal_frame_hook,
+  sqlite3mc_wal_frame_apply,
+
+  sqlite3mc_vle_reencrypt,
+
+  sqlite3mc_key_async,
+
+  sqlite3mc_calibrate_kdf,
 };
 
 /*
@@ -35,7 +35,9 @@
 #define CODEC_TYPE_RC4         5
 #define CODEC_TYPE_ASCON128    6
 #define CODEC_TYPE_AEGIS       7
-#define CODEC_TYPE_MAX_BUILTIN 7
+#define CODEC_TYPE_AES256GCM   8
+#define CODEC_TYPE_AES256XTS   9
+#define CODEC_TYPE_MAX_BUILTIN 9
 
 /*
 ** Definition of API functions
@@ -113,6 +115,107 @@ SQLITE_API int sqlite3mc_config_cipher(sqlite3* db, const char* cipherName, cons
 SQLITE_API unsigned char* sqlite3mc_codec_data(sqlite3* db, const char* zDbName, const char* paramName);
 SQLITE_API const char* sqlite3mc_version();
 
+/*
+** Define functions for shipping encrypted WAL frames to a replica
+**
+** A WAL frame hook is invoked for each frame of a transaction, after the
+** transaction was committed, that is, after the WAL journal file was synced
+** (as far as required by the synchronous setting) and the WAL index was
+** updated. Frames of transactions that are rolled back or fail to commit are
+** not reported. The page content is passed exactly as stored in the WAL file,
+** that is, encrypted.
+**
+** Arguments of the hook:
+**   pArg     - user argument given on registration of the hook
+**   pageNo   - page number of the frame
+**   nCommit  - database size in pages for a commit frame, 0 for other frames
+**   pData    - (encrypted) page content
+**   nData    - size of the page content in bytes
+**
+** Padding frames, which SQLite appends behind the commit frame to fill up the
+** last sector, are not reported. The hook is invoked before the connection
+** releases its database lock and must not use the connection.
+**
+** Each frame should be passed unchanged to sqlite3mc_wal_frame_apply() for a replica database,
+** which was created as a copy of the primary database and uses the same key.
+**
+** The replica writes the shipped ciphertext unchanged. It decrypts each frame
+** once on arrival, to verify it and to keep its own page cache current;
+** frames are not appended to the WAL file of the replica verbatim, since the
+** frame checksums and the WAL index are specific to each WAL file.
+*/
+typedef void (*sqlite3mc_wal_frame_callback)(void* pArg, unsigned int pageNo, unsigned int nCommit, const void* pData, int nData);
+
+SQLITE_API int sqlite3mc_wal_frame_hook(sqlite3* db, const char* zDbName, sqlite3mc_wal_frame_callback xFrame, void* pArg);
+SQLITE_API int sqlite3mc_wal_frame_apply(sqlite3* db, const char* zDbName, unsigned int pageNo, unsigned int nCommit, const void* pData, int nData);
+
+/*
+** Define function for re-encrypting a column encrypted with value level encryption (VLE)
+**
+** All values of the column are re-encrypted with the active VLE key, that is,
+** the key most recently set with SQL function sqlite3mc_vle_key. Values can be
+** decrypted with any key still resident in the key ring of the connection. To
+** rotate a key, first set the old key, then the new key, and call this function.
+**
+** Arguments:
+**   zDbName    - schema name, NULL for "main"
+**   zTable     - name of a rowid table
+**   zColumn    - name of the encrypted column
+**   zScope     - scope used on encryption, NULL if no scope was given
+**   nBatchRows - number of rows per batch (transaction), 0 for default (1000)
+**   nWorkers   - number of threads for encryption, 0 or 1 for no extra threads
+**
+** Values already encrypted with the active key are skipped, so an interrupted
+** operation can be restarted.
+*/
+SQLITE_API int sqlite3mc_vle_reencrypt(sqlite3* db, const char* zDbName, const char* zTable, const char* zColumn, const char* zScope, int nBatchRows, int nWorkers);
+
+/*
+** Define function for setting a database key asynchronously
+**
+** Works like sqlite3_key_v2(), but the key derivation is performed by a worker
+** thread, so that the calling thread is not blocked. The key is copied, the
+** caller may release it immediately.
+**
+** The key derivation runs without holding the mutex of the connection; the
+** mutex is only taken to install the key. Until the key is installed, any
+** access to the database fails with SQLITE_BUSY, as does setting or changing
+** a key. The callback is invoked on the worker thread after the key was
+** installed, with the result code of the key setup and the error message
+** (NULL on success; the message is only valid during the callback). If the
+** connection is closed before the key was installed, the callback is invoked
+** with SQLITE_ABORT. The callback must not use the connection: closing the
+** connection waits for the callback to return while holding the connection
+** mutex.
+**
+** If the connection has no mutex (SQLITE_OPEN_NOMUTEX, single-thread mode) or
+** threads are not available, the key is set synchronously and the callback is
+** invoked before this function returns.
+**
+** Returns SQLITE_OK if the request was accepted, SQLITE_BUSY if a previous
+** request has not yet completed, or an error code if the request could not
+** be started.
+*/
+typedef void (*sqlite3mc_key_callback)(void* pArg, int rc, const char* zErrMsg);
+
+SQLITE_API int sqlite3mc_key_async(sqlite3* db, const char* zDbName, const void* zKey, int nKey, sqlite3mc_key_callback xCallback, void* pArg);
+
+/*
+** Calibrate the key derivation function of a cipher scheme
+**
+** The key derivation function of the cipher scheme cipherName is benchmarked
+** on the current machine, using the parameters of connection db (or the
+** global parameters, if db is NULL). Returns the work factor for which one
+** key derivation takes about targetMs milliseconds, clamped to the valid
+** range of the parameter. The work factor is the parameter "kdf_iter", or
+** "tcost" for the cipher scheme "aegis". The value is not applied; use
+** sqlite3mc_config_cipher() or PRAGMA cipher_calibrate for that.
+**
+** Returns -1 if the cipher scheme has no configurable key derivation
+** function or if targetMs is not positive.
+*/
+SQLITE_API int sqlite3mc_calibrate_kdf(sqlite3* db, const char* cipherName, int targetMs);
+
 #ifdef SQLITE3MC_WXSQLITE3_COMPATIBLE
 SQLITE_API int wxsqlite3_config(sqlite3* db, const char* paramName, int newValue);
 SQLITE_API int wxsqlite3_config_cipher(sqlite3* db, const char* cipherName, const char* paramName, int newValue);
@@ -309,6 +412,15 @@ struct sqlite3mc_api_routines {
     int (*mc_vfs_create)(const char* zVfsReal, int makeDefault);
     void (*mc_vfs_destroy)(const char* zName);
     void (*mc_vfs_shutdown)();
+
+    int (*mc_wal_frame_hook)(sqlite3* db, const char* zDbName, sqlite3mc_wal_frame_callback xFrame, void* pArg);
+    int (*mc_wal_frame_apply)(sqlite3* db, const char* zDbName, unsigned int pageNo, unsigned int nCommit, const void* pData, int nData);
+
+    int (*mc_vle_reencrypt)(sqlite3* db, const char* zDbName, const char* zTable, const char* zColumn, const char* zScope, int nBatchRows, int nWorkers);
+
+    int (*mc_key_async)(sqlite3* db, const char* zDbName, const void* zKey, int nKey, sqlite3mc_key_callback xCallback, void* pArg);
+
+    int (*mc_calibrate_kdf)(sqlite3* db, const char* cipherName, int targetMs);
 };
 
 typedef struct sqlite3mc_core_routines sqlite3mc_core_routines;
@@ -389,6 +501,15 @@ SQLITE3MC_DISPATCH_API extern const sqlite3mc_api_routines*  SQLITE3MC_API_TABLE
 #define sqlite3mc_vfs_destroy       SQLITE3MC_API_TABLE_MC->mc_vfs_destroy
 #define sqlite3mc_vfs_shutdown      SQLITE3MC_API_TABLE_MC->mc_vfs_shutdown
 
+#define sqlite3mc_wal_frame_hook    SQLITE3MC_API_TABLE_MC->mc_wal_frame_hook
+#define sqlite3mc_wal_frame_apply   SQLITE3MC_API_TABLE_MC->mc_wal_frame_apply
+
+#define sqlite3mc_vle_reencrypt     SQLITE3MC_API_TABLE_MC->mc_vle_reencrypt
+
+#define sqlite3mc_key_async         SQLITE3MC_API_TABLE_MC->mc_key_async
+
+#define sqlite3mc_calibrate_kdf     SQLITE3MC_API_TABLE_MC->mc_calibrate_kdf
+
 #endif /* !SQLITE_CORE */
 
 #endif /* SQLITE3MC_USE_DISPATCH_TABLE */
@@ -45,6 +45,14 @@
 #define HAVE_CIPHER_AEGIS WXSQLITE3_HAVE_CIPHER_AEGIS
 #endif
 
+#ifdef WXSQLITE3_HAVE_CIPHER_AES_256_GCM
+#define HAVE_CIPHER_AES_256_GCM WXSQLITE3_HAVE_CIPHER_AES_256_GCM
+#endif
+
+#ifdef WXSQLITE3_HAVE_CIPHER_AES_256_XTS
+#define HAVE_CIPHER_AES_256_XTS WXSQLITE3_HAVE_CIPHER_AES_256_XTS
+#endif
+
 /*
 ** Actual definitions of supported ciphers
 */
@@ -88,6 +96,14 @@
 #define HAVE_CIPHER_AEGIS 1
 #endif
 
+#ifndef HAVE_CIPHER_AES_256_GCM
+#define HAVE_CIPHER_AES_256_GCM 1
+#endif
+
+#ifndef HAVE_CIPHER_AES_256_XTS
+#define HAVE_CIPHER_AES_256_XTS 1
+#endif
+
 /*
 ** Define whether dynamic ciphers will be used
 */
@@ -112,6 +128,8 @@
 #undef HAVE_CIPHER_RC4
 #undef HAVE_CIPHER_ASCON128
 #undef HAVE_CIPHER_AEGIS
+#undef HAVE_CIPHER_AES_256_GCM
+#undef HAVE_CIPHER_AES_256_XTS
 #define HAVE_CIPHER_AES_128_CBC 0
 #define HAVE_CIPHER_AES_256_CBC 0
 #define HAVE_CIPHER_CHACHA20    0
@@ -119,6 +137,8 @@
 #define HAVE_CIPHER_RC4         0
 #define HAVE_CIPHER_ASCON128    0
 #define HAVE_CIPHER_AEGIS       0
+#define HAVE_CIPHER_AES_256_GCM 0
+#define HAVE_CIPHER_AES_256_XTS 0
 #endif
 
 /*
@@ -131,7 +151,9 @@
     HAVE_CIPHER_SQLCIPHER   == 0 &&  \
     HAVE_CIPHER_RC4         == 0 &&  \
     HAVE_CIPHER_ASCON128    == 0 &&  \
-    HAVE_CIPHER_AEGIS       == 0
+    HAVE_CIPHER_AEGIS       == 0 &&  \
+    HAVE_CIPHER_AES_256_GCM == 0 &&  \
+    HAVE_CIPHER_AES_256_XTS == 0
 #pragma message ("sqlite3mc_config.h: WARNING - No built-in cipher scheme enabled!")
 #endif
 
@@ -20,6 +20,38 @@
 
 typedef struct sqlite3mc_file sqlite3mc_file;
 typedef struct sqlite3mc_vfs sqlite3mc_vfs;
+typedef struct sqlite3mc_wal_apply sqlite3mc_wal_apply;
+typedef struct sqlite3mc_wal_ship sqlite3mc_wal_ship;
+
+/*
+** Buffer for WAL frames of a not yet committed transaction,
+** which are to be applied to a replica database
+*/
+
+struct sqlite3mc_wal_apply
+{
+  int nPageSize;               /* Page size of buffered frames */
+  int nFrame;                  /* Number of buffered frames */
+  int nAlloc;                  /* Number of allocated frame slots */
+  Pgno* aPgno;                 /* Page numbers of buffered frames */
+  unsigned char* aData;        /* Decrypted page content of buffered frames */
+  unsigned char* aCipher;      /* Page content of buffered frames as shipped */
+  int* aOrder;                 /* Frame indexes sorted by page number (while committing) */
+  int nOrder;                  /* Number of entries in aOrder, 0 if no commit is in progress */
+};
+
+/*
+** SQLite3 Multiple Ciphers structure for frames captured for the WAL frame hook
+*/
+
+struct sqlite3mc_wal_ship
+{
+  sqlite3_int64 txStart;       /* Offset of 1st frame of current transaction, -1 if unknown */
+  sqlite3_int64 commitEnd;     /* Offset behind the commit frame of the captured transaction */
+  int nPageSize;               /* Page size of captured frames */
+  int nFrame;                  /* Number of captured frames, 0 if none */
+  unsigned char* aFrame;       /* Captured frames (frame header and page content) */
+};
 
 /*
 ** SQLite3 Multiple Ciphers file structure
@@ -36,6 +68,12 @@ struct sqlite3mc_file
   sqlite3mc_file* pMainDb;     /* Main database to which this one is attached */
   Codec* codec;                /* Codec if encrypted */
   int pageNo;                  /* Page number (in case of journal files) */
+  sqlite3mc_wal_frame_callback xWalFrame; /* WAL frame hook (main db file) */
+  void* pWalFrameArg;          /* First argument of WAL frame hook */
+  sqlite3mc_wal_apply walApply; /* Pending frames to apply (main db file) */
+  sqlite3mc_wal_ship walShip;  /* Committed frames to report (main db file) */
+  int walPageSize;             /* Page size taken from the WAL header (WAL file) */
+  int keyPending;              /* Asynchronous key setup in progress (main db file) */
 };
 
 /*
@@ -257,6 +295,36 @@ static sqlite3mc_vfs* mcFindVfs(sqlite3* db, const char* zDbName)
   return pVfsMC;
 }
 
+/*
+** Find the main database file handle
+** corresponding to the database schema name.
+*/
+static sqlite3mc_file* mcFindDbMainFile(sqlite3* db, const char* zDbName)
+{
+  sqlite3mc_file* pDbMain = NULL;
+  sqlite3mc_vfs* pVfsMC = mcFindVfs(db, zDbName);
+  if (pVfsMC)
+  {
+    const char* dbFileName = sqlite3_db_filename(db, zDbName);
+    pDbMain = mcFindDbMainFileName(pVfsMC, dbFileName);
+  }
+  return pDbMain;
+}
+
+/*
+** Mark the main database file corresponding to the database schema name
+** as waiting for an asynchronous key setup. Until the mark is removed,
+** locking the file fails with SQLITE_BUSY.
+*/
+SQLITE_PRIVATE void sqlite3mcSetKeyPending(sqlite3* db, const char* zDbName, int pending)
+{
+  sqlite3mc_file* pDbMain = mcFindDbMainFile(db, zDbName);
+  if (pDbMain != NULL)
+  {
+    pDbMain->keyPending = pending;
+  }
+}
+
 /*
 ** Check whether the VFS of the database file corresponding
 ** to the database schema name supports encryption.
@@ -274,16 +342,10 @@ SQLITE_PRIVATE int sqlite3mcIsEncryptionSupported(sqlite3* db, const char* zDbNa
 SQLITE_PRIVATE Codec* sqlite3mcGetCodec(sqlite3* db, const char* zDbName)
 {
   Codec* codec = NULL;
-  sqlite3mc_vfs* pVfsMC = mcFindVfs(db, zDbName);
-
-  if (pVfsMC)
+  sqlite3mc_file* pDbMain = mcFindDbMainFile(db, zDbName);
+  if (pDbMain)
   {
-    const char* dbFileName = sqlite3_db_filename(db, zDbName);
-    sqlite3mc_file* pDbMain = mcFindDbMainFileName(pVfsMC, dbFileName);
-    if (pDbMain)
-    {
-      codec = pDbMain->codec;
-    }
+    codec = pDbMain->codec;
   }
   return codec;
 }
@@ -365,6 +427,46 @@ SQLITE_PRIVATE void sqlite3mcSetCodec(sqlite3* db, const char* zDbName, const ch
   }
 }
 
+/*
+** Look up the shipped page content of a replicated transaction
+**
+** While sqlite3mc_wal_frame_apply() commits a replicated transaction, the
+** page content is written exactly as it was received from the primary
+** database, instead of encrypting it once more. This is only done if the
+** page is about to be written unchanged, since any valid ciphertext of the
+** same page content and page number is interchangeable for the same key.
+*/
+static const unsigned char* mcWalApplyShipped(sqlite3mc_file* pDbMain, Pgno pageNo, const void* pData)
+{
+  const sqlite3mc_wal_apply* pApply = (pDbMain != NULL) ? &pDbMain->walApply : NULL;
+  int lo = 0;
+  int hi;
+  if (pApply == NULL || pApply->nOrder == 0)
+  {
+    return NULL;
+  }
+  hi = pApply->nOrder - 1;
+  while (lo <= hi)
+  {
+    int mid = (lo + hi) / 2;
+    int j = pApply->aOrder[mid];
+    if (pApply->aPgno[j] == pageNo)
+    {
+      size_t offset = (size_t) j * pApply->nPageSize;
+      return (memcmp(pApply->aData + offset, pData, pApply->nPageSize) == 0) ? pApply->aCipher + offset : NULL;
+    }
+    if (pApply->aPgno[j] < pageNo)
+    {
+      lo = mid + 1;
+    }
+    else
+    {
+      hi = mid - 1;
+    }
+  }
+  return NULL;
+}
+
 /*
 ** This function is called by the wal module when writing page content
 ** into the log file.
@@ -384,7 +486,11 @@ SQLITE_PRIVATE void* sqlite3mcPagerCodec(PgHdrMC* pPg)
     Codec* codec = mcFile->codec;
     if (codec != 0 && codec->m_walLegacy == 0 && sqlite3mcIsEncrypted(codec))
     {
-      aData = sqlite3mcCodec(codec, pPg->pData, pPg->pgno, 6);
+      aData = (void*) mcWalApplyShipped(mcFile, pPg->pgno, pPg->pData);
+      if (aData == NULL)
+      {
+        aData = sqlite3mcCodec(codec, pPg->pData, pPg->pgno, 6);
+      }
     }
     else
     {
@@ -415,6 +521,13 @@ static int mcVfsOpen(sqlite3_vfs* pVfs, const char* zName, sqlite3_file* pFile,
   mcFile->pMainDb = 0;
   mcFile->pMainNext = 0;
   mcFile->pageNo = 0;
+  mcFile->xWalFrame = 0;
+  mcFile->pWalFrameArg = 0;
+  memset(&mcFile->walApply, 0, sizeof(sqlite3mc_wal_apply));
+  memset(&mcFile->walShip, 0, sizeof(sqlite3mc_wal_ship));
+  mcFile->walShip.txStart = -1;
+  mcFile->walPageSize = 0;
+  mcFile->keyPending = 0;
 
   if (zName)
   {
@@ -575,6 +688,59 @@ static const char* mcVfsNextSystemCall(sqlite3_vfs* pVfs, const char* zName)
   return REALVFS(pVfs)->xNextSystemCall(REALVFS(pVfs), zName);
 }
 
+/*
+** Discard the frames buffered for a replicated transaction
+*/
+static void mcWalApplyReset(sqlite3mc_wal_apply* pApply, int freeBuffers)
+{
+  if (pApply->aData != NULL && pApply->nFrame > 0)
+  {
+    sqlite3mcSecureZeroMemory(pApply->aData, (size_t) pApply->nFrame * pApply->nPageSize);
+  }
+  pApply->nFrame = 0;
+  pApply->nOrder = 0;
+  if (freeBuffers)
+  {
+    sqlite3_free(pApply->aPgno);
+    sqlite3_free(pApply->aData);
+    sqlite3_free(pApply->aCipher);
+    sqlite3_free(pApply->aOrder);
+    memset(pApply, 0, sizeof(sqlite3mc_wal_apply));
+  }
+}
+
+/*
+** Discard the frames captured for the WAL frame hook
+*/
+static void mcWalShipReset(sqlite3mc_wal_ship* pShip)
+{
+  sqlite3_free(pShip->aFrame);
+  pShip->aFrame = NULL;
+  pShip->nFrame = 0;
+  pShip->commitEnd = 0;
+}
+
+/*
+** Report the captured frames of a committed transaction to the WAL frame hook
+*/
+static void mcWalShipDeliver(sqlite3mc_file* pDbMain)
+{
+  sqlite3mc_wal_ship* pShip = &pDbMain->walShip;
+  if (pShip->nFrame > 0 && pDbMain->xWalFrame != NULL)
+  {
+    int frameSize = pShip->nPageSize + walFrameHeaderSize;
+    int j;
+    for (j = 0; j < pShip->nFrame; ++j)
+    {
+      const unsigned char* aFrame = pShip->aFrame + (sqlite3_int64) j * frameSize;
+      pDbMain->xWalFrame(pDbMain->pWalFrameArg,
+                         sqlite3Get4byte(aFrame), sqlite3Get4byte(aFrame + 4),
+                         aFrame + walFrameHeaderSize, pShip->nPageSize);
+    }
+  }
+  mcWalShipReset(pShip);
+}
+
 /*
 ** IO methods
 */
@@ -601,6 +767,12 @@ static int mcIoClose(sqlite3_file* pFile)
     p->codec = 0;
   }
 
+  /*
+  ** Release frames of an incomplete replicated transaction
+  */
+  mcWalApplyReset(&p->walApply, 1);
+  mcWalShipReset(&p->walShip);
+
   assert(p->pMainNext == 0 && p->pVfsMC->pMain != p);
   rc = REALFILE(pFile)->pMethods->xClose(REALFILE(pFile));
   return rc;
@@ -636,6 +808,10 @@ static int mcReadMainDb(sqlite3_file* pFile, void* buffer, int count, sqlite3_in
       void* bufferDecrypted = 0;
       const sqlite3_int64 prevOffset = offset - deltaOffset;
       unsigned char* pageBuffer = sqlite3mcGetPageBuffer(mcFile->codec);
+      if (pageBuffer == NULL)
+      {
+        return SQLITE_NOMEM;
+      }
 
       /*
       ** Read complete page from file
@@ -911,7 +1087,16 @@ static int mcWriteMainDb(sqlite3_file* pFile, const void* buffer, int count, sql
       int iPage;
       for (iPage = 0; iPage < nPages; ++iPage)
       {
-        void* bufferEncrypted = sqlite3mcCodec(mcFile->codec, data, pageNo, 6);
+        void* bufferEncrypted = (void*) mcWalApplyShipped(mcFile, pageNo, data);
+        if (bufferEncrypted == NULL)
+        {
+          bufferEncrypted = sqlite3mcCodec(mcFile->codec, data, pageNo, 6);
+        }
+        if (bufferEncrypted == NULL)
+        {
+          rc = SQLITE_NOMEM;
+          break;
+        }
         rc = REALFILE(pFile)->pMethods->xWrite(REALFILE(pFile), bufferEncrypted, pageSize, offset);
         data += pageSize;
         offset += pageSize;
@@ -949,7 +1134,9 @@ static int mcWriteMainJournal(sqlite3_file* pFile, const void* buffer, int count
       ** Encrypt the page buffer, but only if the page number is valid
       */
       void* bufferEncrypted = sqlite3mcCodec(codec, (char*) buffer, mcFile->pageNo, 7);
-      rc = REALFILE(pFile)->pMethods->xWrite(REALFILE(pFile), bufferEncrypted, pageSize, offset);
+      rc = (bufferEncrypted != NULL)
+        ? REALFILE(pFile)->pMethods->xWrite(REALFILE(pFile), bufferEncrypted, pageSize, offset)
+        : SQLITE_NOMEM;
     }
     else
     {
@@ -997,7 +1184,9 @@ static int mcWriteSubJournal(sqlite3_file* pFile, const void* buffer, int count,
       ** Encrypt the page buffer, but only if the page number is valid
       */
       void* bufferEncrypted = sqlite3mcCodec(codec, (char*) buffer, mcFile->pageNo, 7);
-      rc = REALFILE(pFile)->pMethods->xWrite(REALFILE(pFile), bufferEncrypted, pageSize, offset);
+      rc = (bufferEncrypted != NULL)
+        ? REALFILE(pFile)->pMethods->xWrite(REALFILE(pFile), bufferEncrypted, pageSize, offset)
+        : SQLITE_NOMEM;
     }
     else
     {
@@ -1025,6 +1214,122 @@ static int mcWriteSubJournal(sqlite3_file* pFile, const void* buffer, int count,
   return rc;
 }
 
+/*
+** Capture the frames of a committed transaction for the WAL frame hook
+**
+** The function is called after each successful write to the WAL journal
+** file. As soon as the page content of a commit frame has been written,
+** all frames of the transaction are read back from the WAL file. The page
+** content is captured exactly as stored in the WAL file, that is, encrypted.
+**
+** The frames are not captured on each write, because SQLite rewrites the
+** frames of the open transaction in place, if a page is modified again.
+**
+** The captured frames are reported only after the commit has completed,
+** that is, after the WAL file was synced and the WAL index was updated
+** (see SQLITE_FCNTL_COMMIT_PHASETWO in mcIoFileControl). Frames written
+** behind the commit frame before that are padding frames, which SQLite
+** appends to fill up the last sector; they are not reported.
+*/
+static void mcWalFrameTap(sqlite3_file* pFile, const void* buffer, int count, sqlite3_int64 offset)
+{
+  int rc = SQLITE_OK;
+  sqlite3mc_file* mcFile = (sqlite3mc_file*) pFile;
+  sqlite3mc_wal_ship* pShip = &mcFile->pMainDb->walShip;
+  sqlite3_int64 frameSize;
+  sqlite3_int64 frameEnd = offset + count;
+  sqlite3_int64 frameStart;
+  sqlite3_int64 frameOffset;
+  unsigned char* aFrame;
+  int nFrame;
+  unsigned char ac[32]; /* Buffer for WAL file header or WAL frame header */
+
+  if (offset == 0 && count >= walFileHeaderSize)
+  {
+    /* WAL header (re)written, the WAL file is restarted */
+    mcFile->walPageSize = sqlite3Get4byte((const unsigned char*) buffer + 8);
+    pShip->txStart = -1;
+    mcWalShipReset(pShip);
+    return;
+  }
+  if (offset < walFileHeaderSize)
+  {
+    return;
+  }
+  if (pShip->nFrame > 0)
+  {
+    if (offset >= pShip->commitEnd)
+    {
+      /* Padding frame behind the commit frame */
+      return;
+    }
+    /* The captured transaction was not committed, its frames are overwritten */
+    mcWalShipReset(pShip);
+  }
+  if (mcFile->walPageSize == 0)
+  {
+    /* WAL file was not restarted by this connection, get page size from WAL header */
+    rc = REALFILE(pFile)->pMethods->xRead(REALFILE(pFile), ac, walFileHeaderSize, 0);
+    if (rc != SQLITE_OK)
+    {
+      return;
+    }
+    mcFile->walPageSize = sqlite3Get4byte(ac + 8);
+    if (mcFile->walPageSize < 512 || mcFile->walPageSize > SQLITE_MAX_PAGE_SIZE)
+    {
+      mcFile->walPageSize = 0;
+      return;
+    }
+  }
+  frameSize = mcFile->walPageSize + walFrameHeaderSize;
+
+  /* Remember the first frame written by the current transaction */
+  if (pShip->txStart < 0 && (offset - walFileHeaderSize) % frameSize == 0)
+  {
+    pShip->txStart = offset;
+  }
+
+  /* Check whether the write completed a commit frame */
+  if ((frameEnd - walFileHeaderSize) % frameSize != 0)
+  {
+    return;
+  }
+  frameStart = frameEnd - frameSize;
+  rc = REALFILE(pFile)->pMethods->xRead(REALFILE(pFile), ac, walFrameHeaderSize, frameStart);
+  if (rc != SQLITE_OK || sqlite3Get4byte(ac + 4) == 0)
+  {
+    return;
+  }
+  if (pShip->txStart < 0 || pShip->txStart > frameStart)
+  {
+    pShip->txStart = frameStart;
+  }
+
+  nFrame = (int) ((frameEnd - pShip->txStart) / frameSize);
+  aFrame = (unsigned char*) sqlite3_malloc64((sqlite3_uint64) nFrame * frameSize);
+  if (aFrame != NULL)
+  {
+    unsigned char* pFrame = aFrame;
+    for (frameOffset = pShip->txStart; rc == SQLITE_OK && frameOffset < frameEnd; frameOffset += frameSize)
+    {
+      rc = REALFILE(pFile)->pMethods->xRead(REALFILE(pFile), pFrame, (int) frameSize, frameOffset);
+      pFrame += frameSize;
+    }
+    if (rc == SQLITE_OK)
+    {
+      pShip->aFrame = aFrame;
+      pShip->nFrame = nFrame;
+      pShip->nPageSize = mcFile->walPageSize;
+      pShip->commitEnd = frameEnd;
+    }
+    else
+    {
+      sqlite3_free(aFrame);
+    }
+  }
+  pShip->txStart = -1;
+}
+
 /*
 ** Write operation on WAL journal file
 */
@@ -1063,8 +1368,14 @@ static int mcWriteWal(sqlite3_file* pFile, const void* buffer, int count, sqlite
         /*
         ** Encrypt the page buffer, but only if the page number is valid
         */
-        void* bufferEncrypted = sqlite3mcCodec(codec, (char*) buffer, pageNo, 7);
-        rc = REALFILE(pFile)->pMethods->xWrite(REALFILE(pFile), bufferEncrypted, pageSize, offset);
+        void* bufferEncrypted = (void*) mcWalApplyShipped(mcFile->pMainDb, pageNo, buffer);
+        if (bufferEncrypted == NULL)
+        {
+          bufferEncrypted = sqlite3mcCodec(codec, (char*) buffer, pageNo, 7);
+        }
+        rc = (bufferEncrypted != NULL)
+          ? REALFILE(pFile)->pMethods->xWrite(REALFILE(pFile), bufferEncrypted, pageSize, offset)
+          : SQLITE_NOMEM;
       }
       else
       {
@@ -1082,7 +1393,15 @@ static int mcWriteWal(sqlite3_file* pFile, const void* buffer, int count, sqlite
         /*
         ** Encrypt the page buffer, but only if the page number is valid
         */
-        void* bufferEncrypted = sqlite3mcCodec(codec, (char*)buffer+walFrameHeaderSize, pageNo, 7);
+        void* bufferEncrypted = (void*) mcWalApplyShipped(mcFile->pMainDb, pageNo, (char*)buffer+walFrameHeaderSize);
+        if (bufferEncrypted == NULL)
+        {
+          bufferEncrypted = sqlite3mcCodec(codec, (char*)buffer+walFrameHeaderSize, pageNo, 7);
+        }
+        if (bufferEncrypted == NULL)
+        {
+          return SQLITE_NOMEM;
+        }
         rc = REALFILE(pFile)->pMethods->xWrite(REALFILE(pFile), buffer, walFrameHeaderSize, offset);
         rc = REALFILE(pFile)->pMethods->xWrite(REALFILE(pFile), bufferEncrypted, pageSize, offset+walFrameHeaderSize);
       }
@@ -1109,6 +1428,19 @@ static int mcWriteWal(sqlite3_file* pFile, const void* buffer, int count, sqlite
     */
     rc = REALFILE(pFile)->pMethods->xWrite(REALFILE(pFile), buffer, count, offset);
   }
+
+  /*
+  ** Report committed frames, if a WAL frame hook is registered
+  */
+  if (rc == SQLITE_OK && mcFile->pMainDb != NULL && mcFile->pMainDb->xWalFrame != NULL)
+  {
+    mcWalFrameTap(pFile, buffer, count, offset);
+  }
+  else if (rc != SQLITE_OK && mcFile->pMainDb != NULL)
+  {
+    /* The commit fails, captured frames must not be reported */
+    mcWalShipReset(&mcFile->pMainDb->walShip);
+  }
   return rc;
 }
 
@@ -1186,7 +1518,14 @@ static int mcIoTruncate(sqlite3_file* pFile, sqlite3_int64 size)
 
 static int mcIoSync(sqlite3_file* pFile, int flags)
 {
-  return REALFILE(pFile)->pMethods->xSync(REALFILE(pFile), flags);
+  sqlite3mc_file* mcFile = (sqlite3mc_file*) pFile;
+  int rc = REALFILE(pFile)->pMethods->xSync(REALFILE(pFile), flags);
+  if (rc != SQLITE_OK && (mcFile->openFlags & SQLITE_OPEN_WAL) && mcFile->pMainDb != NULL)
+  {
+    /* The commit fails, captured frames must not be reported */
+    mcWalShipReset(&mcFile->pMainDb->walShip);
+  }
+  return rc;
 }
 
 static int mcIoFileSize(sqlite3_file* pFile, sqlite3_int64* pSize)
@@ -1196,6 +1535,11 @@ static int mcIoFileSize(sqlite3_file* pFile, sqlite3_int64* pSize)
 
 static int mcIoLock(sqlite3_file* pFile, int lock)
 {
+  if (((sqlite3mc_file*) pFile)->keyPending)
+  {
+    /* Do not access the database before its key is set up */
+    return SQLITE_BUSY;
+  }
   return REALFILE(pFile)->pMethods->xLock(REALFILE(pFile), lock);
 }
 
@@ -1241,6 +1585,15 @@ static int mcIoFileControl(sqlite3_file* pFile, int op, void* pArg)
 #endif
       }
       break;
+    case SQLITE_FCNTL_COMMIT_PHASETWO:
+      {
+        /*
+        ** The transaction was committed, that is, the WAL file was synced
+        ** and the WAL index was updated. Report the captured frames now.
+        */
+        mcWalShipDeliver(p);
+      }
+      break;
     case SQLITE_FCNTL_PRAGMA:
       {
         /*
@@ -1307,7 +1660,18 @@ static int mcIoShmMap(sqlite3_file* pFile, int iPg, int pgsz, int map, void vola
 
 static int mcIoShmLock(sqlite3_file* pFile, int offset, int n, int flags)
 {
-  return REALFILE(pFile)->pMethods->xShmLock(REALFILE(pFile), offset, n, flags);
+  sqlite3mc_file* mcFile = (sqlite3mc_file*) pFile;
+  int rc = REALFILE(pFile)->pMethods->xShmLock(REALFILE(pFile), offset, n, flags);
+  if (rc == SQLITE_OK && offset == 0 && n == 1 && flags == (SQLITE_SHM_LOCK | SQLITE_SHM_EXCLUSIVE))
+  {
+    /*
+    ** WAL write lock acquired: frames of a previous transaction, which was
+    ** rolled back or failed, must not be taken for the next transaction
+    */
+    mcFile->walShip.txStart = -1;
+    mcWalShipReset(&mcFile->walShip);
+  }
+  return rc;
 }
 
 static void mcIoShmBarrier(sqlite3_file* pFile)
@@ -1535,3 +1899,274 @@ SQLITE_API void sqlite3mc_vfs_shutdown()
     mcVfsDestroy(pVfs);
   }
 }
+
+/*
+** Register a hook that is invoked for each frame of a committed transaction
+** written to the WAL journal file of the given database. Passing NULL for
+** xFrame removes a previously registered hook.
+*/
+SQLITE_API int
+sqlite3mc_wal_frame_hook(sqlite3* db, const char* zDbName, sqlite3mc_wal_frame_callback xFrame, void* pArg)
+{
+  int rc = SQLITE_ERROR;
+  sqlite3mc_file* pDbMain;
+  if (db == NULL)
+  {
+    return SQLITE_MISUSE;
+  }
+  if (zDbName == NULL)
+  {
+    zDbName = "main";
+  }
+  sqlite3_mutex_enter(db->mutex);
+  pDbMain = mcFindDbMainFile(db, zDbName);
+  if (pDbMain != NULL)
+  {
+    pDbMain->xWalFrame = xFrame;
+    pDbMain->pWalFrameArg = pArg;
+    mcWalShipReset(&pDbMain->walShip);
+    rc = SQLITE_OK;
+  }
+  else
+  {
+    sqlite3ErrorWithMsg(db, rc, "Setting WAL frame hook failed. Database '%s' not found or VFS not supported.", zDbName);
+  }
+  sqlite3_mutex_leave(db->mutex);
+  return rc;
+}
+
+/*
+** Write the buffered pages of a replicated transaction to the database
+*/
+static int
+mcWalApplyCommit(sqlite3* db, int dbIndex, sqlite3mc_wal_apply* pApply, Pgno nCommit)
+{
+  Btree* pBt = db->aDb[dbIndex].pBt;
+  Pager* pPager = sqlite3BtreePager(pBt);
+  int pageSize = pApply->nPageSize;
+  Pgno nSkip = WX_PAGER_MJ_PGNO(pageSize);
+  int rc;
+  int j;
+
+  /*
+  ** Index the frames by page number. If a page occurs in several frames,
+  ** the last frame determines the content of the page.
+  */
+  pApply->nOrder = 0;
+  for (j = 0; j < pApply->nFrame; j++)
+  {
+    Pgno pgno = pApply->aPgno[j];
+    int lo = 0;
+    int hi = pApply->nOrder;
+    if (pgno == nSkip || pgno > nCommit) continue;
+    while (lo < hi)
+    {
+      int mid = (lo + hi) / 2;
+      if (pApply->aPgno[pApply->aOrder[mid]] < pgno)
+      {
+        lo = mid + 1;
+      }
+      else
+      {
+        hi = mid;
+      }
+    }
+    if (lo < pApply->nOrder && pApply->aPgno[pApply->aOrder[lo]] == pgno)
+    {
+      pApply->aOrder[lo] = j;
+    }
+    else
+    {
+      memmove(pApply->aOrder + lo + 1, pApply->aOrder + lo, (size_t) (pApply->nOrder - lo) * sizeof(int));
+      pApply->aOrder[lo] = j;
+      pApply->nOrder++;
+    }
+  }
+
+  rc = sqlite3BtreeBeginTrans(pBt, 1, 0);
+  for (j = 0; rc == SQLITE_OK && j < pApply->nOrder; j++)
+  {
+    int iFrame = pApply->aOrder[j];
+    DbPage* pPage;
+    rc = sqlite3PagerGet(pPager, pApply->aPgno[iFrame], &pPage, 0);
+    if (rc == SQLITE_OK)
+    {
+      rc = sqlite3PagerWrite(pPage);
+      if (rc == SQLITE_OK)
+      {
+        memcpy(sqlite3PagerGetData(pPage), pApply->aData + (size_t) iFrame * pageSize, pageSize);
+      }
+      sqlite3PagerUnref(pPage);
+    }
+  }
+
+  if (rc == SQLITE_OK)
+  {
+    int nPageCount = 0;
+    sqlite3PagerPagecount(pPager, &nPageCount);
+    if (nCommit < (Pgno) nPageCount)
+    {
+      sqlite3PagerTruncateImage(pPager, nCommit);
+    }
+    /*
+    ** Commit on the pager level, since the pages are final as shipped;
+    ** the b-tree layer must not apply auto-vacuum to them. The pages
+    ** are written as shipped, see mcWalApplyShipped().
+    */
+    rc = sqlite3PagerCommitPhaseOne(pPager, NULL, 0);
+    if (rc == SQLITE_OK)
+    {
+      rc = sqlite3BtreeCommitPhaseTwo(pBt, 0);
+    }
+  }
+  if (rc != SQLITE_OK)
+  {
+    sqlite3BtreeRollback(pBt, SQLITE_OK, 0);
+  }
+  pApply->nOrder = 0;
+
+  /*
+  ** The b-tree layer still holds the parsed state of the previous content.
+  ** Drop the page cache and the schema, so that both are reloaded.
+  */
+  sqlite3PagerClearCache(pPager);
+  sqlite3ResetAllSchemasOfConnection(db);
+  return rc;
+}
+
+/*
+** Apply a WAL frame, as reported by the WAL frame hook, to a replica database.
+**
+** Frames are buffered until a commit frame (nCommit != 0) arrives; then all
+** pages of the transaction are written to the replica in a single transaction.
+** The replica must have been opened with the same key as the primary database,
+** that is, it must have been created as a copy of the primary database file.
+**
+** The shipped ciphertext is written to the replica unchanged, it is not
+** encrypted again. However, each frame is decrypted once on arrival: the
+** page cache of the replica connection holds plaintext, and frames encrypted
+** with a different key or modified in transit are rejected this way before
+** anything is written.
+*/
+SQLITE_API int
+sqlite3mc_wal_frame_apply(sqlite3* db, const char* zDbName, unsigned int pageNo, unsigned int nCommit, const void* pData, int nData)
+{
+  int rc = SQLITE_ERROR;
+  int dbIndex;
+  int pageSize;
+  Btree* pBt;
+  Codec* codec;
+  sqlite3mc_file* pDbMain;
+  sqlite3mc_wal_apply* pApply;
+  unsigned char* pFrameData;
+
+  if (db == NULL || pData == NULL || pageNo == 0)
+  {
+    return SQLITE_MISUSE;
+  }
+  if (zDbName == NULL)
+  {
+    zDbName = "main";
+  }
+  sqlite3_mutex_enter(db->mutex);
+
+  dbIndex = sqlite3FindDbName(db, zDbName);
+  pDbMain = (dbIndex >= 0) ? mcFindDbMainFile(db, zDbName) : NULL;
+  if (pDbMain == NULL)
+  {
+    sqlite3ErrorWithMsg(db, rc, "Applying WAL frame failed. Database '%s' not found or VFS not supported.", zDbName);
+    goto leave_apply;
+  }
+  if (!db->autoCommit || db->nVdbeActive > 0)
+  {
+    rc = SQLITE_MISUSE;
+    sqlite3ErrorWithMsg(db, rc, "Applying WAL frame failed. Transaction or statement in progress.");
+    goto leave_apply;
+  }
+
+  pBt = db->aDb[dbIndex].pBt;
+  pageSize = sqlite3BtreeGetPageSize(pBt);
+  pApply = &pDbMain->walApply;
+  if (nData != pageSize || (pApply->nFrame > 0 && pApply->nPageSize != pageSize))
+  {
+    mcWalApplyReset(pApply, 0);
+    sqlite3ErrorWithMsg(db, rc, "Applying WAL frame failed. Frame size %d does not match page size %d.", nData, pageSize);
+    goto leave_apply;
+  }
+
+  /* Make room for the frame */
+  if (pApply->nPageSize != pageSize)
+  {
+    mcWalApplyReset(pApply, 1);
+    pApply->nPageSize = pageSize;
+  }
+  if (pApply->nFrame >= pApply->nAlloc)
+  {
+    int nAlloc = (pApply->nAlloc > 0) ? 2 * pApply->nAlloc : 16;
+    Pgno* aPgno = (Pgno*) sqlite3_realloc64(pApply->aPgno, (sqlite3_uint64) nAlloc * sizeof(Pgno));
+    int* aOrder = (aPgno != NULL) ? (int*) sqlite3_realloc64(pApply->aOrder, (sqlite3_uint64) nAlloc * sizeof(int)) : NULL;
+    unsigned char* aCipher = (aOrder != NULL) ? (unsigned char*) sqlite3_realloc64(pApply->aCipher, (sqlite3_uint64) nAlloc * pageSize) : NULL;
+    unsigned char* aData = (aCipher != NULL) ? (unsigned char*) sqlite3_malloc64((sqlite3_uint64) nAlloc * pageSize) : NULL;
+    if (aPgno != NULL)
+    {
+      pApply->aPgno = aPgno;
+    }
+    if (aOrder != NULL)
+    {
+      pApply->aOrder = aOrder;
+    }
+    if (aCipher != NULL)
+    {
+      pApply->aCipher = aCipher;
+    }
+    if (aData == NULL)
+    {
+      mcWalApplyReset(pApply, 0);
+      rc = SQLITE_NOMEM;
+      goto leave_apply;
+    }
+    if (pApply->aData != NULL)
+    {
+      /* Move buffered pages explicitly, so that no copy is left in freed memory */
+      memcpy(aData, pApply->aData, (size_t) pApply->nFrame * pageSize);
+      sqlite3mcSecureZeroMemory(pApply->aData, (size_t) pApply->nFrame * pageSize);
+      sqlite3_free(pApply->aData);
+    }
+    pApply->aData = aData;
+    pApply->nAlloc = nAlloc;
+  }
+
+  /* Decrypt the page content, thereby verifying it */
+  pFrameData = pApply->aData + (size_t) pApply->nFrame * pageSize;
+  memcpy(pApply->aCipher + (size_t) pApply->nFrame * pageSize, pData, pageSize);
+  memcpy(pFrameData, pData, pageSize);
+  codec = pDbMain->codec;
+  if (codec != NULL && sqlite3mcIsEncrypted(codec) && sqlite3mcHasReadCipher(codec))
+  {
+    rc = sqlite3mcDecrypt(codec, (int) pageNo, pFrameData, pageSize);
+    if (rc != SQLITE_OK)
+    {
+      sqlite3mcSecureZeroMemory(pFrameData, pageSize);
+      mcWalApplyReset(pApply, 0);
+      sqlite3ErrorWithMsg(db, rc, "Applying WAL frame failed. Page %u could not be decrypted.", pageNo);
+      goto leave_apply;
+    }
+  }
+  pApply->aPgno[pApply->nFrame++] = (Pgno) pageNo;
+  rc = SQLITE_OK;
+
+  /* Write all buffered pages on reaching the commit frame */
+  if (nCommit != 0)
+  {
+    rc = mcWalApplyCommit(db, dbIndex, pApply, (Pgno) nCommit);
+    mcWalApplyReset(pApply, 0);
+    if (rc != SQLITE_OK)
+    {
+      sqlite3ErrorWithMsg(db, rc, "Applying WAL frame failed. Transaction could not be committed.");
+    }
+  }
+
+leave_apply:
+  sqlite3_mutex_leave(db->mutex);
+  return rc;
+}
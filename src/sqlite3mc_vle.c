@@ -9,13 +9,15 @@
 
 /*
 ** This extension implements "Value Level Encryption" (VLE).
-** Currently, 2 encryption algorithms are supported: chacha20 and ascon128.
+** Currently, 3 families of encryption algorithms are supported: chacha20,
+** ascon128, and the AEGIS variants (aegis-128l, aegis-128x2, aegis-128x4,
+** aegis-256, aegis-256x2, aegis-256x4).
 ** The implementation accesses functions provided by the corresponding
 ** cipher schemes. Therefore it can be compiled only, if at least one
-** cipher scheme is enabled. To use both encryption algorithms, both
+** cipher scheme is enabled. To use all encryption algorithms, all
 ** cipher schemes need to be enabled.
 */
-#if HAVE_CIPHER_CHACHA20 || HAVE_CIPHER_ASCON128
+#if HAVE_CIPHER_CHACHA20 || HAVE_CIPHER_ASCON128 || HAVE_CIPHER_AEGIS
 
 #include <sqlite3ext.h>
 SQLITE_EXTENSION_INIT1
@@ -35,15 +37,66 @@ SQLITE_EXTENSION_INIT1
 #define VLE_TAG_LEN      16
 #define VLE_KEY_ID_LEN    8
 
-typedef struct _VleContext
+/* Header flags */
+#define VLE_FLAG_DETERMINISTIC 0x01
+/* Key id (VLE_KEY_ID_LEN bytes) follows the header */
+#define VLE_FLAG_KEY_ID        0x02
+/* AEGIS variant (AEGIS_ALGORITHM_*) in bits 4 to 6 of the header flags */
+#define VLE_FLAG_VARIANT_SHIFT 4
+#define VLE_FLAG_VARIANT_MASK  0x70
+
+/* Key derivation functions */
+#define VLE_KDF_PBKDF2 1
+#define VLE_KDF_ARGON2 2
+
+#define VLE_KDF_ITER_DEFAULT 64007
+
+/* Number of keys kept resident per connection */
+#define VLE_KEYRING_SIZE 4
+
+#define VLE_SCOPE_DIGEST_LEN     64
+#define VLE_SCOPE_CACHE_SIZE      8
+#define VLE_SCOPE_CACHE_MAXLEN  128
+
+/*
+** Cache entry for the digest of a scope.
+** Only scopes up to VLE_SCOPE_CACHE_MAXLEN bytes are cached.
+*/
+typedef struct _VleScopeCacheEntry
 {
+  uint64_t lastUsed;
+  int      scopeLen;
+  unsigned char scope[VLE_SCOPE_CACHE_MAXLEN];
+  unsigned char digest[VLE_SCOPE_DIGEST_LEN];
+} VleScopeCacheEntry;
+
+typedef struct _VleKey
+{
+  unsigned char keyId[VLE_KEY_ID_LEN];
   unsigned char key[VLE_KEY_LEN];
   unsigned char salt[VLE_SALT_LEN];
+  unsigned char sivKey[VLE_KEY_LEN];
   size_t  keyLen;
   uint8_t algorithm;
   uint8_t flags;
   uint8_t nonceLen;
   uint8_t tagLen;
+  uint8_t aegisAlgorithm;
+} VleKey;
+
+/*
+** VLE state of a database connection
+**
+** The key ring holds the active key (index 0) and the most recently
+** replaced keys. Values are always encrypted with the active key, but
+** can be decrypted with any resident key.
+*/
+typedef struct _VleContext
+{
+  VleKey  keys[VLE_KEYRING_SIZE];
+  int     nKeys;
+  uint64_t scopeCacheClock;
+  VleScopeCacheEntry scopeCache[VLE_SCOPE_CACHE_SIZE];
 } VleContext;
 
 typedef struct _VleHeader
@@ -58,8 +111,8 @@ typedef struct _VleHeader
 
 static VleContext* vle_getContext(sqlite3* db);
 
-static int vle_packValue(sqlite3_value* val, unsigned char** out, int* out_len);
-static int vle_unpackValue(sqlite3_context* ctx, VleHeader* header, const unsigned char* buf, int len);
+static int vle_packValue(sqlite3_value* val, unsigned char* tmp, const unsigned char** payload, int* payloadLen);
+static int vle_unpackValue(sqlite3_context* ctx, unsigned char* buf, int len);
 
 static uint32_t vle_readU32BE(const unsigned char* p);
 static void vle_writeU64BE(unsigned char* p, uint64_t v);
@@ -142,7 +195,7 @@ vle_findOption(const VleOptionDef* table, const char* name, int nameLength)
   const VleOptionDef* opt;
   for (opt = table; opt->name != 0; opt++)
   {
-    if (sqlite3_strnicmp(opt->name, name, nameLength) == 0)
+    if (sqlite3_strnicmp(opt->name, name, nameLength) == 0 && opt->name[nameLength] == 0)
       return opt;
   }
   return 0;
@@ -176,6 +229,29 @@ vle_optionSetInt(const char* value, size_t valueLength, void* target)
   return SQLITE_OK;
 }
 
+/*
+** Key derivation function setter.
+**
+** Accepts the names "pbkdf2" and "argon2".
+*/
+static int
+vle_optionSetKdf(const char* value, size_t valueLength, void* target)
+{
+  if (valueLength == 6 && sqlite3_strnicmp(value, "pbkdf2", 6) == 0)
+  {
+    *(int*)target = VLE_KDF_PBKDF2;
+  }
+  else if (valueLength == 6 && sqlite3_strnicmp(value, "argon2", 6) == 0)
+  {
+    *(int*)target = VLE_KDF_ARGON2;
+  }
+  else
+  {
+    return SQLITE_ERROR;
+  }
+  return SQLITE_OK;
+}
+
 /*
 ** Parse option string.
 **
@@ -254,36 +330,199 @@ vle_getScope(sqlite3_value* argv, const unsigned char** scope, int* scopeLen)
   }
 }
 
+/*
+** Determine the digest of the scope argument of the current function call.
+**
+** The scope digest is the starting point for deriving the one-time key of
+** each value. Usually, the same scope (for example a column name) is used
+** for a large number of rows. Therefore the digest is cached as auxiliary
+** data of the scope argument, and in a small LRU cache of the VLE context
+** for scopes varying from row to row. SQLite keeps auxiliary data only for
+** arguments that are constant at compile time, and discards it right after
+** the call otherwise.
+*/
 static void
-vle_aeadEncrypt(const VleContext* ctx,
+vle_getScopeDigest(sqlite3_context* ctx, VleContext* vle,
+                   int argc, sqlite3_value** argv,
+                   unsigned char* digest)
+{
+  int scopeLen = 0;
+  const unsigned char* scope = NULL;
+  VleScopeCacheEntry* entry = NULL;
+  VleScopeCacheEntry* victim = NULL;
+  int j;
+
+  /* Check auxiliary data of the scope argument */
+  if (argc > 1)
+  {
+    const unsigned char* auxDigest = sqlite3_get_auxdata(ctx, 1);
+    if (auxDigest != NULL)
+    {
+      memcpy(digest, auxDigest, VLE_SCOPE_DIGEST_LEN);
+      return;
+    }
+  }
+
+  /* Retrieve scope if given, otherwise set default scope */
+  vle_getScope((argc > 1) ? argv[1] : NULL, &scope, &scopeLen);
+
+  /* Look up scope in LRU cache */
+  if (scopeLen <= VLE_SCOPE_CACHE_MAXLEN)
+  {
+    victim = &vle->scopeCache[0];
+    for (j = 0; j < VLE_SCOPE_CACHE_SIZE; ++j)
+    {
+      VleScopeCacheEntry* candidate = &vle->scopeCache[j];
+      if (candidate->lastUsed != 0 && candidate->scopeLen == scopeLen &&
+          (scopeLen == 0 || memcmp(candidate->scope, scope, scopeLen) == 0))
+      {
+        entry = candidate;
+        break;
+      }
+      if (candidate->lastUsed < victim->lastUsed)
+      {
+        victim = candidate;
+      }
+    }
+  }
+
+  if (entry != NULL)
+  {
+    memcpy(digest, entry->digest, VLE_SCOPE_DIGEST_LEN);
+  }
+  else
+  {
+    sha512(scope, scopeLen, digest);
+    if (victim != NULL)
+    {
+      /* Replace least recently used entry */
+      entry = victim;
+      entry->scopeLen = scopeLen;
+      if (scopeLen > 0)
+      {
+        memcpy(entry->scope, scope, scopeLen);
+      }
+      memcpy(entry->digest, digest, VLE_SCOPE_DIGEST_LEN);
+    }
+  }
+  if (entry != NULL)
+  {
+    entry->lastUsed = ++vle->scopeCacheClock;
+  }
+
+  /* Keep digest for subsequent calls, SQLite retains it for a constant scope */
+  if (argc > 1)
+  {
+    unsigned char* auxDigest = sqlite3_malloc(VLE_SCOPE_DIGEST_LEN);
+    if (auxDigest != NULL)
+    {
+      memcpy(auxDigest, digest, VLE_SCOPE_DIGEST_LEN);
+      sqlite3_set_auxdata(ctx, 1, auxDigest, sqlite3_free);
+    }
+  }
+}
+
+/*
+** Derive the synthetic nonce for deterministic encryption (SIV mode).
+**
+** The nonce is the truncated HMAC-SHA512 over scope digest, VLE header,
+** and plaintext (value type and payload), keyed with a subkey of the VLE
+** key. Equal values encrypted within the same scope therefore result in
+** equal ciphertexts, while different values get different nonces. The
+** ciphertext is authenticated by the AEAD tag as usual, so decryption does
+** not depend on the mode.
+*/
+static void
+vle_sivNonce(const VleKey* ctx,
+             const unsigned char* header, int headerLen,
+             const unsigned char* ptext, int ptextLen,
+             const unsigned char* scopeDigest,
+             unsigned char* nonce, int nonceLen)
+{
+  HMAC_CTX(sha512) hmac;
+  unsigned char mac[SHA512_DIGEST_SIZE];
+  HMAC_INIT(sha512)(&hmac, ctx->sivKey, VLE_KEY_LEN);
+  HMAC_UPDATE(sha512)(&hmac, scopeDigest, VLE_SCOPE_DIGEST_LEN);
+  HMAC_UPDATE(sha512)(&hmac, header, headerLen);
+  HMAC_UPDATE(sha512)(&hmac, ptext, ptextLen);
+  HMAC_FINAL(sha512)(&hmac, mac);
+  memcpy(nonce, mac, nonceLen);
+  sqlite3mcSecureZeroMemory(&hmac, sizeof(hmac));
+  sqlite3mcSecureZeroMemory(mac, sizeof(mac));
+}
+
+#if HAVE_CIPHER_AEGIS
+/*
+** Generate one-time key and nonce for AEGIS.
+**
+** On entry otk holds the scope digest. The AEGIS keystream for the value
+** nonce is combined with it, resulting in key (first keyLen bytes) and
+** nonce (next nonceLen bytes) for the AEAD operation.
+*/
+static void
+vle_aegisGenOtk(const VleKey* ctx, const unsigned char* nonce, uint8_t* otk)
+{
+  int j;
+  int otkLen = (int) ctx->keyLen + ctx->nonceLen;
+  uint8_t stream[64];
+  mcAegisCryptFunctions[ctx->aegisAlgorithm].stream(stream, otkLen, nonce, ctx->key);
+  for (j = 0; j < otkLen; ++j)
+  {
+    otk[j] ^= stream[j];
+  }
+  sqlite3mcSecureZeroMemory(stream, sizeof(stream));
+}
+#endif
+
+static void
+vle_aeadEncrypt(const VleKey* ctx,
                 const unsigned char* data, int dataLen,
                 unsigned char* ctext, int ctextLen,
                 unsigned char* tag, int tagLen,
                 unsigned char* nonce, int nonceLen,
-                const unsigned char* scope, int scopeLen)
+                const unsigned char* scopeDigest)
 {
   uint8_t otk[64];
-  unsigned char digest[SHA512_DIGEST_SIZE];
-  sha512(scope, scopeLen, digest);
-  memcpy(otk, digest, 64);
+  memcpy(otk, scopeDigest, 64);
+
+  /* Random nonce, or synthetic nonce in deterministic mode */
+  if (ctx->flags & VLE_FLAG_DETERMINISTIC)
+  {
+    vle_sivNonce(ctx, data, dataLen - nonceLen, ctext, ctextLen,
+                 scopeDigest, nonce, nonceLen);
+  }
+  else
+  {
+    chacha20_rng(nonce, nonceLen);
+  }
 
   switch (ctx->algorithm)
   {
 #if HAVE_CIPHER_ASCON128    
     case CODEC_TYPE_ASCON128:
     {
-      chacha20_rng(nonce, nonceLen);
       AsconGenOtk(otk, ctx->key, nonce, VLE_MAGIC_NUM);
 
       ascon_aead_encrypt(ctext, tag, ctext, ctextLen,
                          data, dataLen, nonce, otk);
       break;
     }
+#endif
+#if HAVE_CIPHER_AEGIS
+    case CODEC_TYPE_AEGIS:
+    {
+      vle_aegisGenOtk(ctx, nonce, otk);
+
+      mcAegisCryptFunctions[ctx->aegisAlgorithm].encrypt(ctext, tag, tagLen,
+                                                         ctext, ctextLen,
+                                                         data, dataLen,
+                                                         otk + ctx->keyLen, otk);
+      break;
+    }
 #endif
     case CODEC_TYPE_CHACHA20:
     default:
     {
-      chacha20_rng(nonce, nonceLen);
       uint32_t counter = vle_readU32BE(nonce + nonceLen - 4) ^ VLE_MAGIC_NUM;
       chacha20_xor(otk, 64, ctx->key, nonce, counter);
 
@@ -292,22 +531,29 @@ vle_aeadEncrypt(const VleContext* ctx,
       break;
     }
   }
+  sqlite3mcSecureZeroMemory(otk, 64);
 }
 
 
+/*
+** Authenticate and decrypt a value.
+**
+** The authenticated data and the ciphertext are expected to be contiguous
+** in memory, that is, the ciphertext starts at data + dataLen. The
+** plaintext is written to ptext, which may be identical to ctext. If the
+** authentication fails, no plaintext is left behind in ptext.
+*/
 static int
-vle_aeadDecrypt(const VleContext* ctx,
+vle_aeadDecrypt(const VleKey* ctx,
                 const unsigned char* data, int dataLen,
-                unsigned char* ctext, int ctextLen,
+                const unsigned char* ctext, unsigned char* ptext, int ctextLen,
                 const unsigned char* tag, int tagLen,
                 const unsigned char* nonce, int nonceLen,
-                const unsigned char* scope, int scopeLen)
+                const unsigned char* scopeDigest)
 {
   int rc = SQLITE_OK;
   uint8_t otk[64];
-  unsigned char digest[SHA512_DIGEST_SIZE];
-  sha512(scope, scopeLen, digest);
-  memcpy(otk, digest, 64);
+  memcpy(otk, scopeDigest, 64);
 
   switch (ctx->algorithm)
   {
@@ -316,11 +562,31 @@ vle_aeadDecrypt(const VleContext* ctx,
     {
       AsconGenOtk(otk, ctx->key, nonce, VLE_MAGIC_NUM);
 
-      int tagOk = ascon_aead_decrypt(ctext, ctext, ctextLen,
+      int tagOk = ascon_aead_decrypt(ptext, ctext, ctextLen,
                                      data, dataLen,
                                      tag, nonce, otk);
       if (tagOk != 0)
       {
+        /* Don't leave unauthenticated plaintext behind */
+        sqlite3mcSecureZeroMemory(ptext, ctextLen);
+        rc = SQLITE_CORRUPT;
+      }
+      break;
+    }
+#endif
+#if HAVE_CIPHER_AEGIS
+    case CODEC_TYPE_AEGIS:
+    {
+      vle_aegisGenOtk(ctx, nonce, otk);
+
+      int tagOk = mcAegisCryptFunctions[ctx->aegisAlgorithm].decrypt(ptext, ctext, ctextLen,
+                                                                     tag, tagLen,
+                                                                     data, dataLen,
+                                                                     otk + ctx->keyLen, otk);
+      if (tagOk != 0)
+      {
+        /* Don't leave unauthenticated plaintext behind */
+        sqlite3mcSecureZeroMemory(ptext, ctextLen);
         rc = SQLITE_CORRUPT;
       }
       break;
@@ -333,12 +599,19 @@ vle_aeadDecrypt(const VleContext* ctx,
       chacha20_xor(otk, 64, ctx->key, nonce, counter);
 
       poly1305(data, dataLen + ctextLen, otk, tagCalc);
-      chacha20_xor(ctext, ctextLen, otk + 32, nonce, counter + 1);
       /* Verify the MAC */
       if (poly1305_tagcmp(tag, tagCalc))
       {
         rc = SQLITE_CORRUPT;
       }
+      else
+      {
+        if (ptext != ctext)
+        {
+          memcpy(ptext, ctext, ctextLen);
+        }
+        chacha20_xor(ptext, ctextLen, otk + 32, nonce, counter + 1);
+      }
       break;
     }
     default:
@@ -353,43 +626,116 @@ static const char* VLE_CONTEXT_KEY = "vle_context";
 
 // ---------- Helper Functions ----------
 
+static void
+vle_freeContext(void* ctx)
+{
+  sqlite3mcSecureFree(ctx);
+}
+
 static VleContext* vle_getContext(sqlite3* db)
 {
   VleContext* ctx = sqlite3_get_clientdata(db, VLE_CONTEXT_KEY);
   if (!ctx)
   {
-    ctx = sqlite3_malloc(sizeof(VleContext));
-    memset(ctx, 0, sizeof(VleContext));
-    ctx->algorithm = CODEC_TYPE_CHACHA20;
-    ctx->flags = 0;
-    ctx->nonceLen = VLE_NONCE_LEN;
-    ctx->tagLen = VLE_TAG_LEN;
-    sqlite3_set_clientdata(db, VLE_CONTEXT_KEY, ctx, sqlite3_free);
+    ctx = sqlite3mcSecureAlloc(sizeof(VleContext));
+    if (ctx != NULL)
+    {
+      memset(ctx, 0, sizeof(VleContext));
+      sqlite3_set_clientdata(db, VLE_CONTEXT_KEY, ctx, vle_freeContext);
+    }
   }
   return ctx;
 }
 
+/*
+** Derive a subkey from a VLE key with HMAC-SHA512 and a label.
+*/
+static void
+vle_deriveSubkey(const VleKey* vkey, const char* label, unsigned char* out, int outLen)
+{
+  HMAC_CTX(sha512) hmac;
+  unsigned char mac[SHA512_DIGEST_SIZE];
+  HMAC_INIT(sha512)(&hmac, vkey->key, vkey->keyLen);
+  HMAC_UPDATE(sha512)(&hmac, label, strlen(label));
+  HMAC_FINAL(sha512)(&hmac, mac);
+  memcpy(out, mac, outLen);
+  sqlite3mcSecureZeroMemory(&hmac, sizeof(hmac));
+  sqlite3mcSecureZeroMemory(mac, sizeof(mac));
+}
+
+/*
+** Make a key the active key of the key ring.
+**
+** A resident key with the same key id is replaced, otherwise the least
+** recently activated key is dropped if the key ring is full.
+*/
+static void
+vle_activateKey(VleContext* vle, const VleKey* vkey)
+{
+  int j;
+  int last = (vle->nKeys < VLE_KEYRING_SIZE) ? vle->nKeys : VLE_KEYRING_SIZE - 1;
+  for (j = 0; j < vle->nKeys; ++j)
+  {
+    if (memcmp(vle->keys[j].keyId, vkey->keyId, VLE_KEY_ID_LEN) == 0)
+    {
+      last = j;
+      break;
+    }
+  }
+  if (last == vle->nKeys)
+  {
+    ++vle->nKeys;
+  }
+  for (j = last; j > 0; --j)
+  {
+    vle->keys[j] = vle->keys[j-1];
+  }
+  vle->keys[0] = *vkey;
+}
+
+/*
+** Find a resident key by key id.
+*/
+static const VleKey*
+vle_findKey(const VleContext* vle, const unsigned char* keyId)
+{
+  int j;
+  for (j = 0; j < vle->nKeys; ++j)
+  {
+    if (memcmp(vle->keys[j].keyId, keyId, VLE_KEY_ID_LEN) == 0)
+      return &vle->keys[j];
+  }
+  return NULL;
+}
+
 // ---------- Payload Packing / Unpacking ----------
 
+/*
+** Determine the payload of a value without copying it.
+**
+** For INTEGER and FLOAT values the payload is serialized into the
+** caller supplied buffer tmp (at least 8 bytes). For TEXT and BLOB values
+** the payload points to the value content owned by SQLite, which stays
+** valid until the value is modified. The caller copies the payload
+** directly into its output buffer.
+*/
 static int
-vle_packValue(sqlite3_value* val, unsigned char** out, int* out_len)
+vle_packValue(sqlite3_value* val, unsigned char* tmp, const unsigned char** payload, int* payloadLen)
 {
   int type = sqlite3_value_type(val);
-  unsigned char tmp[8];
-  const void* payload = NULL;
-  uint32_t payloadLen = 0;
+  *payload = NULL;
+  *payloadLen = 0;
 
   switch(type)
   {
     case SQLITE_NULL:
-      payloadLen = 0;
       break;
     case SQLITE_INTEGER:
     {
       int64_t v = sqlite3_value_int64(val);
       vle_writeU64BE(tmp, (uint64_t) v);
-      payload = tmp;
-      payloadLen = 8;
+      *payload = tmp;
+      *payloadLen = 8;
       break;
     }
     case SQLITE_FLOAT:
@@ -398,42 +744,50 @@ vle_packValue(sqlite3_value* val, unsigned char** out, int* out_len)
       uint64_t bits;
       memcpy(&bits, &d, 8);
       vle_writeU64BE(tmp, bits);
-      payload = tmp;
-      payloadLen = 8;
+      *payload = tmp;
+      *payloadLen = 8;
       break;
     }
     case SQLITE_TEXT:
-      payloadLen = sqlite3_value_bytes(val);
-      payload = sqlite3_value_text(val);
+      /* Call sqlite3_value_text before sqlite3_value_bytes */
+      *payload = sqlite3_value_text(val);
+      *payloadLen = sqlite3_value_bytes(val);
       break;
     case SQLITE_BLOB:
-      payloadLen = sqlite3_value_bytes(val);
-      payload = sqlite3_value_blob(val);
+      *payload = sqlite3_value_blob(val);
+      *payloadLen = sqlite3_value_bytes(val);
       break;
     default:
       return SQLITE_MISUSE;
   }
-
-  *out = sqlite3_malloc(payloadLen);
-  if (!*out)
-  {
-    return SQLITE_NOMEM;
-  }
-  if (payloadLen > 0)
-  {
-    memcpy(*out, payload, payloadLen);
-  }
-  *out_len = payloadLen;
   return SQLITE_OK;
 }
 
+/*
+** Destructor for TEXT and BLOB results.
+**
+** The result content starts 1 byte behind the allocated plaintext buffer,
+** because the buffer begins with the value type.
+*/
+static void
+vle_freeValue(void* payload)
+{
+  sqlite3_free(((unsigned char*) payload) - 1);
+}
+
+/*
+** Set the function result from a decrypted value.
+**
+** The buffer holds the value type followed by len bytes of payload, and
+** must have been allocated with sqlite3_malloc. For TEXT and BLOB values
+** ownership of the buffer is passed to SQLite, otherwise it is freed.
+*/
 static int
-vle_unpackValue(sqlite3_context* ctx, VleHeader* hdr, const unsigned char* buffer, int len)
+vle_unpackValue(sqlite3_context* ctx, unsigned char* buffer, int len)
 {
   uint8_t type = buffer[0];
-  uint32_t payloadLen = len;
-
-  const unsigned char* payload = buffer+1;
+  unsigned char* payload = buffer+1;
+  int rc = SQLITE_OK;
 
   switch (type)
   {
@@ -442,39 +796,220 @@ vle_unpackValue(sqlite3_context* ctx, VleHeader* hdr, const unsigned char* buffe
       break;
 
     case SQLITE_INTEGER:
-    {
-      int64_t v = (int64_t) vle_readU64BE(payload);
-      sqlite3_result_int64(ctx, v);
-      break;
-    }
-
     case SQLITE_FLOAT:
     {
-      uint64_t bits = vle_readU64BE(payload);
-      double d;
-      memcpy(&d, &bits, 8);
-      sqlite3_result_double(ctx, d);
+      if (len != 8)
+      {
+        rc = SQLITE_CORRUPT;
+      }
+      else if (type == SQLITE_INTEGER)
+      {
+        int64_t v = (int64_t) vle_readU64BE(payload);
+        sqlite3_result_int64(ctx, v);
+      }
+      else
+      {
+        uint64_t bits = vle_readU64BE(payload);
+        double d;
+        memcpy(&d, &bits, 8);
+        sqlite3_result_double(ctx, d);
+      }
       break;
     }
 
     case SQLITE_TEXT:
-      sqlite3_result_text(ctx,
-                          (const char*) payload,
-                          payloadLen,
-                          SQLITE_TRANSIENT);
-      break;
+      sqlite3_result_text(ctx, (const char*) payload, len, vle_freeValue);
+      return SQLITE_OK;
 
     case SQLITE_BLOB:
-      sqlite3_result_blob(ctx,
-                          payload,
-                          payloadLen,
-                          SQLITE_TRANSIENT);
-      break;
+      sqlite3_result_blob(ctx, payload, len, vle_freeValue);
+      return SQLITE_OK;
 
     default:
+      rc = SQLITE_CORRUPT;
+      break;
+  }
+
+  sqlite3mcSecureZeroMemory(buffer, len + 1);
+  sqlite3_free(buffer);
+  return rc;
+}
+
+// ---------- Value Encryption / Decryption ----------
+
+/*
+** Encrypt a value with a key.
+**
+** The value is given by its SQLite type and its serialized payload. The
+** encrypted value consists of header, key id, nonce, ciphertext (value
+** type and payload), and tag. It is allocated with sqlite3_malloc and
+** returned in *pOut.
+*/
+static int
+vle_encryptValue(const VleKey* vkey, const unsigned char* scopeDigest,
+                 int type, const unsigned char* payload, int payloadLen,
+                 sqlite3_int64 maxLen, unsigned char** pOut, int* pOutLen)
+{
+  int headerLen = sizeof(VleHeader) + VLE_KEY_ID_LEN;
+  int nonceLen = vkey->nonceLen;
+  int tagLen = vkey->tagLen;
+  sqlite3_int64 totalLen = headerLen + nonceLen + 1 + (sqlite3_int64) payloadLen + tagLen;
+
+  *pOut = NULL;
+  *pOutLen = 0;
+  if (totalLen > maxLen)
+  {
+    return SQLITE_TOOBIG;
+  }
+
+  /* Allocate the output buffer */
+  unsigned char* buffer = sqlite3_malloc64(totalLen);
+  if (!buffer)
+  {
+    return SQLITE_NOMEM;
+  }
+
+  /* Fill header and key id */
+  buffer[0] = VLE_MAGIC;
+  buffer[1] = VLE_VERSION;
+  buffer[2] = vkey->algorithm;
+  buffer[3] = vkey->flags | VLE_FLAG_KEY_ID;
+  memcpy(buffer + sizeof(VleHeader), vkey->keyId, VLE_KEY_ID_LEN);
+
+  /* Define positions in output buffer */
+  unsigned char* nonce = buffer + headerLen;
+  unsigned char* ciphertext = nonce + nonceLen;
+  unsigned char* tag = ciphertext + payloadLen + 1;
+
+  /* Serialize SQLite value type and value directly into the output buffer */
+  ciphertext[0] = (uint8_t) type;
+  if (payloadLen > 0)
+  {
+    memcpy(ciphertext + 1, payload, payloadLen);
+  }
+
+  /* Encrypt in place */
+  vle_aeadEncrypt(vkey,
+                  buffer, headerLen + nonceLen,
+                  ciphertext, payloadLen + 1,
+                  tag, tagLen, nonce, nonceLen,
+                  scopeDigest);
+
+  *pOut = buffer;
+  *pOutLen = (int) totalLen;
+  return SQLITE_OK;
+}
+
+/*
+** Decrypt an encrypted value.
+**
+** The key is selected by the key id stored with the value. Values written
+** by earlier versions don't have a key id, then all resident keys of the
+** same algorithm are tried, starting with the active key.
+** On success *pPlain holds the value type followed by *pPayloadLen bytes
+** of payload. The buffer is allocated with sqlite3_malloc.
+*/
+static int
+vle_decryptValue(const VleContext* vle, const unsigned char* scopeDigest,
+                 const unsigned char* blob, int blobLen,
+                 unsigned char** pPlain, int* pPayloadLen, const char** pzErrMsg)
+{
+  int rc = SQLITE_CORRUPT;
+  int headerLen = sizeof(VleHeader);
+  int hasKeyId;
+  int nTried = 0;
+  int j;
+  VleHeader hdr;
+
+  *pPlain = NULL;
+  *pPayloadLen = 0;
+  *pzErrMsg = "Encrypted content too short";
+  if (blobLen < headerLen)
+  {
+    return SQLITE_CORRUPT;
+  }
+
+  /* Parse header */
+  vle_parseHeader(blob, &hdr);
+  if (hdr.magic != VLE_MAGIC)
+  {
+    *pzErrMsg = "Invalid VLE header in encrypted value";
+    return SQLITE_CORRUPT;
+  }
+  hasKeyId = (hdr.flags & VLE_FLAG_KEY_ID) != 0;
+  if (hasKeyId)
+  {
+    headerLen += VLE_KEY_ID_LEN;
+    if (blobLen < headerLen)
+    {
       return SQLITE_CORRUPT;
+    }
+  }
+
+  /*
+  ** Allocate the result buffer, it receives value type and plaintext.
+  ** The blob itself stays untouched, so no writable copy is needed.
+  */
+  unsigned char* plaintext = sqlite3_malloc(blobLen - headerLen);
+  if (!plaintext)
+  {
+    return SQLITE_NOMEM;
   }
 
+  for (j = 0; j < vle->nKeys && rc != SQLITE_OK; ++j)
+  {
+    const VleKey* vkey = &vle->keys[j];
+    if (hasKeyId && memcmp(vkey->keyId, blob + sizeof(VleHeader), VLE_KEY_ID_LEN) != 0)
+      continue;
+    if (vkey->algorithm != hdr.algorithm ||
+        (vkey->flags & VLE_FLAG_VARIANT_MASK) != (hdr.flags & VLE_FLAG_VARIANT_MASK))
+      continue;
+    ++nTried;
+
+    /* Determine required lengths and offsets */
+    int nonceLen = vkey->nonceLen;
+    int tagLen = vkey->tagLen;
+    int payloadLen = blobLen - headerLen - nonceLen - tagLen - 1;
+    if (payloadLen < 0)
+    {
+      *pzErrMsg = "Encrypted content too short";
+      continue;
+    }
+
+    const unsigned char* nonce = blob + headerLen;
+    const unsigned char* ciphertext = nonce + nonceLen;
+    const unsigned char* tag = ciphertext + payloadLen + 1;
+
+    /* Decrypt value and check tag */
+    rc = vle_aeadDecrypt(vkey,
+                         blob, headerLen + nonceLen,
+                         ciphertext, plaintext, payloadLen + 1,
+                         tag, tagLen,
+                         nonce, nonceLen,
+                         scopeDigest);
+    if (rc == SQLITE_OK)
+    {
+      *pPayloadLen = payloadLen;
+    }
+    else
+    {
+      *pzErrMsg = "AEAD authentication failed";
+    }
+  }
+
+  if (rc != SQLITE_OK)
+  {
+    sqlite3_free(plaintext);
+    if (nTried == 0)
+    {
+      *pzErrMsg = (hasKeyId) ? "VLE key of encrypted value not available"
+                             : "Encrypted value uses a different VLE algorithm";
+    }
+    return rc;
+  }
+
+  *pPlain = plaintext;
+  *pzErrMsg = NULL;
   return SQLITE_OK;
 }
 
@@ -484,6 +1019,14 @@ static void vle_setKey(sqlite3_context* ctx, int argc, sqlite3_value** argv)
 {
   sqlite3* db = sqlite3_context_db_handle(ctx);
   VleContext* vle = vle_getContext(db);
+  VleKey newKey;
+  VleKey* vkey = &newKey;
+  if (!vle)
+  {
+    sqlite3_result_error_nomem(ctx);
+    return;
+  }
+  memset(vkey, 0, sizeof(VleKey));
   if (argc < 1)
   {
     sqlite3_result_error(ctx, "The key parameter is required", -1);
@@ -527,10 +1070,13 @@ static void vle_setKey(sqlite3_context* ctx, int argc, sqlite3_value** argv)
 
   unsigned char digest[SHA256_DIGEST_SIZE];
   sha256(salt, saltLen, digest);
-  memcpy(vle->salt, digest, sizeof(vle->salt));
+  memcpy(vkey->salt, digest, sizeof(vkey->salt));
 
   /* Algorithm */
-  vle->algorithm = CODEC_TYPE_CHACHA20;
+  vkey->algorithm = CODEC_TYPE_CHACHA20;
+  vkey->aegisAlgorithm = 0;
+  vkey->nonceLen = VLE_NONCE_LEN;
+  vkey->tagLen = VLE_TAG_LEN;
   if (argc >= 3)
   {
     int algorithmType = sqlite3_value_type(argv[2]);
@@ -540,12 +1086,22 @@ static void vle_setKey(sqlite3_context* ctx, int argc, sqlite3_value** argv)
       const char* algorithm = (const char*) sqlite3_value_text(argv[2]);
       if (sqlite3_strnicmp(algorithm, "chacha20", algorithmLen) == 0)
       {
-        vle->algorithm = CODEC_TYPE_CHACHA20;
+        vkey->algorithm = CODEC_TYPE_CHACHA20;
       }
       else if (sqlite3_strnicmp(algorithm, "ascon128", algorithmLen) == 0)
       {
-        vle->algorithm = CODEC_TYPE_ASCON128;
+        vkey->algorithm = CODEC_TYPE_ASCON128;
       }
+#if HAVE_CIPHER_AEGIS
+      else if (sqlite3_stricmp(algorithm, "aegis") == 0 ||
+               sqlite3mcAegisAlgorithmToIndex(algorithm) > 0)
+      {
+        int aegisAlgorithm = sqlite3mcAegisAlgorithmToIndex(algorithm);
+        vkey->algorithm = CODEC_TYPE_AEGIS;
+        vkey->aegisAlgorithm = (aegisAlgorithm > 0) ? aegisAlgorithm : AEGIS_ALGORITHM_DEFAULT;
+        vkey->nonceLen = (vkey->aegisAlgorithm < AEGIS_ALGORITHM_256) ? PAGE_NONCE_LEN_AEGIS_128 : PAGE_NONCE_LEN_AEGIS_256;
+      }
+#endif
       else
       {
         sqlite3_result_error(ctx, "Unsupported cipher type", -1);
@@ -587,9 +1143,10 @@ static void vle_setKey(sqlite3_context* ctx, int argc, sqlite3_value** argv)
   }
 
   char optionsUsed[256] = "";
+  int deterministic = 0;
   int pswdLen = sqlite3_value_bytes(argv[0]);
   const unsigned char* pswd = sqlite3_value_blob(argv[0]);
-  switch (vle->algorithm)
+  switch (vkey->algorithm)
   {
 #if HAVE_CIPHER_CHACHA20
   case CODEC_TYPE_CHACHA20:
@@ -597,8 +1154,9 @@ static void vle_setKey(sqlite3_context* ctx, int argc, sqlite3_value** argv)
       int kdfIter = CHACHA20_KDF_ITER_DEFAULT;
       const VleOptionDef chacha20KeyOptions[] =
       {
-          { "kdf_iter", vle_optionSetInt, &kdfIter },
-          { 0,          0,                0        }
+          { "kdf_iter",      vle_optionSetInt, &kdfIter       },
+          { "deterministic", vle_optionSetInt, &deterministic },
+          { 0,               0,                0              }
       };
       vle_parseOptions(options, optionsLen, chacha20KeyOptions);
       if (kdfIter < 1)
@@ -607,10 +1165,10 @@ static void vle_setKey(sqlite3_context* ctx, int argc, sqlite3_value** argv)
       }
       sqlite3_snprintf(sizeof(optionsUsed), optionsUsed, "kdf_iter=%d", kdfIter);
       fastpbkdf2_hmac_sha256(pswd, pswdLen,
-                             vle->salt, SALTLENGTH_CHACHA20,
+                             vkey->salt, SALTLENGTH_CHACHA20,
                              kdfIter,
-                             vle->key, KEYLENGTH_CHACHA20);
-      vle->keyLen = KEYLENGTH_CHACHA20;
+                             vkey->key, KEYLENGTH_CHACHA20);
+      vkey->keyLen = KEYLENGTH_CHACHA20;
       break;
   }
 #endif
@@ -620,8 +1178,9 @@ static void vle_setKey(sqlite3_context* ctx, int argc, sqlite3_value** argv)
       int kdfIter = ASCON128_KDF_ITER_DEFAULT;
       const VleOptionDef chacha20KeyOptions[] =
       {
-          { "kdf_iter", vle_optionSetInt, &kdfIter },
-          { 0,          0,                0        }
+          { "kdf_iter",      vle_optionSetInt, &kdfIter       },
+          { "deterministic", vle_optionSetInt, &deterministic },
+          { 0,               0,                0              }
       };
       vle_parseOptions(options, optionsLen, chacha20KeyOptions);
       if (kdfIter < 1)
@@ -629,10 +1188,64 @@ static void vle_setKey(sqlite3_context* ctx, int argc, sqlite3_value** argv)
         kdfIter = ASCON128_KDF_ITER_DEFAULT;
       }
       sqlite3_snprintf(sizeof(optionsUsed), optionsUsed, "kdf_iter=%d", kdfIter);
-      ascon_pbkdf2(vle->key, KEYLENGTH_ASCON128,
+      ascon_pbkdf2(vkey->key, KEYLENGTH_ASCON128,
                    (const uint8_t*) pswd, pswdLen,
-                   vle->salt, SALTLENGTH_ASCON128, kdfIter);
-      vle->keyLen = KEYLENGTH_ASCON128;
+                   vkey->salt, SALTLENGTH_ASCON128, kdfIter);
+      vkey->keyLen = KEYLENGTH_ASCON128;
+      break;
+    }
+#endif
+#if HAVE_CIPHER_AEGIS
+    case CODEC_TYPE_AEGIS:
+    {
+      int kdf = VLE_KDF_ARGON2;
+      int kdfIter = VLE_KDF_ITER_DEFAULT;
+      int tcost = AEGIS_TCOST_DEFAULT;
+      int mcost = AEGIS_MCOST_DEFAULT;
+      int pcost = AEGIS_PCOST_DEFAULT;
+      const VleOptionDef aegisKeyOptions[] =
+      {
+          { "kdf",           vle_optionSetKdf, &kdf           },
+          { "kdf_iter",      vle_optionSetInt, &kdfIter       },
+          { "tcost",         vle_optionSetInt, &tcost         },
+          { "mcost",         vle_optionSetInt, &mcost         },
+          { "pcost",         vle_optionSetInt, &pcost         },
+          { "deterministic", vle_optionSetInt, &deterministic },
+          { 0,               0,                0              }
+      };
+      vle_parseOptions(options, optionsLen, aegisKeyOptions);
+      int keyLen = (vkey->aegisAlgorithm < AEGIS_ALGORITHM_256) ? KEYLENGTH_AEGIS_128 : KEYLENGTH_AEGIS_256;
+      if (kdf == VLE_KDF_PBKDF2)
+      {
+        if (kdfIter < 1)
+        {
+          kdfIter = VLE_KDF_ITER_DEFAULT;
+        }
+        sqlite3_snprintf(sizeof(optionsUsed), optionsUsed, "kdf=pbkdf2,kdf_iter=%d", kdfIter);
+        fastpbkdf2_hmac_sha256(pswd, pswdLen,
+                               vkey->salt, VLE_SALT_LEN,
+                               kdfIter,
+                               vkey->key, keyLen);
+      }
+      else
+      {
+        if (tcost < 1) tcost = AEGIS_TCOST_DEFAULT;
+        if (mcost < 1) mcost = AEGIS_MCOST_DEFAULT;
+        if (pcost < 1) pcost = AEGIS_PCOST_DEFAULT;
+        sqlite3_snprintf(sizeof(optionsUsed), optionsUsed, "kdf=argon2,tcost=%d,mcost=%d,pcost=%d", tcost, mcost, pcost);
+        int rc = sqlite3mcArgon2idHashRaw((uint32_t) tcost, (uint32_t) mcost, (uint32_t) pcost,
+                                          pswd, pswdLen,
+                                          vkey->salt, VLE_SALT_LEN,
+                                          vkey->key, keyLen);
+        if (rc != ARGON2_OK)
+        {
+          sqlite3mcSecureZeroMemory(vkey, sizeof(VleKey));
+          sqlite3_free(options);
+          sqlite3_result_error(ctx, argon2_error_message(rc), -1);
+          return;
+        }
+      }
+      vkey->keyLen = keyLen;
       break;
     }
 #endif
@@ -641,6 +1254,23 @@ static void vle_setKey(sqlite3_context* ctx, int argc, sqlite3_value** argv)
       return;
   }
 
+  /* Deterministic encryption (SIV mode) */
+  vkey->flags = (deterministic != 0) ? VLE_FLAG_DETERMINISTIC : 0;
+  vkey->flags |= (vkey->aegisAlgorithm << VLE_FLAG_VARIANT_SHIFT) & VLE_FLAG_VARIANT_MASK;
+  if (deterministic != 0)
+  {
+    int n = (int) strlen(optionsUsed);
+    sqlite3_snprintf(sizeof(optionsUsed) - n, optionsUsed + n, ",deterministic=1");
+  }
+
+  /* Derive subkey for synthetic nonces and key id */
+  vle_deriveSubkey(vkey, "vle:siv-key", vkey->sivKey, VLE_KEY_LEN);
+  vle_deriveSubkey(vkey, "vle:key-id", vkey->keyId, VLE_KEY_ID_LEN);
+
+  /* Make the new key the active key, previous keys stay resident */
+  vle_activateKey(vle, vkey);
+  sqlite3mcSecureZeroMemory(vkey, sizeof(VleKey));
+
   char* result = sqlite3_mprintf("Ok. Options(%s)", optionsUsed);
   sqlite3_result_text(ctx, result, -1, sqlite3_free);
   if (options != NULL)
@@ -659,64 +1289,47 @@ vle_encrypt(sqlite3_context* ctx, int argc, sqlite3_value** argv)
     sqlite3_result_error(ctx, "sqlite3mc_vle_encrypt requires a value", -1);
     return;
   }
-  if (vle->keyLen == 0)
+  if (vle == NULL || vle->nKeys == 0)
   {
     sqlite3_result_error(ctx, "VLE key not set", -1);
     return;
   }
 
-  /* Retrieve scope if given, otherwise set default scope */
-  int scopeLen = 0;
-  const unsigned char* scope = NULL;
-  vle_getScope((argc > 1) ? argv[1] : NULL, &scope, &scopeLen);
+  /* Retrieve digest of scope if given, otherwise of default scope */
+  unsigned char scopeDigest[VLE_SCOPE_DIGEST_LEN];
+  vle_getScopeDigest(ctx, vle, argc, argv, scopeDigest);
 
-  /* Pack Value */
-  unsigned char* payload = NULL;
+  /* Determine payload of value, TEXT and BLOB content is not copied */
+  unsigned char tmp[8];
+  const unsigned char* payload = NULL;
   int payloadLen = 0;
-  if (vle_packValue(argv[0], &payload, &payloadLen) != SQLITE_OK)
+  if (vle_packValue(argv[0], tmp, &payload, &payloadLen) != SQLITE_OK)
   {
     sqlite3_result_error(ctx, "sqlite3mc_vle_encrypt: Failed to pack value", -1);
     return;
   }
 
-  // Determine length of nonce and tag and total length
-  int nonceLen = vle->nonceLen;
-  int tagLen = vle->tagLen;
-  int totalLen = sizeof(VleHeader) + nonceLen + 1 + payloadLen + tagLen;
-
-  /* Allocate memory for buffer */
-  unsigned char* buffer = sqlite3_malloc(totalLen);
-  if (!buffer)
+  /* Encrypt with the active key directly into the result buffer */
+  unsigned char* buffer = NULL;
+  int bufferLen = 0;
+  int rc = vle_encryptValue(&vle->keys[0], scopeDigest,
+                            sqlite3_value_type(argv[0]), payload, payloadLen,
+                            sqlite3_limit(db, SQLITE_LIMIT_LENGTH, -1),
+                            &buffer, &bufferLen);
+  sqlite3mcSecureZeroMemory(tmp, sizeof(tmp));
+  if (rc == SQLITE_TOOBIG)
+  {
+    sqlite3_result_error_toobig(ctx);
+    return;
+  }
+  if (rc != SQLITE_OK)
   {
-    sqlite3_free(payload);
     sqlite3_result_error_nomem(ctx);
     return;
   }
 
-  /* Fill header */
-  buffer[0] = VLE_MAGIC;
-  buffer[1] = VLE_VERSION;
-  buffer[2] = vle->algorithm;
-  buffer[3] = vle->flags;
-
-  /* Define positions in output buffer */
-  unsigned char* nonce = buffer + sizeof(VleHeader);
-  unsigned char* ciphertext = nonce + nonceLen;
-  unsigned char* tag = ciphertext + payloadLen + 1;
-
-  /* Output SQLite value type and value */
-  ciphertext[0] = (uint8_t) sqlite3_value_type(argv[0]);
-  memcpy(ciphertext + 1, payload, payloadLen + 1);
-
-  /* Encrypt */
-  vle_aeadEncrypt(vle,
-                  buffer, sizeof(VleHeader) + nonceLen,
-                  ciphertext, payloadLen + 1,
-                  tag, tagLen, nonce, nonceLen,
-                  scope, scopeLen);
-
-  sqlite3_result_blob(ctx, buffer, totalLen, sqlite3_free);
-  sqlite3_free(payload);
+  /* Pass ownership of the buffer to SQLite */
+  sqlite3_result_blob(ctx, buffer, bufferLen, sqlite3_free);
 }
 
 static void
@@ -733,67 +1346,372 @@ vle_decrypt(sqlite3_context* ctx, int argc, sqlite3_value** argv)
   }
 
   /* Check whether key was set */
-  if (vle->keyLen == 0)
+  if (vle == NULL || vle->nKeys == 0)
   {
     sqlite3_result_error(ctx, "VLE key not set", -1);
     return;
   }
 
-  /* Retrieve scope if given, otherwise set default scope */
-  int scopeLen = 0;
-  const unsigned char* scope = NULL;
-  vle_getScope((argc > 1) ? argv[1] : NULL, &scope, &scopeLen);
+  /* Retrieve digest of scope if given, otherwise of default scope */
+  unsigned char scopeDigest[VLE_SCOPE_DIGEST_LEN];
+  vle_getScopeDigest(ctx, vle, argc, argv, scopeDigest);
 
   /* Retrieve value */
   int blobLen = sqlite3_value_bytes(argv[0]);
   const unsigned char* blob = (const unsigned char*) sqlite3_value_blob(argv[0]);
-  if (blobLen < sizeof(VleHeader))
+
+  /* Decrypt value and check tag */
+  unsigned char* plaintext = NULL;
+  int payloadLen = 0;
+  const char* zErrMsg = NULL;
+  int rc = vle_decryptValue(vle, scopeDigest, blob, blobLen, &plaintext, &payloadLen, &zErrMsg);
+  if (rc == SQLITE_NOMEM)
   {
-    sqlite3_result_error(ctx, "Encrypted content too short", -1);
+    sqlite3_result_error_nomem(ctx);
     return;
   }
-
-  /* Make writable copy of value */
-  unsigned char* buffer = sqlite3_malloc(blobLen);
-  if (!buffer)
+  if (rc != SQLITE_OK)
   {
-    sqlite3_result_error_nomem(ctx);
+    sqlite3_result_error(ctx, zErrMsg, -1);
     return;
   }
-  memcpy(buffer, blob, blobLen);
 
-  /* Parse header */
-  VleHeader hdr;
-  vle_parseHeader(buffer, &hdr);
-  if (hdr.magic != VLE_MAGIC)
+  /* Unpack value and set return value, passes ownership of the buffer */
+  if (vle_unpackValue(ctx, plaintext, payloadLen) != SQLITE_OK)
   {
-    sqlite3_result_error(ctx, "Invalid VLE header in encrypted value", -1);
-    return;
+    sqlite3_result_error(ctx, "Invalid value type in encrypted value", -1);
   }
+}
 
-  /* Determine required lenghts and offsets */
-  int nonceLen = vle->nonceLen;
-  int tagLen = vle->tagLen;
-  int payloadLen = blobLen - sizeof(VleHeader) - nonceLen - tagLen - 1;
+// ---------- Bulk Re-encryption ----------
 
-  unsigned char* nonce = buffer + sizeof(VleHeader);
-  unsigned char* ciphertext = nonce + nonceLen;
-  unsigned char* tag = ciphertext + payloadLen + 1;
+#define VLE_REKEY_BATCH_DEFAULT 1000
+#define VLE_REKEY_WORKERS_MAX      8
 
-  /* Decrypt value and check tag */
-  int rc = vle_aeadDecrypt(vle,
-                           buffer, sizeof(VleHeader) + nonceLen,
-                           ciphertext, payloadLen + 1,
-                           tag, tagLen,
-                           nonce, nonceLen,
-                           scope, scopeLen);
+typedef struct _VleRekeyItem
+{
+  sqlite3_int64  rowid;
+  unsigned char* value;
+  int            valueLen;
+  int            rc;
+} VleRekeyItem;
+
+typedef struct _VleRekeyTask
+{
+  const VleContext*    vle;
+  const unsigned char* scopeDigest;
+  VleRekeyItem*        items;
+  int                  nItems;
+  int                  maxLen;
+} VleRekeyTask;
+
+/*
+** Re-encrypt the values of a task with the active key.
+**
+** Values already encrypted with the active key are released and set to
+** NULL, so that they are not written back.
+*/
+static void*
+vle_rekeyWorker(void* pArg)
+{
+  VleRekeyTask* task = (VleRekeyTask*) pArg;
+  const VleKey* active = &task->vle->keys[0];
+  int j;
+
+  for (j = 0; j < task->nItems; ++j)
+  {
+    VleRekeyItem* item = &task->items[j];
+    const unsigned char* blob = item->value;
+    unsigned char* plaintext = NULL;
+    unsigned char* buffer = NULL;
+    int payloadLen = 0;
+    int bufferLen = 0;
+    const char* zErrMsg = NULL;
+
+    if (item->valueLen >= (int) sizeof(VleHeader) + VLE_KEY_ID_LEN &&
+        blob[0] == VLE_MAGIC && blob[2] == active->algorithm &&
+        blob[3] == (active->flags | VLE_FLAG_KEY_ID) &&
+        memcmp(blob + sizeof(VleHeader), active->keyId, VLE_KEY_ID_LEN) == 0)
+    {
+      /* Nothing to do */
+      item->rc = SQLITE_OK;
+    }
+    else
+    {
+      item->rc = vle_decryptValue(task->vle, task->scopeDigest,
+                                  blob, item->valueLen,
+                                  &plaintext, &payloadLen, &zErrMsg);
+      if (item->rc == SQLITE_OK)
+      {
+        item->rc = vle_encryptValue(active, task->scopeDigest,
+                                    plaintext[0], plaintext + 1, payloadLen,
+                                    task->maxLen, &buffer, &bufferLen);
+        sqlite3mcSecureZeroMemory(plaintext, payloadLen + 1);
+        sqlite3_free(plaintext);
+      }
+    }
+    sqlite3_free(item->value);
+    item->value = buffer;
+    item->valueLen = bufferLen;
+  }
+  return NULL;
+}
+
+/*
+** Re-encrypt the values of a batch, optionally distributed over worker threads.
+*/
+static int
+vle_rekeyBatch(const VleContext* vle, const unsigned char* scopeDigest,
+               VleRekeyItem* items, int nItems, int maxLen, int nWorkers)
+{
+  VleRekeyTask tasks[VLE_REKEY_WORKERS_MAX];
+  int nTasks = (nWorkers < nItems) ? nWorkers : nItems;
+  int nDone = 0;
+  int j;
+
+  for (j = 0; j < nTasks; ++j)
+  {
+    int nChunk = (nItems - nDone) / (nTasks - j);
+    tasks[j].vle = vle;
+    tasks[j].scopeDigest = scopeDigest;
+    tasks[j].items = items + nDone;
+    tasks[j].nItems = nChunk;
+    tasks[j].maxLen = maxLen;
+    nDone += nChunk;
+  }
+
+#if SQLITE_MAX_WORKER_THREADS>0
+  {
+    SQLiteThread* threads[VLE_REKEY_WORKERS_MAX];
+    for (j = 1; j < nTasks; ++j)
+    {
+      if (sqlite3ThreadCreate(&threads[j], vle_rekeyWorker, &tasks[j]) != SQLITE_OK)
+      {
+        threads[j] = NULL;
+        vle_rekeyWorker(&tasks[j]);
+      }
+    }
+    if (nTasks > 0)
+    {
+      vle_rekeyWorker(&tasks[0]);
+    }
+    for (j = 1; j < nTasks; ++j)
+    {
+      void* pOut;
+      if (threads[j] != NULL)
+      {
+        sqlite3ThreadJoin(threads[j], &pOut);
+      }
+    }
+  }
+#else
+  for (j = 0; j < nTasks; ++j)
+  {
+    vle_rekeyWorker(&tasks[j]);
+  }
+#endif
+
+  for (j = 0; j < nItems; ++j)
+  {
+    if (items[j].rc != SQLITE_OK)
+      return items[j].rc;
+  }
+  return SQLITE_OK;
+}
+
+/*
+** Re-encrypt a column with the active VLE key
+**
+** The rows of the table are processed in batches of nBatchRows rows in
+** rowid order. Each batch is decrypted with the resident keys and
+** encrypted with the active key, optionally by up to nWorkers threads,
+** and is committed as a transaction of its own, unless a transaction is
+** already active. Values already encrypted with the active key are
+** skipped, so an interrupted operation can simply be restarted.
+*/
+SQLITE_API int
+sqlite3mc_vle_reencrypt(sqlite3* db, const char* zDbName,
+                        const char* zTable, const char* zColumn, const char* zScope,
+                        int nBatchRows, int nWorkers)
+{
+  int rc = SQLITE_OK;
+  int autoCommit;
+  int maxLen;
+  int done = 0;
+  sqlite3_int64 nextRowid = SMALLEST_INT64;
+  sqlite3_int64 failedRowid = 0;
+  VleContext* vle;
+  VleContext* keyRing = NULL;
+  VleRekeyItem* items = NULL;
+  sqlite3_stmt* pSelect = NULL;
+  sqlite3_stmt* pUpdate = NULL;
+  char* zSql;
+  unsigned char scopeDigest[VLE_SCOPE_DIGEST_LEN];
+
+  if (db == NULL || zTable == NULL || zColumn == NULL)
+  {
+    return SQLITE_MISUSE;
+  }
+  if (zDbName == NULL)
+  {
+    zDbName = "main";
+  }
+  if (nBatchRows < 1)
+  {
+    nBatchRows = VLE_REKEY_BATCH_DEFAULT;
+  }
+  if (nWorkers < 1)
+  {
+    nWorkers = 1;
+  }
+  else if (nWorkers > VLE_REKEY_WORKERS_MAX)
+  {
+    nWorkers = VLE_REKEY_WORKERS_MAX;
+  }
+
+  sqlite3_mutex_enter(sqlite3_db_mutex(db));
+  autoCommit = sqlite3_get_autocommit(db);
+  maxLen = sqlite3_limit(db, SQLITE_LIMIT_LENGTH, -1);
+
+  /* Take a snapshot of the key ring, it is shared by the worker threads */
+  vle = sqlite3_get_clientdata(db, VLE_CONTEXT_KEY);
+  if (vle == NULL || vle->nKeys == 0)
+  {
+    sqlite3ErrorWithMsg(db, SQLITE_ERROR, "VLE key not set");
+    sqlite3_mutex_leave(sqlite3_db_mutex(db));
+    return SQLITE_ERROR;
+  }
+  keyRing = sqlite3mcSecureAlloc(sizeof(VleContext));
+  items = sqlite3_malloc64(sizeof(VleRekeyItem) * (sqlite3_uint64) nBatchRows);
+  if (keyRing == NULL || items == NULL)
+  {
+    rc = SQLITE_NOMEM;
+    goto rekey_done;
+  }
+  memcpy(keyRing, vle, sizeof(VleContext));
+
+  /* The scope is the same for all values, NULL stands for no scope argument */
+  sha512((const unsigned char*) ((zScope != NULL) ? zScope : ""),
+         (zScope != NULL) ? (unsigned int) strlen(zScope) : 0, scopeDigest);
+
+  zSql = sqlite3_mprintf("SELECT rowid, \"%w\" FROM \"%w\".\"%w\" WHERE rowid >= ?1 ORDER BY rowid LIMIT ?2",
+                         zColumn, zDbName, zTable);
+  rc = (zSql != NULL) ? sqlite3_prepare_v2(db, zSql, -1, &pSelect, NULL) : SQLITE_NOMEM;
+  sqlite3_free(zSql);
+  if (rc != SQLITE_OK)
+  {
+    goto rekey_done;
+  }
+  zSql = sqlite3_mprintf("UPDATE \"%w\".\"%w\" SET \"%w\" = ?1 WHERE rowid = ?2",
+                         zDbName, zTable, zColumn);
+  rc = (zSql != NULL) ? sqlite3_prepare_v2(db, zSql, -1, &pUpdate, NULL) : SQLITE_NOMEM;
+  sqlite3_free(zSql);
   if (rc != SQLITE_OK)
   {
-    sqlite3_result_error(ctx, "AEAD authentication failed", -1);
+    goto rekey_done;
+  }
+
+  while (!done && rc == SQLITE_OK)
+  {
+    int nRows = 0;
+    int nItems = 0;
+    int j;
+    sqlite3_int64 lastRowid = nextRowid;
+
+    if (autoCommit)
+    {
+      rc = sqlite3_exec(db, "BEGIN IMMEDIATE", NULL, NULL, NULL);
+      if (rc != SQLITE_OK)
+        break;
+    }
+
+    /* Read the next batch of encrypted values */
+    sqlite3_bind_int64(pSelect, 1, nextRowid);
+    sqlite3_bind_int(pSelect, 2, nBatchRows);
+    while ((rc = sqlite3_step(pSelect)) == SQLITE_ROW)
+    {
+      ++nRows;
+      lastRowid = sqlite3_column_int64(pSelect, 0);
+      if (sqlite3_column_type(pSelect, 1) == SQLITE_BLOB)
+      {
+        const void* value = sqlite3_column_blob(pSelect, 1);
+        int valueLen = sqlite3_column_bytes(pSelect, 1);
+        VleRekeyItem* item = &items[nItems];
+        item->rowid = lastRowid;
+        item->valueLen = valueLen;
+        item->rc = SQLITE_OK;
+        item->value = sqlite3_malloc((valueLen > 0) ? valueLen : 1);
+        if (item->value == NULL)
+        {
+          rc = SQLITE_NOMEM;
+          break;
+        }
+        memcpy(item->value, value, valueLen);
+        ++nItems;
+      }
+    }
+    sqlite3_reset(pSelect);
+    if (rc == SQLITE_DONE)
+    {
+      rc = SQLITE_OK;
+    }
+
+    /* Re-encrypt and write back the batch */
+    if (rc == SQLITE_OK)
+    {
+      rc = vle_rekeyBatch(keyRing, scopeDigest, items, nItems, maxLen, nWorkers);
+    }
+    for (j = 0; j < nItems; ++j)
+    {
+      VleRekeyItem* item = &items[j];
+      if (rc == SQLITE_OK && item->value != NULL)
+      {
+        sqlite3_bind_blob(pUpdate, 1, item->value, item->valueLen, SQLITE_STATIC);
+        sqlite3_bind_int64(pUpdate, 2, item->rowid);
+        rc = sqlite3_step(pUpdate);
+        sqlite3_reset(pUpdate);
+        rc = (rc == SQLITE_DONE) ? SQLITE_OK : rc;
+      }
+      else if (rc != SQLITE_OK && item->rc != SQLITE_OK && failedRowid == 0)
+      {
+        failedRowid = item->rowid;
+      }
+      sqlite3_free(item->value);
+      item->value = NULL;
+    }
+    sqlite3_clear_bindings(pUpdate);
+
+    if (autoCommit)
+    {
+      if (rc == SQLITE_OK)
+      {
+        rc = sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
+      }
+      else
+      {
+        sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+      }
+    }
+
+    done = (nRows < nBatchRows || lastRowid == LARGEST_INT64);
+    nextRowid = lastRowid + 1;
   }
 
-  /* Unpack value and set return value */
-  vle_unpackValue(ctx, &hdr, ciphertext, payloadLen);
+rekey_done:
+  sqlite3_finalize(pSelect);
+  sqlite3_finalize(pUpdate);
+  sqlite3_free(items);
+  sqlite3mcSecureFree(keyRing);
+  if (rc == SQLITE_CORRUPT || (rc != SQLITE_OK && failedRowid != 0))
+  {
+    sqlite3ErrorWithMsg(db, rc, "VLE re-encryption failed for rowid %lld", failedRowid);
+  }
+  else if (rc != SQLITE_OK && rc != sqlite3_errcode(db))
+  {
+    sqlite3ErrorWithMsg(db, rc, "VLE re-encryption failed: %s", sqlite3_errstr(rc));
+  }
+  sqlite3_mutex_leave(sqlite3_db_mutex(db));
+  return rc;
 }
 
 /*
@@ -830,4 +1748,15 @@ int sqlite3_vle_init(sqlite3* db, char** pzErrMsg, const sqlite3_api_routines* p
   return SQLITE_OK;
 }
 
+#else
+
+SQLITE_API int
+sqlite3mc_vle_reencrypt(sqlite3* db, const char* zDbName,
+                        const char* zTable, const char* zColumn, const char* zScope,
+                        int nBatchRows, int nWorkers)
+{
+  /* Value level encryption is not available */
+  return SQLITE_ERROR;
+}
+
 #endif
@@ -27,6 +27,7 @@
 **  validatetext=BOOL   validate UTF-8 encoding of text fields
 **  affinity=AFFINITY   affinity to apply to each returned value
 **  nulls=BOOL          empty fields are returned as NULL
+**  threads=N           number of threads parsing the input
 **
 **
 ** Defaults:
@@ -51,6 +52,7 @@
 **  validatetext=no     do not validate text field encoding
 **  affinity=none       do not apply affinity to each returned value
 **  nulls=off           empty fields returned as zero-length
+**  threads=1           parse the input on the calling thread
 **
 **
 ** Parameter types:
@@ -117,6 +119,15 @@
 ** the contents are explicity empty ("") then a 0 length blob
 ** (if affinity=blob) or 0 length text string.
 **
+** The threads option (at most 64) reads the input in large blocks,
+** which are split into N pieces at record separators.  The pieces are
+** parsed by worker threads, including UTF-8 validation and number
+** detection, and the rows are returned in order.  A split point that
+** turns out to be inside a quoted field is detected, and the input
+** from there on is parsed again with the next block, so the result is
+** the same as with a single thread.  Without thread support the pieces
+** are parsed one after the other.
+**
 ** For the affinity setting, the following processing is applied to
 ** each value returned by the VSV virtual table:
 **
@@ -228,6 +239,8 @@ SQLITE_EXTENSION_INIT1
 #include <stdio.h>
 #include <math.h>
 #include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #ifdef SQLITE_HAVE_ZLIB
 #include <zlib.h>
@@ -251,8 +264,53 @@ SQLITE_EXTENSION_INIT1
 #define LONGDOUBLE_CONSTANT(x) x##L
 #endif
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#define VSV_USE_AVX2 1
+#define VSV_USE_SSE2 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP>=2)
+#include <emmintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#define VSV_USE_AVX2 0
+#define VSV_USE_SSE2 1
+#else
+#define VSV_USE_AVX2 0
+#define VSV_USE_SSE2 0
+#endif
+
 #ifndef SQLITE_OMIT_VIRTUALTABLE
 
+/*
+** Worker threads are available if compiled as part of the SQLite
+** amalgamation with worker thread support.
+*/
+#if defined(SQLITEINT_H) && SQLITE_MAX_WORKER_THREADS>0 && SQLITE_THREADSAFE>0
+#define VSV_USE_THREADS 1
+#else
+#define VSV_USE_THREADS 0
+#endif
+
+#if VSV_USE_SSE2
+/*
+** Index of the lowest set bit of a non-zero SIMD compare mask
+*/
+static unsigned int vsv_ctz(unsigned int m)
+{
+#if defined(_MSC_VER)
+    unsigned long k;
+    _BitScanForward(&k, m);
+    return (unsigned int)k;
+#else
+    return (unsigned int)__builtin_ctz(m);
+#endif
+}
+#endif
+
 /*
 ** A macro to hint to the compiler that a function should not be
 ** inlined.
@@ -381,6 +439,39 @@ static int vsv_reader_open(
     return 0;
 }
 
+/*
+** Return the offset of the next unread character of the input
+*/
+static sqlite3_int64 vsv_reader_tell(VsvReader *p)
+{
+    if (p->in==0)
+    {
+        return (sqlite3_int64)p->iIn;
+    }
+    return (sqlite3_int64)ftell(p->in) - (sqlite3_int64)p->nIn + (sqlite3_int64)p->iIn;
+}
+
+/*
+** Position the reader at offset iOff of the input, which is the start
+** of line nLine
+*/
+static void vsv_reader_seek(VsvReader *p, sqlite3_int64 iOff, int nLine)
+{
+    if (p->in==0)
+    {
+        assert( iOff>=0 && (size_t)iOff<=p->nIn );
+        p->iIn = (size_t)iOff;
+    }
+    else
+    {
+        fseek(p->in, (long)iOff, SEEK_SET);
+        p->iIn = 0;
+        p->nIn = 0;
+    }
+    p->nLine = nLine;
+    p->bNotFirst = iOff>0;
+}
+
 /*
 ** The input buffer has overflowed.  Refill the input buffer, then
 ** return the next character
@@ -399,7 +490,7 @@ static VSV_NOINLINE int vsv_getc_refill(VsvReader *p)
     }
     p->nIn = got;
     p->iIn = 1;
-    return p->zIn[0];
+    return ((unsigned char*)p->zIn)[0];
 }
 
 /*
@@ -604,6 +695,35 @@ static int vsvtabEof(sqlite3_vtab_cursor*);
 static int vsvtabColumn(sqlite3_vtab_cursor*,sqlite3_context*,int);
 static int vsvtabRowid(sqlite3_vtab_cursor*,sqlite3_int64*);
 
+/*
+** Maximum number of threads parsing the input
+*/
+#define VSV_THREADS_MAX 64
+
+/*
+** Bytes of input per thread and block of the threaded parser
+*/
+#define VSV_CHUNK_SIZE (1024*1024)
+
+/*
+** Largest rowid
+*/
+#define LARGEST_INT64_VSV  (0xffffffff|(((sqlite3_int64)0x7fffffff)<<32))
+
+/*
+** Number of rows per entry of the sparse rowid index
+*/
+#define VSV_ROWIDX_STEP 64
+
+/*
+** An entry of the sparse rowid index: the position where a row starts
+*/
+typedef struct VsvRowMark
+{
+    sqlite3_int64 iOff;             /* Offset of the row in the input */
+    int nLine;                      /* Line number at that offset */
+} VsvRowMark;
+
 /*
 ** An instance of the VSV virtual table
 */
@@ -619,14 +739,103 @@ typedef struct VsvTable
     int affinity;                   /* Perform affinity conversions */
     int nulls;                      /* Process NULLs */
     int validateUTF8;               /* Validate UTF8 */
+    int nThread;                    /* Number of threads parsing the input */
     unsigned int tstFlags;          /* Bit values used for testing */
+    VsvRowMark *aMark;              /* Start of rows 1, 1+STEP, 1+2*STEP, ... */
+    int nMark;                      /* Number of entries in aMark[] */
+    int nMarkAlloc;                 /* Space allocated for aMark[] */
+    sqlite3_int64 nRow;             /* Number of rows, or -1 if not yet known */
+    sqlite3_int64 szFile;           /* Size of zFilename when indexed */
+    sqlite3_int64 tmFile;           /* Modification time of zFilename */
 } VsvTable;
 
+/*
+** Values of idxNum: which rowid constraints are passed to xFilter, in the
+** order of the arguments
+*/
+#define VSV_IDX_EQ      0x0001      /* rowid = ? */
+#define VSV_IDX_GT      0x0002      /* rowid > ? */
+#define VSV_IDX_GE      0x0004      /* rowid >= ? */
+#define VSV_IDX_LT      0x0008      /* rowid < ? */
+#define VSV_IDX_LE      0x0010      /* rowid <= ? */
+#define VSV_IDX_LIMIT   0x0020      /* LIMIT ? */
+#define VSV_IDX_OFFSET  0x0040      /* OFFSET ? */
+
 /*
 ** Allowed values for tstFlags
 */
 #define VSVTEST_FIDX  0x0001        /* Pretend that constrained searchs cost less*/
 
+/*
+** A field parsed by a worker thread
+*/
+typedef struct VsvField
+{
+    size_t iText;                   /* Offset of the text in VsvChunk.zText */
+    int n;                          /* Data length, -1 for NULL */
+    int eNumber;                    /* vsv_isValidNumber(), or -2 */
+    long long nValid;               /* vsv_utf8IsValid(), or -2 */
+} VsvField;
+
+/*
+** A row parsed by a worker thread
+*/
+typedef struct VsvChunkRow
+{
+    size_t iOff;                    /* Offset of the row in the block */
+    int nLine;                      /* Line number relative to the piece */
+} VsvChunkRow;
+
+/*
+** A piece of a block of input, and the rows parsed from it by a worker
+** thread.  The worker parses the records starting before iLimit; the last
+** of them may extend beyond iLimit.
+*/
+typedef struct VsvChunk
+{
+    VsvTable *pTab;                 /* The table */
+    const char *zIn;                /* The block of input */
+    size_t nIn;                     /* Size of the block */
+    size_t iStart;                  /* Offset of the piece in the block */
+    size_t iLimit;                  /* End of the piece */
+    int bLast;                      /* The block ends at the end of input */
+    int bNotFirst;                  /* The piece is not at the start of input */
+    size_t iEnd;                    /* End of the last complete record */
+    int bIncomplete;                /* The record at iEnd exceeds the block */
+    int nLine;                      /* Lines up to iEnd */
+    int rc;                         /* SQLITE_OK or SQLITE_NOMEM */
+    sqlite3_int64 iBase;            /* Input offset of the block */
+    int nBaseLine;                  /* Line number at the start of the piece */
+    VsvChunkRow *aRow;              /* Rows */
+    int nRow;                       /* Number of rows */
+    int nRowAlloc;                  /* Space allocated for aRow[] */
+    VsvField *aField;               /* Fields, nCol per row */
+    int *aIntCol;                   /* Columns with only integers so far */
+    char *zText;                    /* Text of the fields, zero terminated */
+    size_t nText;                   /* Bytes used in zText[] */
+    size_t nTextAlloc;              /* Space allocated for zText[] */
+    int bErr;                       /* A parse error occurred */
+} VsvChunk;
+
+/*
+** State of the threaded parser of a cursor
+*/
+typedef struct VsvBatch
+{
+    VsvChunk *aChunk;               /* One chunk per thread */
+    int nChunk;                     /* Number of chunks with valid rows */
+    int iChunk;                     /* Chunk of the next row */
+    int iRow;                       /* Next row within aChunk[iChunk] */
+    char *zBuf;                     /* Block of input read from the file */
+    size_t nBuf;                    /* Bytes in zBuf[] */
+    size_t nBufAlloc;               /* Space allocated for zBuf[] */
+    size_t nBlock;                  /* Size of a block of input */
+    sqlite3_int64 iNext;            /* Input offset of the next record */
+    int nNextLine;                  /* Line number at iNext */
+    int bEof;                       /* All input has been parsed */
+    int bErr;                       /* A parse error occurred */
+} VsvBatch;
+
 /*
 ** A cursor for the VSV virtual table
 */
@@ -637,9 +846,18 @@ typedef struct VsvCursor
     char **azVal;                   /* Value of the current row */
     int *aLen;                      /* Allocation Length of each entry */
     int *dLen;                      /* Data Length of each entry */
+    long long *aValid;              /* vsv_utf8IsValid() of each entry, or -2 */
+    int *aNumber;                   /* vsv_isValidNumber() of each entry, or -2 */
+    int *aIntCol;                   /* Columns with only integers so far */
+    VsvBatch *pBatch;               /* Threaded parser, if threads>1 */
     sqlite3_int64 iRowid;           /* The current rowid.  Negative for EOF */
+    sqlite3_int64 iMaxRowid;        /* Stop after this rowid */
 } VsvCursor;
 
+static int vsvtabNextBatched(VsvCursor *pCur);
+static void vsvBatchFree(VsvBatch *pBatch, int nThread);
+static void vsvBatchReset(VsvBatch *pBatch, sqlite3_int64 iOff, int nLine);
+
 /*
 ** Transfer error message text from a reader into a VsvTable
 */
@@ -657,6 +875,7 @@ static int vsvtabDisconnect(sqlite3_vtab *pVtab)
     VsvTable *p = (VsvTable*)pVtab;
     sqlite3_free(p->zFilename);
     sqlite3_free(p->zData);
+    sqlite3_free(p->aMark);
     sqlite3_free(p);
     return SQLITE_OK;
 }
@@ -960,6 +1179,7 @@ static int vsvtabConnect(
     int b;                     /* Value of a boolean parameter */
     int nCol = -99;            /* Value of the columns= parameter */
     int nSkip = -1;            /* Value of the skip= parameter */
+    int nThread = -1;          /* Value of the threads= parameter */
     int bNulls = -1;           /* Process Nulls flag */
     VsvReader sRdr;            /* A VSV file reader used to store an error
                                ** message and/or to count the number of columns */
@@ -1044,6 +1264,20 @@ static int vsvtabConnect(
                 goto vsvtab_connect_error;
             }
         }
+        else if ((zValue = vsv_parameter("threads",7,z))!=0)
+        {
+            if (nThread>0)
+            {
+                vsv_errmsg(&sRdr, "more than one 'threads' parameter");
+                goto vsvtab_connect_error;
+            }
+            nThread = atoi(zValue);
+            if (nThread<=0 || nThread>VSV_THREADS_MAX)
+            {
+                vsv_errmsg(&sRdr, "threads= value must be between 1 and %d", VSV_THREADS_MAX);
+                goto vsvtab_connect_error;
+            }
+        }
         else if ((zValue = vsv_parameter("skip",4,z))!=0)
         {
             if (nSkip>0)
@@ -1095,6 +1329,10 @@ static int vsvtabConnect(
     {
         validateUTF8 = 0;
     }
+    if (nThread<=0)
+    {
+        nThread = 1;
+    }
     if ((VSV_FILENAME==0)==(VSV_DATA==0))
     {
         vsv_errmsg(&sRdr, "must specify either filename= or data= but not both");
@@ -1123,11 +1361,13 @@ static int vsvtabConnect(
         goto vsvtab_connect_oom;
     }
     memset(pNew, 0, sizeof(*pNew));
+    pNew->nRow = -1;
     pNew->fsep = sRdr.fsep;
     pNew->rsep = sRdr.rsep;
     pNew->affinity = affinity;
     pNew->validateUTF8 = validateUTF8;
     pNew->nulls = bNulls;
+    pNew->nThread = nThread;
     if (VSV_SCHEMA==0)
     {
         sqlite3_str *pStr = sqlite3_str_new(0);
@@ -1326,6 +1566,54 @@ static int vsvtabCreate(
     return vsvtabConnect(db, pAux, argc, argv, ppVtab, pzErr);
 }
 
+/*
+** Discard the sparse rowid index of a VsvTable, if the file changed since
+** the index was built.
+*/
+static void vsvtabCheckIndex(VsvTable *pTab)
+{
+    struct stat st;
+    if (pTab->zFilename==0)
+    {
+        return;
+    }
+    if (stat(pTab->zFilename, &st)!=0)
+    {
+        st.st_size = 0;
+        st.st_mtime = 0;
+    }
+    if ((sqlite3_int64)st.st_size!=pTab->szFile || (sqlite3_int64)st.st_mtime!=pTab->tmFile)
+    {
+        pTab->nMark = 0;
+        pTab->nRow = -1;
+        pTab->szFile = (sqlite3_int64)st.st_size;
+        pTab->tmFile = (sqlite3_int64)st.st_mtime;
+    }
+}
+
+/*
+** Record the position iOff, at line nLine, of the next row in the sparse
+** rowid index.  The index is optional, so an OOM error just leaves it
+** incomplete.
+*/
+static void vsvtabMarkRow(VsvTable *pTab, sqlite3_int64 iOff, int nLine)
+{
+    if (pTab->nMark>=pTab->nMarkAlloc)
+    {
+        int nNew = pTab->nMarkAlloc*2 + 64;
+        VsvRowMark *aNew = sqlite3_realloc64(pTab->aMark, nNew*sizeof(VsvRowMark));
+        if (aNew==0)
+        {
+            return;
+        }
+        pTab->aMark = aNew;
+        pTab->nMarkAlloc = nNew;
+    }
+    pTab->aMark[pTab->nMark].iOff = iOff;
+    pTab->aMark[pTab->nMark].nLine = nLine;
+    pTab->nMark++;
+}
+
 /*
 ** Destructor for a VsvCursor.
 */
@@ -1334,6 +1622,10 @@ static int vsvtabClose(sqlite3_vtab_cursor *cur)
     VsvCursor *pCur = (VsvCursor*)cur;
     vsvtabCursorRowReset(pCur);
     vsv_reader_reset(&pCur->rdr);
+    if (pCur->pBatch)
+    {
+        vsvBatchFree(pCur->pBatch, ((VsvTable*)cur->pVtab)->nThread);
+    }
     sqlite3_free(cur);
     return SQLITE_OK;
 }
@@ -1346,14 +1638,45 @@ static int vsvtabOpen(sqlite3_vtab *p, sqlite3_vtab_cursor **ppCursor)
     VsvTable *pTab = (VsvTable*)p;
     VsvCursor *pCur;
     size_t nByte;
-    nByte = sizeof(*pCur) + (sizeof(char*)+(2*sizeof(int)))*pTab->nCol;
+    int i;
+    nByte = sizeof(*pCur) + (sizeof(char*)+sizeof(long long)+(4*sizeof(int)))*pTab->nCol;
     pCur = sqlite3_malloc64( nByte );
     if (pCur==0)
         return SQLITE_NOMEM;
     memset(pCur, 0, nByte);
     pCur->azVal = (char**)&pCur[1];
-    pCur->aLen = (int*)&pCur->azVal[pTab->nCol];
+    pCur->aValid = (long long*)&pCur->azVal[pTab->nCol];
+    pCur->aLen = (int*)&pCur->aValid[pTab->nCol];
     pCur->dLen = (int*)&pCur->aLen[pTab->nCol];
+    pCur->aNumber = (int*)&pCur->dLen[pTab->nCol];
+    pCur->aIntCol = (int*)&pCur->aNumber[pTab->nCol];
+    for (i=0; i<pTab->nCol; i++)
+    {
+        pCur->aIntCol[i] = 1;
+    }
+    if (pTab->nThread>1)
+    {
+        int *aIntCol;
+        nByte = sizeof(VsvBatch) + pTab->nThread*(sizeof(VsvChunk)+sizeof(int)*pTab->nCol);
+        pCur->pBatch = sqlite3_malloc64( nByte );
+        if (pCur->pBatch==0)
+        {
+            sqlite3_free(pCur);
+            return SQLITE_NOMEM;
+        }
+        memset(pCur->pBatch, 0, nByte);
+        pCur->pBatch->aChunk = (VsvChunk*)&pCur->pBatch[1];
+        aIntCol = (int*)&pCur->pBatch->aChunk[pTab->nThread];
+        for (i=0; i<pTab->nThread*pTab->nCol; i++)
+        {
+            aIntCol[i] = 1;
+        }
+        for (i=0; i<pTab->nThread; i++)
+        {
+            pCur->pBatch->aChunk[i].aIntCol = &aIntCol[i*pTab->nCol];
+        }
+        pCur->pBatch->nBlock = (size_t)pTab->nThread*VSV_CHUNK_SIZE;
+    }
     pCur->rdr.fsep = pTab->fsep;
     pCur->rdr.rsep = pTab->rsep;
     pCur->rdr.affinity = pTab->affinity;
@@ -1363,6 +1686,7 @@ static int vsvtabOpen(sqlite3_vtab *p, sqlite3_vtab_cursor **ppCursor)
         vsv_xfer_error(pTab, &pCur->rdr);
         return SQLITE_ERROR;
     }
+    vsvtabCheckIndex(pTab);
     return SQLITE_OK;
 }
 
@@ -1377,6 +1701,14 @@ static int vsvtabNext(sqlite3_vtab_cursor *cur)
     VsvTable *pTab = (VsvTable*)cur->pVtab;
     int i = 0;
     char *z;
+    if (pCur->pBatch)
+    {
+        return vsvtabNextBatched(pCur);
+    }
+    if (pCur->iRowid==(sqlite3_int64)pTab->nMark*VSV_ROWIDX_STEP && pTab->nRow<0)
+    {
+        vsvtabMarkRow(pTab, vsv_reader_tell(&pCur->rdr), pCur->rdr.nLine);
+    }
     do
     {
         z = vsv_read_one_field(&pCur->rdr);
@@ -1387,6 +1719,8 @@ static int vsvtabNext(sqlite3_vtab_cursor *cur)
         }
         else if (i<pTab->nCol)
         {
+            pCur->aValid[i] = -2;
+            pCur->aNumber[i] = -2;
             if (pCur->aLen[i] < pCur->rdr.n+1)
             {
                 char *zNew = sqlite3_realloc64(pCur->azVal[i], pCur->rdr.n+1);
@@ -1415,6 +1749,10 @@ static int vsvtabNext(sqlite3_vtab_cursor *cur)
     while (pCur->rdr.cTerm==pCur->rdr.fsep);
     if ((pCur->rdr.cTerm==EOF && i==0))
     {
+        if (pCur->rdr.zErr[0]==0)
+        {
+            pTab->nRow = pCur->iRowid;
+        }
         pCur->iRowid = -1;
     }
     else
@@ -1425,10 +1763,106 @@ static int vsvtabNext(sqlite3_vtab_cursor *cur)
             pCur->dLen[i] = -1;
             i++;
         }
+        if (pCur->iRowid>pCur->iMaxRowid)
+        {
+            pCur->iRowid = -1;
+        }
     }
     return SQLITE_OK;
 }
 
+/*
+** Return a pointer to the first character before zEnd that is not an
+** ASCII digit, or zEnd if there is none
+*/
+static const char *vsv_skip_digits(const char *z, const char *zEnd)
+{
+#if VSV_USE_SSE2
+    unsigned int m;
+    /* c is a digit if (c-'0') is below 10 as unsigned value, which is
+    ** tested as signed value after adding 0x80 */
+#if VSV_USE_AVX2
+    const __m256i vBias32 = _mm256_set1_epi8((char)(0x80-'0'));
+    const __m256i vTen32 = _mm256_set1_epi8((char)(0x80+10));
+    while (zEnd-z>=32)
+    {
+        __m256i v = _mm256_add_epi8(_mm256_loadu_si256((const __m256i*)z), vBias32);
+        m = ~(unsigned int)_mm256_movemask_epi8(_mm256_cmpgt_epi8(vTen32, v));
+        if (m)
+        {
+            return z + vsv_ctz(m);
+        }
+        z += 32;
+    }
+#endif
+    {
+        const __m128i vBias = _mm_set1_epi8((char)(0x80-'0'));
+        const __m128i vTen = _mm_set1_epi8((char)(0x80+10));
+        while (zEnd-z>=16)
+        {
+            __m128i v = _mm_add_epi8(_mm_loadu_si128((const __m128i*)z), vBias);
+            m = ~(unsigned int)_mm_movemask_epi8(_mm_cmplt_epi8(v, vTen)) & 0xffff;
+            if (m)
+            {
+                return z + vsv_ctz(m);
+            }
+            z += 16;
+        }
+    }
+#endif
+    while (z<zEnd && *z>='0' && *z<='9')
+    {
+        z++;
+    }
+    return z;
+}
+
+/*
+** Return the number of ASCII characters other than zero at the start of
+** z[], looking at the characters before zEnd only
+*/
+static size_t vsv_ascii_prefix(const unsigned char *z, const unsigned char *zEnd)
+{
+    size_t n = 0;
+#if VSV_USE_SSE2
+    unsigned int m;
+#if VSV_USE_AVX2
+    const __m256i vZero32 = _mm256_setzero_si256();
+    while (zEnd-z>=32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)z);
+        m = (unsigned int)_mm256_movemask_epi8(_mm256_or_si256(v, _mm256_cmpeq_epi8(v, vZero32)));
+        if (m)
+        {
+            return n + vsv_ctz(m);
+        }
+        z += 32;
+        n += 32;
+    }
+#endif
+    {
+        const __m128i vZero = _mm_setzero_si128();
+        while (zEnd-z>=16)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i*)z);
+            m = (unsigned int)_mm_movemask_epi8(_mm_or_si128(v, _mm_cmpeq_epi8(v, vZero)));
+            if (m)
+            {
+                return n + vsv_ctz(m);
+            }
+            z += 16;
+            n += 16;
+        }
+    }
+#endif
+    while (z<zEnd && *z && *z<0x80)
+    {
+        z++;
+        n++;
+    }
+    return n;
+}
+
 /*
 **
 ** Determine affinity of field
@@ -1472,10 +1906,7 @@ static int vsv_isValidNumber(char *arg)
         hasDigit = 1;
         isValid = 1;
     }
-    while (start <= stop && isdigit(*start))            // bunch of digits
-    {
-        start++;
-    }
+    start = (char*)vsv_skip_digits(start, stop+1);      // bunch of digits
     if (start <= stop && *start=='.')                   // may have .
     {
         isValid = 2;
@@ -1485,10 +1916,7 @@ static int vsv_isValidNumber(char *arg)
     {
         hasDigit = 1;
     }
-    while (start <= stop && isdigit(*start))            // bunch of digits
-    {
-        start++;
-    }
+    start = (char*)vsv_skip_digits(start, stop+1);      // bunch of digits
     if (!hasDigit)                                      // no digits then invalid
     {
         isValid = 0;
@@ -1507,10 +1935,7 @@ static int vsv_isValidNumber(char *arg)
     {
         isValid = 2;
     }
-    while (start <= stop && isdigit(*start))            // bunch of digits
-    {
-        start++;
-    }
+    start = (char*)vsv_skip_digits(start, stop+1);      // bunch of digits
     if (isValid == 3)
     {
         isValid = 0;
@@ -1525,19 +1950,51 @@ vsv_end_isValidNumber:
 
 
 /*
-** Validate UTF-8
+** Determine affinity of the field z[] of length n like vsv_isValidNumber().
+** *pbInt is true for a column with only integers so far: these are
+** recognized by just checking for digits.
+*/
+static int vsv_numberType(char *z, int n, int *pbInt)
+{
+    if (*pbInt)
+    {
+        const char *zDigit = (n>0 && (z[0]=='+' || z[0]=='-')) ? z+1 : z;
+        if (zDigit<z+n && vsv_skip_digits(zDigit, z+n)==z+n)
+        {
+            return 1;
+        }
+        *pbInt = 0;
+    }
+    return vsv_isValidNumber(z);
+}
+
+/*
+** Validate UTF-8 of the zero terminated string of at most n characters.
+** Runs of ASCII characters are skipped in SIMD blocks.
 ** Return -1 if invalid else length
 */
-static long long vsv_utf8IsValid(char *string)
+static long long vsv_utf8IsValid(char *string, int n)
 {
     long long length = 0;
     unsigned char *start;
+    unsigned char *end;
     int trailing = 0;
     unsigned char c;
 
     start = (unsigned char *)string;
-    while ((c = *start))
+    end = start + n;
+    while (1)
     {
+        if (!trailing)
+        {
+            size_t k = vsv_ascii_prefix(start, end);
+            start += k;
+            length += k;
+        }
+        if ((c = *start)==0)
+        {
+            break;
+        }
         if (trailing)
         {
             if ((c & 0xC0) == 0x80)
@@ -1616,6 +2073,473 @@ static long long vsv_utf8IsValid(char *string)
     return length;
 }
 
+/*
+** Make room for one more row in a VsvChunk.
+** Return 0 on success and non-zero if there is an OOM error
+*/
+static int vsvChunkGrow(VsvChunk *pChunk, int nCol)
+{
+    if (pChunk->nRow>=pChunk->nRowAlloc)
+    {
+        int nNew = pChunk->nRowAlloc*2 + 256;
+        VsvChunkRow *aRow;
+        VsvField *aField;
+        aRow = sqlite3_realloc64(pChunk->aRow, nNew*sizeof(VsvChunkRow));
+        if (aRow==0)
+        {
+            return 1;
+        }
+        pChunk->aRow = aRow;
+        aField = sqlite3_realloc64(pChunk->aField, (sqlite3_uint64)nNew*(nCol>0 ? nCol : 1)*sizeof(VsvField));
+        if (aField==0)
+        {
+            return 1;
+        }
+        pChunk->aField = aField;
+        pChunk->nRowAlloc = nNew;
+    }
+    return 0;
+}
+
+/*
+** Append the n bytes of field text z, plus its zero terminator, to the
+** text of a VsvChunk and store its offset in *piText.
+** Return 0 on success and non-zero if there is an OOM error
+*/
+static int vsvChunkText(VsvChunk *pChunk, const char *z, int n, size_t *piText)
+{
+    if (pChunk->nText+n+1>pChunk->nTextAlloc)
+    {
+        size_t nNew = pChunk->nTextAlloc*2 + n + 4096;
+        char *zNew = sqlite3_realloc64(pChunk->zText, nNew);
+        if (zNew==0)
+        {
+            return 1;
+        }
+        pChunk->zText = zNew;
+        pChunk->nTextAlloc = nNew;
+    }
+    memcpy(&pChunk->zText[pChunk->nText], z, n+1);
+    *piText = pChunk->nText;
+    pChunk->nText += n+1;
+    return 0;
+}
+
+/*
+** Parse the records starting in one piece of a block of input.  This
+** assembles the rows in the same way as vsvtabNext(), and also does the
+** UTF-8 validation and number detection needed by vsvtabColumn().  A
+** record reaching the end of the block is incomplete, unless the block
+** is the end of the input.  Runs on a worker thread.
+*/
+static void *vsvChunkWorker(void *pArg)
+{
+    VsvChunk *pChunk = (VsvChunk*)pArg;
+    VsvTable *pTab = pChunk->pTab;
+    int nCol = pTab->nCol;
+    VsvReader rdr;
+
+    vsv_reader_init(&rdr);
+    rdr.fsep = pTab->fsep;
+    rdr.rsep = pTab->rsep;
+    rdr.affinity = pTab->affinity;
+    rdr.cTerm = pTab->rsep;
+    rdr.zIn = (char*)pChunk->zIn;
+    rdr.nIn = pChunk->nIn;
+    rdr.iIn = pChunk->iStart;
+    rdr.bNotFirst = pChunk->bNotFirst;
+    pChunk->iEnd = pChunk->iStart;
+    pChunk->bIncomplete = 0;
+    pChunk->nLine = 0;
+    pChunk->nRow = 0;
+    pChunk->nText = 0;
+    pChunk->bErr = 0;
+    pChunk->rc = SQLITE_OK;
+    if (vsv_append(&rdr, 0))
+    {
+        pChunk->rc = SQLITE_NOMEM;
+        return 0;
+    }
+    while (rdr.iIn<pChunk->iLimit)
+    {
+        size_t iOff = rdr.iIn;
+        int nLine = rdr.nLine;
+        size_t nText = pChunk->nText;
+        VsvField *aField;
+        char *z;
+        int i = 0;
+        if (vsvChunkGrow(pChunk, nCol))
+        {
+            pChunk->rc = SQLITE_NOMEM;
+            break;
+        }
+        aField = &pChunk->aField[(size_t)pChunk->nRow*nCol];
+        rdr.zErr[0] = 0;
+        do
+        {
+            z = vsv_read_one_field(&rdr);
+            if (z==0)
+            {
+                if (i<nCol)
+                    aField[i].n = -1;
+            }
+            else if (i<nCol)
+            {
+                if (!rdr.notNull && pTab->nulls)
+                {
+                    aField[i].n = -1;
+                }
+                else
+                {
+                    if (vsvChunkText(pChunk, z, rdr.n, &aField[i].iText))
+                    {
+                        pChunk->rc = SQLITE_NOMEM;
+                        break;
+                    }
+                    aField[i].n = rdr.n;
+                }
+                i++;
+            }
+        }
+        while (rdr.cTerm==rdr.fsep);
+        if (pChunk->rc!=SQLITE_OK)
+        {
+            break;
+        }
+        if (rdr.cTerm==EOF && !pChunk->bLast)
+        {
+            pChunk->nText = nText;
+            pChunk->bIncomplete = 1;
+            break;
+        }
+        if (rdr.cTerm==EOF && i==0)
+        {
+            pChunk->iEnd = rdr.iIn;
+            pChunk->nLine = rdr.nLine;
+            break;
+        }
+        while (i<nCol)
+        {
+            aField[i].n = -1;
+            i++;
+        }
+        for (i=0; i<nCol; i++)
+        {
+            aField[i].nValid = -2;
+            aField[i].eNumber = -2;
+            if (aField[i].n>=0)
+            {
+                if (pTab->validateUTF8)
+                    aField[i].nValid = vsv_utf8IsValid(&pChunk->zText[aField[i].iText], aField[i].n);
+                if (pTab->affinity>=3)
+                    aField[i].eNumber = vsv_numberType(&pChunk->zText[aField[i].iText], aField[i].n, &pChunk->aIntCol[i]);
+            }
+        }
+        pChunk->aRow[pChunk->nRow].iOff = iOff;
+        pChunk->aRow[pChunk->nRow].nLine = nLine;
+        pChunk->nRow++;
+        pChunk->iEnd = rdr.iIn;
+        pChunk->nLine = rdr.nLine;
+        if (rdr.zErr[0])
+        {
+            pChunk->bErr = 1;
+        }
+    }
+    sqlite3_free(rdr.z);
+    return 0;
+}
+
+/*
+** Free the threaded parser of a cursor
+*/
+static void vsvBatchFree(VsvBatch *pBatch, int nThread)
+{
+    int k;
+    for (k=0; k<nThread; k++)
+    {
+        sqlite3_free(pBatch->aChunk[k].aRow);
+        sqlite3_free(pBatch->aChunk[k].aField);
+        sqlite3_free(pBatch->aChunk[k].zText);
+    }
+    sqlite3_free(pBatch->zBuf);
+    sqlite3_free(pBatch);
+}
+
+/*
+** Restart the threaded parser at offset iOff of the input, which is the
+** start of line nLine.  The reader of the cursor must have been
+** positioned there as well.
+*/
+static void vsvBatchReset(VsvBatch *pBatch, sqlite3_int64 iOff, int nLine)
+{
+    pBatch->nChunk = 0;
+    pBatch->iChunk = 0;
+    pBatch->iRow = 0;
+    pBatch->nBuf = 0;
+    pBatch->iNext = iOff;
+    pBatch->nNextLine = nLine;
+    pBatch->bEof = 0;
+    pBatch->bErr = 0;
+}
+
+/*
+** Parse the next block of input.  The block is split into one piece per
+** thread just after a record separator.  Such a split point may be inside
+** a quoted field, so the rows of a piece are only used if the rows of the
+** previous piece end exactly at its start.  The input from the first piece
+** not used on is parsed again with the next block.
+*/
+static int vsvBatchRun(VsvCursor *pCur)
+{
+    VsvTable *pTab = (VsvTable*)pCur->base.pVtab;
+    VsvBatch *pBatch = pCur->pBatch;
+    int nThread = pTab->nThread;
+    const char *zIn;
+    size_t nIn;
+    size_t iPos = 0;
+    int bLast;
+    int nLine;
+    int k;
+
+    pBatch->nChunk = 0;
+    pBatch->iChunk = 0;
+    pBatch->iRow = 0;
+    if (pTab->zData)
+    {
+        zIn = pTab->zData + pBatch->iNext;
+        nIn = pCur->rdr.nIn - (size_t)pBatch->iNext;
+        bLast = 1;
+        if (nIn>pBatch->nBlock)
+        {
+            nIn = pBatch->nBlock;
+            bLast = 0;
+        }
+    }
+    else
+    {
+        if (pBatch->nBufAlloc<pBatch->nBlock)
+        {
+            char *zNew = sqlite3_realloc64(pBatch->zBuf, pBatch->nBlock);
+            if (zNew==0)
+            {
+                return SQLITE_NOMEM;
+            }
+            pBatch->zBuf = zNew;
+            pBatch->nBufAlloc = pBatch->nBlock;
+        }
+        pBatch->nBuf += fread(pBatch->zBuf+pBatch->nBuf, 1, pBatch->nBlock-pBatch->nBuf, pCur->rdr.in);
+        zIn = pBatch->zBuf;
+        nIn = pBatch->nBuf;
+        bLast = pBatch->nBuf<pBatch->nBlock;
+    }
+    if (nIn==0)
+    {
+        pBatch->bEof = 1;
+        return SQLITE_OK;
+    }
+
+    for (k=0; k<nThread; k++)
+    {
+        VsvChunk *pChunk = &pBatch->aChunk[k];
+        size_t iLimit = nIn;
+        if (k<nThread-1)
+        {
+            size_t iSplit = nIn/nThread*(k+1);
+            const char *zSep;
+            if (iSplit<iPos)
+            {
+                iSplit = iPos;
+            }
+            zSep = memchr(zIn+iSplit, pTab->rsep, nIn-iSplit);
+            if (zSep)
+            {
+                iLimit = (size_t)(zSep-zIn) + 1;
+            }
+        }
+        pChunk->pTab = pTab;
+        pChunk->zIn = zIn;
+        pChunk->nIn = nIn;
+        pChunk->iStart = iPos;
+        pChunk->iLimit = iLimit;
+        pChunk->bLast = bLast;
+        pChunk->bNotFirst = pBatch->iNext+(sqlite3_int64)iPos>0;
+        iPos = iLimit;
+    }
+
+#if VSV_USE_THREADS
+    {
+        SQLiteThread *aThread[VSV_THREADS_MAX];
+        for (k=1; k<nThread; k++)
+        {
+            if (sqlite3ThreadCreate(&aThread[k], vsvChunkWorker, &pBatch->aChunk[k])!=SQLITE_OK)
+            {
+                aThread[k] = 0;
+                vsvChunkWorker(&pBatch->aChunk[k]);
+            }
+        }
+        vsvChunkWorker(&pBatch->aChunk[0]);
+        for (k=1; k<nThread; k++)
+        {
+            void *pOut;
+            if (aThread[k])
+            {
+                sqlite3ThreadJoin(aThread[k], &pOut);
+            }
+        }
+    }
+#else
+    for (k=0; k<nThread; k++)
+    {
+        vsvChunkWorker(&pBatch->aChunk[k]);
+    }
+#endif
+
+    nLine = pBatch->nNextLine;
+    for (k=0; k<nThread; k++)
+    {
+        VsvChunk *pChunk = &pBatch->aChunk[k];
+        if (k>0 && (pBatch->aChunk[k-1].bIncomplete || pBatch->aChunk[k-1].iEnd!=pChunk->iStart))
+        {
+            break;
+        }
+        if (pChunk->rc!=SQLITE_OK)
+        {
+            return pChunk->rc;
+        }
+        pChunk->iBase = pBatch->iNext;
+        pChunk->nBaseLine = nLine;
+        nLine += pChunk->nLine;
+        if (pChunk->bErr)
+        {
+            pBatch->bErr = 1;
+        }
+    }
+    pBatch->nChunk = k;
+    iPos = pBatch->aChunk[k-1].iEnd;
+    pBatch->iNext += (sqlite3_int64)iPos;
+    pBatch->nNextLine = nLine;
+    if (pTab->zData==0)
+    {
+        memmove(pBatch->zBuf, pBatch->zBuf+iPos, pBatch->nBuf-iPos);
+        pBatch->nBuf -= iPos;
+    }
+    if (bLast && k==nThread)
+    {
+        pBatch->bEof = 1;
+    }
+    else if (iPos==0)
+    {
+        /* A record does not fit into a block */
+        pBatch->nBlock *= 2;
+    }
+    return SQLITE_OK;
+}
+
+/*
+** Advance a VsvCursor to its next row of input, using the threaded parser.
+** Set the EOF marker if we reach the end of input.
+*/
+static int vsvtabNextBatched(VsvCursor *pCur)
+{
+    VsvTable *pTab = (VsvTable*)pCur->base.pVtab;
+    VsvBatch *pBatch = pCur->pBatch;
+    VsvChunk *pChunk;
+    VsvField *aField;
+    int i, rc;
+
+    while (pBatch->iChunk>=pBatch->nChunk || pBatch->iRow>=pBatch->aChunk[pBatch->iChunk].nRow)
+    {
+        if (pBatch->iChunk<pBatch->nChunk)
+        {
+            pBatch->iChunk++;
+            pBatch->iRow = 0;
+            continue;
+        }
+        if (pBatch->bEof)
+        {
+            if (pCur->iRowid==(sqlite3_int64)pTab->nMark*VSV_ROWIDX_STEP && pTab->nRow<0)
+            {
+                vsvtabMarkRow(pTab, pBatch->iNext, pBatch->nNextLine);
+            }
+            if (!pBatch->bErr)
+            {
+                pTab->nRow = pCur->iRowid;
+            }
+            pCur->iRowid = -1;
+            return SQLITE_OK;
+        }
+        rc = vsvBatchRun(pCur);
+        if (rc!=SQLITE_OK)
+        {
+            vsv_errmsg(&pCur->rdr, "out of memory");
+            vsv_xfer_error(pTab, &pCur->rdr);
+            return rc;
+        }
+    }
+    pChunk = &pBatch->aChunk[pBatch->iChunk];
+    if (pCur->iRowid==(sqlite3_int64)pTab->nMark*VSV_ROWIDX_STEP && pTab->nRow<0)
+    {
+        vsvtabMarkRow(pTab, pChunk->iBase + (sqlite3_int64)pChunk->aRow[pBatch->iRow].iOff,
+                      pChunk->nBaseLine + pChunk->aRow[pBatch->iRow].nLine);
+    }
+    aField = &pChunk->aField[(size_t)pBatch->iRow*pTab->nCol];
+    for (i=0; i<pTab->nCol; i++)
+    {
+        if (aField[i].n<0)
+        {
+            pCur->dLen[i] = -1;
+            continue;
+        }
+        if (pCur->aLen[i] < aField[i].n+1)
+        {
+            char *zNew = sqlite3_realloc64(pCur->azVal[i], aField[i].n+1);
+            if (zNew==0)
+            {
+                vsv_errmsg(&pCur->rdr, "out of memory");
+                vsv_xfer_error(pTab, &pCur->rdr);
+                return SQLITE_NOMEM;
+            }
+            pCur->azVal[i] = zNew;
+            pCur->aLen[i] = aField[i].n+1;
+        }
+        memcpy(pCur->azVal[i], &pChunk->zText[aField[i].iText], aField[i].n+1);
+        pCur->dLen[i] = aField[i].n;
+        pCur->aValid[i] = aField[i].nValid;
+        pCur->aNumber[i] = aField[i].eNumber;
+    }
+    pBatch->iRow++;
+    pCur->iRowid++;
+    if (pCur->iRowid>pCur->iMaxRowid)
+    {
+        pCur->iRowid = -1;
+    }
+    return SQLITE_OK;
+}
+
+/*
+** Return vsv_utf8IsValid() of column i of the current row
+*/
+static long long vsvtabValidLength(VsvCursor *pCur, int i)
+{
+    if (pCur->aValid[i]==-2)
+    {
+        pCur->aValid[i] = vsv_utf8IsValid(pCur->azVal[i], pCur->dLen[i]);
+    }
+    return pCur->aValid[i];
+}
+
+/*
+** Return vsv_isValidNumber() of column i of the current row
+*/
+static int vsvtabNumberType(VsvCursor *pCur, int i)
+{
+    if (pCur->aNumber[i]==-2)
+    {
+        pCur->aNumber[i] = vsv_numberType(pCur->azVal[i], pCur->dLen[i], &pCur->aIntCol[i]);
+    }
+    return pCur->aNumber[i];
+}
+
 /*
 ** Return values of columns for the row at which the VsvCursor
 ** is currently pointing.
@@ -1640,7 +2564,7 @@ static int vsvtabColumn(
             {
                 if (pTab->validateUTF8)
                 {
-                    length = vsv_utf8IsValid(pCur->azVal[i]);
+                    length = vsvtabValidLength(pCur, i);
                     if (length == dLen)
                     {
                         sqlite3_result_text(ctx, pCur->azVal[i], dLen, SQLITE_TRANSIENT);
@@ -1665,7 +2589,7 @@ static int vsvtabColumn(
             {
                 if (pTab->validateUTF8)
                 {
-                    length = vsv_utf8IsValid(pCur->azVal[i]);
+                    length = vsvtabValidLength(pCur, i);
                     if (length < dLen)
                     {
                         sqlite3_result_blob(ctx, pCur->azVal[i], dLen, SQLITE_TRANSIENT);
@@ -1683,7 +2607,7 @@ static int vsvtabColumn(
             }
             case 3:
             {
-                switch (vsv_isValidNumber(pCur->azVal[i]))
+                switch (vsvtabNumberType(pCur, i))
                 {
                     case 1:
                     {
@@ -1694,7 +2618,7 @@ static int vsvtabColumn(
                     {
                         if (pTab->validateUTF8)
                         {
-                            length = vsv_utf8IsValid(pCur->azVal[i]);
+                            length = vsvtabValidLength(pCur, i);
                             if (length < dLen)
                             {
                                 sqlite3_result_blob(ctx, pCur->azVal[i], dLen, SQLITE_TRANSIENT);
@@ -1715,7 +2639,7 @@ static int vsvtabColumn(
             }
             case 4:
             {
-                switch (vsv_isValidNumber(pCur->azVal[i]))
+                switch (vsvtabNumberType(pCur, i))
                 {
                     case 1:
                     case 2:
@@ -1727,7 +2651,7 @@ static int vsvtabColumn(
                     {
                         if (pTab->validateUTF8)
                         {
-                            length = vsv_utf8IsValid(pCur->azVal[i]);
+                            length = vsvtabValidLength(pCur, i);
                             if (length < dLen)
                             {
                                 sqlite3_result_blob(ctx, pCur->azVal[i], dLen, SQLITE_TRANSIENT);
@@ -1748,7 +2672,7 @@ static int vsvtabColumn(
             }
             case 5:
             {
-                switch (vsv_isValidNumber(pCur->azVal[i]))
+                switch (vsvtabNumberType(pCur, i))
                 {
                     case 1:
                     {
@@ -1812,7 +2736,7 @@ static int vsvtabColumn(
                     {
                         if (pTab->validateUTF8)
                         {
-                            length = vsv_utf8IsValid(pCur->azVal[i]);
+                            length = vsvtabValidLength(pCur, i);
                             if (length < dLen)
                             {
                                 sqlite3_result_blob(ctx, pCur->azVal[i], dLen, SQLITE_TRANSIENT);
@@ -1856,8 +2780,74 @@ static int vsvtabEof(sqlite3_vtab_cursor *cur)
 }
 
 /*
-** Only a full table scan is supported.  So xFilter simply rewinds to
-** the beginning.
+** Narrow the rowid range [*piFirst, *piLast] by the constraint "rowid OP pVal".
+** Values that are not numeric leave the range as it is; the constraints
+** are not omitted, so SQLite checks them again anyway.
+*/
+static void vsv_rowid_constraint(
+                                sqlite3_value *pVal,
+                                int op,
+                                sqlite3_int64 *piFirst,
+                                sqlite3_int64 *piLast
+                                )
+{
+    sqlite3_int64 v;
+    int eType = sqlite3_value_numeric_type(pVal);
+    if (eType==SQLITE_FLOAT)
+    {
+        double r = sqlite3_value_double(pVal);
+        if (r<-9.0e18) r = -9.0e18;
+        if (r>9.0e18) r = 9.0e18;
+        v = (sqlite3_int64)r;
+        if ((double)v!=r)
+        {
+            /* Not integral: round towards the values satisfying the constraint */
+            if (op==SQLITE_INDEX_CONSTRAINT_EQ)
+            {
+                *piFirst = 1;
+                *piLast = 0;
+                return;
+            }
+            if (r>0.0 && (op==SQLITE_INDEX_CONSTRAINT_GE || op==SQLITE_INDEX_CONSTRAINT_LT))
+                v++;
+            if (r<0.0 && (op==SQLITE_INDEX_CONSTRAINT_GT || op==SQLITE_INDEX_CONSTRAINT_LE))
+                v--;
+        }
+    }
+    else if (eType==SQLITE_INTEGER)
+    {
+        v = sqlite3_value_int64(pVal);
+    }
+    else
+    {
+        return;
+    }
+    switch (op)
+    {
+        case SQLITE_INDEX_CONSTRAINT_EQ:
+            if (v>*piFirst) *piFirst = v;
+            if (v<*piLast) *piLast = v;
+            break;
+        case SQLITE_INDEX_CONSTRAINT_GT:
+            if (v>=*piFirst) *piFirst = (v<LARGEST_INT64_VSV) ? v+1 : v;
+            if (v==LARGEST_INT64_VSV) *piLast = 0;
+            break;
+        case SQLITE_INDEX_CONSTRAINT_GE:
+            if (v>*piFirst) *piFirst = v;
+            break;
+        case SQLITE_INDEX_CONSTRAINT_LT:
+            if (v<=*piLast) *piLast = (v>0) ? v-1 : 0;
+            break;
+        case SQLITE_INDEX_CONSTRAINT_LE:
+            if (v<*piLast) *piLast = v;
+            break;
+    }
+}
+
+/*
+** Start a scan of the rows with rowids in the range given by the
+** constraints of idxNum.  The scan starts at the closest preceding entry
+** of the sparse rowid index, which is extended as rows are read.
 */
 static int vsvtabFilter(
                        sqlite3_vtab_cursor *pVtabCursor,
@@ -1867,43 +2857,132 @@ static int vsvtabFilter(
 {
     VsvCursor *pCur = (VsvCursor*)pVtabCursor;
     VsvTable *pTab = (VsvTable*)pVtabCursor->pVtab;
-    pCur->iRowid = 0;
+    sqlite3_int64 iFirst = 1;
+    sqlite3_int64 iLast = LARGEST_INT64_VSV;
+    sqlite3_int64 nLimit = -1;
+    int iArg = 0;
+    int iMark;
+    sqlite3_int64 iOff;
+    int nLine;
+    int rc;
 
     /* Ensure the field buffer is always allocated. Otherwise, if the
     ** first field is zero bytes in size, this may be mistaken for an OOM
     ** error in csvtabNext(). */
     if( vsv_append(&pCur->rdr, 0) ) return SQLITE_NOMEM;
 
+    if (idxNum & VSV_IDX_EQ)
+        vsv_rowid_constraint(argv[iArg++], SQLITE_INDEX_CONSTRAINT_EQ, &iFirst, &iLast);
+    if (idxNum & VSV_IDX_GT)
+        vsv_rowid_constraint(argv[iArg++], SQLITE_INDEX_CONSTRAINT_GT, &iFirst, &iLast);
+    if (idxNum & VSV_IDX_GE)
+        vsv_rowid_constraint(argv[iArg++], SQLITE_INDEX_CONSTRAINT_GE, &iFirst, &iLast);
+    if (idxNum & VSV_IDX_LT)
+        vsv_rowid_constraint(argv[iArg++], SQLITE_INDEX_CONSTRAINT_LT, &iFirst, &iLast);
+    if (idxNum & VSV_IDX_LE)
+        vsv_rowid_constraint(argv[iArg++], SQLITE_INDEX_CONSTRAINT_LE, &iFirst, &iLast);
+    if (idxNum & VSV_IDX_LIMIT)
+        nLimit = sqlite3_value_int64(argv[iArg++]);
+    if (idxNum & VSV_IDX_OFFSET)
+    {
+        /* OFFSET is only consumed if there are no other constraints */
+        sqlite3_int64 nOffset = sqlite3_value_int64(argv[iArg++]);
+        if (nOffset>0)
+        {
+            iFirst = (nOffset<LARGEST_INT64_VSV) ? nOffset+1 : LARGEST_INT64_VSV;
+        }
+    }
+    if (nLimit>=0 && nLimit<=LARGEST_INT64_VSV-iFirst)
+    {
+        iLast = iFirst + nLimit - 1;
+    }
+    assert( iArg==argc );
+
+    if (iFirst<1)
+    {
+        iFirst = 1;
+    }
+    pCur->iMaxRowid = iLast;
+    if (iFirst>iLast || (pTab->nRow>=0 && iFirst>pTab->nRow))
+    {
+        pCur->iRowid = -1;
+        return SQLITE_OK;
+    }
+
     if (pCur->rdr.in==0)
     {
         assert( pCur->rdr.zIn==pTab->zData );
         assert( pTab->iStart>=0 );
         assert( (size_t)pTab->iStart<=pCur->rdr.nIn );
-        pCur->rdr.iIn = pTab->iStart;
+    }
+    iMark = pTab->nMark - 1;
+    if ((iFirst-1)/VSV_ROWIDX_STEP<iMark)
+    {
+        iMark = (int)((iFirst-1)/VSV_ROWIDX_STEP);
+    }
+    if (iMark>=0)
+    {
+        iOff = pTab->aMark[iMark].iOff;
+        nLine = pTab->aMark[iMark].nLine;
+        pCur->iRowid = (sqlite3_int64)iMark*VSV_ROWIDX_STEP;
     }
     else
     {
-        fseek(pCur->rdr.in, pTab->iStart, SEEK_SET);
-        pCur->rdr.iIn = 0;
-        pCur->rdr.nIn = 0;
+        iOff = pTab->iStart;
+        nLine = 0;
+        pCur->iRowid = 0;
+    }
+    vsv_reader_seek(&pCur->rdr, iOff, nLine);
+    if (pCur->pBatch)
+    {
+        vsvBatchReset(pCur->pBatch, iOff, nLine);
+    }
+    do
+    {
+        rc = vsvtabNext(pVtabCursor);
     }
-    return vsvtabNext(pVtabCursor);
+    while (rc==SQLITE_OK && pCur->iRowid>0 && pCur->iRowid<iFirst);
+    return rc;
 }
 
 /*
-** Only a forward full table scan is supported.  xBestIndex is mostly
-** a no-op.  If VSVTEST_FIDX is set, then the presence of equality
-** constraints lowers the estimated cost, which is fiction, but is useful
-** for testing certain kinds of virtual table behavior.
+** Constraints on the rowid are passed to xFilter, which uses the sparse
+** rowid index to start the scan close to the first requested row.  OFFSET
+** (and LIMIT) are consumed as well if there are no other constraints and
+** no ORDER BY other than rowid ascending.
+** Rows are always returned in rowid order.  If VSVTEST_FIDX is set, then
+** the presence of equality constraints lowers the estimated cost, which is
+** fiction, but is useful for testing certain kinds of virtual table
+** behavior.
 */
 static int vsvtabBestIndex(
                           sqlite3_vtab *tab,
                           sqlite3_index_info *pIdxInfo
                           )
 {
+    VsvTable *pTab = (VsvTable*)tab;
+    int iEq = -1, iLower = -1, iUpper = -1, iLimit = -1, iOffset = -1;
+    int nOther = 0;
+    int idxNum = 0;
+    int nArg = 0;
+    int bInOrder = pIdxInfo->nOrderBy==0;
+    int i;
+
     pIdxInfo->estimatedCost = 1000000;
+    if (pTab->nRow>=0)
+    {
+        pIdxInfo->estimatedRows = pTab->nRow;
+    }
+    if (pIdxInfo->nOrderBy==1
+        && pIdxInfo->aOrderBy[0].iColumn<0
+        && pIdxInfo->aOrderBy[0].desc==0
+       )
+    {
+        pIdxInfo->orderByConsumed = 1;
+        bInOrder = 1;
+    }
 #ifdef SQLITE_TEST
-    if ((((VsvTable*)tab)->tstFlags & VSVTEST_FIDX)!=0)
+    if ((pTab->tstFlags & VSVTEST_FIDX)!=0)
     {
         /* The usual (and sensible) case is to always do a full table scan.
         ** The code in this branch only runs when testflags=1.  This code
@@ -1916,7 +2995,6 @@ static int vsvtabBestIndex(
         ** as omittable, however, so the query planner should still generate a
         ** plan that gives a correct answer, even if they plan is not optimal.
         */
-        int i;
         int nConst = 0;
         for (i=0; i<pIdxInfo->nConstraint; i++)
         {
@@ -1933,8 +3011,81 @@ static int vsvtabBestIndex(
                 nConst++;
             }
         }
+        return SQLITE_OK;
     }
 #endif
+    for (i=0; i<pIdxInfo->nConstraint; i++)
+    {
+        const struct sqlite3_index_constraint *pCons = &pIdxInfo->aConstraint[i];
+        if (pCons->op==SQLITE_INDEX_CONSTRAINT_LIMIT)
+        {
+            if (pCons->usable) iLimit = i;
+            continue;
+        }
+        if (pCons->op==SQLITE_INDEX_CONSTRAINT_OFFSET)
+        {
+            if (pCons->usable) iOffset = i;
+            continue;
+        }
+        nOther++;
+        if (pCons->usable==0 || pCons->iColumn>=0) continue;
+        switch (pCons->op)
+        {
+            case SQLITE_INDEX_CONSTRAINT_EQ:
+                if (iEq<0) iEq = i;
+                break;
+            case SQLITE_INDEX_CONSTRAINT_GT:
+            case SQLITE_INDEX_CONSTRAINT_GE:
+                if (iLower<0) iLower = i;
+                break;
+            case SQLITE_INDEX_CONSTRAINT_LT:
+            case SQLITE_INDEX_CONSTRAINT_LE:
+                if (iUpper<0) iUpper = i;
+                break;
+        }
+    }
+    if (iEq>=0)
+    {
+        idxNum = VSV_IDX_EQ;
+        pIdxInfo->aConstraintUsage[iEq].argvIndex = ++nArg;
+        pIdxInfo->estimatedCost = VSV_ROWIDX_STEP;
+        pIdxInfo->estimatedRows = 1;
+        pIdxInfo->idxFlags |= SQLITE_INDEX_SCAN_UNIQUE;
+    }
+    else if (iLower>=0 || iUpper>=0)
+    {
+        if (iLower>=0)
+        {
+            idxNum |= (pIdxInfo->aConstraint[iLower].op==SQLITE_INDEX_CONSTRAINT_GT) ? VSV_IDX_GT : VSV_IDX_GE;
+            pIdxInfo->aConstraintUsage[iLower].argvIndex = ++nArg;
+            pIdxInfo->estimatedCost /= 2;
+        }
+        if (iUpper>=0)
+        {
+            idxNum |= (pIdxInfo->aConstraint[iUpper].op==SQLITE_INDEX_CONSTRAINT_LT) ? VSV_IDX_LT : VSV_IDX_LE;
+            pIdxInfo->aConstraintUsage[iUpper].argvIndex = ++nArg;
+            pIdxInfo->estimatedCost /= 2;
+        }
+        if (pTab->nRow>=0)
+        {
+            pIdxInfo->estimatedRows = pTab->nRow/4 + 1;
+        }
+    }
+    else if (nOther==0 && iOffset>=0 && bInOrder)
+    {
+        /* LIMIT and OFFSET count rows in the order of the result, which is
+        ** the rowid order only if there is no ORDER BY or if it was consumed */
+        if (iLimit>=0)
+        {
+            idxNum |= VSV_IDX_LIMIT;
+            pIdxInfo->aConstraintUsage[iLimit].argvIndex = ++nArg;
+        }
+        idxNum |= VSV_IDX_OFFSET;
+        pIdxInfo->aConstraintUsage[iOffset].argvIndex = ++nArg;
+        pIdxInfo->aConstraintUsage[iOffset].omit = 1;
+        pIdxInfo->estimatedCost /= 2;
+    }
+    pIdxInfo->idxNum = idxNum;
     return SQLITE_OK;
 }
 
@@ -17,11 +17,23 @@
 **
 **     SELECT name, sz, datetime(mtime,'unixepoch') FROM zipfile($filename);
 **
+** A table created with CREATE VIRTUAL TABLE accepts the option threads=N
+** (1 to 64) after the file name:
+**
+**     CREATE VIRTUAL TABLE temp.zz USING zipfile('test.zip', threads=4);
+**
+** With N>1 the data of new entries is not compressed when it is inserted.
+** It is kept in memory instead, compressed on N threads once enough data
+** is pending (or the entries are read, or the transaction commits), and
+** then appended to the archive in the order of insertion.
+**
+** Archives with more than 65535 entries or larger than 4 GiB are read and
+** written using the zip64 extensions.
+**
 ** Current limitations:
 **
 **    *  No support for encryption
 **    *  No support for ZIP archives spanning multiple files
-**    *  No support for zip64 extensions
 **    *  Only the "inflate/deflate" (zlib) compression method is supported
 */
 #include "sqlite3ext.h"
@@ -29,6 +41,8 @@ SQLITE_EXTENSION_INIT1
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 #ifndef SQLITE_NO_STDINT
 #  include <stdint.h>
 #endif
@@ -43,6 +57,15 @@ SQLITE_EXTENSION_INIT1
 # define sqlite3_fopen fopen
 #endif
 
+/* Seek and tell with 64-bit offsets, for archives larger than 2 GiB */
+#if defined(_WIN32)
+# define zipfileFseek(f,o,w) _fseeki64(f,(__int64)(o),w)
+# define zipfileFtell(f) ((i64)_ftelli64(f))
+#else
+# define zipfileFseek(f,o,w) fseeko(f,(off_t)(o),w)
+# define zipfileFtell(f) ((i64)ftello(f))
+#endif
+
 #ifndef SQLITE_OMIT_VIRTUALTABLE
 
 #ifndef SQLITE_AMALGAMATION
@@ -66,6 +89,7 @@ typedef unsigned char u8;
 typedef UINT32_TYPE u32;           /* 4-byte unsigned integer */
 typedef UINT16_TYPE u16;           /* 2-byte unsigned integer */
 #define MIN(a,b) ((a)<(b) ? (a) : (b))
+#define MAX(a,b) ((a)>(b) ? (a) : (b))
 
 #if defined(SQLITE_COVERAGE_TEST) || defined(SQLITE_MUTATION_TEST)
 # define SQLITE_OMIT_AUXILIARY_SAFETY_CHECKS 1
@@ -115,6 +139,7 @@ static const char ZIPFILE_SCHEMA[] =
   ") WITHOUT ROWID;";
 
 #define ZIPFILE_F_COLUMN_IDX 7    /* Index of column "file" in the above */
+#define ZIPFILE_N_COLUMN_IDX 0    /* Index of column "name" in the above */
 #define ZIPFILE_MX_NAME (250)     /* Windows limitation on filename size */
 
 /*
@@ -123,6 +148,24 @@ static const char ZIPFILE_SCHEMA[] =
 */
 #define ZIPFILE_BUFFER_SIZE (200*1024)
 
+/*
+** Worker threads are available if compiled as part of the SQLite
+** amalgamation with worker thread support.
+*/
+#if defined(SQLITEINT_H) && SQLITE_MAX_WORKER_THREADS>0 && SQLITE_THREADSAFE>0
+# define ZIPFILE_USE_THREADS 1
+#else
+# define ZIPFILE_USE_THREADS 0
+#endif
+
+/*
+** Maximum value of the threads=N option, and the number of bytes of
+** uncompressed data per thread that may be pending before it is compressed
+** and written to the archive.
+*/
+#define ZIPFILE_THREADS_MAX 64
+#define ZIPFILE_PENDING_SIZE (16*1024*1024)
+
 
 /*
 ** Magic numbers used to read and write zip files.
@@ -149,6 +192,19 @@ static const char ZIPFILE_SCHEMA[] =
 **
 ** ZIPFILE_SIGNATURE_EOCD
 **   First 4 bytes of a valid EOCD record.
+**
+** ZIPFILE_SIGNATURE_EOCD64, ZIPFILE_SIGNATURE_LOC64
+**   First 4 bytes of a valid zip64 EOCD record and zip64 EOCD locator.
+**
+** ZIPFILE_EXTRA_ZIP64
+**   Header ID of the zip64 extended information extra field.
+**
+** ZIPFILE_ZIP64_MADEBY, ZIPFILE_ZIP64_REQUIRED:
+**   Version values for records using the zip64 extensions (4.5).
+**
+** ZIPFILE_MAX_U16, ZIPFILE_MAX_U32:
+**   Values of 16 and 32-bit fields that indicate the actual value is
+**   stored in a zip64 record or extra field.
 */
 #define ZIPFILE_EXTRA_TIMESTAMP   0x5455
 #define ZIPFILE_NEWENTRY_MADEBY   ((3<<8) + 30)
@@ -157,6 +213,13 @@ static const char ZIPFILE_SCHEMA[] =
 #define ZIPFILE_SIGNATURE_CDS     0x02014b50
 #define ZIPFILE_SIGNATURE_LFH     0x04034b50
 #define ZIPFILE_SIGNATURE_EOCD    0x06054b50
+#define ZIPFILE_SIGNATURE_EOCD64  0x06064b50
+#define ZIPFILE_SIGNATURE_LOC64   0x07064b50
+#define ZIPFILE_EXTRA_ZIP64       0x0001
+#define ZIPFILE_ZIP64_MADEBY      ((3<<8) + 45)
+#define ZIPFILE_ZIP64_REQUIRED    45
+#define ZIPFILE_MAX_U16           0xFFFF
+#define ZIPFILE_MAX_U32           ((i64)0xFFFFFFFF)
 
 /*
 ** The sizes of the fixed-size part of each of the three main data
@@ -165,6 +228,8 @@ static const char ZIPFILE_SCHEMA[] =
 #define ZIPFILE_LFH_FIXED_SZ      30
 #define ZIPFILE_EOCD_FIXED_SZ     22
 #define ZIPFILE_CDS_FIXED_SZ      46
+#define ZIPFILE_EOCD64_FIXED_SZ   56
+#define ZIPFILE_LOC64_FIXED_SZ    20
 
 /*
 *** 4.3.16  End of central directory record:
@@ -183,15 +248,21 @@ static const char ZIPFILE_SCHEMA[] =
 ***   the starting disk number        4 bytes
 ***   .ZIP file comment length        2 bytes
 ***   .ZIP file comment       (variable size)
+***
+*** If any of the entry counts, the size or the offset do not fit, they are
+*** set to all ones and the actual values are stored in a zip64 EOCD record
+*** (4.3.14), which is found using the zip64 EOCD locator (4.3.15) that
+*** immediately precedes the EOCD record. The fields below hold the actual
+*** values.
 */
 typedef struct ZipfileEOCD ZipfileEOCD;
 struct ZipfileEOCD {
   u16 iDisk;
   u16 iFirstDisk;
-  u16 nEntry;
-  u16 nEntryTotal;
-  u32 nSize;
-  u32 iOffset;
+  i64 nEntry;
+  i64 nEntryTotal;
+  i64 nSize;
+  i64 iOffset;
 };
 
 /*
@@ -216,6 +287,10 @@ struct ZipfileEOCD {
 ***   internal file attributes        2 bytes
 ***   external file attributes        4 bytes
 ***   relative offset of local header 4 bytes
+***
+*** The sizes and the offset are stored in a zip64 extra field (4.5.3)
+*** instead if they do not fit into 32 bits. The szCompressed,
+*** szUncompressed and iOffset fields below hold the actual values.
 */
 typedef struct ZipfileCDS ZipfileCDS;
 struct ZipfileCDS {
@@ -226,15 +301,15 @@ struct ZipfileCDS {
   u16 mTime;
   u16 mDate;
   u32 crc32;
-  u32 szCompressed;
-  u32 szUncompressed;
+  i64 szCompressed;
+  i64 szUncompressed;
   u16 nFile;
   u16 nExtra;
   u16 nComment;
   u16 iDiskStart;
   u16 iInternalAttr;
   u32 iExternalAttr;
-  u32 iOffset;
+  i64 iOffset;
   char *zFile;                    /* Filename (sqlite3_malloc()) */
 };
 
@@ -276,6 +351,26 @@ struct ZipfileEntry {
   i64 iDataOff;              /* Offset to data in file (if aData==0) */
   u8 *aData;                 /* cds.szCompressed bytes of compressed data */
   ZipfileEntry *pNext;       /* Next element in in-memory CDS */
+  ZipfileEntry *pPrev;       /* Previous element in in-memory CDS */
+  ZipfileEntry *pHashNext;   /* Next element in same ZipfileTab.aHash slot */
+  int iPending;              /* 1 + index in ZipfileTab.aPending[], or 0 */
+};
+
+/*
+** Data of a new entry that has not been compressed and written to the
+** archive yet. Only used if the table was created with threads=N, N>1.
+*/
+typedef struct ZipfilePending ZipfilePending;
+struct ZipfilePending {
+  ZipfileEntry *pEntry;      /* Entry for the data, NULL if it was removed */
+  u8 *aIn;                   /* Copy of the uncompressed data */
+  int nIn;                   /* Size of aIn[] in bytes */
+  int bAuto;                 /* Store uncompressed if deflate does not help */
+  u32 iCrc32;                /* crc32 of aIn[] */
+  u8 *aOut;                  /* Compressed data */
+  int nOut;                  /* Size of aOut[] in bytes */
+  int rc;                    /* Result of compressing aIn[] */
+  char *zErr;                /* Error message from zipfileDeflate(), if any */
 };
 
 /*
@@ -295,9 +390,35 @@ struct ZipfileCsr {
 
   ZipfileEntry *pFreeEntry;  /* Free this list when cursor is closed or reset */
   ZipfileEntry *pCurrent;    /* Current entry */
+  char *zName;               /* Only visit entries with this name (or NULL) */
+  int nName;                 /* strlen(zName) */
+  i64 *aCand;                /* CDS offsets of candidates for zName, or NULL */
+  int nCand;                 /* Number of entries in aCand[] */
+  int iCand;                 /* Next entry of aCand[] to visit */
   ZipfileCsr *pCsrNext;      /* Next cursor on same virtual table */
 };
 
+/*
+** Hash index over the paths in the central directory of an archive file.
+** It is used to look up entries by name outside of write transactions,
+** and kept for the most recently indexed file only. The index is rebuilt
+** if the size or the modification time of that file change.
+*/
+typedef struct ZipfileNameIdx ZipfileNameIdx;
+struct ZipfileNameIdx {
+  char *zFile;               /* Archive file this index was built for */
+  i64 szFile;                /* Size of zFile when the index was built */
+  i64 mTime;                 /* Modification time of zFile at that time */
+  ZipfileEOCD eocd;          /* Parse of central directory record */
+  u8 aEocd[ZIPFILE_EOCD_FIXED_SZ];  /* Raw EOCD record that follows the CDS */
+  int nEntry;                /* Number of entries in aOff[] */
+  int nSlot;                 /* Number of slots in aSlot[] (a power of 2) */
+  int *aSlot;                /* First entry of each slot, or -1 */
+  int *aChain;               /* Next entry in the same slot, or -1 */
+  u32 *aHashVal;             /* zipfileHashPath() value of each entry */
+  i64 *aOff;                 /* Offset of the CDS record of each entry */
+};
+
 typedef struct ZipfileTab ZipfileTab;
 struct ZipfileTab {
   sqlite3_vtab base;         /* Base class - must be first */
@@ -307,15 +428,26 @@ struct ZipfileTab {
 
   ZipfileCsr *pCsrList;      /* List of cursors */
   i64 iNextCsrid;
+  ZipfileNameIdx *pNameIdx;  /* Name index used outside write transactions */
+  int nThread;               /* Value of the threads=N option */
 
   /* The following are used by write transactions only */
   ZipfileEntry *pFirstEntry; /* Linked list of all files (if pWriteFd!=0) */
   ZipfileEntry *pLastEntry;  /* Last element in pFirstEntry list */
+  int nEntry;                /* Number of elements in pFirstEntry list */
+  ZipfileEntry **aHash;      /* Hash table of pFirstEntry list by name */
+  int nHash;                 /* Number of slots in aHash[] */
   FILE *pWriteFd;            /* File handle open on zip archive */
   i64 szCurrent;             /* Current size of zip archive */
   i64 szOrig;                /* Size of archive at start of transaction */
+  ZipfilePending *aPending;  /* Data of new entries not written yet */
+  int nPending;              /* Number of elements in aPending[] */
+  int nPendingAlloc;         /* Allocated size of aPending[] */
+  i64 szPending;             /* Sum of aPending[].nIn */
 };
 
+static int zipfileFlushPending(ZipfileTab *pTab);
+
 /*
 ** Set the error message contained in context ctx to the results of
 ** vprintf(zFmt, ...).
@@ -368,6 +500,7 @@ static int zipfileConnect(
   int nFile = 0;
   const char *zFile = 0;
   ZipfileTab *pNew = 0;
+  int nThread = 1;
   int rc;
   (void)pAux;
 
@@ -381,11 +514,34 @@ static int zipfileConnect(
   **   CREATE VIRTUAL TABLE zipfile USING zipfile();
   */
   assert( 0==sqlite3_stricmp(argv[0], "zipfile") );
-  if( (0!=sqlite3_stricmp(argv[2], "zipfile") && argc<4) || argc>4 ){
+  if( (0!=sqlite3_stricmp(argv[2], "zipfile") && argc<4) || argc>5 ){
     *pzErr = sqlite3_mprintf("zipfile constructor requires one argument");
     return SQLITE_ERROR;
   }
 
+  /* The optional second argument must be threads=N */
+  if( argc>4 ){
+    const char *z = argv[4];
+    nThread = 0;
+    if( sqlite3_strnicmp(z, "threads", 7)==0 ){
+      for(z+=7; *z==' '; z++);
+      if( *z=='=' ){
+        for(z++; *z==' '; z++);
+        while( *z>='0' && *z<='9' && nThread<=ZIPFILE_THREADS_MAX ){
+          nThread = nThread*10 + (*z++ - '0');
+        }
+        if( *z!=0 ) nThread = 0;
+      }
+    }
+    if( nThread<1 || nThread>ZIPFILE_THREADS_MAX ){
+      *pzErr = sqlite3_mprintf(
+          "zipfile: expected threads=N with N between 1 and %d",
+          ZIPFILE_THREADS_MAX
+      );
+      return SQLITE_ERROR;
+    }
+  }
+
   if( argc>3 ){
     zFile = argv[3];
     nFile = (int)strlen(zFile)+1;
@@ -397,6 +553,7 @@ static int zipfileConnect(
     if( pNew==0 ) return SQLITE_NOMEM;
     memset(pNew, 0, nByte+nFile);
     pNew->db = db;
+    pNew->nThread = nThread;
     pNew->aBuffer = (u8*)&pNew[1];
     if( zFile ){
       pNew->zFile = (char*)&pNew->aBuffer[ZIPFILE_BUFFER_SIZE];
@@ -426,6 +583,7 @@ static void zipfileEntryFree(ZipfileEntry *p){
 static void zipfileCleanupTransaction(ZipfileTab *pTab){
   ZipfileEntry *pEntry;
   ZipfileEntry *pNext;
+  int i;
 
   if( pTab->pWriteFd ){
     fclose(pTab->pWriteFd);
@@ -437,8 +595,24 @@ static void zipfileCleanupTransaction(ZipfileTab *pTab){
   }
   pTab->pFirstEntry = 0;
   pTab->pLastEntry = 0;
+  pTab->nEntry = 0;
+  sqlite3_free(pTab->aHash);
+  pTab->aHash = 0;
+  pTab->nHash = 0;
   pTab->szCurrent = 0;
   pTab->szOrig = 0;
+  for(i=0; i<pTab->nPending; i++){
+    sqlite3_free(pTab->aPending[i].aIn);
+    sqlite3_free(pTab->aPending[i].aOut);
+    sqlite3_free(pTab->aPending[i].zErr);
+  }
+  sqlite3_free(pTab->aPending);
+  pTab->aPending = 0;
+  pTab->nPending = 0;
+  pTab->nPendingAlloc = 0;
+  pTab->szPending = 0;
+  sqlite3_free(pTab->pNameIdx);
+  pTab->pNameIdx = 0;
 }
 
 /*
@@ -489,6 +663,13 @@ static void zipfileResetCursor(ZipfileCsr *pCsr){
     zipfileEntryFree(p);
   }
   pCsr->pFreeEntry = 0;
+  sqlite3_free(pCsr->zName);
+  pCsr->zName = 0;
+  pCsr->nName = 0;
+  sqlite3_free(pCsr->aCand);
+  pCsr->aCand = 0;
+  pCsr->nCand = 0;
+  pCsr->iCand = 0;
 }
 
 /*
@@ -545,8 +726,8 @@ static int zipfileReadData(
   char **pzErrmsg                 /* OUT: Error message (from sqlite3_malloc) */
 ){
   size_t n;
-  fseek(pFile, (long)iOff, SEEK_SET);
-  n = fread(aRead, 1, (long)nRead, pFile);
+  zipfileFseek(pFile, iOff, SEEK_SET);
+  n = fread(aRead, 1, (size_t)nRead, pFile);
   if( n!=(size_t)nRead ){
     sqlite3_free(*pzErrmsg);
     *pzErrmsg = sqlite3_mprintf("error in fread()");
@@ -562,7 +743,7 @@ static int zipfileAppendData(
 ){
   if( nWrite>0 ){
     size_t n = nWrite;
-    fseek(pTab->pWriteFd, (long)pTab->szCurrent, SEEK_SET);
+    zipfileFseek(pTab->pWriteFd, pTab->szCurrent, SEEK_SET);
     n = fwrite(aWrite, 1, nWrite, pTab->pWriteFd);
     if( (int)n!=nWrite ){
       zipfileTableErr(pTab,"error in fwrite()");
@@ -591,6 +772,14 @@ static u32 zipfileGetU32(const u8 *aBuf){
        + ((u32)(aBuf[0]) <<  0);
 }
 
+/*
+** Read and return a 64-bit little-endian integer from buffer aBuf.
+*/
+static i64 zipfileGetU64(const u8 *aBuf){
+  sqlite3_uint64 v = zipfileGetU32(&aBuf[4]);
+  return (i64)((v << 32) + zipfileGetU32(aBuf));
+}
+
 /*
 ** Write a 16-bit little endiate integer into buffer aBuf.
 */
@@ -609,9 +798,19 @@ static void zipfilePutU32(u8 *aBuf, u32 val){
   aBuf[3] = (val>>24) & 0xFF;
 }
 
+/*
+** Write a 64-bit little endian integer into buffer aBuf.
+*/
+static void zipfilePutU64(u8 *aBuf, i64 val){
+  zipfilePutU32(aBuf, (u32)(val & 0xFFFFFFFF));
+  zipfilePutU32(&aBuf[4], (u32)(((sqlite3_uint64)val)>>32));
+}
+
+#define zipfileRead64(aBuf) ( aBuf+=8, zipfileGetU64(aBuf-8) )
 #define zipfileRead32(aBuf) ( aBuf+=4, zipfileGetU32(aBuf-4) )
 #define zipfileRead16(aBuf) ( aBuf+=2, zipfileGetU16(aBuf-2) )
 
+#define zipfileWrite64(aBuf,val) { zipfilePutU64(aBuf,val); aBuf+=8; }
 #define zipfileWrite32(aBuf,val) { zipfilePutU32(aBuf,val); aBuf+=4; }
 #define zipfileWrite16(aBuf,val) { zipfilePutU16(aBuf,val); aBuf+=2; }
 
@@ -731,6 +930,41 @@ static int zipfileScanExtra(u8 *aExtra, int nExtra, u32 *pmTime){
   return ret;
 }
 
+/*
+** Buffer aExtra (size nExtra bytes) contains the extra fields of the CDS
+** record decoded into (*pCDS). If it contains a zip64 extended information
+** field, replace those of the szUncompressed, szCompressed and iOffset
+** fields of (*pCDS) that are set to ZIPFILE_MAX_U32 with the 64-bit values
+** from it. The values in the zip64 field are stored in this order, and
+** only if the corresponding CDS field is ZIPFILE_MAX_U32.
+*/
+static void zipfileScanZip64(const u8 *aExtra, int nExtra, ZipfileCDS *pCDS){
+  const u8 *p = aExtra;
+  const u8 *pEnd = &aExtra[nExtra];
+
+  while( p+2*sizeof(u16)<=pEnd ){
+    u16 id = zipfileRead16(p);
+    u16 nByte = zipfileRead16(p);
+    const u8 *pField = p;
+    const u8 *pFieldEnd = &p[nByte];
+
+    if( pFieldEnd>pEnd ) break;
+    if( id==ZIPFILE_EXTRA_ZIP64 ){
+      if( pCDS->szUncompressed==ZIPFILE_MAX_U32 && pField+8<=pFieldEnd ){
+        pCDS->szUncompressed = zipfileRead64(pField);
+      }
+      if( pCDS->szCompressed==ZIPFILE_MAX_U32 && pField+8<=pFieldEnd ){
+        pCDS->szCompressed = zipfileRead64(pField);
+      }
+      if( pCDS->iOffset==ZIPFILE_MAX_U32 && pField+8<=pFieldEnd ){
+        pCDS->iOffset = zipfileRead64(pField);
+      }
+      break;
+    }
+    p = pFieldEnd;
+  }
+}
+
 /*
 ** Convert the standard MS-DOS timestamp stored in the mTime and mDate
 ** fields of the CDS structure passed as the only argument to a 32-bit
@@ -812,6 +1046,143 @@ static void zipfileMtimeToDos(ZipfileCDS *pCds, u32 mUnixTime){
   );
 }
 
+/*
+** Both (const char*) arguments point to nul-terminated strings. Argument
+** nB is the value of strlen(zB). This function returns 0 if the strings are
+** identical, ignoring any trailing '/' character in either path.  */
+static int zipfileComparePath(const char *zA, const char *zB, int nB){
+  int nA = (int)strlen(zA);
+  if( nA>0 && zA[nA-1]=='/' ) nA--;
+  if( nB>0 && zB[nB-1]=='/' ) nB--;
+  if( nA==nB && memcmp(zA, zB, nA)==0 ) return 0;
+  return 1;
+}
+
+/*
+** Return the hash of the nul-terminated path zPath of nPath bytes.  A
+** trailing '/' is ignored, so that paths equal according to
+** zipfileComparePath() have the same hash.
+*/
+static unsigned int zipfileHashPath(const char *zPath, int nPath){
+  unsigned int h = 2166136261u;
+  int i;
+  if( nPath>0 && zPath[nPath-1]=='/' ) nPath--;
+  for(i=0; i<nPath; i++){
+    h = (h ^ (u8)zPath[i]) * 16777619u;
+  }
+  return h;
+}
+
+/*
+** Add entry pEntry to the ZipfileTab.aHash[] hash table.
+*/
+static void zipfileHashInsert(ZipfileTab *pTab, ZipfileEntry *pEntry){
+  const char *zFile = pEntry->cds.zFile;
+  unsigned int h = zipfileHashPath(zFile, (int)strlen(zFile));
+  ZipfileEntry **pp = &pTab->aHash[h & (pTab->nHash-1)];
+  pEntry->pHashNext = *pp;
+  *pp = pEntry;
+}
+
+/*
+** Rebuild the ZipfileTab.aHash[] hash table with nHash slots from the
+** pFirstEntry list. If this fails with an OOM error, the existing hash
+** table (if any) is left as it is.
+*/
+static void zipfileHashResize(ZipfileTab *pTab, int nHash){
+  ZipfileEntry **aHash;
+  ZipfileEntry *p;
+  aHash = (ZipfileEntry**)sqlite3_malloc64(sizeof(ZipfileEntry*)*nHash);
+  if( aHash==0 ) return;
+  memset(aHash, 0, sizeof(ZipfileEntry*)*nHash);
+  sqlite3_free(pTab->aHash);
+  pTab->aHash = aHash;
+  pTab->nHash = nHash;
+  for(p=pTab->pFirstEntry; p; p=p->pNext){
+    zipfileHashInsert(pTab, p);
+  }
+}
+
+/*
+** Remove entry pEntry from the ZipfileTab.aHash[] hash table.
+*/
+static void zipfileHashRemove(ZipfileTab *pTab, ZipfileEntry *pEntry){
+  if( pTab->aHash ){
+    const char *zFile = pEntry->cds.zFile;
+    unsigned int h = zipfileHashPath(zFile, (int)strlen(zFile));
+    ZipfileEntry **pp = &pTab->aHash[h & (pTab->nHash-1)];
+    while( *pp && *pp!=pEntry ) pp = &(*pp)->pHashNext;
+    if( *pp ) *pp = pEntry->pHashNext;
+    pEntry->pHashNext = 0;
+  }
+}
+
+/*
+** Return the first entry of the pTab->pFirstEntry list after pAfter (or
+** the first entry overall, if pAfter is NULL) with a path equal to zPath
+** according to zipfileComparePath(), or NULL if there is no such entry.
+** If pAfter is not NULL, it must have a path equal to zPath as well.
+** Unless an OOM error prevented building it, the hash table is used, in
+** which case the entries are not visited in list order.
+*/
+static ZipfileEntry *zipfileFindEntry(
+  ZipfileTab *pTab,
+  ZipfileEntry *pAfter,
+  const char *zPath,
+  int nPath
+){
+  ZipfileEntry *p;
+  if( pTab->aHash ){
+    if( pAfter ){
+      p = pAfter->pHashNext;
+    }else{
+      p = pTab->aHash[zipfileHashPath(zPath, nPath) & (pTab->nHash-1)];
+    }
+    while( p && zipfileComparePath(p->cds.zFile, zPath, nPath) ){
+      p = p->pHashNext;
+    }
+  }else{
+    p = pAfter ? pAfter->pNext : pTab->pFirstEntry;
+    while( p && zipfileComparePath(p->cds.zFile, zPath, nPath) ){
+      p = p->pNext;
+    }
+  }
+  return p;
+}
+
+/*
+** Read the CDS record at offset iOff of file pFile and check whether or not
+** the path it contains is equal to zName according to zipfileComparePath().
+** Set *pbMatch accordingly and *piNext to the offset of the next CDS
+** record. This reads only the CDS record itself, not the LFH.
+*/
+static int zipfileMatchCDS(
+  ZipfileTab *pTab,               /* Store any error message here */
+  FILE *pFile,                    /* Read from this file */
+  i64 iOff,                       /* Offset of CDS record */
+  const char *zName,              /* Path to compare */
+  int nName,                      /* strlen(zName) */
+  int *pbMatch,                   /* OUT: True if the paths are equal */
+  i64 *piNext                     /* OUT: Offset of next CDS record */
+){
+  u8 *aRead = pTab->aBuffer;
+  char **pzErr = &pTab->base.zErrMsg;
+  int rc;
+  rc = zipfileReadData(pFile, aRead, ZIPFILE_CDS_FIXED_SZ, iOff, pzErr);
+  if( rc==SQLITE_OK ){
+    int nFile = zipfileGetU16(&aRead[ZIPFILE_CDS_NFILE_OFF]);
+    int nExtra = zipfileGetU16(&aRead[ZIPFILE_CDS_NFILE_OFF+2]);
+    nExtra += zipfileGetU16(&aRead[ZIPFILE_CDS_NFILE_OFF+4]);
+    *piNext = iOff + ZIPFILE_CDS_FIXED_SZ + nFile + nExtra;
+    rc = zipfileReadData(pFile, aRead, nFile, iOff+ZIPFILE_CDS_FIXED_SZ, pzErr);
+    if( rc==SQLITE_OK ){
+      aRead[nFile] = 0;
+      *pbMatch = zipfileComparePath((const char*)aRead, zName, nName)==0;
+    }
+  }
+  return rc;
+}
+
 /*
 ** Set (*pzErr) to point to a buffer from sqlite3_malloc() containing a
 ** generic corruption message and return SQLITE_CORRUPT;
@@ -866,7 +1237,24 @@ static int zipfileGetEntry(
 
     nAlloc = sizeof(ZipfileEntry) + nExtra;
     if( aBlob ){
-      nAlloc += zipfileGetU32(&aRead[ZIPFILE_CDS_SZCOMPRESSED_OFF]);
+      i64 szCompressed = zipfileGetU32(&aRead[ZIPFILE_CDS_SZCOMPRESSED_OFF]);
+      if( szCompressed==ZIPFILE_MAX_U32 ){
+        /* The actual size is in the zip64 extra field */
+        ZipfileCDS cds;
+        i64 iExtra = iOff + ZIPFILE_CDS_FIXED_SZ + nFile;
+        int nExtraOnly = zipfileGetU16(&aRead[ZIPFILE_CDS_NFILE_OFF+2]);
+        memset(&cds, 0, sizeof(cds));
+        if( zipfileReadCDS(aRead, &cds)==SQLITE_OK
+         && iExtra+nExtraOnly<=nBlob
+        ){
+          zipfileScanZip64(&aBlob[iExtra], nExtraOnly, &cds);
+        }
+        szCompressed = cds.szCompressed;
+      }
+      if( szCompressed>nBlob ){
+        return zipfileCorrupt(pzErr);
+      }
+      nAlloc += szCompressed;
     }
 
     pNew = (ZipfileEntry*)sqlite3_malloc64(nAlloc);
@@ -905,6 +1293,7 @@ static int zipfileGetEntry(
       }else if( 0==zipfileScanExtra(&aRead[nFile], pNew->cds.nExtra, pt) ){
         pNew->mUnixTime = zipfileMtime(&pNew->cds);
       }
+      zipfileScanZip64(&aRead[nFile], pNew->cds.nExtra, &pNew->cds);
     }
 
     if( rc==SQLITE_OK ){
@@ -933,8 +1322,8 @@ static int zipfileGetEntry(
           }
         }
       }else{
-        zipfileTableErr(pTab, "failed to read LFH at offset %d",
-            (int)pNew->cds.iOffset
+        zipfileTableErr(pTab, "failed to read LFH at offset %lld",
+            pNew->cds.iOffset
         );
       }
     }
@@ -960,6 +1349,32 @@ static int zipfileNext(sqlite3_vtab_cursor *cur){
     i64 iEof = (i64)pCsr->eocd.iOffset + (i64)pCsr->eocd.nSize;
     zipfileEntryFree(pCsr->pCurrent);
     pCsr->pCurrent = 0;
+    if( pCsr->aCand ){
+      /* Visit the candidates found in the name index */
+      ZipfileTab *pTab = (ZipfileTab*)(cur->pVtab);
+      int bMatch = 0;
+      while( rc==SQLITE_OK && !bMatch && pCsr->iCand<pCsr->nCand ){
+        i64 iNext = 0;
+        pCsr->iNextOff = pCsr->aCand[pCsr->iCand++];
+        rc = zipfileMatchCDS(pTab, pCsr->pFile, pCsr->iNextOff,
+            pCsr->zName, pCsr->nName, &bMatch, &iNext
+        );
+      }
+      if( rc!=SQLITE_OK ) return rc;
+      if( !bMatch ) pCsr->iNextOff = iEof;
+    }else if( pCsr->zName ){
+      /* Skip the CDS records with other paths */
+      ZipfileTab *pTab = (ZipfileTab*)(cur->pVtab);
+      int bMatch = 0;
+      while( rc==SQLITE_OK && !bMatch && pCsr->iNextOff<iEof ){
+        i64 iNext = 0;
+        rc = zipfileMatchCDS(pTab, pCsr->pFile, pCsr->iNextOff,
+            pCsr->zName, pCsr->nName, &bMatch, &iNext
+        );
+        if( rc==SQLITE_OK && !bMatch ) pCsr->iNextOff = iNext;
+      }
+      if( rc!=SQLITE_OK ) return rc;
+    }
     if( pCsr->iNextOff>=iEof ){
       pCsr->bEof = 1;
     }else{
@@ -972,10 +1387,29 @@ static int zipfileNext(sqlite3_vtab_cursor *cur){
       }
       pCsr->pCurrent = p;
     }
+  }else if( pCsr->zName && pCsr->pFreeEntry==0 ){
+    /* Visit the entries of a write transaction with the name given */
+    if( !pCsr->bNoop ){
+      ZipfileTab *pTab = (ZipfileTab*)(cur->pVtab);
+      pCsr->pCurrent = zipfileFindEntry(
+          pTab, pCsr->pCurrent, pCsr->zName, pCsr->nName
+      );
+    }
+    if( pCsr->pCurrent==0 ){
+      pCsr->bEof = 1;
+    }
   }else{
     if( !pCsr->bNoop ){
       pCsr->pCurrent = pCsr->pCurrent->pNext;
     }
+    if( pCsr->zName ){
+      while( pCsr->pCurrent
+          && zipfileComparePath(pCsr->pCurrent->cds.zFile,
+                                pCsr->zName, pCsr->nName)
+      ){
+        pCsr->pCurrent = pCsr->pCurrent->pNext;
+      }
+    }
     if( pCsr->pCurrent==0 ){
       pCsr->bEof = 1;
     }
@@ -1095,6 +1529,10 @@ static int zipfileColumn(
   ZipfileCsr *pCsr = (ZipfileCsr*)cur;
   ZipfileCDS *pCDS = &pCsr->pCurrent->cds;
   int rc = SQLITE_OK;
+  if( pCsr->pCurrent->iPending ){
+    rc = zipfileFlushPending((ZipfileTab*)(pCsr->base.pVtab));
+    if( rc!=SQLITE_OK ) return rc;
+  }
   switch( i ){
     case 0:   /* name */
       sqlite3_result_text(ctx, pCDS->zFile, -1, SQLITE_TRANSIENT);
@@ -1118,9 +1556,12 @@ static int zipfileColumn(
       if( sqlite3_vtab_nochange(ctx) ) break;
     case 5: { /* data */
       if( i==4 || pCDS->iCompression==0 || pCDS->iCompression==8 ){
-        int sz = pCDS->szCompressed;
-        int szFinal = pCDS->szUncompressed;
-        if( szFinal>0 ){
+        int sz = (int)pCDS->szCompressed;
+        int szFinal = (int)pCDS->szUncompressed;
+        if( pCDS->szCompressed>0x7FFFFFFF || pCDS->szUncompressed>0x7FFFFFFF ){
+          /* Too large for an SQLite blob */
+          sqlite3_result_error_toobig(ctx);
+        }else if( szFinal>0 ){
           u8 *aBuf;
           u8 *aFree = 0;
           if( pCsr->pCurrent->aData ){
@@ -1201,14 +1642,14 @@ static int zipfileReadEOCD(
 ){
   u8 *aRead = pTab->aBuffer;      /* Temporary buffer */
   i64 nRead;                      /* Bytes to read from file */
+  i64 szFile = nBlob;             /* Total size of file in bytes */
   int rc = SQLITE_OK;
 
   memset(pEOCD, 0, sizeof(ZipfileEOCD));
   if( aBlob==0 ){
     i64 iOff;                     /* Offset to read from */
-    i64 szFile;                   /* Total size of file in bytes */
-    fseek(pFile, 0, SEEK_END);
-    szFile = (i64)ftell(pFile);
+    zipfileFseek(pFile, 0, SEEK_END);
+    szFile = zipfileFtell(pFile);
     if( szFile==0 ){
       return SQLITE_OK;
     }
@@ -1221,6 +1662,7 @@ static int zipfileReadEOCD(
   }
 
   if( rc==SQLITE_OK ){
+    const u8 *aTail = aRead;
     i64 i;
 
     /* Scan backwards looking for the signature bytes */
@@ -1243,16 +1685,203 @@ static int zipfileReadEOCD(
     pEOCD->nEntryTotal = zipfileRead16(aRead);
     pEOCD->nSize = zipfileRead32(aRead);
     pEOCD->iOffset = zipfileRead32(aRead);
+
+    /* If any of the values do not fit, and there is a zip64 EOCD locator
+    ** immediately before the EOCD record, read the zip64 EOCD record. */
+    if( (pEOCD->nEntry==ZIPFILE_MAX_U16 || pEOCD->nSize==ZIPFILE_MAX_U32
+      || pEOCD->iOffset==ZIPFILE_MAX_U32)
+     && i>=ZIPFILE_LOC64_FIXED_SZ
+     && ZIPFILE_SIGNATURE_LOC64==zipfileGetU32(&aTail[i-ZIPFILE_LOC64_FIXED_SZ])
+    ){
+      const u8 *aLoc = &aTail[i-ZIPFILE_LOC64_FIXED_SZ];
+      u8 aEocd64[ZIPFILE_EOCD64_FIXED_SZ];
+      i64 iEocd64 = zipfileGetU64(&aLoc[8]);
+      if( iEocd64<0 || iEocd64+ZIPFILE_EOCD64_FIXED_SZ>szFile ){
+        return zipfileCorrupt(&pTab->base.zErrMsg);
+      }
+      if( aBlob ){
+        memcpy(aEocd64, &aBlob[iEocd64], ZIPFILE_EOCD64_FIXED_SZ);
+      }else{
+        rc = zipfileReadData(pFile, aEocd64, ZIPFILE_EOCD64_FIXED_SZ,
+            iEocd64, &pTab->base.zErrMsg
+        );
+      }
+      if( rc==SQLITE_OK ){
+        if( zipfileGetU32(aEocd64)!=ZIPFILE_SIGNATURE_EOCD64 ){
+          return zipfileCorrupt(&pTab->base.zErrMsg);
+        }
+        pEOCD->nEntry = zipfileGetU64(&aEocd64[24]);
+        pEOCD->nEntryTotal = zipfileGetU64(&aEocd64[32]);
+        pEOCD->nSize = zipfileGetU64(&aEocd64[40]);
+        pEOCD->iOffset = zipfileGetU64(&aEocd64[48]);
+      }
+    }
   }
 
   return rc;
 }
 
+/*
+** Read the ZIPFILE_EOCD_FIXED_SZ bytes that immediately follow the central
+** directory described by pEOCD into aEocd[]. Return true if successful and
+** those bytes start with an EOCD or zip64 EOCD signature, or false
+** otherwise.
+*/
+static int zipfileNameIdxEocd(FILE *pFile, const ZipfileEOCD *pEOCD, u8 *aEocd){
+  zipfileFseek(pFile, pEOCD->iOffset + pEOCD->nSize, SEEK_SET);
+  return fread(aEocd, 1, ZIPFILE_EOCD_FIXED_SZ, pFile)==ZIPFILE_EOCD_FIXED_SZ
+      && (zipfileGetU32(aEocd)==ZIPFILE_SIGNATURE_EOCD
+       || zipfileGetU32(aEocd)==ZIPFILE_SIGNATURE_EOCD64);
+}
+
+/*
+** Make sure pTab->pNameIdx is a name index for archive file zFile, which
+** is open as pFile. If the current index was built for another file, or
+** the file has been modified since, build a new one from a single read of
+** the central directory.
+**
+** If the file cannot be stat()ed or its central directory does not look
+** sane, pTab->pNameIdx is left NULL and SQLITE_OK returned. The caller
+** then falls back to scanning the archive, which reports any corruption.
+** An SQLite error code is returned if an OOM or IO error occurs.
+*/
+static int zipfileNameIdxLoad(ZipfileTab *pTab, const char *zFile, FILE *pFile){
+  ZipfileNameIdx *pIdx = pTab->pNameIdx;
+  struct stat sStat;
+  ZipfileEOCD eocd;
+  u8 *aCds = 0;
+  i64 nByte;
+  int nPath;
+  int nFile;
+  int nSlot;
+  int bEocd = 0;
+  int i;
+  int rc;
+
+  if( stat(zFile, &sStat) ){
+    sqlite3_free(pIdx);
+    pTab->pNameIdx = 0;
+    return SQLITE_OK;
+  }
+  if( pIdx && pIdx->szFile==(i64)sStat.st_size
+   && pIdx->mTime==(i64)sStat.st_mtime && strcmp(pIdx->zFile, zFile)==0
+  ){
+    u8 aEocd[ZIPFILE_EOCD_FIXED_SZ];
+    if( zipfileNameIdxEocd(pFile, &pIdx->eocd, aEocd)
+     && memcmp(aEocd, pIdx->aEocd, ZIPFILE_EOCD_FIXED_SZ)==0
+    ){
+      return SQLITE_OK;
+    }
+  }
+  sqlite3_free(pIdx);
+  pTab->pNameIdx = pIdx = 0;
+
+  rc = zipfileReadEOCD(pTab, 0, 0, pFile, &eocd);
+  if( rc!=SQLITE_OK ) return rc;
+  if( eocd.iOffset+eocd.nSize>(i64)sStat.st_size
+   || eocd.nEntry*ZIPFILE_CDS_FIXED_SZ>eocd.nSize
+   || eocd.nEntry>0x3FFFFFFF
+  ){
+    return SQLITE_OK;
+  }
+
+  for(nSlot=64; nSlot<eocd.nEntry; nSlot*=2);
+  nPath = (int)strlen(zFile);
+  nByte = sizeof(ZipfileNameIdx) + nSlot*sizeof(int)
+        + eocd.nEntry*(sizeof(i64) + sizeof(int) + sizeof(u32)) + nPath + 1;
+  pIdx = (ZipfileNameIdx*)sqlite3_malloc64(nByte);
+  aCds = (u8*)sqlite3_malloc64((i64)eocd.nSize + 1);
+  if( pIdx==0 || aCds==0 ){
+    rc = SQLITE_NOMEM;
+  }else{
+    rc = zipfileReadData(
+        pFile, aCds, eocd.nSize, eocd.iOffset, &pTab->base.zErrMsg
+    );
+  }
+
+  if( rc==SQLITE_OK ){
+    i64 iOff = 0;
+    memset(pIdx, 0, sizeof(ZipfileNameIdx));
+    pIdx->aOff = (i64*)&pIdx[1];
+    pIdx->aSlot = (int*)&pIdx->aOff[eocd.nEntry];
+    pIdx->aChain = &pIdx->aSlot[nSlot];
+    pIdx->aHashVal = (u32*)&pIdx->aChain[eocd.nEntry];
+    pIdx->zFile = (char*)&pIdx->aHashVal[eocd.nEntry];
+    memcpy(pIdx->zFile, zFile, nPath+1);
+    pIdx->szFile = (i64)sStat.st_size;
+    pIdx->mTime = (i64)sStat.st_mtime;
+    pIdx->eocd = eocd;
+    bEocd = zipfileNameIdxEocd(pFile, &eocd, pIdx->aEocd);
+    pIdx->nSlot = nSlot;
+    memset(pIdx->aSlot, 0xff, nSlot*sizeof(int));
+
+    for(i=0; bEocd && i<eocd.nEntry; i++){
+      const u8 *aRec = &aCds[iOff];
+      int nName;
+      int nRec;
+      u32 h;
+      if( iOff+ZIPFILE_CDS_FIXED_SZ>eocd.nSize
+       || zipfileGetU32(aRec)!=ZIPFILE_SIGNATURE_CDS
+      ){
+        break;
+      }
+      nFile = zipfileGetU16(&aRec[ZIPFILE_CDS_NFILE_OFF]);
+      nRec = nFile + zipfileGetU16(&aRec[ZIPFILE_CDS_NFILE_OFF+2]);
+      nRec += zipfileGetU16(&aRec[ZIPFILE_CDS_NFILE_OFF+4]);
+      if( iOff+ZIPFILE_CDS_FIXED_SZ+nFile>eocd.nSize ) break;
+      aRec += ZIPFILE_CDS_FIXED_SZ;
+      for(nName=0; nName<nFile && aRec[nName]; nName++);
+      h = zipfileHashPath((const char*)aRec, nName);
+      pIdx->aOff[i] = eocd.iOffset + iOff;
+      pIdx->aHashVal[i] = h;
+      pIdx->aChain[i] = pIdx->aSlot[h & (nSlot-1)];
+      pIdx->aSlot[h & (nSlot-1)] = i;
+      iOff += ZIPFILE_CDS_FIXED_SZ + nRec;
+    }
+    pIdx->nEntry = i;
+    if( bEocd && i==eocd.nEntry ){
+      pTab->pNameIdx = pIdx;
+      pIdx = 0;
+    }
+  }
+
+  sqlite3_free(aCds);
+  sqlite3_free(pIdx);
+  return rc;
+}
+
+/*
+** Set pCsr->aCand[] to the offsets of the CDS records in pTab->pNameIdx
+** that may contain path pCsr->zName, in central directory order.
+*/
+static int zipfileNameIdxSeek(ZipfileTab *pTab, ZipfileCsr *pCsr){
+  ZipfileNameIdx *pIdx = pTab->pNameIdx;
+  u32 h = zipfileHashPath(pCsr->zName, pCsr->nName);
+  int nCand = 0;
+  int i;
+
+  for(i=pIdx->aSlot[h & (pIdx->nSlot-1)]; i>=0; i=pIdx->aChain[i]){
+    if( pIdx->aHashVal[i]==h ) nCand++;
+  }
+  pCsr->aCand = (i64*)sqlite3_malloc64(sizeof(i64)*(nCand+1));
+  if( pCsr->aCand==0 ) return SQLITE_NOMEM;
+  pCsr->nCand = nCand;
+  pCsr->iCand = 0;
+  /* Slot chains are in reverse order of insertion */
+  for(i=pIdx->aSlot[h & (pIdx->nSlot-1)]; i>=0; i=pIdx->aChain[i]){
+    if( pIdx->aHashVal[i]==h ) pCsr->aCand[--nCand] = pIdx->aOff[i];
+  }
+  pCsr->eocd = pIdx->eocd;
+  return SQLITE_OK;
+}
+
 /*
 ** Add object pNew to the linked list that begins at ZipfileTab.pFirstEntry
 ** and ends with pLastEntry. If argument pBefore is NULL, then pNew is added
 ** to the end of the list. Otherwise, it is added to the list immediately
 ** before pBefore (which is guaranteed to be a part of said list).
+**
+** During a write transaction, pNew is added to the hash table as well.
 */
 static void zipfileAddEntry(
   ZipfileTab *pTab,
@@ -1260,20 +1889,38 @@ static void zipfileAddEntry(
   ZipfileEntry *pNew
 ){
   assert( (pTab->pFirstEntry==0)==(pTab->pLastEntry==0) );
-  assert( pNew->pNext==0 );
+  assert( pNew->pNext==0 && pNew->pPrev==0 );
   if( pBefore==0 ){
     if( pTab->pFirstEntry==0 ){
       pTab->pFirstEntry = pTab->pLastEntry = pNew;
     }else{
       assert( pTab->pLastEntry->pNext==0 );
       pTab->pLastEntry->pNext = pNew;
+      pNew->pPrev = pTab->pLastEntry;
       pTab->pLastEntry = pNew;
     }
   }else{
-    ZipfileEntry **pp;
-    for(pp=&pTab->pFirstEntry; *pp!=pBefore; pp=&((*pp)->pNext));
     pNew->pNext = pBefore;
-    *pp = pNew;
+    pNew->pPrev = pBefore->pPrev;
+    if( pBefore->pPrev ){
+      pBefore->pPrev->pNext = pNew;
+    }else{
+      pTab->pFirstEntry = pNew;
+    }
+    pBefore->pPrev = pNew;
+  }
+  pTab->nEntry++;
+
+  if( pTab->pWriteFd ){
+    if( pTab->nEntry>pTab->nHash ){
+      zipfileHashResize(pTab, pTab->nHash ? pTab->nHash*2 : 64);
+    }else{
+      zipfileHashInsert(pTab, pNew);
+    }
+    if( pTab->aHash && pTab->nEntry>pTab->nHash ){
+      /* The hash table could not be grown, so keep using it as it is */
+      zipfileHashInsert(pTab, pNew);
+    }
   }
 }
 
@@ -1317,9 +1964,25 @@ static int zipfileFilter(
 
   zipfileResetCursor(pCsr);
 
+  /* Compress and write the data of new entries, so that it can be read */
+  rc = zipfileFlushPending(pTab);
+  if( rc!=SQLITE_OK ) return rc;
+
+  if( idxNum & 2 ){
+    /* name=? constraint. A NULL value does not match any entry. */
+    const char *zName = (const char*)sqlite3_value_text(argv[(idxNum & 1)]);
+    if( zName==0 ){
+      pCsr->bEof = 1;
+      return SQLITE_OK;
+    }
+    pCsr->zName = sqlite3_mprintf("%s", zName);
+    if( pCsr->zName==0 ) return SQLITE_NOMEM;
+    pCsr->nName = (int)strlen(pCsr->zName);
+  }
+
   if( pTab->zFile ){
     zFile = pTab->zFile;
-  }else if( idxNum==0 ){
+  }else if( (idxNum & 1)==0 ){
     zipfileCursorErr(pCsr, "zipfile() function requires an argument");
     return SQLITE_ERROR;
   }else if( sqlite3_value_type(argv[0])==SQLITE_BLOB ){
@@ -1346,7 +2009,15 @@ static int zipfileFilter(
       zipfileCursorErr(pCsr, "cannot open file: %s", zFile);
       rc = SQLITE_ERROR;
     }else{
-      rc = zipfileReadEOCD(pTab, 0, 0, pCsr->pFile, &pCsr->eocd);
+      if( pCsr->zName ){
+        rc = zipfileNameIdxLoad(pTab, zFile, pCsr->pFile);
+        if( rc==SQLITE_OK && pTab->pNameIdx ){
+          rc = zipfileNameIdxSeek(pTab, pCsr);
+        }
+      }
+      if( rc==SQLITE_OK && pCsr->aCand==0 ){
+        rc = zipfileReadEOCD(pTab, 0, 0, pCsr->pFile, &pCsr->eocd);
+      }
       if( rc==SQLITE_OK ){
         if( pCsr->eocd.nEntry==0 ){
           pCsr->bEof = 1;
@@ -1358,7 +2029,11 @@ static int zipfileFilter(
     }
   }else{
     pCsr->bNoop = 1;
-    pCsr->pCurrent = pCsr->pFreeEntry ? pCsr->pFreeEntry : pTab->pFirstEntry;
+    if( pCsr->zName && pCsr->pFreeEntry==0 ){
+      pCsr->pCurrent = zipfileFindEntry(pTab, 0, pCsr->zName, pCsr->nName);
+    }else{
+      pCsr->pCurrent = pCsr->pFreeEntry ? pCsr->pFreeEntry : pTab->pFirstEntry;
+    }
     rc = zipfileNext(cur);
   }
 
@@ -1367,6 +2042,11 @@ static int zipfileFilter(
 
 /*
 ** xBestIndex callback.
+**
+** Bit 0x01 of idxNum is set if the archive is passed as the first
+** argument. Bit 0x02 is set if the next argument is the value of a
+** name=? constraint. That constraint is not omitted, as entries are
+** looked up ignoring a trailing '/' in their names.
 */
 static int zipfileBestIndex(
   sqlite3_vtab *tab,
@@ -1374,11 +2054,20 @@ static int zipfileBestIndex(
 ){
   int i;
   int idx = -1;
+  int idxName = -1;
   int unusable = 0;
   (void)tab;
 
   for(i=0; i<pIdxInfo->nConstraint; i++){
     const struct sqlite3_index_constraint *pCons = &pIdxInfo->aConstraint[i];
+    if( pCons->iColumn==ZIPFILE_N_COLUMN_IDX ){
+      if( pCons->usable && pCons->op==SQLITE_INDEX_CONSTRAINT_EQ
+       && sqlite3_stricmp(sqlite3_vtab_collation(pIdxInfo, i), "BINARY")==0
+      ){
+        idxName = i;
+      }
+      continue;
+    }
     if( pCons->iColumn!=ZIPFILE_F_COLUMN_IDX ) continue;
     if( pCons->usable==0 ){
       unusable = 1;
@@ -1394,6 +2083,12 @@ static int zipfileBestIndex(
   }else if( unusable ){
     return SQLITE_CONSTRAINT;
   }
+  if( idxName>=0 ){
+    pIdxInfo->aConstraintUsage[idxName].argvIndex = (idx>=0) ? 2 : 1;
+    pIdxInfo->idxNum |= 2;
+    pIdxInfo->estimatedCost = 10.0;
+    pIdxInfo->estimatedRows = 1;
+  }
   return SQLITE_OK;
 }
 
@@ -1464,6 +2159,152 @@ static int zipfileAppendEntry(
   return rc;
 }
 
+/*
+** Add a copy of the nData bytes of uncompressed data at aData to the
+** pending data of the write transaction, for new entry pEntry. If bAuto
+** is true, the data is stored uncompressed if deflate does not reduce its
+** size.
+*/
+static int zipfileAddPending(
+  ZipfileTab *pTab,
+  ZipfileEntry *pEntry,
+  const u8 *aData,
+  int nData,
+  int bAuto
+){
+  ZipfilePending *p;
+  if( pTab->nPending>=pTab->nPendingAlloc ){
+    int nNew = pTab->nPendingAlloc ? pTab->nPendingAlloc*2 : 64;
+    ZipfilePending *aNew = (ZipfilePending*)sqlite3_realloc64(
+        pTab->aPending, nNew*sizeof(ZipfilePending)
+    );
+    if( aNew==0 ) return SQLITE_NOMEM;
+    pTab->aPending = aNew;
+    pTab->nPendingAlloc = nNew;
+  }
+  p = &pTab->aPending[pTab->nPending];
+  memset(p, 0, sizeof(ZipfilePending));
+  p->aIn = (u8*)sqlite3_malloc64(nData);
+  if( p->aIn==0 ) return SQLITE_NOMEM;
+  memcpy(p->aIn, aData, nData);
+  p->nIn = nData;
+  p->bAuto = bAuto;
+  p->pEntry = pEntry;
+  pEntry->iPending = ++pTab->nPending;
+  pTab->szPending += nData;
+  return SQLITE_OK;
+}
+
+/*
+** A range of ZipfileTab.aPending[] compressed by one thread.
+*/
+typedef struct ZipfileDeflateTask ZipfileDeflateTask;
+struct ZipfileDeflateTask {
+  ZipfilePending *aPending;       /* Array to compress */
+  int iFirst;                     /* First element of aPending[] */
+  int iLast;                      /* One past the last element */
+};
+
+/*
+** Compute the crc32 of and compress the pending data in a range of
+** ZipfileTab.aPending[]. Runs on a worker thread.
+*/
+static void *zipfileDeflateWorker(void *pArg){
+  ZipfileDeflateTask *pTask = (ZipfileDeflateTask*)pArg;
+  int i;
+  for(i=pTask->iFirst; i<pTask->iLast; i++){
+    ZipfilePending *p = &pTask->aPending[i];
+    if( p->pEntry ){
+      p->iCrc32 = crc32(0, p->aIn, p->nIn);
+      p->rc = zipfileDeflate(p->aIn, p->nIn, &p->aOut, &p->nOut, &p->zErr);
+    }
+  }
+  return 0;
+}
+
+/*
+** Compress the pending data of new entries on up to ZipfileTab.nThread
+** threads, and append it to the archive in the order the entries were
+** inserted.
+*/
+static int zipfileFlushPending(ZipfileTab *pTab){
+  ZipfileDeflateTask aTask[ZIPFILE_THREADS_MAX];
+  int nTask = MIN(pTab->nThread, pTab->nPending);
+  i64 nSum = 0;
+  int rc = SQLITE_OK;
+  int i;
+  int k;
+
+  if( pTab->nPending==0 ) return SQLITE_OK;
+
+  /* Split aPending[] into ranges with about the same number of bytes */
+  for(i=k=0; k<nTask; k++){
+    i64 nLimit = pTab->szPending*(k+1)/nTask;
+    aTask[k].aPending = pTab->aPending;
+    aTask[k].iFirst = i;
+    while( i<pTab->nPending && (nSum<nLimit || k==nTask-1) ){
+      nSum += pTab->aPending[i++].nIn;
+    }
+    aTask[k].iLast = i;
+  }
+
+#if ZIPFILE_USE_THREADS
+  {
+    SQLiteThread *aThread[ZIPFILE_THREADS_MAX];
+    for(k=1; k<nTask; k++){
+      if( sqlite3ThreadCreate(&aThread[k], zipfileDeflateWorker, &aTask[k]) ){
+        aThread[k] = 0;
+        zipfileDeflateWorker(&aTask[k]);
+      }
+    }
+    zipfileDeflateWorker(&aTask[0]);
+    for(k=1; k<nTask; k++){
+      void *pOut;
+      if( aThread[k] ) sqlite3ThreadJoin(aThread[k], &pOut);
+    }
+  }
+#else
+  for(k=0; k<nTask; k++){
+    zipfileDeflateWorker(&aTask[k]);
+  }
+#endif
+
+  for(i=0; i<pTab->nPending; i++){
+    ZipfilePending *p = &pTab->aPending[i];
+    ZipfileEntry *pEntry = p->pEntry;
+    if( pEntry ){
+      pEntry->iPending = 0;
+      if( rc==SQLITE_OK && p->rc!=SQLITE_OK ){
+        rc = p->rc;
+        if( p->zErr ){
+          sqlite3_free(pTab->base.zErrMsg);
+          pTab->base.zErrMsg = p->zErr;
+          p->zErr = 0;
+        }
+      }
+      if( rc==SQLITE_OK ){
+        const u8 *aData = p->aOut;
+        int nData = p->nOut;
+        if( p->bAuto && p->nOut>=p->nIn ){
+          aData = p->aIn;
+          nData = p->nIn;
+          pEntry->cds.iCompression = 0;
+        }
+        pEntry->cds.crc32 = p->iCrc32;
+        pEntry->cds.szCompressed = nData;
+        pEntry->cds.iOffset = pTab->szCurrent;
+        rc = zipfileAppendEntry(pTab, pEntry, aData, nData);
+      }
+    }
+    sqlite3_free(p->aIn);
+    sqlite3_free(p->aOut);
+    sqlite3_free(p->zErr);
+  }
+  pTab->nPending = 0;
+  pTab->szPending = 0;
+  return rc;
+}
+
 static int zipfileGetMode(
   sqlite3_value *pVal,
   int bIsDir,                     /* If true, default to directory */
@@ -1505,18 +2346,6 @@ static int zipfileGetMode(
   return SQLITE_ERROR;
 }
 
-/*
-** Both (const char*) arguments point to nul-terminated strings. Argument
-** nB is the value of strlen(zB). This function returns 0 if the strings are
-** identical, ignoring any trailing '/' character in either path.  */
-static int zipfileComparePath(const char *zA, const char *zB, int nB){
-  int nA = (int)strlen(zA);
-  if( nA>0 && zA[nA-1]=='/' ) nA--;
-  if( nB>0 && zB[nB-1]=='/' ) nB--;
-  if( nA==nB && memcmp(zA, zB, nA)==0 ) return 0;
-  return 1;
-}
-
 static int zipfileBegin(sqlite3_vtab *pVtab){
   ZipfileTab *pTab = (ZipfileTab*)pVtab;
   int rc = SQLITE_OK;
@@ -1538,8 +2367,8 @@ static int zipfileBegin(sqlite3_vtab *pVtab){
     );
     rc = SQLITE_ERROR;
   }else{
-    fseek(pTab->pWriteFd, 0, SEEK_END);
-    pTab->szCurrent = pTab->szOrig = (i64)ftell(pTab->pWriteFd);
+    zipfileFseek(pTab->pWriteFd, 0, SEEK_END);
+    pTab->szCurrent = pTab->szOrig = zipfileFtell(pTab->pWriteFd);
     rc = zipfileLoadDirectory(pTab, 0, 0);
   }
 
@@ -1590,18 +2419,27 @@ static u32 zipfileGetTime(sqlite3_value *pVal){
 */
 static void zipfileRemoveEntryFromList(ZipfileTab *pTab, ZipfileEntry *pOld){
   if( pOld ){
-    if( pTab->pFirstEntry==pOld ){
+    if( pOld->pPrev ){
+      pOld->pPrev->pNext = pOld->pNext;
+    }else{
+      assert( pTab->pFirstEntry==pOld );
       pTab->pFirstEntry = pOld->pNext;
-      if( pTab->pLastEntry==pOld ) pTab->pLastEntry = 0;
+    }
+    if( pOld->pNext ){
+      pOld->pNext->pPrev = pOld->pPrev;
     }else{
-      ZipfileEntry *p;
-      for(p=pTab->pFirstEntry; p; p=p->pNext){
-        if( p->pNext==pOld ){
-          p->pNext = pOld->pNext;
-          if( pTab->pLastEntry==pOld ) pTab->pLastEntry = p;
-          break;
-        }
-      }
+      assert( pTab->pLastEntry==pOld );
+      pTab->pLastEntry = pOld->pPrev;
+    }
+    pTab->nEntry--;
+    zipfileHashRemove(pTab, pOld);
+    if( pOld->iPending ){
+      ZipfilePending *p = &pTab->aPending[pOld->iPending-1];
+      pTab->szPending -= p->nIn;
+      sqlite3_free(p->aIn);
+      p->aIn = 0;
+      p->nIn = 0;
+      p->pEntry = 0;
     }
     zipfileEntryFree(pOld);
   }
@@ -1634,6 +2472,8 @@ static int zipfileUpdate(
   ZipfileEntry *pOld2 = 0;
   int bUpdate = 0;                /* True for an update that modifies "name" */
   int bIsDir = 0;
+  int bPending = 0;               /* True to compress data later */
+  int bAuto = 0;                  /* True if method is NULL */
   u32 iCrc32 = 0;
 
   (void)pRowid;
@@ -1653,12 +2493,8 @@ static int zipfileUpdate(
         bUpdate = 1;
       }
     }
-    for(pOld=pTab->pFirstEntry; 1; pOld=pOld->pNext){
-      if( zipfileComparePath(pOld->cds.zFile, zDelete, nDelete)==0 ){
-        break;
-      }
-      assert( pOld->pNext );
-    }
+    pOld = zipfileFindEntry(pTab, 0, zDelete, nDelete);
+    assert( pOld );
   }
 
   if( nVal>1 ){
@@ -1681,7 +2517,7 @@ static int zipfileUpdate(
         ** a regular file or a symlink. */
         const u8 *aIn = sqlite3_value_blob(apVal[7]);
         int nIn = sqlite3_value_bytes(apVal[7]);
-        int bAuto = sqlite3_value_type(apVal[8])==SQLITE_NULL;
+        bAuto = sqlite3_value_type(apVal[8])==SQLITE_NULL;
 
         iMethod = sqlite3_value_int(apVal[8]);
         sz = nIn;
@@ -1690,6 +2526,10 @@ static int zipfileUpdate(
         if( iMethod!=0 && iMethod!=8 ){
           zipfileTableErr(pTab, "unknown compression method: %d", iMethod);
           rc = SQLITE_CONSTRAINT;
+        }else if( (bAuto || iMethod) && pTab->nThread>1 && nIn>0 ){
+          /* Compressed on the worker threads by zipfileFlushPending() */
+          bPending = 1;
+          iMethod = 8;
         }else{
           if( bAuto || iMethod ){
             int nCmp;
@@ -1743,24 +2583,21 @@ static int zipfileUpdate(
     /* Check that we're not inserting a duplicate entry -OR- updating an
     ** entry with a path, thereby making it into a duplicate. */
     if( (pOld==0 || bUpdate) && rc==SQLITE_OK ){
-      ZipfileEntry *p;
-      for(p=pTab->pFirstEntry; p; p=p->pNext){
-        if( zipfileComparePath(p->cds.zFile, zPath, nPath)==0 ){
-          switch( sqlite3_vtab_on_conflict(pTab->db) ){
-            case SQLITE_IGNORE: {
-              goto zipfile_update_done;
-            }
-            case SQLITE_REPLACE: {
-              pOld2 = p;
-              break;
-            }
-            default: {
-              zipfileTableErr(pTab, "duplicate name: \"%s\"", zPath);
-              rc = SQLITE_CONSTRAINT;
-              break;
-            }
+      ZipfileEntry *p = zipfileFindEntry(pTab, 0, zPath, nPath);
+      if( p ){
+        switch( sqlite3_vtab_on_conflict(pTab->db) ){
+          case SQLITE_IGNORE: {
+            goto zipfile_update_done;
+          }
+          case SQLITE_REPLACE: {
+            pOld2 = p;
+            break;
+          }
+          default: {
+            zipfileTableErr(pTab, "duplicate name: \"%s\"", zPath);
+            rc = SQLITE_CONSTRAINT;
+            break;
           }
-          break;
         }
       }
     }
@@ -1778,13 +2615,22 @@ static int zipfileUpdate(
         zipfileMtimeToDos(&pNew->cds, mTime);
         pNew->cds.crc32 = iCrc32;
         pNew->cds.szCompressed = nData;
-        pNew->cds.szUncompressed = (u32)sz;
+        pNew->cds.szUncompressed = sz;
         pNew->cds.iExternalAttr = (mode<<16);
-        pNew->cds.iOffset = (u32)pTab->szCurrent;
+        pNew->cds.iOffset = pTab->szCurrent;
         pNew->cds.nFile = (u16)nPath;
         pNew->mUnixTime = (u32)mTime;
-        rc = zipfileAppendEntry(pTab, pNew, pData, nData);
+        if( bPending ){
+          rc = zipfileAddPending(pTab, pNew, pData, nData, bAuto);
+        }else{
+          rc = zipfileAppendEntry(pTab, pNew, pData, nData);
+        }
         zipfileAddEntry(pTab, pOld, pNew);
+        if( rc==SQLITE_OK
+         && pTab->szPending>=(i64)pTab->nThread*ZIPFILE_PENDING_SIZE
+        ){
+          rc = zipfileFlushPending(pTab);
+        }
       }
     }
   }
@@ -1793,7 +2639,13 @@ static int zipfileUpdate(
     ZipfileCsr *pCsr;
     for(pCsr=pTab->pCsrList; pCsr; pCsr=pCsr->pCsrNext){
       if( pCsr->pCurrent && (pCsr->pCurrent==pOld || pCsr->pCurrent==pOld2) ){
-        pCsr->pCurrent = pCsr->pCurrent->pNext;
+        if( pCsr->zName ){
+          pCsr->pCurrent = zipfileFindEntry(
+              pTab, pCsr->pCurrent, pCsr->zName, pCsr->nName
+          );
+        }else{
+          pCsr->pCurrent = pCsr->pCurrent->pNext;
+        }
         pCsr->bNoop = 1;
       }
     }
@@ -1808,15 +2660,50 @@ zipfile_update_done:
   return rc;
 }
 
+/*
+** Serialize the EOCD record into buffer aBuf[], which must be large enough
+** for ZIPFILE_EOCD64_FIXED_SZ+ZIPFILE_LOC64_FIXED_SZ+ZIPFILE_EOCD_FIXED_SZ
+** bytes. If the number of entries, the size or the offset of the central
+** directory do not fit into the EOCD record, a zip64 EOCD record and
+** locator are written first. The central directory is assumed to end
+** where the records are written. Return the number of bytes written.
+*/
 static int zipfileSerializeEOCD(ZipfileEOCD *p, u8 *aBuf){
   u8 *a = aBuf;
+  int bZip64 = p->nEntry>=ZIPFILE_MAX_U16
+            || p->nSize>=ZIPFILE_MAX_U32
+            || p->iOffset>=ZIPFILE_MAX_U32;
+
+  if( bZip64 ){
+    i64 iEocd64 = p->iOffset + p->nSize;
+
+    /* The zip64 EOCD record */
+    zipfileWrite32(a, ZIPFILE_SIGNATURE_EOCD64);
+    zipfileWrite64(a, ZIPFILE_EOCD64_FIXED_SZ-12);
+    zipfileWrite16(a, ZIPFILE_ZIP64_MADEBY);
+    zipfileWrite16(a, ZIPFILE_ZIP64_REQUIRED);
+    zipfileWrite32(a, p->iDisk);
+    zipfileWrite32(a, p->iFirstDisk);
+    zipfileWrite64(a, p->nEntry);
+    zipfileWrite64(a, p->nEntryTotal);
+    zipfileWrite64(a, p->nSize);
+    zipfileWrite64(a, p->iOffset);
+    assert( a==&aBuf[ZIPFILE_EOCD64_FIXED_SZ] );
+
+    /* The zip64 EOCD locator */
+    zipfileWrite32(a, ZIPFILE_SIGNATURE_LOC64);
+    zipfileWrite32(a, p->iFirstDisk);
+    zipfileWrite64(a, iEocd64);
+    zipfileWrite32(a, 1);
+  }
+
   zipfileWrite32(a, ZIPFILE_SIGNATURE_EOCD);
   zipfileWrite16(a, p->iDisk);
   zipfileWrite16(a, p->iFirstDisk);
-  zipfileWrite16(a, p->nEntry);
-  zipfileWrite16(a, p->nEntryTotal);
-  zipfileWrite32(a, p->nSize);
-  zipfileWrite32(a, p->iOffset);
+  zipfileWrite16(a, (u16)MIN(p->nEntry, ZIPFILE_MAX_U16));
+  zipfileWrite16(a, (u16)MIN(p->nEntryTotal, ZIPFILE_MAX_U16));
+  zipfileWrite32(a, (u32)MIN(p->nSize, ZIPFILE_MAX_U32));
+  zipfileWrite32(a, (u32)MIN(p->iOffset, ZIPFILE_MAX_U32));
   zipfileWrite16(a, 0);        /* Size of trailing comment in bytes*/
 
   return a-aBuf;
@@ -1824,48 +2711,68 @@ static int zipfileSerializeEOCD(ZipfileEOCD *p, u8 *aBuf){
 
 static int zipfileAppendEOCD(ZipfileTab *pTab, ZipfileEOCD *p){
   int nBuf = zipfileSerializeEOCD(p, pTab->aBuffer);
-  assert( nBuf==ZIPFILE_EOCD_FIXED_SZ );
+  assert( nBuf==ZIPFILE_EOCD_FIXED_SZ || nBuf==ZIPFILE_EOCD_FIXED_SZ
+       + ZIPFILE_EOCD64_FIXED_SZ + ZIPFILE_LOC64_FIXED_SZ );
   return zipfileAppendData(pTab, pTab->aBuffer, nBuf);
 }
 
 /*
 ** Serialize the CDS structure into buffer aBuf[]. Return the number
 ** of bytes written.
+**
+** A zip64 extra field is written for sizes and offsets that do not fit
+** into 32 bits. Any zip64 extra field that an entry read from an existing
+** archive had is dropped and, if still required, written from scratch.
 */
 static int zipfileSerializeCDS(ZipfileEntry *pEntry, u8 *aBuf){
   u8 *a = aBuf;
+  u8 *aExtra;
   ZipfileCDS *pCDS = &pEntry->cds;
+  int nZip64 = 0;
 
   if( pEntry->aExtra==0 ){
     pCDS->nExtra = 9;
   }
+  if( pCDS->szUncompressed>=ZIPFILE_MAX_U32 ) nZip64 += 8;
+  if( pCDS->szCompressed>=ZIPFILE_MAX_U32 ) nZip64 += 8;
+  if( pCDS->iOffset>=ZIPFILE_MAX_U32 ) nZip64 += 8;
 
   zipfileWrite32(a, ZIPFILE_SIGNATURE_CDS);
   zipfileWrite16(a, pCDS->iVersionMadeBy);
-  zipfileWrite16(a, pCDS->iVersionExtract);
+  zipfileWrite16(a, nZip64 ? MAX(pCDS->iVersionExtract, ZIPFILE_ZIP64_REQUIRED)
+                           : pCDS->iVersionExtract);
   zipfileWrite16(a, pCDS->flags);
   zipfileWrite16(a, pCDS->iCompression);
   zipfileWrite16(a, pCDS->mTime);
   zipfileWrite16(a, pCDS->mDate);
   zipfileWrite32(a, pCDS->crc32);
-  zipfileWrite32(a, pCDS->szCompressed);
-  zipfileWrite32(a, pCDS->szUncompressed);
+  zipfileWrite32(a, (u32)MIN(pCDS->szCompressed, ZIPFILE_MAX_U32));
+  zipfileWrite32(a, (u32)MIN(pCDS->szUncompressed, ZIPFILE_MAX_U32));
   assert( a==&aBuf[ZIPFILE_CDS_NFILE_OFF] );
   zipfileWrite16(a, pCDS->nFile);
-  zipfileWrite16(a, pCDS->nExtra);
+  zipfileWrite16(a, 0);        /* Size of extra fields, set below */
   zipfileWrite16(a, pCDS->nComment);
   zipfileWrite16(a, pCDS->iDiskStart);
   zipfileWrite16(a, pCDS->iInternalAttr);
   zipfileWrite32(a, pCDS->iExternalAttr);
-  zipfileWrite32(a, pCDS->iOffset);
+  zipfileWrite32(a, (u32)MIN(pCDS->iOffset, ZIPFILE_MAX_U32));
 
   memcpy(a, pCDS->zFile, pCDS->nFile);
   a += pCDS->nFile;
 
+  aExtra = a;
   if( pEntry->aExtra ){
-    int n = (int)pCDS->nExtra + (int)pCDS->nComment;
-    memcpy(a, pEntry->aExtra, n);
-    a += n;
+    const u8 *p = pEntry->aExtra;
+    const u8 *pEnd = &p[pCDS->nExtra];
+    while( p<pEnd ){
+      int n = (int)(pEnd - p);
+      if( n>=4 && 4+zipfileGetU16(&p[2])<=n ) n = 4+zipfileGetU16(&p[2]);
+      if( n<4 || zipfileGetU16(p)!=ZIPFILE_EXTRA_ZIP64 ){
+        memcpy(a, p, n);
+        a += n;
+      }
+      p += n;
+    }
   }else{
     assert( pCDS->nExtra==9 );
     zipfileWrite16(a, ZIPFILE_EXTRA_TIMESTAMP);
@@ -1874,6 +2781,26 @@ static int zipfileSerializeCDS(ZipfileEntry *pEntry, u8 *aBuf){
     zipfileWrite32(a, pEntry->mUnixTime);
   }
 
+  if( nZip64 ){
+    zipfileWrite16(a, ZIPFILE_EXTRA_ZIP64);
+    zipfileWrite16(a, (u16)nZip64);
+    if( pCDS->szUncompressed>=ZIPFILE_MAX_U32 ){
+      zipfileWrite64(a, pCDS->szUncompressed);
+    }
+    if( pCDS->szCompressed>=ZIPFILE_MAX_U32 ){
+      zipfileWrite64(a, pCDS->szCompressed);
+    }
+    if( pCDS->iOffset>=ZIPFILE_MAX_U32 ){
+      zipfileWrite64(a, pCDS->iOffset);
+    }
+  }
+  zipfilePutU16(&aBuf[ZIPFILE_CDS_NFILE_OFF+2], (u16)(a - aExtra));
+
+  if( pEntry->aExtra && pCDS->nComment ){
+    memcpy(a, &pEntry->aExtra[pCDS->nExtra], pCDS->nComment);
+    a += pCDS->nComment;
+  }
+
   return a-aBuf;
 }
 
@@ -1886,6 +2813,10 @@ static int zipfileCommit(sqlite3_vtab *pVtab){
     ZipfileEOCD eocd;
     int nEntry = 0;
 
+    /* Write out the data of new entries that is still pending */
+    rc = zipfileFlushPending(pTab);
+    iOffset = pTab->szCurrent;
+
     /* Write out all entries */
     for(p=pTab->pFirstEntry; rc==SQLITE_OK && p; p=p->pNext){
       int n = zipfileSerializeCDS(p, pTab->aBuffer);
@@ -1896,10 +2827,10 @@ static int zipfileCommit(sqlite3_vtab *pVtab){
     /* Write out the EOCD record */
     eocd.iDisk = 0;
     eocd.iFirstDisk = 0;
-    eocd.nEntry = (u16)nEntry;
-    eocd.nEntryTotal = (u16)nEntry;
-    eocd.nSize = (u32)(pTab->szCurrent - iOffset);
-    eocd.iOffset = (u32)iOffset;
+    eocd.nEntry = nEntry;
+    eocd.nEntryTotal = nEntry;
+    eocd.nSize = pTab->szCurrent - iOffset;
+    eocd.iOffset = iOffset;
     rc = zipfileAppendEOCD(pTab, &eocd);
 
     zipfileCleanupTransaction(pTab);
@@ -1929,6 +2860,13 @@ static void zipfileFunctionCds(
   assert( argc>0 );
 
   pCsr = zipfileFindCursor(pTab, sqlite3_value_int64(argv[0]));
+  if( pCsr && pCsr->pCurrent->iPending ){
+    int rc = zipfileFlushPending(pTab);
+    if( rc!=SQLITE_OK ){
+      sqlite3_result_error_code(context, rc);
+      return;
+    }
+  }
   if( pCsr ){
     ZipfileCDS *p = &pCsr->pCurrent->cds;
     char *zRes = sqlite3_mprintf("{"
@@ -1939,23 +2877,23 @@ static void zipfileFunctionCds(
         "\"time\" : %u, "
         "\"date\" : %u, "
         "\"crc32\" : %u, "
-        "\"compressed-size\" : %u, "
-        "\"uncompressed-size\" : %u, "
+        "\"compressed-size\" : %lld, "
+        "\"uncompressed-size\" : %lld, "
         "\"file-name-length\" : %u, "
         "\"extra-field-length\" : %u, "
         "\"file-comment-length\" : %u, "
         "\"disk-number-start\" : %u, "
         "\"internal-attr\" : %u, "
         "\"external-attr\" : %u, "
-        "\"offset\" : %u }",
+        "\"offset\" : %lld }",
         (u32)p->iVersionMadeBy, (u32)p->iVersionExtract,
         (u32)p->flags, (u32)p->iCompression,
         (u32)p->mTime, (u32)p->mDate,
-        (u32)p->crc32, (u32)p->szCompressed,
-        (u32)p->szUncompressed, (u32)p->nFile,
+        (u32)p->crc32, p->szCompressed,
+        p->szUncompressed, (u32)p->nFile,
         (u32)p->nExtra, (u32)p->nComment,
         (u32)p->iDiskStart, (u32)p->iInternalAttr,
-        (u32)p->iExternalAttr, (u32)p->iOffset
+        (u32)p->iExternalAttr, p->iOffset
     );
 
     if( zRes==0 ){
@@ -2215,19 +3153,21 @@ static void zipfileFinal(sqlite3_context *pCtx){
   if( p==0 ) return;
   if( p->nEntry>0 ){
     memset(&eocd, 0, sizeof(eocd));
-    eocd.nEntry = (u16)p->nEntry;
-    eocd.nEntryTotal = (u16)p->nEntry;
+    eocd.nEntry = p->nEntry;
+    eocd.nEntryTotal = p->nEntry;
     eocd.nSize = p->cds.n;
     eocd.iOffset = p->body.n;
 
-    nZip = (i64)p->body.n + (i64)p->cds.n + ZIPFILE_EOCD_FIXED_SZ;
+    nZip = (i64)p->body.n + (i64)p->cds.n + ZIPFILE_EOCD_FIXED_SZ
+         + ZIPFILE_EOCD64_FIXED_SZ + ZIPFILE_LOC64_FIXED_SZ;
     aZip = (u8*)sqlite3_malloc64(nZip);
     if( aZip==0 ){
       sqlite3_result_error_nomem(pCtx);
     }else{
       memcpy(aZip, p->body.a, p->body.n);
       memcpy(&aZip[p->body.n], p->cds.a, p->cds.n);
-      zipfileSerializeEOCD(&eocd, &aZip[p->body.n + p->cds.n]);
+      nZip = (i64)p->body.n + (i64)p->cds.n;
+      nZip += zipfileSerializeEOCD(&eocd, &aZip[nZip]);
       sqlite3_result_blob(pCtx, aZip, (int)nZip, zipfileFree);
     }
   }
@@ -0,0 +1,111 @@
+/*
+** Name:        cipherkeytest.c
+** Purpose:     Test opening encrypted databases with wrong cipher parameters
+** Author:      Ulrich Telle
+** Created:     2026-10-19
+** Copyright:   (c) 2026-2026 Ulrich Telle
+** License:     MIT
+*/
+
+/*
+** Reading a database with a wrong key or a wrong algorithm raises an error,
+** which can't be checked by a test script for the shell.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sqlite3mc.h"
+
+#define TEST_DB "cipherkeytest.db3"
+
+static int nFailed = 0;
+
+static void check(int ok, const char* zTest, const char* zWhat)
+{
+  if (!ok)
+  {
+    fprintf(stderr, "%s: %s\n", zTest, zWhat);
+    ++nFailed;
+  }
+}
+
+static int countRows(sqlite3* db)
+{
+  sqlite3_stmt* pStmt = NULL;
+  int rc = sqlite3_prepare_v2(db, "SELECT count(*) FROM t1", -1, &pStmt, NULL);
+  if (rc == SQLITE_OK)
+  {
+    rc = sqlite3_step(pStmt);
+    rc = (rc == SQLITE_ROW) ? sqlite3_column_int(pStmt, 0) : -rc;
+  }
+  else
+  {
+    rc = -rc;
+  }
+  sqlite3_finalize(pStmt);
+  return rc;
+}
+
+/*
+** Open the test database with the cipher scheme Ascon and the given
+** algorithm and key; returns the number of rows of the test table, or
+** the negated error code
+*/
+static int openAscon(int algorithm, const char* zKey, const char* zSql)
+{
+  sqlite3* db = NULL;
+  int rc = sqlite3_open(TEST_DB, &db);
+  if (rc == SQLITE_OK &&
+      (sqlite3mc_config(db, "cipher", sqlite3mc_cipher_index("ascon128")) < 0 ||
+       sqlite3mc_config_cipher(db, "ascon128", "algorithm", algorithm) != algorithm ||
+       sqlite3mc_config_cipher(db, "ascon128", "kdf_iter", 1000) != 1000))
+  {
+    rc = SQLITE_ERROR;
+  }
+  if (rc == SQLITE_OK)
+  {
+    rc = sqlite3_key(db, zKey, -1);
+  }
+  if (rc == SQLITE_OK && zSql != NULL)
+  {
+    rc = sqlite3_exec(db, zSql, NULL, NULL, NULL);
+  }
+  rc = (rc == SQLITE_OK) ? countRows(db) : -rc;
+  sqlite3_close(db);
+  return rc;
+}
+
+int main(void)
+{
+  int rc;
+
+  /* Create a database encrypted with Ascon-AEAD128 */
+  remove(TEST_DB);
+  rc = openAscon(2, "testkey",
+                 "CREATE TABLE t1(a INTEGER PRIMARY KEY, b TEXT);"
+                 "WITH RECURSIVE c(i) AS (VALUES(1) UNION ALL SELECT i+1 FROM c WHERE i<500)"
+                 "  INSERT INTO t1 SELECT i, 'value ' || i FROM c;");
+  check(rc == 500, "ascon-aead128-create", "database not created");
+
+  /* Reopen it with the right parameters */
+  check(openAscon(2, "testkey", NULL) == 500, "ascon-aead128-reopen", "database not readable");
+
+  /* A wrong key or the Ascon-128 v1.2 algorithm can't read the database */
+  check(openAscon(2, "wrongkey", NULL) == -SQLITE_NOTADB, "ascon-aead128-wrong-key", "database readable with wrong key");
+  check(openAscon(1, "testkey", NULL) == -SQLITE_NOTADB, "ascon-aead128-wrong-algorithm", "database readable with wrong algorithm");
+
+  /* The database can still be read after the failed attempts */
+  check(openAscon(2, "testkey", NULL) == 500, "ascon-aead128-reopen", "database not readable after failed attempts");
+
+  remove(TEST_DB);
+
+  if (nFailed > 0)
+  {
+    fprintf(stderr, "%d checks failed\n", nFailed);
+    return 1;
+  }
+  printf("Tests passed\n");
+  return 0;
+}
@@ -0,0 +1,148 @@
+-- Round trip tests for cipher schemes
+-- Each test case checks its result and stops with an error on a mismatch
+.bail on
+.mode list
+
+-- AES-256-GCM: create an encrypted database, reopen it and read it back
+.open --new aesgcmtest.db3
+pragma cipher='aes256gcm';
+pragma key='testkey';
+CREATE TABLE t1(a INTEGER PRIMARY KEY, b TEXT, c BLOB);
+WITH RECURSIVE c(i) AS (VALUES(1) UNION ALL SELECT i+1 FROM c WHERE i<2000)
+INSERT INTO t1 SELECT i, 'plaintext marker ' || i, zeroblob(i%300) FROM c;
+.open aesgcmtest.db3
+pragma cipher='aes256gcm';
+pragma key='testkey';
+.testcase aes256gcm-roundtrip
+SELECT count(*), sum(a), sum(length(c)), max(b) FROM t1;
+PRAGMA quick_check;
+SELECT instr(readfile('aesgcmtest.db3'), CAST('plaintext marker' AS BLOB));
+.check "2000|2001000|289200|plaintext marker 999\nok\n0\n"
+
+-- AES-256-GCM in WAL mode
+.open --new aesgcmtest.db3
+pragma cipher='aes256gcm';
+pragma key='testkey';
+.testcase aes256gcm-wal
+PRAGMA journal_mode=WAL;
+CREATE TABLE t1(a INTEGER PRIMARY KEY, b TEXT);
+WITH RECURSIVE c(i) AS (VALUES(1) UNION ALL SELECT i+1 FROM c WHERE i<500)
+INSERT INTO t1 SELECT i, 'plaintext marker ' || i FROM c;
+UPDATE t1 SET b = b || '!' WHERE a%7=0;
+SELECT count(*), sum(length(b)) FROM t1;
+SELECT instr(readfile('aesgcmtest.db3-wal'), CAST('plaintext marker' AS BLOB));
+.check "wal\n500|9963\n0\n"
+.open aesgcmtest.db3
+pragma cipher='aes256gcm';
+pragma key='testkey';
+.testcase aes256gcm-wal-reopen
+SELECT count(*), sum(length(b)) FROM t1;
+PRAGMA quick_check;
+.check "500|9963\nok\n"
+
+-- AES-256-XTS: create an encrypted database, reopen it and read it back
+.open --new aesxtstest.db3
+pragma cipher='aes256xts';
+pragma key='testkey';
+CREATE TABLE t1(a INTEGER PRIMARY KEY, b TEXT, c BLOB);
+WITH RECURSIVE c(i) AS (VALUES(1) UNION ALL SELECT i+1 FROM c WHERE i<2000)
+INSERT INTO t1 SELECT i, 'plaintext marker ' || i, zeroblob(i%300) FROM c;
+.open aesxtstest.db3
+pragma cipher='aes256xts';
+pragma key='testkey';
+.testcase aes256xts-roundtrip
+SELECT count(*), sum(a), sum(length(c)), max(b) FROM t1;
+PRAGMA quick_check;
+SELECT instr(readfile('aesxtstest.db3'), CAST('plaintext marker' AS BLOB));
+.check "2000|2001000|289200|plaintext marker 999\nok\n0\n"
+
+-- AES-256-XTS needs no reserved bytes, so a plaintext database can be
+-- encrypted in place
+.open --new aesxtstest.db3
+CREATE TABLE t1(a INTEGER PRIMARY KEY, b TEXT);
+WITH RECURSIVE c(i) AS (VALUES(1) UNION ALL SELECT i+1 FROM c WHERE i<500)
+INSERT INTO t1 SELECT i, 'plaintext marker ' || i FROM c;
+pragma cipher='aes256xts';
+pragma rekey='testkey';
+.open aesxtstest.db3
+pragma cipher='aes256xts';
+pragma key='testkey';
+.testcase aes256xts-rekey-plaintext
+SELECT count(*), sum(length(b)) FROM t1;
+PRAGMA quick_check;
+SELECT instr(readfile('aesxtstest.db3'), CAST('plaintext marker' AS BLOB));
+.check "500|9892\nok\n0\n"
+
+-- Ascon-AEAD128: the algorithm is not stored in the database and has to be
+-- given whenever the database is opened; opening the database with a wrong
+-- key or algorithm raises an error and is tested by cipherkeytest.c
+.open --new asconaeadtest.db3
+pragma cipher='ascon128';
+pragma algorithm=2;
+pragma key='testkey';
+CREATE TABLE t1(a INTEGER PRIMARY KEY, b TEXT, c BLOB);
+WITH RECURSIVE c(i) AS (VALUES(1) UNION ALL SELECT i+1 FROM c WHERE i<2000)
+INSERT INTO t1 SELECT i, 'plaintext marker ' || i, zeroblob(i%300) FROM c;
+.open asconaeadtest.db3
+pragma cipher='ascon128';
+pragma algorithm=2;
+pragma key='testkey';
+.testcase ascon-aead128-roundtrip
+SELECT count(*), sum(a), sum(length(c)), max(b) FROM t1;
+PRAGMA quick_check;
+SELECT instr(readfile('asconaeadtest.db3'), CAST('plaintext marker' AS BLOB));
+.check "2000|2001000|289200|plaintext marker 999\nok\n0\n"
+
+-- Ascon-AEAD128 in WAL mode
+.open --new asconaeadtest.db3
+pragma cipher='ascon128';
+pragma algorithm=2;
+pragma key='testkey';
+.testcase ascon-aead128-wal
+PRAGMA journal_mode=WAL;
+CREATE TABLE t1(a INTEGER PRIMARY KEY, b TEXT);
+WITH RECURSIVE c(i) AS (VALUES(1) UNION ALL SELECT i+1 FROM c WHERE i<500)
+INSERT INTO t1 SELECT i, 'plaintext marker ' || i FROM c;
+UPDATE t1 SET b = b || '!' WHERE a%7=0;
+SELECT count(*), sum(length(b)) FROM t1;
+SELECT instr(readfile('asconaeadtest.db3-wal'), CAST('plaintext marker' AS BLOB));
+.check "wal\n500|9963\n0\n"
+.open asconaeadtest.db3
+pragma cipher='ascon128';
+pragma algorithm=2;
+pragma key='testkey';
+.testcase ascon-aead128-wal-reopen
+SELECT count(*), sum(length(b)) FROM t1;
+PRAGMA quick_check;
+.check "500|9963\nok\n"
+
+-- ChaCha20 with reduced rounds: the number of rounds is not stored in the
+-- database and has to be given whenever the database is opened
+.open --new chacha12test.db3
+pragma cipher='chacha20';
+pragma rounds=12;
+pragma key='testkey';
+CREATE TABLE t1(a INTEGER PRIMARY KEY, b TEXT);
+WITH RECURSIVE c(i) AS (VALUES(1) UNION ALL SELECT i+1 FROM c WHERE i<500)
+INSERT INTO t1 SELECT i, 'plaintext marker ' || i FROM c;
+.open chacha12test.db3
+pragma cipher='chacha20';
+pragma rounds=12;
+pragma key='testkey';
+.testcase chacha12-roundtrip
+SELECT count(*), sum(length(b)) FROM t1;
+PRAGMA quick_check;
+SELECT instr(readfile('chacha12test.db3'), CAST('plaintext marker' AS BLOB));
+.check "500|9892\nok\n0\n"
+
+-- Only 20, 12 and 8 rounds are supported
+.testcase chacha20-rounds
+SELECT quote(sqlite3mc_config('chacha20', 'rounds', 8));
+SELECT quote(sqlite3mc_config('chacha20', 'rounds', 10));
+SELECT quote(sqlite3mc_config('chacha20', 'rounds', 16));
+SELECT quote(sqlite3mc_config('chacha20', 'rounds', 12));
+SELECT quote(sqlite3mc_config('chacha20', 'rounds', 20));
+.check "8\nNULL\nNULL\n12\n20\n"
+
+.print Tests passed
+.q
@@ -0,0 +1,72 @@
+-- Tests for the csv and vsv virtual tables
+-- Each test case checks its result and stops with an error on a mismatch
+.bail on
+.headers on
+.mode csv
+.once csvtest.csv
+WITH RECURSIVE c(i) AS (VALUES(0) UNION ALL SELECT i+1 FROM c WHERE i<499)
+SELECT i AS a, (i*7919)%1000 AS b FROM c;
+.headers off
+.mode list
+
+CREATE VIRTUAL TABLE temp.tcsv USING csv(filename='csvtest.csv', header=1);
+CREATE VIRTUAL TABLE temp.tvsv USING vsv(filename='csvtest.csv', header=1);
+CREATE TEMP TABLE tref AS SELECT rowid AS id, * FROM tcsv;
+
+-- Rowid seeks use the sparse rowid index of the table
+.testcase csv-rowid-seek
+SELECT (SELECT b FROM tcsv WHERE rowid=321) = (SELECT b FROM tref WHERE id=321),
+       (SELECT count(*) FROM tcsv WHERE rowid BETWEEN 60 AND 200),
+       (SELECT count(*) FROM tcsv WHERE rowid>490),
+       (SELECT count(*) FROM tcsv WHERE rowid=0 OR rowid=501);
+.check "1|141|10|0\n"
+.testcase vsv-rowid-seek
+SELECT (SELECT b FROM tvsv WHERE rowid=321) = (SELECT b FROM tref WHERE id=321),
+       (SELECT count(*) FROM tvsv WHERE rowid BETWEEN 60 AND 200),
+       (SELECT count(*) FROM tvsv WHERE rowid>490),
+       (SELECT count(*) FROM tvsv WHERE rowid=0 OR rowid=501);
+.check "1|141|10|0\n"
+
+-- LIMIT and OFFSET may only be used by the table if the rows are
+-- returned in the order of the result
+.testcase csv-limit-offset
+SELECT group_concat(rowid) FROM (SELECT rowid,* FROM tcsv LIMIT 5 OFFSET 7);
+SELECT group_concat(rowid) FROM (SELECT rowid,* FROM tcsv ORDER BY rowid LIMIT 5 OFFSET 7);
+SELECT group_concat(rowid) FROM (SELECT rowid,* FROM tcsv ORDER BY rowid DESC LIMIT 5 OFFSET 7);
+SELECT group_concat(a) FROM (SELECT rowid,* FROM tcsv ORDER BY 2 LIMIT 5 OFFSET 7);
+SELECT group_concat(a) FROM (SELECT rowid,* FROM tcsv ORDER BY 3, 2 LIMIT 5 OFFSET 7);
+.check "8,9,10,11,12\n8,9,10,11,12\n493,492,491,490,489\n104,105,106,107,108\n48,406,85,443,122\n"
+.testcase vsv-limit-offset
+SELECT group_concat(rowid) FROM (SELECT rowid,* FROM tvsv LIMIT 5 OFFSET 7);
+SELECT group_concat(rowid) FROM (SELECT rowid,* FROM tvsv ORDER BY rowid LIMIT 5 OFFSET 7);
+SELECT group_concat(rowid) FROM (SELECT rowid,* FROM tvsv ORDER BY rowid DESC LIMIT 5 OFFSET 7);
+SELECT group_concat(a) FROM (SELECT rowid,* FROM tvsv ORDER BY 2 LIMIT 5 OFFSET 7);
+SELECT group_concat(a) FROM (SELECT rowid,* FROM tvsv ORDER BY 3, 2 LIMIT 5 OFFSET 7);
+.check "8,9,10,11,12\n8,9,10,11,12\n493,492,491,490,489\n104,105,106,107,108\n48,406,85,443,122\n"
+
+-- Parsing in parallel blocks must give the same results as a single
+-- thread, also with quoted fields spanning the block boundaries
+.headers on
+.mode csv
+.once vsvtest.csv
+WITH RECURSIVE c(i) AS (VALUES(1) UNION ALL SELECT i+1 FROM c WHERE i<100000)
+SELECT i AS n, i*0.5 AS r,
+       CASE i%3 WHEN 0 THEN 'quoted, "text"' || char(10) || 'line ' || i
+                WHEN 1 THEN 'Gr' || char(246) || char(223) || 'e ' || i
+                ELSE '' END AS t,
+       printf('%.*c', i%50, 'x') AS x
+FROM c;
+.headers off
+.mode list
+CREATE VIRTUAL TABLE temp.tvsv1 USING vsv(filename='vsvtest.csv', header=1, affinity=numeric);
+CREATE VIRTUAL TABLE temp.tvsv4 USING vsv(filename='vsvtest.csv', header=1, affinity=numeric, threads=4);
+.testcase vsv-threads
+SELECT count(*), sum(n), sum(r), sum(length(t)), sum(length(x)) FROM tvsv4;
+SELECT count(*) FROM (SELECT rowid,* FROM tvsv4 EXCEPT SELECT rowid,* FROM tvsv1);
+SELECT count(*) FROM (SELECT rowid,* FROM tvsv1 EXCEPT SELECT rowid,* FROM tvsv4);
+SELECT n, t FROM tvsv4 WHERE rowid=99999;
+SELECT group_concat(n) FROM (SELECT n FROM tvsv4 LIMIT 3 OFFSET 40000);
+.check "100000|5000050000|2500025000.0|1192596|2452000\n0\n0\n99999|quoted, \"text\"\nline 99999\n40001,40002,40003\n"
+
+.print Tests passed
+.q
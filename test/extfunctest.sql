@@ -0,0 +1,63 @@
+-- Tests for the extension functions
+-- Each test case checks its result and stops with an error on a mismatch
+.bail on
+.mode list
+
+CREATE TEMP TABLE tvar(i INTEGER PRIMARY KEY, x);
+INSERT INTO tvar(x) VALUES (0.5),(1e9),(1.2),(3.1),(2.0),(0.9),(1e-3),(-3e12),(17.25),(3.5),(2.75);
+
+.testcase variance-aggregate
+SELECT printf('%.6f', variance(x)), printf('%.6f', stdev(x)) FROM tvar WHERE i<>2 AND i<>8;
+.check "28.164758|5.307048\n"
+
+-- Values leaving the window frame, in particular large outliers,
+-- must not leave rounding errors behind
+.testcase variance-window-2-rows
+SELECT group_concat(printf('%.6f', v)) FROM
+  (SELECT i, variance(x) OVER (ORDER BY i ROWS 1 PRECEDING) AS v FROM tvar)
+WHERE i IN (4,5,6,7,10,11);
+.check "1.805000,0.605000,0.605000,0.404101,94.531250,0.281250\n"
+.testcase variance-window-3-rows
+SELECT group_concat(printf('%.6f', v)) FROM
+  (SELECT i, variance(x) OVER (ORDER BY i ROWS 2 PRECEDING) AS v FROM tvar)
+WHERE i IN (5,6,7,11);
+.check "0.910000,1.210000,1.002367,66.645833\n"
+.testcase stdev-window-3-rows
+SELECT group_concat(printf('%.6f', v)) FROM
+  (SELECT i, stdev(x) OVER (ORDER BY i ROWS 2 PRECEDING) AS v FROM tvar)
+WHERE i IN (5,6,7,11);
+.check "0.953939,1.100000,1.001183,8.163690\n"
+
+-- Percentiles are found by selection, also for sorted input, and integers
+-- beyond 32 bits are kept
+CREATE TEMP TABLE tagg(i INTEGER PRIMARY KEY, n, r);
+WITH RECURSIVE c(i) AS (VALUES(1) UNION ALL SELECT i+1 FROM c WHERE i<10001)
+INSERT INTO tagg SELECT i, i, (i%97)*0.5 FROM c;
+.testcase percentile-aggregates
+SELECT median(n), lower_quartile(n), upper_quartile(n) FROM tagg;
+SELECT median(n), lower_quartile(n), upper_quartile(n) FROM (SELECT n FROM tagg ORDER BY n DESC);
+SELECT median(r), lower_quartile(r), upper_quartile(r) FROM tagg;
+SELECT median(n*10000000000), mode(CASE WHEN n%3=0 THEN 30000000000 ELSE n END) FROM tagg;
+SELECT median(x) FROM (SELECT 1 x UNION ALL SELECT 2 UNION ALL SELECT 4 UNION ALL SELECT 10);
+SELECT median(x), mode(x) FROM (SELECT NULL x);
+.check "5001|2501|7501\n5001|2501|7501\n24.0|12.0|36.0\n50010000000000|30000000000\n3.0\n|\n"
+.testcase mode-aggregate
+SELECT mode(CASE WHEN n%5=0 THEN 7 ELSE n END) FROM tagg;
+SELECT mode(CASE WHEN n%5=0 THEN 2.5 ELSE n*1.0 END) FROM tagg;
+SELECT quote(mode(n%7)) FROM tagg;
+SELECT mode(x) FROM (SELECT 3 x UNION ALL SELECT 5 UNION ALL SELECT 5 UNION ALL SELECT 3 UNION ALL SELECT 5);
+.check "7\n2.5\nNULL\n5\n"
+
+-- charindex(needle, haystack [, start]) returns the character position
+-- of the first match at or after start, or 0
+.testcase charindex
+SELECT charindex('c', 'abcabc'), charindex('c', 'abcabc', 4), charindex('c', 'abcabc', 7);
+SELECT charindex('bca', 'abcabc'), charindex('x', 'abcabc'), charindex('', 'abc');
+SELECT charindex('ße', 'Größe und Maße'), charindex('ße', 'Größe und Maße', 5), charindex('€', 'a€b€', 3);
+SELECT charindex('needle', printf('%.*c', 1000, 'n') || 'needle' || printf('%.*c', 100, 'e'));
+SELECT charindex('xyz', printf('%.*c', 999, 'x') || 'xy'), charindex('abab', 'abaabab');
+SELECT quote(charindex(NULL, 'abc')), quote(charindex('a', NULL));
+.check "3|6|0\n2|0|0\n4|13|4\n1001\n0|4\nNULL|NULL\n"
+
+.print Tests passed
+.q
@@ -0,0 +1,373 @@
+/*
+** Name:        kdftest.c
+** Purpose:     Test the configuration of the key derivation functions
+** Author:      Ulrich Telle
+** Created:     2026-10-19
+** Copyright:   (c) 2026-2026 Ulrich Telle
+** License:     MIT
+*/
+
+/*
+** The calibration of the key derivation depends on the speed of the
+** machine, so only the range of the results is checked. Keys derived with
+** a limited number of concurrent Argon2 derivations and pooled memory have
+** to open the databases created without them, and vice versa.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sqlite3mc.h"
+
+#define TEST_DB "kdftest.db3"
+#define AEGIS_DB_COUNT 5
+
+typedef struct KeyResults KeyResults;
+struct KeyResults
+{
+  sqlite3_mutex* mutex;
+  int nCalls;
+  int nFailed;
+};
+
+static int nFailed = 0;
+
+static void check(int ok, const char* zTest, const char* zWhat)
+{
+  if (!ok)
+  {
+    fprintf(stderr, "%s: %s\n", zTest, zWhat);
+    ++nFailed;
+  }
+}
+
+static int countRows(sqlite3* db)
+{
+  sqlite3_stmt* pStmt = NULL;
+  int rc = sqlite3_prepare_v2(db, "SELECT count(*) FROM t1", -1, &pStmt, NULL);
+  if (rc == SQLITE_OK)
+  {
+    rc = sqlite3_step(pStmt);
+    rc = (rc == SQLITE_ROW) ? sqlite3_column_int(pStmt, 0) : -rc;
+  }
+  else
+  {
+    rc = -rc;
+  }
+  sqlite3_finalize(pStmt);
+  return rc;
+}
+
+/*
+** Execute a pragma and return its single result as text in zResult;
+** returns the result code
+*/
+static int pragmaResult(sqlite3* db, const char* zSql, char* zResult, int nResult)
+{
+  sqlite3_stmt* pStmt = NULL;
+  int rc = sqlite3_prepare_v2(db, zSql, -1, &pStmt, NULL);
+  zResult[0] = 0;
+  if (rc == SQLITE_OK)
+  {
+    rc = sqlite3_step(pStmt);
+    if (rc == SQLITE_ROW)
+    {
+      snprintf(zResult, nResult, "%s", (const char*) sqlite3_column_text(pStmt, 0));
+      rc = SQLITE_OK;
+    }
+    else
+    {
+      snprintf(zResult, nResult, "%s", sqlite3_errmsg(db));
+      rc = sqlite3_finalize(pStmt);
+      pStmt = NULL;
+    }
+  }
+  else
+  {
+    snprintf(zResult, nResult, "%s", sqlite3_errmsg(db));
+  }
+  sqlite3_finalize(pStmt);
+  return rc;
+}
+
+/*
+** Open the test database encrypted with ChaCha20 and the given number of
+** iterations of the key derivation; returns the number of rows of the
+** test table, or the negated error code
+*/
+static int openChaCha20(int kdfIter)
+{
+  sqlite3* db = NULL;
+  int rc = sqlite3_open(TEST_DB, &db);
+  if (rc == SQLITE_OK &&
+      (sqlite3mc_config(db, "cipher", sqlite3mc_cipher_index("chacha20")) < 0 ||
+       sqlite3mc_config_cipher(db, "chacha20", "kdf_iter", kdfIter) != kdfIter))
+  {
+    rc = SQLITE_ERROR;
+  }
+  if (rc == SQLITE_OK)
+  {
+    rc = sqlite3_key(db, "kdftest", -1);
+  }
+  rc = (rc == SQLITE_OK) ? countRows(db) : -rc;
+  sqlite3_close(db);
+  return rc;
+}
+
+static void testCalibrate(void)
+{
+  char zResult[256];
+  sqlite3* db = NULL;
+  int tcostMin = sqlite3mc_config_cipher(NULL, "aegis", "min:tcost", -1);
+  int tcostMax = sqlite3mc_config_cipher(NULL, "aegis", "max:tcost", -1);
+  int kdfIter;
+  int rc;
+
+  /* The work factor is within the range of the parameter */
+  kdfIter = sqlite3mc_calibrate_kdf(NULL, "chacha20", 20);
+  check(kdfIter >= 1, "calibrate-chacha20", "no work factor");
+  rc = sqlite3mc_calibrate_kdf(NULL, "sqlcipher", 20);
+  check(rc >= 1, "calibrate-sqlcipher", "no work factor");
+  rc = sqlite3mc_calibrate_kdf(NULL, "ascon128", 20);
+  check(rc >= 1, "calibrate-ascon128", "no work factor");
+  rc = sqlite3mc_calibrate_kdf(NULL, "aegis", 20);
+  check(rc >= tcostMin && rc <= tcostMax, "calibrate-aegis", "tcost out of range");
+
+  /* A longer key derivation takes more work */
+  rc = sqlite3mc_calibrate_kdf(NULL, "chacha20", 200);
+  check(rc > kdfIter, "calibrate-chacha20", "work factor not increasing with target");
+
+  /* The calibration does not change the parameters */
+  check(sqlite3mc_config_cipher(NULL, "chacha20", "kdf_iter", -1) ==
+        sqlite3mc_config_cipher(NULL, "chacha20", "default:kdf_iter", -1),
+        "calibrate-chacha20", "kdf_iter changed");
+
+  /* Invalid arguments are rejected */
+  check(sqlite3mc_calibrate_kdf(NULL, NULL, 20) == -1, "calibrate-args", "NULL cipher accepted");
+  check(sqlite3mc_calibrate_kdf(NULL, "nosuchcipher", 20) == -1, "calibrate-args", "unknown cipher accepted");
+  check(sqlite3mc_calibrate_kdf(NULL, "aes128cbc", 20) == -1, "calibrate-args", "cipher without kdf accepted");
+  check(sqlite3mc_calibrate_kdf(NULL, "chacha20", 0) == -1, "calibrate-args", "zero target accepted");
+  check(sqlite3mc_calibrate_kdf(NULL, "chacha20", -5) == -1, "calibrate-args", "negative target accepted");
+
+  /* PRAGMA cipher_calibrate applies the work factor to the current cipher scheme */
+  remove(TEST_DB);
+  sqlite3_open(TEST_DB, &db);
+  pragmaResult(db, "PRAGMA cipher='aes128cbc'", zResult, sizeof(zResult));
+  rc = pragmaResult(db, "PRAGMA cipher_calibrate=20", zResult, sizeof(zResult));
+  check(rc == SQLITE_ERROR && strstr(zResult, "can't be calibrated") != NULL, "pragma-calibrate", "cipher without kdf accepted");
+  pragmaResult(db, "PRAGMA cipher='chacha20'", zResult, sizeof(zResult));
+  rc = pragmaResult(db, "PRAGMA cipher_calibrate=0", zResult, sizeof(zResult));
+  check(rc == SQLITE_ERROR, "pragma-calibrate", "zero target accepted");
+  rc = pragmaResult(db, "PRAGMA cipher_calibrate='fast'", zResult, sizeof(zResult));
+  check(rc == SQLITE_ERROR, "pragma-calibrate", "malformed target accepted");
+  rc = pragmaResult(db, "PRAGMA cipher_calibrate=20", zResult, sizeof(zResult));
+  kdfIter = atoi(zResult);
+  check(rc == SQLITE_OK && kdfIter >= 1, "pragma-calibrate", "no work factor");
+  check(sqlite3mc_config_cipher(db, "chacha20", "kdf_iter", -1) == kdfIter, "pragma-calibrate", "kdf_iter not applied");
+
+  /* The next key uses the calibrated work factor */
+  rc = pragmaResult(db, "PRAGMA key='kdftest'", zResult, sizeof(zResult));
+  check(rc == SQLITE_OK, "pragma-calibrate-key", "key not set");
+  rc = sqlite3_exec(db, "CREATE TABLE t1(a); INSERT INTO t1 VALUES (1), (2), (3);", NULL, NULL, NULL);
+  check(rc == SQLITE_OK, "pragma-calibrate-key", "database not created");
+  sqlite3_close(db);
+  if (kdfIter >= 1 && kdfIter < 0x7fffffff)
+  {
+    check(openChaCha20(kdfIter) == 3, "pragma-calibrate-key", "database not readable with calibrated kdf_iter");
+    check(openChaCha20(kdfIter + 1) == -SQLITE_NOTADB, "pragma-calibrate-key", "database readable with other kdf_iter");
+  }
+  remove(TEST_DB);
+}
+
+static void aegisDbName(char* zName, int nName, int j)
+{
+  snprintf(zName, nName, "kdftest-aegis%d.db3", j);
+}
+
+/*
+** Open an AEGIS database; the Argon2 memory cost differs between the
+** databases, so that blocks of different sizes are pooled
+*/
+static sqlite3* openAegis(int j)
+{
+  char zName[64];
+  int mcost = 1024 * (1 + j % 2);
+  sqlite3* db = NULL;
+  aegisDbName(zName, sizeof(zName), j);
+  if (sqlite3_open(zName, &db) != SQLITE_OK ||
+      sqlite3mc_config(db, "cipher", sqlite3mc_cipher_index("aegis")) < 0 ||
+      sqlite3mc_config_cipher(db, "aegis", "tcost", 1) != 1 ||
+      sqlite3mc_config_cipher(db, "aegis", "mcost", mcost) != mcost ||
+      sqlite3mc_config_cipher(db, "aegis", "pcost", 1) != 1)
+  {
+    fprintf(stderr, "opening database %s failed\n", zName);
+    sqlite3_close(db);
+    db = NULL;
+  }
+  return db;
+}
+
+static void aegisKey(char* zKey, int nKey, int j)
+{
+  snprintf(zKey, nKey, "kdftest key %d", j);
+}
+
+/*
+** Create the AEGIS database j with j+1 rows
+*/
+static int createAegis(int j)
+{
+  char zKey[64];
+  char* zSql = sqlite3_mprintf(
+    "CREATE TABLE t1(a);"
+    "WITH RECURSIVE c(i) AS (VALUES(1) UNION ALL SELECT i+1 FROM c WHERE i<%d)"
+    "  INSERT INTO t1 SELECT i FROM c;", j + 1);
+  sqlite3* db = openAegis(j);
+  int rc = (db != NULL) ? SQLITE_OK : SQLITE_ERROR;
+  aegisKey(zKey, sizeof(zKey), j);
+  if (rc == SQLITE_OK)
+  {
+    rc = sqlite3_key(db, zKey, -1);
+  }
+  if (rc == SQLITE_OK)
+  {
+    rc = sqlite3_exec(db, zSql, NULL, NULL, NULL);
+  }
+  sqlite3_free(zSql);
+  sqlite3_close(db);
+  return rc;
+}
+
+static void keyDone(void* pArg, int rc, const char* zErrMsg)
+{
+  KeyResults* p = (KeyResults*) pArg;
+  (void) zErrMsg;
+  sqlite3_mutex_enter(p->mutex);
+  if (rc != SQLITE_OK)
+  {
+    ++p->nFailed;
+  }
+  ++p->nCalls;
+  sqlite3_mutex_leave(p->mutex);
+}
+
+static int callCount(KeyResults* p)
+{
+  int nCalls;
+  sqlite3_mutex_enter(p->mutex);
+  nCalls = p->nCalls;
+  sqlite3_mutex_leave(p->mutex);
+  return nCalls;
+}
+
+/*
+** Key all AEGIS databases at once, using concurrent key derivations;
+** returns the number of databases which can be read
+*/
+static int readAegisAll(void)
+{
+  KeyResults results;
+  sqlite3* aDb[AEGIS_DB_COUNT];
+  char zKey[64];
+  int nRead = 0;
+  int j;
+
+  results.mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_FAST);
+  results.nCalls = 0;
+  results.nFailed = 0;
+  for (j = 0; j < AEGIS_DB_COUNT; ++j)
+  {
+    aDb[j] = openAegis(j);
+    aegisKey(zKey, sizeof(zKey), j);
+    if (aDb[j] == NULL || sqlite3mc_key_async(aDb[j], "main", zKey, -1, keyDone, &results) != SQLITE_OK)
+    {
+      keyDone(&results, SQLITE_ERROR, NULL);
+    }
+  }
+
+  /* Wait (at most 60 seconds) for the key derivations */
+  for (j = 0; j < 6000 && callCount(&results) < AEGIS_DB_COUNT; ++j)
+  {
+    sqlite3_sleep(10);
+  }
+  check(callCount(&results) == AEGIS_DB_COUNT && results.nFailed == 0, "argon2-pool", "key derivations failed");
+
+  for (j = 0; j < AEGIS_DB_COUNT; ++j)
+  {
+    if (aDb[j] != NULL && countRows(aDb[j]) == j + 1)
+    {
+      ++nRead;
+    }
+    sqlite3_close(aDb[j]);
+  }
+  sqlite3_mutex_free(results.mutex);
+  return nRead;
+}
+
+static void removeAegisAll(void)
+{
+  char zName[64];
+  int j;
+  for (j = 0; j < AEGIS_DB_COUNT; ++j)
+  {
+    aegisDbName(zName, sizeof(zName), j);
+    remove(zName);
+  }
+}
+
+static void testArgon2Pool(void)
+{
+  sqlite3* db;
+  int j;
+
+  /* Both parameters are process-wide and range checked */
+  check(sqlite3mc_config(NULL, "argon2_concurrency", -1) == 0, "argon2-config", "concurrency not unlimited by default");
+  check(sqlite3mc_config(NULL, "argon2_pool_size", -1) == 0, "argon2-config", "pooling enabled by default");
+  check(sqlite3mc_config(NULL, "argon2_concurrency", 5000) == -1, "argon2-config", "concurrency out of range accepted");
+  check(sqlite3mc_config(NULL, "argon2_pool_size", 100) == -1, "argon2-config", "pool size out of range accepted");
+  check(sqlite3mc_config(NULL, "argon2_nosuchparam", 1) == -1, "argon2-config", "unknown parameter accepted");
+
+  /* Create the databases without pooling */
+  removeAegisAll();
+  for (j = 0; j < AEGIS_DB_COUNT - 1; ++j)
+  {
+    check(createAegis(j) == SQLITE_OK, "argon2-unpooled", "database not created");
+  }
+
+  /* With limited concurrency and pooling the same keys are derived */
+  check(sqlite3mc_config(NULL, "argon2_concurrency", 2) == 2, "argon2-config", "concurrency not set");
+  check(sqlite3mc_config(NULL, "argon2_pool_size", 2) == 2, "argon2-config", "pool size not set");
+  check(sqlite3mc_config(NULL, "argon2_concurrency", -1) == 2, "argon2-config", "concurrency not kept");
+  check(sqlite3mc_config(NULL, "argon2_pool_size", -1) == 2, "argon2-config", "pool size not kept");
+  check(createAegis(AEGIS_DB_COUNT - 1) == SQLITE_OK, "argon2-pooled", "database not created");
+  check(readAegisAll() == AEGIS_DB_COUNT, "argon2-pooled", "databases not readable");
+  check(readAegisAll() == AEGIS_DB_COUNT, "argon2-pooled", "databases not readable with pooled memory");
+
+  /* A wrong key is not derived from pooled memory */
+  db = openAegis(0);
+  check(db != NULL && sqlite3_key(db, "wrong key", -1) == SQLITE_OK && countRows(db) == -SQLITE_NOTADB,
+        "argon2-pooled", "database readable with wrong key");
+  sqlite3_close(db);
+
+  /* The database created with pooling can be read without it */
+  check(sqlite3mc_config(NULL, "argon2_pool_size", 0) == 0, "argon2-config", "pool size not reset");
+  check(sqlite3mc_config(NULL, "argon2_concurrency", 0) == 0, "argon2-config", "concurrency not reset");
+  check(readAegisAll() == AEGIS_DB_COUNT, "argon2-unpooled", "databases not readable");
+
+  removeAegisAll();
+}
+
+int main(void)
+{
+  testCalibrate();
+  testArgon2Pool();
+
+  if (nFailed > 0)
+  {
+    fprintf(stderr, "%d checks failed\n", nFailed);
+    return 1;
+  }
+  printf("Tests passed\n");
+  return 0;
+}
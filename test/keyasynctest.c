@@ -0,0 +1,199 @@
+/*
+** Name:        keyasynctest.c
+** Purpose:     Test setting a database key asynchronously
+** Author:      Ulrich Telle
+** Created:     2026-10-19
+** Copyright:   (c) 2026-2026 Ulrich Telle
+** License:     MIT
+*/
+
+/*
+** The key derivation is made expensive, so that the key setup is still
+** pending, while the database is accessed by the calling thread.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sqlite3mc.h"
+
+#define TEST_DB "keyasynctest.db3"
+#define KDF_ITER 500000
+
+typedef struct KeyResult KeyResult;
+struct KeyResult
+{
+  sqlite3_mutex* mutex;
+  int nCalls;
+  int rc;
+  char zErrMsg[256];
+};
+
+static int nFailed = 0;
+
+static void check(int ok, const char* zTest, const char* zWhat)
+{
+  if (!ok)
+  {
+    fprintf(stderr, "%s: %s\n", zTest, zWhat);
+    ++nFailed;
+  }
+}
+
+/*
+** Key callback: record the result, the connection must not be used here
+*/
+static void keyDone(void* pArg, int rc, const char* zErrMsg)
+{
+  KeyResult* p = (KeyResult*) pArg;
+  sqlite3_mutex_enter(p->mutex);
+  p->rc = rc;
+  snprintf(p->zErrMsg, sizeof(p->zErrMsg), "%s", (zErrMsg != NULL) ? zErrMsg : "");
+  ++p->nCalls;
+  sqlite3_mutex_leave(p->mutex);
+}
+
+static void resetResult(KeyResult* p)
+{
+  sqlite3_mutex_enter(p->mutex);
+  p->nCalls = 0;
+  p->rc = -1;
+  p->zErrMsg[0] = 0;
+  sqlite3_mutex_leave(p->mutex);
+}
+
+static int callCount(KeyResult* p)
+{
+  int nCalls;
+  sqlite3_mutex_enter(p->mutex);
+  nCalls = p->nCalls;
+  sqlite3_mutex_leave(p->mutex);
+  return nCalls;
+}
+
+/*
+** Wait (at most 60 seconds) for the callback
+*/
+static int waitForKey(KeyResult* p)
+{
+  int j;
+  for (j = 0; j < 6000 && callCount(p) == 0; ++j)
+  {
+    sqlite3_sleep(10);
+  }
+  return callCount(p);
+}
+
+static int countRows(sqlite3* db)
+{
+  sqlite3_stmt* pStmt = NULL;
+  int rc = sqlite3_prepare_v2(db, "SELECT count(*) FROM t1", -1, &pStmt, NULL);
+  if (rc == SQLITE_OK)
+  {
+    rc = sqlite3_step(pStmt);
+    rc = (rc == SQLITE_ROW) ? sqlite3_column_int(pStmt, 0) : -rc;
+  }
+  else
+  {
+    rc = -rc;
+  }
+  sqlite3_finalize(pStmt);
+  return rc;
+}
+
+static sqlite3* openDb(void)
+{
+  sqlite3* db = NULL;
+  if (sqlite3_open(TEST_DB, &db) != SQLITE_OK ||
+      sqlite3mc_config(db, "cipher", sqlite3mc_cipher_index("chacha20")) < 0 ||
+      sqlite3mc_config_cipher(db, "chacha20", "kdf_iter", KDF_ITER) != KDF_ITER)
+  {
+    fprintf(stderr, "opening the database failed\n");
+    sqlite3_close(db);
+    db = NULL;
+  }
+  return db;
+}
+
+int main(void)
+{
+  KeyResult result;
+  sqlite3* db;
+  int rc;
+
+  result.mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_FAST);
+  resetResult(&result);
+
+  /* Create an encrypted database */
+  remove(TEST_DB);
+  db = openDb();
+  if (db == NULL ||
+      sqlite3_key(db, "keyasynctest", -1) != SQLITE_OK ||
+      sqlite3_exec(db, "CREATE TABLE t1(a); INSERT INTO t1 VALUES (1), (2), (3);", NULL, NULL, NULL) != SQLITE_OK)
+  {
+    fprintf(stderr, "creating the database failed\n");
+    return 1;
+  }
+  sqlite3_close(db);
+
+  /* While the key is pending, the database and the key are busy */
+  db = openDb();
+  if (db == NULL)
+  {
+    return 1;
+  }
+  rc = sqlite3mc_key_async(db, "main", "keyasynctest", -1, keyDone, &result);
+  check(rc == SQLITE_OK, "key-async", "request not accepted");
+  check(sqlite3mc_key_async(db, "main", "keyasynctest", -1, keyDone, &result) == SQLITE_BUSY, "key-pending", "second request not busy");
+  check(countRows(db) == -SQLITE_BUSY, "key-pending", "database access not busy");
+  check(sqlite3_key(db, "keyasynctest", -1) == SQLITE_BUSY, "key-pending", "sqlite3_key not busy");
+  check(sqlite3_rekey(db, "other", -1) == SQLITE_BUSY, "key-pending", "sqlite3_rekey not busy");
+
+  /* After the callback, the key is installed */
+  check(waitForKey(&result) == 1, "key-async", "callback not invoked once");
+  check(result.rc == SQLITE_OK && result.zErrMsg[0] == 0, "key-async", "key setup failed");
+  check(countRows(db) == 3, "key-async", "database not readable");
+  sqlite3_close(db);
+
+  /* A wrong key is installed as well, but the database can't be read */
+  resetResult(&result);
+  db = openDb();
+  if (db == NULL)
+  {
+    return 1;
+  }
+  rc = sqlite3mc_key_async(db, "main", "wrongkey", -1, keyDone, &result);
+  check(rc == SQLITE_OK && waitForKey(&result) == 1, "key-async-wrong", "callback not invoked");
+  check(countRows(db) == -SQLITE_NOTADB, "key-async-wrong", "database readable with wrong key");
+
+  /* Requests for unknown schemas are rejected immediately */
+  resetResult(&result);
+  rc = sqlite3mc_key_async(db, "nosuchdb", "keyasynctest", -1, keyDone, &result);
+  check(rc == SQLITE_ERROR && callCount(&result) == 0, "key-async-schema", "unknown schema accepted");
+  sqlite3_close(db);
+
+  /* Closing the connection aborts a pending key setup */
+  resetResult(&result);
+  db = openDb();
+  if (db == NULL)
+  {
+    return 1;
+  }
+  rc = sqlite3mc_key_async(db, "main", "keyasynctest", -1, keyDone, &result);
+  check(rc == SQLITE_OK, "key-async-close", "request not accepted");
+  sqlite3_close(db);
+  check(callCount(&result) == 1, "key-async-close", "callback not invoked before close returned");
+  check(result.rc == SQLITE_ABORT && result.zErrMsg[0] != 0, "key-async-close", "key setup not aborted");
+
+  sqlite3_mutex_free(result.mutex);
+  remove(TEST_DB);
+
+  if (nFailed > 0)
+  {
+    fprintf(stderr, "%d checks failed\n", nFailed);
+    return 1;
+  }
+  printf("Tests passed\n");
+  return 0;
+}
@@ -0,0 +1,34 @@
+-- Tests for the regexp() function
+-- Requires a shell built with SQLITE_ENABLE_REGEXP and SQLITE_OMIT_SHELL_REGEXP,
+-- so that the regexp extension of this library replaces the one built into
+-- the shell (as done by Makefile.am)
+-- Each test case checks its result and stops with an error on a mismatch
+.bail on
+.mode list
+
+-- Inputs without the literal required by the pattern are rejected early,
+-- inputs with it still have to match the whole pattern
+.testcase regexp-literal-prefilter
+SELECT 'xx hello world' REGEXP 'hel+o w', 'xx help world' REGEXP 'hel+o w', 'hello' REGEXP 'hel+o w';
+SELECT 'abc123def' REGEXP '[a-z]+[0-9]{3}def$', 'abc12def' REGEXP '[a-z]+[0-9]{3}def$', 'abc123defx' REGEXP '[a-z]+[0-9]{3}def$';
+SELECT 'the cat sat' REGEXP '(cat|dog) sat', 'the dog sat' REGEXP '(cat|dog) sat', 'the cow sat' REGEXP '(cat|dog) sat';
+SELECT 'prefix: value' REGEXP '^prefix: \w+$', 'xprefix: value' REGEXP '^prefix: \w+$';
+SELECT 'a.b' REGEXP 'a\.b', 'axb' REGEXP 'a\.b', 'ab' REGEXP 'a?b?c?', '' REGEXP 'x*';
+.check "1|0|0\n1|0|0\n1|1|0\n1|0\n1|0|1|1\n"
+
+-- Long inputs, where the required literal is at the end or missing
+.testcase regexp-long-input
+SELECT printf('%.*c', 5000, 'a') || 'needle' REGEXP 'a+ne+dle$';
+SELECT printf('%.*c', 5000, 'a') || 'needl' REGEXP 'a+ne+dle$';
+SELECT printf('%.*c', 5000, 'n') || 'eedle' REGEXP 'needle';
+SELECT printf('%.*c', 5000, 'b') REGEXP '(a|b)*c';
+.check "1\n0\n1\n0\n"
+
+-- Case insensitive matching and non-ASCII characters
+.testcase regexp-case-and-utf8
+SELECT regexpi('hello w', 'HeLLo World'), regexpi('hello', 'Hallo'), regexp('hello w', 'HeLLo World');
+SELECT 'Größe' REGEXP 'Gr.ße', 'Grosse' REGEXP 'Gr.ße', 'Maße' REGEXP '[ßs]+e$', '€uro' REGEXP '^.uro$';
+.check "1|0|0\n1|0|1|1\n"
+
+.print Tests passed
+.q
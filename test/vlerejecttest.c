@@ -0,0 +1,137 @@
+/*
+** Name:        vlerejecttest.c
+** Purpose:     Test rejection of modified values by value level encryption (VLE)
+** Author:      Ulrich Telle
+** Created:     2026-10-19
+** Copyright:   (c) 2026-2026 Ulrich Telle
+** License:     MIT
+*/
+
+/*
+** Decrypting a modified value or using a wrong scope raises an SQL error,
+** which can't be checked by a test script for the shell.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sqlite3mc.h"
+
+#define PLAINTEXT "plaintext of the vle reject test"
+
+static int nFailed = 0;
+
+static void check(int ok, const char* zTest, const char* zWhat)
+{
+  if (!ok)
+  {
+    fprintf(stderr, "%s: %s\n", zTest, zWhat);
+    ++nFailed;
+  }
+}
+
+/*
+** Decrypt a value and return the result code; on success the plaintext
+** has to match
+*/
+static int decrypt(sqlite3* db, const void* pBlob, int nBlob, const char* zScope, const char** pzErrMsg)
+{
+  sqlite3_stmt* pStmt = NULL;
+  int rc = sqlite3_prepare_v2(db, "SELECT sqlite3mc_vle_decrypt(?1, ?2)", -1, &pStmt, NULL);
+  *pzErrMsg = "";
+  if (rc == SQLITE_OK)
+  {
+    sqlite3_bind_blob(pStmt, 1, pBlob, nBlob, SQLITE_TRANSIENT);
+    sqlite3_bind_text(pStmt, 2, zScope, -1, SQLITE_STATIC);
+    rc = sqlite3_step(pStmt);
+    if (rc == SQLITE_ROW)
+    {
+      const char* zText = (const char*) sqlite3_column_text(pStmt, 0);
+      rc = (zText != NULL && strcmp(zText, PLAINTEXT) == 0) ? SQLITE_OK : SQLITE_MISMATCH;
+    }
+    else
+    {
+      *pzErrMsg = sqlite3_errmsg(db);
+      rc = sqlite3_finalize(pStmt);
+      pStmt = NULL;
+    }
+  }
+  sqlite3_finalize(pStmt);
+  return rc;
+}
+
+static void testAlgorithm(sqlite3* db, const char* zAlgorithm, const char* zOptions)
+{
+  sqlite3_stmt* pStmt = NULL;
+  unsigned char* pBlob = NULL;
+  int nBlob = 0;
+  const char* zErrMsg;
+  char* zSql = sqlite3_mprintf(
+    "SELECT sqlite3mc_vle_key('vle reject key', 'vle reject salt', %Q, %Q), "
+    "sqlite3mc_vle_encrypt('" PLAINTEXT "', 'scope')", zAlgorithm, zOptions);
+
+  if (sqlite3_prepare_v2(db, zSql, -1, &pStmt, NULL) == SQLITE_OK && sqlite3_step(pStmt) == SQLITE_ROW &&
+      sqlite3_column_type(pStmt, 1) == SQLITE_BLOB)
+  {
+    nBlob = sqlite3_column_bytes(pStmt, 1);
+    pBlob = (unsigned char*) malloc(nBlob);
+    memcpy(pBlob, sqlite3_column_blob(pStmt, 1), nBlob);
+  }
+  sqlite3_finalize(pStmt);
+  sqlite3_free(zSql);
+  if (pBlob == NULL)
+  {
+    fprintf(stderr, "%s: encryption failed: %s\n", zAlgorithm, sqlite3_errmsg(db));
+    ++nFailed;
+    return;
+  }
+
+  check(decrypt(db, pBlob, nBlob, "scope", &zErrMsg) == SQLITE_OK, zAlgorithm, "value not decrypted");
+
+  /* A wrong scope fails the authentication */
+  check(decrypt(db, pBlob, nBlob, "other scope", &zErrMsg) == SQLITE_ERROR &&
+        strstr(zErrMsg, "AEAD authentication failed") != NULL, zAlgorithm, "wrong scope not rejected");
+
+  /* Modifying the tag or the ciphertext fails the authentication */
+  pBlob[nBlob - 1] ^= 0x01;
+  check(decrypt(db, pBlob, nBlob, "scope", &zErrMsg) == SQLITE_ERROR &&
+        strstr(zErrMsg, "AEAD authentication failed") != NULL, zAlgorithm, "modified tag not rejected");
+  pBlob[nBlob - 1] ^= 0x01;
+  pBlob[nBlob - 20] ^= 0x80;
+  check(decrypt(db, pBlob, nBlob, "scope", &zErrMsg) == SQLITE_ERROR &&
+        strstr(zErrMsg, "AEAD authentication failed") != NULL, zAlgorithm, "modified ciphertext not rejected");
+  pBlob[nBlob - 20] ^= 0x80;
+
+  /* A truncated value is rejected */
+  check(decrypt(db, pBlob, nBlob - 1, "scope", &zErrMsg) == SQLITE_ERROR, zAlgorithm, "truncated value not rejected");
+
+  check(decrypt(db, pBlob, nBlob, "scope", &zErrMsg) == SQLITE_OK, zAlgorithm, "restored value not decrypted");
+  free(pBlob);
+}
+
+int main(void)
+{
+  sqlite3* db = NULL;
+  if (sqlite3_open(":memory:", &db) != SQLITE_OK)
+  {
+    fprintf(stderr, "opening the database failed\n");
+    return 1;
+  }
+
+  testAlgorithm(db, "chacha20", "kdf_iter=1000");
+  testAlgorithm(db, "ascon128", "kdf_iter=1000");
+  testAlgorithm(db, "aegis-128l", "tcost=1,mcost=1024,pcost=1");
+  testAlgorithm(db, "aegis-256", "kdf=pbkdf2,kdf_iter=1000");
+  testAlgorithm(db, "aegis-256x2", "kdf=pbkdf2,kdf_iter=1000,deterministic=1");
+
+  sqlite3_close(db);
+
+  if (nFailed > 0)
+  {
+    fprintf(stderr, "%d checks failed\n", nFailed);
+    return 1;
+  }
+  printf("Tests passed\n");
+  return 0;
+}
@@ -0,0 +1,72 @@
+-- Tests for value level encryption (VLE)
+-- Each test case checks its result and stops with an error on a mismatch
+.bail on
+.mode list
+
+.testcase vle-key
+SELECT substr(sqlite3mc_vle_key('vle test key 1', 'vle test salt', 'chacha20', 'kdf_iter=1000'), 1, 3);
+.check "Ok.\n"
+
+CREATE TEMP TABLE tvle(id INTEGER PRIMARY KEY, s TEXT, c TEXT, v, e, e2);
+WITH RECURSIVE c(i) AS (VALUES(1) UNION ALL SELECT i+1 FROM c WHERE i<200)
+INSERT INTO tvle(id, s, c, v)
+  SELECT i, 'scope' || (i%5), 'constant',
+         CASE i%4 WHEN 0 THEN i WHEN 1 THEN i+0.25 WHEN 2 THEN 'value ' || i
+                  ELSE CAST('blob ' || i AS BLOB) END
+  FROM c;
+
+-- The scope varies from row to row, so that its digest must not be kept
+-- as auxiliary data of the function call
+UPDATE tvle SET e = sqlite3mc_vle_encrypt(v, s), e2 = sqlite3mc_vle_encrypt(v, 'constant');
+.testcase vle-scope-per-row
+SELECT count(*) FROM tvle WHERE sqlite3mc_vle_decrypt(e, s) IS v;
+SELECT count(*) FROM tvle WHERE s='scope1' AND sqlite3mc_vle_decrypt(e, 'scope1') IS v;
+SELECT count(*) FROM tvle WHERE sqlite3mc_vle_decrypt(e2, c) IS v;
+SELECT count(*) FROM tvle WHERE sqlite3mc_vle_decrypt(e2, 'constant') IS v;
+SELECT count(DISTINCT e) FROM tvle;
+.check "200\n40\n200\n200\n200\n"
+
+-- After setting a new key, values encrypted with the previous key can
+-- still be decrypted, while new values are encrypted with the new key
+CREATE TEMP TABLE tvleold AS SELECT id, e FROM tvle;
+.testcase vle-key-rotation
+SELECT substr(sqlite3mc_vle_key('vle test key 2', 'vle test salt', 'chacha20', 'kdf_iter=1000'), 1, 3);
+SELECT count(*) FROM tvle WHERE sqlite3mc_vle_decrypt(e, s) IS v;
+UPDATE tvle SET e = sqlite3mc_vle_encrypt(sqlite3mc_vle_decrypt(e, s), s) WHERE id%2=0;
+SELECT count(*) FROM tvle WHERE sqlite3mc_vle_decrypt(e, s) IS v;
+SELECT count(*) FROM tvle JOIN tvleold USING(id) WHERE tvle.e=tvleold.e;
+.check "Ok.\n200\n200\n100\n"
+
+-- With deterministic encryption equal values encrypted for the same scope
+-- give equal ciphertexts, so that encrypted columns can be looked up by
+-- equality and indexed
+.testcase vle-deterministic
+SELECT sqlite3mc_vle_key('vle test key 3', 'vle test salt', 'chacha20', 'kdf_iter=1000,deterministic=1');
+CREATE TEMP TABLE tdet(id INTEGER PRIMARY KEY, v, e);
+CREATE INDEX temp.tdet_e ON tdet(e);
+WITH RECURSIVE c(i) AS (VALUES(1) UNION ALL SELECT i+1 FROM c WHERE i<300)
+INSERT INTO tdet(id, v) SELECT i, CASE i%2 WHEN 0 THEN 'value ' || (i%20) ELSE i%20 END FROM c;
+UPDATE tdet SET e = sqlite3mc_vle_encrypt(v, 'det');
+SELECT count(DISTINCT e), count(DISTINCT v) FROM tdet;
+SELECT count(*) FROM tdet WHERE e = sqlite3mc_vle_encrypt('value 8', 'det');
+SELECT count(*) FROM tdet INDEXED BY tdet_e WHERE e = sqlite3mc_vle_encrypt(7, 'det');
+SELECT sqlite3mc_vle_encrypt('value 8', 'det') = sqlite3mc_vle_encrypt('value 8', 'other');
+SELECT count(*) FROM tdet WHERE sqlite3mc_vle_decrypt(e, 'det') IS v;
+.check "Ok. Options(kdf_iter=1000,deterministic=1)\n20|20\n15\n15\n0\n300\n"
+
+-- AEGIS: values are encrypted and decrypted with the AEGIS variant of the
+-- key, with Argon2 or PBKDF2 as key derivation function; the rejection of
+-- modified values raises an error and is tested by vlerejecttest.c
+.testcase vle-aegis
+SELECT sqlite3mc_vle_key('vle test key 4', 'vle test salt', 'aegis-128l', 'tcost=1,mcost=1024,pcost=1');
+UPDATE tvle SET e = sqlite3mc_vle_encrypt(v, s);
+SELECT count(*) FROM tvle WHERE sqlite3mc_vle_decrypt(e, s) IS v;
+SELECT count(DISTINCT e) FROM tvle;
+SELECT sqlite3mc_vle_key('vle test key 5', 'vle test salt', 'aegis-256', 'kdf=pbkdf2,kdf_iter=1000');
+UPDATE tvle SET e2 = sqlite3mc_vle_encrypt(v, s);
+SELECT count(*) FROM tvle WHERE sqlite3mc_vle_decrypt(e, s) IS v AND sqlite3mc_vle_decrypt(e2, s) IS v;
+SELECT count(*) FROM tvle WHERE length(e2) - length(e) = 16;
+.check "Ok. Options(kdf=argon2,tcost=1,mcost=1024,pcost=1)\n200\n200\nOk. Options(kdf=pbkdf2,kdf_iter=1000)\n200\n200\n"
+
+.print Tests passed
+.q
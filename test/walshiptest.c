@@ -0,0 +1,305 @@
+/*
+** Name:        walshiptest.c
+** Purpose:     Test shipping encrypted WAL frames to a replica database
+** Author:      Ulrich Telle
+** Created:     2026-10-19
+** Copyright:   (c) 2026-2026 Ulrich Telle
+** License:     MIT
+*/
+
+/*
+** The frames reported by the WAL frame hook of a primary database are
+** applied to a replica, which was created as a copy of the primary database.
+** After each step the content of both databases has to be identical.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sqlite3mc.h"
+
+#define PRIMARY_DB "walshiptest-primary.db3"
+#define REPLICA_DB "walshiptest-replica.db3"
+
+typedef struct ShipFrame ShipFrame;
+struct ShipFrame
+{
+  unsigned int pageNo;
+  unsigned int nCommit;
+  int nData;
+  void* pData;
+};
+
+typedef struct ShipFrames ShipFrames;
+struct ShipFrames
+{
+  int nFrame;
+  int nAlloc;
+  ShipFrame* aFrame;
+};
+
+static int nFailed = 0;
+
+static void check(int ok, const char* zTest, const char* zWhat)
+{
+  if (!ok)
+  {
+    fprintf(stderr, "%s: %s\n", zTest, zWhat);
+    ++nFailed;
+  }
+}
+
+/*
+** WAL frame hook: keep the frames, they are applied after the statement
+*/
+static void collectFrame(void* pArg, unsigned int pageNo, unsigned int nCommit, const void* pData, int nData)
+{
+  ShipFrames* p = (ShipFrames*) pArg;
+  if (p->nFrame >= p->nAlloc)
+  {
+    p->nAlloc = (p->nAlloc > 0) ? 2 * p->nAlloc : 64;
+    p->aFrame = (ShipFrame*) realloc(p->aFrame, p->nAlloc * sizeof(ShipFrame));
+  }
+  p->aFrame[p->nFrame].pageNo = pageNo;
+  p->aFrame[p->nFrame].nCommit = nCommit;
+  p->aFrame[p->nFrame].nData = nData;
+  p->aFrame[p->nFrame].pData = malloc(nData);
+  memcpy(p->aFrame[p->nFrame].pData, pData, nData);
+  ++p->nFrame;
+}
+
+/*
+** Apply the collected frames to the replica and return the number of
+** transactions, that is, of commit frames. Returns -1 if a frame was
+** rejected or if frames follow the last commit frame.
+*/
+static int shipFrames(ShipFrames* p, sqlite3* dbReplica)
+{
+  int nCommit = 0;
+  int rc = SQLITE_OK;
+  int j;
+  for (j = 0; j < p->nFrame; ++j)
+  {
+    ShipFrame* pFrame = &p->aFrame[j];
+    if (rc == SQLITE_OK)
+    {
+      rc = sqlite3mc_wal_frame_apply(dbReplica, "main", pFrame->pageNo, pFrame->nCommit, pFrame->pData, pFrame->nData);
+    }
+    if (pFrame->nCommit != 0)
+    {
+      ++nCommit;
+    }
+    free(pFrame->pData);
+  }
+  if (rc != SQLITE_OK)
+  {
+    fprintf(stderr, "applying frame failed: %s\n", sqlite3_errmsg(dbReplica));
+    nCommit = -1;
+  }
+  else if (p->nFrame > 0 && p->aFrame[p->nFrame - 1].nCommit == 0)
+  {
+    nCommit = -1;
+  }
+  p->nFrame = 0;
+  return nCommit;
+}
+
+static int exec(sqlite3* db, const char* zSql)
+{
+  char* zErr = NULL;
+  int rc = sqlite3_exec(db, zSql, NULL, NULL, &zErr);
+  if (rc != SQLITE_OK)
+  {
+    fprintf(stderr, "%s: %s\n", zSql, zErr);
+    sqlite3_free(zErr);
+  }
+  return rc;
+}
+
+/*
+** Get a summary of the content of the test table
+*/
+static char* summary(sqlite3* db)
+{
+  char* zResult = NULL;
+  sqlite3_stmt* pStmt = NULL;
+  int rc = sqlite3_prepare_v2(db,
+    "SELECT count(*) || '|' || total(a) || '|' || total(length(b)) || '|' || max(b) FROM t1",
+    -1, &pStmt, NULL);
+  if (rc == SQLITE_OK && sqlite3_step(pStmt) == SQLITE_ROW)
+  {
+    zResult = sqlite3_mprintf("%s", sqlite3_column_text(pStmt, 0));
+  }
+  else
+  {
+    zResult = sqlite3_mprintf("error: %s", sqlite3_errmsg(db));
+  }
+  sqlite3_finalize(pStmt);
+  return zResult;
+}
+
+static void checkSame(sqlite3* dbPrimary, sqlite3* dbReplica, const char* zTest)
+{
+  char* zPrimary = summary(dbPrimary);
+  char* zReplica = summary(dbReplica);
+  if (strcmp(zPrimary, zReplica) != 0)
+  {
+    fprintf(stderr, "%s: primary '%s', replica '%s'\n", zTest, zPrimary, zReplica);
+    ++nFailed;
+  }
+  sqlite3_free(zPrimary);
+  sqlite3_free(zReplica);
+}
+
+static long fileSize(const char* zFileName)
+{
+  long size = 0;
+  FILE* f = fopen(zFileName, "rb");
+  if (f != NULL)
+  {
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fclose(f);
+  }
+  return size;
+}
+
+static int copyFile(const char* zFrom, const char* zTo)
+{
+  char buffer[4096];
+  size_t n;
+  FILE* fIn = fopen(zFrom, "rb");
+  FILE* fOut = (fIn != NULL) ? fopen(zTo, "wb") : NULL;
+  if (fOut == NULL)
+  {
+    if (fIn != NULL) fclose(fIn);
+    return 0;
+  }
+  while ((n = fread(buffer, 1, sizeof(buffer), fIn)) > 0)
+  {
+    fwrite(buffer, 1, n, fOut);
+  }
+  fclose(fIn);
+  fclose(fOut);
+  return 1;
+}
+
+static void removeDb(const char* zFileName)
+{
+  char zName[256];
+  remove(zFileName);
+  snprintf(zName, sizeof(zName), "%s-wal", zFileName);
+  remove(zName);
+  snprintf(zName, sizeof(zName), "%s-shm", zFileName);
+  remove(zName);
+}
+
+/*
+** The primary database is opened with psow=0 and synchronous=FULL, so that
+** SQLite pads each transaction in the WAL file up to the sector boundary.
+** The small cache forces SQLite to spill frames of large transactions to
+** the WAL file before the transaction is committed.
+*/
+static sqlite3* openPrimary(void)
+{
+  sqlite3* db = NULL;
+  sqlite3_open_v2("file:" PRIMARY_DB "?psow=0", &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_URI, NULL);
+  if (exec(db, "PRAGMA key='walshiptest'; PRAGMA journal_mode=WAL; PRAGMA synchronous=FULL; PRAGMA cache_size=10;") != SQLITE_OK)
+  {
+    sqlite3_close(db);
+    db = NULL;
+  }
+  return db;
+}
+
+int main(void)
+{
+  ShipFrames frames = { 0, 0, NULL };
+  sqlite3* dbPrimary;
+  sqlite3* dbReplica = NULL;
+  long walSize;
+  int nCommit;
+
+  /* Create the primary database and a copy of it as replica */
+  removeDb(PRIMARY_DB);
+  removeDb(REPLICA_DB);
+  dbPrimary = openPrimary();
+  if (dbPrimary == NULL || exec(dbPrimary, "CREATE TABLE t1(a INTEGER PRIMARY KEY, b TEXT);") != SQLITE_OK)
+  {
+    return 1;
+  }
+  sqlite3_close(dbPrimary);
+  if (!copyFile(PRIMARY_DB, REPLICA_DB))
+  {
+    fprintf(stderr, "copying the primary database failed\n");
+    return 1;
+  }
+  dbPrimary = openPrimary();
+  sqlite3_open(REPLICA_DB, &dbReplica);
+  if (dbPrimary == NULL || exec(dbReplica, "PRAGMA key='walshiptest';") != SQLITE_OK)
+  {
+    return 1;
+  }
+  sqlite3mc_wal_frame_hook(dbPrimary, "main", collectFrame, &frames);
+
+  /* A transaction spanning many frames is reported once, after its commit */
+  exec(dbPrimary,
+       "BEGIN;"
+       "WITH RECURSIVE c(i) AS (VALUES(1) UNION ALL SELECT i+1 FROM c WHERE i<2000)"
+       "  INSERT INTO t1 SELECT i, printf('%.*c', 100 + i%50, 'x') || i FROM c;"
+       "COMMIT;");
+  check(frames.nFrame > 10, "multi-frame", "too few frames reported");
+  nCommit = shipFrames(&frames, dbReplica);
+  check(nCommit == 1, "multi-frame", "not reported as one transaction");
+  checkSame(dbPrimary, dbReplica, "multi-frame");
+
+  /* Padding frames written behind the commit frames are not reported */
+  exec(dbPrimary, "INSERT INTO t1(b) VALUES('one');");
+  exec(dbPrimary, "UPDATE t1 SET b='two' WHERE a=17;");
+  exec(dbPrimary, "DELETE FROM t1 WHERE a%100=0;");
+  nCommit = shipFrames(&frames, dbReplica);
+  check(nCommit == 3, "padding", "padding frames reported as transactions");
+  checkSame(dbPrimary, dbReplica, "padding");
+
+  /* Frames spilled by a transaction, which is rolled back, are not reported */
+  walSize = fileSize(PRIMARY_DB "-wal");
+  exec(dbPrimary,
+       "BEGIN;"
+       "UPDATE t1 SET b=b || 'rolled back';"
+       "WITH RECURSIVE c(i) AS (VALUES(1) UNION ALL SELECT i+1 FROM c WHERE i<2000)"
+       "  INSERT INTO t1(b) SELECT printf('%.*c', 200, 'y') FROM c;");
+  check(fileSize(PRIMARY_DB "-wal") > walSize, "rollback", "no frames spilled");
+  exec(dbPrimary, "ROLLBACK;");
+  check(frames.nFrame == 0, "rollback", "frames of rolled back transaction reported");
+  exec(dbPrimary, "INSERT INTO t1(b) VALUES('after rollback');");
+  nCommit = shipFrames(&frames, dbReplica);
+  check(nCommit == 1, "rollback", "transaction after rollback not reported once");
+  checkSame(dbPrimary, dbReplica, "rollback");
+
+  /* After a restart of the WAL file, frames are reported from its start */
+  exec(dbPrimary, "PRAGMA wal_checkpoint(TRUNCATE);");
+  check(fileSize(PRIMARY_DB "-wal") == 0, "restart", "WAL file not truncated");
+  exec(dbPrimary,
+       "WITH RECURSIVE c(i) AS (VALUES(1) UNION ALL SELECT i+1 FROM c WHERE i<500)"
+       "  INSERT INTO t1(b) SELECT 'after restart ' || i FROM c;");
+  exec(dbPrimary, "UPDATE t1 SET b=upper(b) WHERE a%3=0;");
+  nCommit = shipFrames(&frames, dbReplica);
+  check(nCommit == 2, "restart", "transactions after restart not reported");
+  checkSame(dbPrimary, dbReplica, "restart");
+
+  sqlite3mc_wal_frame_hook(dbPrimary, "main", NULL, NULL);
+  sqlite3_close(dbPrimary);
+  sqlite3_close(dbReplica);
+  free(frames.aFrame);
+  removeDb(PRIMARY_DB);
+  removeDb(REPLICA_DB);
+
+  if (nFailed > 0)
+  {
+    fprintf(stderr, "%d checks failed\n", nFailed);
+    return 1;
+  }
+  printf("Tests passed\n");
+  return 0;
+}
@@ -0,0 +1,52 @@
+-- Tests for the zipfile virtual table
+-- Requires a shell built with zlib, SQLITE_ENABLE_ZIPFILE and
+-- SQLITE_OMIT_SHELL_ZIPFILE, so that the zipfile extension of this library
+-- replaces the one built into the shell (as done by Makefile.am)
+-- Each test case checks its result and stops with an error on a mismatch
+.bail on
+.mode list
+
+-- Lookups by name use the index of the entries, which has to follow
+-- inserts, replacements, renames and deletes
+CREATE VIRTUAL TABLE temp.z USING zipfile('zipfiletest.zip');
+DELETE FROM z;
+INSERT INTO z(name, data) VALUES ('a.txt','hello'), ('dir/',NULL), ('dir/b.txt','bbbb'), ('c','ccc');
+.testcase zipfile-name-lookup
+SELECT name, data FROM z WHERE name='a.txt';
+SELECT name FROM z WHERE name='dir/';
+SELECT count(*) FROM z WHERE name='dir';
+SELECT count(*) FROM z WHERE name='A.TXT';
+INSERT OR REPLACE INTO z(name, data) VALUES ('a.txt','replaced');
+INSERT OR IGNORE INTO z(name, data) VALUES ('c','ignored');
+UPDATE z SET name='e.txt' WHERE name='c';
+DELETE FROM z WHERE name='dir/b.txt';
+SELECT group_concat(name || '=' || coalesce(data, ''), ',') FROM (SELECT name, data FROM z ORDER BY name);
+SELECT name, data FROM zipfile('zipfiletest.zip') WHERE name='e.txt';
+.check "a.txt|hello\ndir/\n0\n0\na.txt=replaced,dir/=,e.txt=ccc\ne.txt|ccc\n"
+
+-- Archives with more than 65535 entries are written and read using the
+-- zip64 extensions
+CREATE VIRTUAL TABLE temp.z64 USING zipfile('zip64test.zip');
+DELETE FROM z64;
+WITH RECURSIVE c(i) AS (VALUES(1) UNION ALL SELECT i+1 FROM c WHERE i<70000)
+INSERT INTO z64(name, data) SELECT 'f' || i, 'value ' || i FROM c;
+.testcase zipfile-zip64
+SELECT count(*), sum(length(data)) FROM zipfile('zip64test.zip');
+SELECT data FROM zipfile('zip64test.zip') WHERE name='f69999';
+SELECT count(*) FROM zipfile(readfile('zip64test.zip'));
+SELECT count(*) FROM zipfile((SELECT zipfile(name, data) FROM z64));
+.check "70000|758894\nvalue 69999\n70000\n70000\n"
+
+-- Entries compressed on worker threads are appended in insertion order
+CREATE VIRTUAL TABLE temp.zt USING zipfile('zipthreadtest.zip', threads=4);
+DELETE FROM zt;
+WITH RECURSIVE c(i) AS (VALUES(1) UNION ALL SELECT i+1 FROM c WHERE i<3000)
+INSERT INTO zt(name, data) SELECT 'f' || i, printf('%.*c', 1000 + i%1000, char(65 + i%26)) FROM c;
+.testcase zipfile-threads
+SELECT count(*), sum(sz), sum(length(data)), sum(method=8) FROM zipfile('zipthreadtest.zip');
+SELECT count(*) FROM (SELECT row_number() OVER () AS i, name, data FROM zipfile('zipthreadtest.zip'))
+  WHERE name <> 'f' || i OR CAST(data AS TEXT) <> printf('%.*c', 1000 + i%1000, char(65 + i%26));
+.check "3000|4498500|4498500|3000\n0\n"
+
+.print Tests passed
+.q